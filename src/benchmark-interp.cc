@@ -0,0 +1,336 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for the interpreter. Each benchmark is run in every mode
+// below, and the times are reported relative to the first mode. Calls to a
+// host function are timed separately, for each host function ABI, as are
+// calls into a tiny export, for each way of calling it.
+
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+#include <vector>
+
+#include "src/binary-reader.h"
+#include "src/interp/binary-reader-interp.h"
+#include "src/interp/interp.h"
+
+using namespace wabt;
+
+namespace {
+
+// (module
+//   (func (export "loop") (param i32) (result i32) (local i32)
+//     (loop $l
+//       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+//       (br_if $l (local.tee 0 (i32.sub (local.get 0) (i32.const 1)))))
+//     (local.get 1))
+//   (func $fib (export "fib") (param i32) (result i32)
+//     (if (result i32) (i32.lt_u (local.get 0) (i32.const 2))
+//       (then (local.get 0))
+//       (else (i32.add (call $fib (i32.sub (local.get 0) (i32.const 1)))
+//                      (call $fib (i32.sub (local.get 0) (i32.const 2))))))))
+const std::vector<uint8_t> s_module_data = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x00, 0x07, 0x0e, 0x02,
+    0x04, 0x6c, 0x6f, 0x6f, 0x70, 0x00, 0x00, 0x03, 0x66, 0x69, 0x62, 0x00,
+    0x01, 0x0a, 0x38, 0x02, 0x19, 0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01,
+    0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00,
+    0x0d, 0x00, 0x0b, 0x20, 0x01, 0x0b, 0x1c, 0x00, 0x20, 0x00, 0x41, 0x02,
+    0x49, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x10,
+    0x01, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10, 0x01, 0x6a, 0x0b, 0x0b,
+};
+
+// (module
+//   (import "host" "inc" (func $inc (param i32) (result i32)))
+//   (func (export "call_host") (param i32) (result i32) (local i32)
+//     (loop $l
+//       (local.set 1 (call $inc (local.get 1)))
+//       (br_if $l (local.tee 0 (i32.sub (local.get 0) (i32.const 1)))))
+//     (local.get 1)))
+const std::vector<uint8_t> s_host_module_data = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x02, 0x0c, 0x01, 0x04, 0x68, 0x6f, 0x73, 0x74,
+    0x03, 0x69, 0x6e, 0x63, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0x07, 0x0d,
+    0x01, 0x09, 0x63, 0x61, 0x6c, 0x6c, 0x5f, 0x68, 0x6f, 0x73, 0x74, 0x00,
+    0x01, 0x0a, 0x1a, 0x01, 0x18, 0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01,
+    0x10, 0x00, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d,
+    0x00, 0x0b, 0x20, 0x01, 0x0b,
+};
+
+const uint32_t kNumHostCalls = 1000000;
+const uint32_t kNumEntryCalls = 1000000;
+
+struct Benchmark {
+  const char* name;
+  uint32_t arg;
+};
+
+const Benchmark s_benchmarks[] = {
+    {"loop", 10000000},
+    {"fib", 27},
+};
+
+struct Mode {
+  const char* name;
+  bool register_lowering;
+  bool fuse;
+};
+
+const Mode s_modes[] = {
+    {"default", false, false},
+    {"register", true, false},
+    {"fused", false, true},
+    {"register+fused", true, true},
+};
+
+const int kNumRuns = 5;
+
+// Returns the best time in nanoseconds over |kNumRuns| runs, or a negative
+// value if the module failed to load or the export trapped.
+double RunBenchmark(const Benchmark& benchmark,
+                    const Mode& mode,
+                    uint32_t* out_result) {
+  Features features;
+  interp::Environment env(features);
+  env.lowering_options_.register_lowering = mode.register_lowering;
+  if (mode.fuse) {
+    for (int i = 0; i < interp::kFusionCount; ++i) {
+      env.lowering_options_.EnableFusion(static_cast<interp::Fusion>(i));
+    }
+  }
+  Errors errors;
+  interp::DefinedModule* module = nullptr;
+  ReadBinaryOptions read_options;
+  Result result =
+      ReadBinaryInterp(&env, s_module_data.data(), s_module_data.size(),
+                       read_options, &errors, &module);
+  if (Failed(result)) {
+    return -1;
+  }
+
+  interp::Executor executor(&env);
+
+  interp::TypedValues args;
+  args.emplace_back(Type::I32);
+  args.back().set_i32(benchmark.arg);
+
+  double best = 0;
+  for (int i = 0; i < kNumRuns; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    interp::ExecResult exec_result =
+        executor.RunExportByName(module, benchmark.name, args);
+    auto end = std::chrono::steady_clock::now();
+    if (!exec_result.ok()) {
+      return -1;
+    }
+    *out_result = exec_result.values[0].get_i32();
+    double elapsed = std::chrono::duration<double, std::nano>(end - start)
+                         .count();
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+interp::Result IncCallback(const interp::HostFunc* func,
+                           const interp::FuncSignature* sig,
+                           const interp::TypedValues& args,
+                           interp::TypedValues& results) {
+  results[0].set_i32(args[0].get_i32() + 1);
+  return interp::ResultType::Ok;
+}
+
+uint32_t TypedInc(uint32_t x) {
+  return x + 1;
+}
+
+// Like RunBenchmark, but times |kNumHostCalls| calls to a trivial host
+// function, registered with the TypedValues callback or the typed ABI.
+double RunHostCallBenchmark(bool typed, uint32_t* out_result) {
+  Features features;
+  interp::Environment env(features);
+  interp::HostModule* host_module = env.AppendHostModule("host");
+  if (typed) {
+    host_module->AppendFuncExport("inc", TypedInc);
+  } else {
+    host_module->AppendFuncExport("inc", {{Type::I32}, {Type::I32}},
+                                  IncCallback);
+  }
+  Errors errors;
+  interp::DefinedModule* module = nullptr;
+  ReadBinaryOptions read_options;
+  Result result = ReadBinaryInterp(&env, s_host_module_data.data(),
+                                   s_host_module_data.size(), read_options,
+                                   &errors, &module);
+  if (Failed(result)) {
+    return -1;
+  }
+
+  interp::Executor executor(&env);
+  interp::TypedValues args;
+  args.emplace_back(Type::I32);
+  args.back().set_i32(kNumHostCalls);
+
+  double best = 0;
+  for (int i = 0; i < kNumRuns; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    interp::ExecResult exec_result =
+        executor.RunExportByName(module, "call_host", args);
+    auto end = std::chrono::steady_clock::now();
+    if (!exec_result.ok()) {
+      return -1;
+    }
+    *out_result = exec_result.values[0].get_i32();
+    double elapsed = std::chrono::duration<double, std::nano>(end - start)
+                         .count();
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+// Times |kNumEntryCalls| calls into a tiny export from outside, through
+// RunExportByName or a CallHandle.
+double RunEntryBenchmark(bool use_handle, uint32_t* out_result) {
+  Features features;
+  interp::Environment env(features);
+  Errors errors;
+  interp::DefinedModule* module = nullptr;
+  ReadBinaryOptions read_options;
+  Result result =
+      ReadBinaryInterp(&env, s_module_data.data(), s_module_data.size(),
+                       read_options, &errors, &module);
+  if (Failed(result)) {
+    return -1;
+  }
+
+  interp::Executor executor(&env);
+  interp::CallHandle handle;
+  if (!executor.GetCallHandle(module, "loop", &handle).ok()) {
+    return -1;
+  }
+  interp::TypedValues args;
+  args.emplace_back(Type::I32);
+  args.back().set_i32(1);
+
+  double best = 0;
+  for (int i = 0; i < kNumRuns; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t j = 0; j < kNumEntryCalls; ++j) {
+      if (use_handle) {
+        interp::Value value;
+        if (!executor.Call(handle, &args[0].value, 1, &value, 1).ok()) {
+          return -1;
+        }
+        *out_result = value.i32;
+      } else {
+        interp::ExecResult exec_result =
+            executor.RunExportByName(module, "loop", args);
+        if (!exec_result.ok()) {
+          return -1;
+        }
+        *out_result = exec_result.values[0].get_i32();
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::nano>(end - start)
+                         .count();
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+}  // end of anonymous namespace
+
+int main(int argc, char** argv) {
+  printf("%-8s", "name");
+  for (const Mode& mode : s_modes) {
+    printf(" %20s", mode.name);
+  }
+  printf("\n");
+
+  for (const Benchmark& benchmark : s_benchmarks) {
+    printf("%-8s", benchmark.name);
+    double baseline_ns = 0;
+    uint32_t baseline_result = 0;
+    for (const Mode& mode : s_modes) {
+      uint32_t result = 0;
+      double ns = RunBenchmark(benchmark, mode, &result);
+      if (ns < 0) {
+        fprintf(stderr, "\n%s (%s): failed\n", benchmark.name, mode.name);
+        return 1;
+      }
+      if (&mode == s_modes) {
+        baseline_ns = ns;
+        baseline_result = result;
+      } else if (result != baseline_result) {
+        fprintf(stderr, "\n%s (%s): result mismatch (%u != %u)\n",
+                benchmark.name, mode.name, result, baseline_result);
+        return 1;
+      }
+      printf(" %10.2fms (%5.2fx)", ns / 1e6, baseline_ns / ns);
+    }
+    printf("\n");
+  }
+
+  printf("\n%-8s %20s\n", "host abi", "calls");
+  double baseline_ns = 0;
+  for (bool typed : {false, true}) {
+    const char* name = typed ? "typed" : "callback";
+    uint32_t result = 0;
+    double ns = RunHostCallBenchmark(typed, &result);
+    if (ns < 0) {
+      fprintf(stderr, "%s: failed\n", name);
+      return 1;
+    }
+    if (result != kNumHostCalls) {
+      fprintf(stderr, "%s: result mismatch (%u != %u)\n", name, result,
+              kNumHostCalls);
+      return 1;
+    }
+    if (!typed) {
+      baseline_ns = ns;
+    }
+    printf("%-8s %18.0f/s (%5.2fx)\n", name, kNumHostCalls / (ns / 1e9),
+           baseline_ns / ns);
+  }
+
+  printf("\n%-8s %20s\n", "entry", "calls");
+  for (bool use_handle : {false, true}) {
+    const char* name = use_handle ? "handle" : "export";
+    uint32_t result = 0;
+    double ns = RunEntryBenchmark(use_handle, &result);
+    if (ns < 0) {
+      fprintf(stderr, "%s: failed\n", name);
+      return 1;
+    }
+    if (result != 1) {
+      fprintf(stderr, "%s: result mismatch (%u != 1)\n", name, result);
+      return 1;
+    }
+    if (!use_handle) {
+      baseline_ns = ns;
+    }
+    printf("%-8s %18.0f/s (%5.2fx)\n", name, kNumEntryCalls / (ns / 1e9),
+           baseline_ns / ns);
+  }
+  return 0;
+}
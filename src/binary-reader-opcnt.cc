@@ -184,8 +184,10 @@ namespace {
 
 class BinaryReaderOpcnt : public BinaryReaderNop {
  public:
-  explicit BinaryReaderOpcnt(OpcodeInfoCounts* counts);
+  BinaryReaderOpcnt(OpcodeInfoCounts* counts,
+                    OpcodeSequenceCounts* sequence_counts);
 
+  Result BeginFunctionBody(Index index, Offset size) override;
   Result OnOpcode(Opcode opcode) override;
   Result OnOpcodeBare() override;
   Result OnOpcodeUint32(uint32_t value) override;
@@ -206,7 +208,10 @@ class BinaryReaderOpcnt : public BinaryReaderNop {
   Result Emplace(Args&&... args);
 
   OpcodeInfoCounts* opcode_counts_;
+  OpcodeSequenceCounts* sequence_counts_;
   Opcode current_opcode_;
+  // The most recent opcodes in the current function body, oldest first.
+  std::vector<Opcode> recent_opcodes_;
 };
 
 template <typename... Args>
@@ -220,11 +225,29 @@ Result BinaryReaderOpcnt::Emplace(Args&&... args) {
   return Result::Ok;
 }
 
-BinaryReaderOpcnt::BinaryReaderOpcnt(OpcodeInfoCounts* counts)
-    : opcode_counts_(counts) {}
+BinaryReaderOpcnt::BinaryReaderOpcnt(OpcodeInfoCounts* counts,
+                                     OpcodeSequenceCounts* sequence_counts)
+    : opcode_counts_(counts), sequence_counts_(sequence_counts) {}
+
+Result BinaryReaderOpcnt::BeginFunctionBody(Index index, Offset size) {
+  recent_opcodes_.clear();
+  return Result::Ok;
+}
 
 Result BinaryReaderOpcnt::OnOpcode(Opcode opcode) {
   current_opcode_ = opcode;
+  if (sequence_counts_) {
+    if (recent_opcodes_.size() == kMaxOpcodeSequenceLength) {
+      recent_opcodes_.erase(recent_opcodes_.begin());
+    }
+    recent_opcodes_.push_back(opcode);
+    // Count every sequence that ends with this opcode.
+    for (size_t length = 2; length <= recent_opcodes_.size(); ++length) {
+      std::vector<Opcode> sequence(recent_opcodes_.end() - length,
+                                   recent_opcodes_.end());
+      (*sequence_counts_)[sequence]++;
+    }
+  }
   return Result::Ok;
 }
 
@@ -282,8 +305,9 @@ Result BinaryReaderOpcnt::OnEndFunc() {
 Result ReadBinaryOpcnt(const void* data,
                        size_t size,
                        const ReadBinaryOptions& options,
-                       OpcodeInfoCounts* counts) {
-  BinaryReaderOpcnt reader(counts);
+                       OpcodeInfoCounts* counts,
+                       OpcodeSequenceCounts* sequence_counts) {
+  BinaryReaderOpcnt reader(counts, sequence_counts);
   return ReadBinary(data, size, &reader, options);
 }
 
@@ -83,10 +83,16 @@ bool operator>=(const OpcodeInfo&, const OpcodeInfo&);
 
 typedef std::map<OpcodeInfo, size_t> OpcodeInfoCounts;
 
+// Counts of runs of adjacent opcodes within a function body, from two up to
+// kMaxOpcodeSequenceLength opcodes long.
+typedef std::map<std::vector<Opcode>, size_t> OpcodeSequenceCounts;
+static const size_t kMaxOpcodeSequenceLength = 3;
+
 Result ReadBinaryOpcnt(const void* data,
                        size_t size,
                        const ReadBinaryOptions& options,
-                       OpcodeInfoCounts* opcode_counts);
+                       OpcodeInfoCounts* opcode_counts,
+                       OpcodeSequenceCounts* sequence_counts = nullptr);
 
 }  // namespace wabt
 
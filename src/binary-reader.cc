@@ -72,6 +72,10 @@ class BinaryReader {
                const ReadBinaryOptions& options);
 
   Result ReadModule();
+  Result ReadFunctionBodyAt(Index func_index,
+                            Offset body_offset,
+                            Offset body_size,
+                            const BinaryFunctionBodyContext& context);
 
  private:
   template <typename T, T BinaryReader::*member>
@@ -125,6 +129,9 @@ class BinaryReader {
   Result ReadMemory(Limits* out_page_limits) WABT_WARN_UNUSED;
   Result ReadGlobalHeader(Type* out_type, bool* out_mutable) WABT_WARN_UNUSED;
   Result ReadEventType(Index* out_sig_index) WABT_WARN_UNUSED;
+  Result ReadFunction(Index func_index,
+                      Offset body_start_offset,
+                      Offset body_size) WABT_WARN_UNUSED;
   Result ReadFunctionBody(Offset end_offset) WABT_WARN_UNUSED;
   Result ReadNameSection(Offset section_size) WABT_WARN_UNUSED;
   Result ReadRelocSection(Offset section_size) WABT_WARN_UNUSED;
@@ -2278,22 +2285,17 @@ Result BinaryReader::ReadElemSection(Offset section_size) {
   return Result::Ok;
 }
 
-Result BinaryReader::ReadCodeSection(Offset section_size) {
-  CALLBACK(BeginCodeSection, section_size);
-  CHECK_RESULT(ReadCount(&num_function_bodies_, "function body count"));
-  ERROR_UNLESS(num_function_signatures_ == num_function_bodies_,
-               "function signature count != function body count");
-  CALLBACK(OnFunctionBodyCount, num_function_bodies_);
-  for (Index i = 0; i < num_function_bodies_; ++i) {
-    Index func_index = num_func_imports_ + i;
-    Offset func_offset = state_.offset;
-    state_.offset = func_offset;
-    uint32_t body_size;
-    CHECK_RESULT(ReadU32Leb128(&body_size, "function body size"));
-    Offset body_start_offset = state_.offset;
-    Offset end_offset = body_start_offset + body_size;
-    CALLBACK(BeginFunctionBody, func_index, body_size);
+Result BinaryReader::ReadFunction(Index func_index,
+                                  Offset body_start_offset,
+                                  Offset body_size) {
+  Offset end_offset = body_start_offset + body_size;
+  CALLBACK(BeginFunctionBody, func_index, body_size);
 
+  if (options_.skip_function_bodies) {
+    ERROR_UNLESS(end_offset <= read_end_,
+                 "function body extends past the end of the section");
+    state_.offset = end_offset;
+  } else {
     uint64_t total_locals = 0;
     Index num_local_decls;
     CHECK_RESULT(ReadCount(&num_local_decls, "local declaration count"));
@@ -2311,8 +2313,23 @@ Result BinaryReader::ReadCodeSection(Offset section_size) {
     }
 
     CHECK_RESULT(ReadFunctionBody(end_offset));
+  }
+
+  CALLBACK(EndFunctionBody, func_index);
+  return Result::Ok;
+}
 
-    CALLBACK(EndFunctionBody, func_index);
+Result BinaryReader::ReadCodeSection(Offset section_size) {
+  CALLBACK(BeginCodeSection, section_size);
+  CHECK_RESULT(ReadCount(&num_function_bodies_, "function body count"));
+  ERROR_UNLESS(num_function_signatures_ == num_function_bodies_,
+               "function signature count != function body count");
+  CALLBACK(OnFunctionBodyCount, num_function_bodies_);
+  for (Index i = 0; i < num_function_bodies_; ++i) {
+    Index func_index = num_func_imports_ + i;
+    uint32_t body_size;
+    CHECK_RESULT(ReadU32Leb128(&body_size, "function body size"));
+    CHECK_RESULT(ReadFunction(func_index, state_.offset, body_size));
   }
   CALLBACK0(EndCodeSection);
   return Result::Ok;
@@ -2524,6 +2541,22 @@ Result BinaryReader::ReadModule() {
   return Result::Ok;
 }
 
+Result BinaryReader::ReadFunctionBodyAt(
+    Index func_index,
+    Offset body_offset,
+    Offset body_size,
+    const BinaryFunctionBodyContext& context) {
+  // Everything is counted as defined, since the body only needs the totals.
+  num_signatures_ = context.num_signatures;
+  num_function_signatures_ = context.num_funcs;
+  num_tables_ = context.num_tables;
+  data_count_ = context.has_data_count ? 0 : kInvalidIndex;
+
+  ERROR_UNLESS(body_offset <= read_end_, "invalid function body offset");
+  state_.offset = body_offset;
+  return ReadFunction(func_index, body_offset, body_size);
+}
+
 }  // end anonymous namespace
 
 Result ReadBinary(const void* data,
@@ -2534,4 +2567,17 @@ Result ReadBinary(const void* data,
   return reader.ReadModule();
 }
 
+Result ReadBinaryFunctionBody(const void* data,
+                              size_t size,
+                              Index func_index,
+                              Offset body_offset,
+                              Offset body_size,
+                              const BinaryFunctionBodyContext& context,
+                              BinaryReaderDelegate* delegate,
+                              const ReadBinaryOptions& options) {
+  BinaryReader reader(data, size, delegate, options);
+  return reader.ReadFunctionBodyAt(func_index, body_offset, body_size,
+                                   context);
+}
+
 }  // namespace wabt
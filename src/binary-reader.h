@@ -49,6 +49,19 @@ struct ReadBinaryOptions {
   bool read_debug_names = false;
   bool stop_on_first_error = true;
   bool fail_on_custom_section_error = true;
+  // Only call BeginFunctionBody and EndFunctionBody for each function in the
+  // code section, without reading its locals or instructions. They can be
+  // read later with ReadBinaryFunctionBody.
+  bool skip_function_bodies = false;
+};
+
+// The parts of a module that its function bodies are validated against, for
+// ReadBinaryFunctionBody. Counts include imports.
+struct BinaryFunctionBodyContext {
+  Index num_signatures = 0;
+  Index num_funcs = 0;
+  Index num_tables = 0;
+  bool has_data_count = false;
 };
 
 class BinaryReaderDelegate {
@@ -424,6 +437,19 @@ Result ReadBinary(const void* data,
                   BinaryReaderDelegate* reader,
                   const ReadBinaryOptions& options);
 
+// Reads one function body of a module, calling the same delegate methods as
+// ReadBinary does for it, from BeginFunctionBody to EndFunctionBody.
+// |body_offset| and |body_size| are the ones that were current when
+// BeginFunctionBody was called for it by ReadBinary.
+Result ReadBinaryFunctionBody(const void* data,
+                              size_t size,
+                              Index func_index,
+                              Offset body_offset,
+                              Offset body_size,
+                              const BinaryFunctionBodyContext& context,
+                              BinaryReaderDelegate* reader,
+                              const ReadBinaryOptions& options);
+
 size_t ReadU32Leb128(const uint8_t* ptr,
                      const uint8_t* end,
                      uint32_t* out_value);
@@ -16,6 +16,7 @@
 
 #include "src/c-writer.h"
 
+#include <algorithm>
 #include <cctype>
 #include <cinttypes>
 #include <map>
@@ -49,12 +50,15 @@ struct Label {
         used(used) {}
 
   bool HasValue() const {
-    return label_type != LabelType::Loop && !sig.empty();
+    return !sig.empty();
   }
 
   LabelType label_type;
   const std::string& name;
+  // The types of the values that a branch to the label carries: the params of
+  // a loop, and the results of anything else.
   const TypeVector& sig;
+  // The height of the type stack below the values.
   size_t type_stack_size;
   bool used = false;
 };
@@ -111,6 +115,61 @@ struct Newline {};
 struct OpenBrace {};
 struct CloseBrace {};
 
+Index CountExprs(const ExprList& exprs) {
+  Index count = 0;
+  for (const Expr& expr : exprs) {
+    ++count;
+    switch (expr.type()) {
+      case ExprType::Block:
+        count += CountExprs(cast<BlockExpr>(&expr)->block.exprs);
+        break;
+
+      case ExprType::Loop:
+        count += CountExprs(cast<LoopExpr>(&expr)->block.exprs);
+        break;
+
+      case ExprType::If: {
+        auto* if_ = cast<IfExpr>(&expr);
+        count += CountExprs(if_->true_.exprs) + CountExprs(if_->false_);
+        break;
+      }
+
+      case ExprType::Try: {
+        auto* try_ = cast<TryExpr>(&expr);
+        count += CountExprs(try_->block.exprs) + CountExprs(try_->catch_);
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+  return count;
+}
+
+bool IsSimdOpcode(Opcode opcode) {
+  return opcode.GetPrefix() == 0xfd;
+}
+
+bool IsAtomicOpcode(Opcode opcode) {
+  return opcode.GetPrefix() == 0xfe;
+}
+
+// SIMD and atomic instructions call the helper in the simd_declarations or
+// atomic_declarations that has the same name, e.g. i32x4.add calls i32x4_add.
+std::string GetOpcodeFuncName(Opcode opcode) {
+  std::string name = opcode.GetName();
+  std::replace(name.begin(), name.end(), '.', '_');
+  return name;
+}
+
+// The names of the state of the data or elem segment at |index|: its
+// contents, for the "data" field, or its size, for "size". Passive segments
+// keep their size so that they can be dropped.
+std::string GetSegmentName(const char* kind, const char* field, Index index) {
+  return std::string(kind) + "_segment_" + field + "_" + std::to_string(index);
+}
+
 int GetShiftMask(Type type) {
   switch (type) {
     case Type::I32: return 31;
@@ -121,14 +180,18 @@ int GetShiftMask(Type type) {
 
 class CWriter {
  public:
-  CWriter(Stream* c_stream,
+  CWriter(const std::vector<Stream*>& c_streams,
           Stream* h_stream,
+          Stream* impl_h_stream,
           const char* header_name,
+          const char* impl_header_name,
           const WriteCOptions& options)
       : options_(options),
-        c_stream_(c_stream),
+        c_streams_(c_streams),
         h_stream_(h_stream),
-        header_name_(header_name) {}
+        impl_h_stream_(impl_h_stream),
+        header_name_(header_name),
+        impl_header_name_(impl_header_name ? impl_header_name : "") {}
 
   Result WriteModule(const Module&);
 
@@ -141,6 +204,7 @@ class CWriter {
   void UseStream(Stream*);
 
   void WriteCHeader();
+  void WriteImplHeader();
   void WriteCSource();
 
   size_t MarkTypeStack() const;
@@ -163,6 +227,8 @@ class CWriter {
 
   static char MangleType(Type);
   static std::string MangleTypes(const TypeVector&);
+  static std::string MangleMultivalueTypes(const TypeVector&);
+  static std::string MangleMultivalueField(Type, Index);
   static std::string MangleName(string_view);
   static std::string MangleFuncName(string_view,
                                     const TypeVector& param_types,
@@ -175,6 +241,7 @@ class CWriter {
                                string_view module_name,
                                string_view mangled_field_name);
   std::string DefineGlobalScopeName(const std::string&);
+  std::string DefineSharedName(const std::string&);
   std::string DefineLocalScopeName(const std::string&);
   std::string DefineStackVarName(Index, Type, string_view);
 
@@ -192,6 +259,8 @@ class CWriter {
   }
 
   std::string GetGlobalName(const std::string&) const;
+  std::string GetExternalName(const std::string&) const;
+  std::string GetFuncInstance(const std::string&) const;
 
   enum class WriteExportsKind {
     Declarations,
@@ -220,31 +289,49 @@ class CWriter {
   void Write(const ResultType&);
   void Write(const Const&);
   void WriteInitExpr(const ExprList&);
+  void WriteRefFunc(const Func*);
+  void WriteElemExpr(const ElemExpr&);
   void InitGlobalSymbols();
-  std::string GenerateHeaderGuard() const;
+  std::string GenerateHeaderGuard(const std::string& header_name) const;
+  const char* GetInternalLinkage() const;
   void WriteSourceTop();
   void WriteFuncTypes();
+  void WriteMultivalueTypes();
   void WriteImports();
+  void WriteImportInstances();
+  void WriteInstanceStruct();
+  void WriteInstanceParam();
   void WriteFuncDeclarations();
-  void WriteFuncDeclaration(const FuncDeclaration&, const std::string&);
-  void WriteGlobals();
+  void WriteFuncDeclaration(const FuncDeclaration&,
+                            const std::string&,
+                            const char* instance_type);
+  void WriteGlobals(const char* storage_class);
   void WriteGlobal(const Global&, const std::string&);
-  void WriteMemories();
+  void WriteInitGlobals();
+  void WriteMemories(const char* storage_class);
   void WriteMemory(const std::string&);
-  void WriteTables();
+  void WriteTables(const char* storage_class);
   void WriteTable(const std::string&);
+  void WriteDataSegments();
+  void WriteSegmentState(const char* storage_class);
   void WriteDataInitializers();
   void WriteElemInitializers();
   void WriteInitExports();
   void WriteExports(WriteExportsKind);
+  void WriteInstanceExport(const Export&, WriteExportsKind);
   void WriteInit();
-  void WriteFuncs();
+  void WriteInstantiate();
+  std::vector<Index> PartitionFuncs() const;
+  void WriteFuncs(Index begin, Index end);
   void Write(const Func&);
   void WriteParamsAndLocals();
   void WriteParams(const std::vector<std::string>& index_to_name);
   void WriteLocals(const std::vector<std::string>& index_to_name);
   void WriteStackVarDeclarations();
+  void WriteConsumeFuel(ExprList::const_iterator begin,
+                        ExprList::const_iterator end);
   void Write(const ExprList&);
+  void WriteMultivalueResults(const TypeVector&);
 
   enum class AssignOp {
     Disallowed,
@@ -267,15 +354,27 @@ class CWriter {
   void Write(const SimdLaneOpExpr&);
   void Write(const SimdShuffleOpExpr&);
   void Write(const LoadSplatExpr&);
+  void WriteAtomicExpr(Opcode, Address offset, int num_args);
+  void Write(const AtomicLoadExpr&);
+  void Write(const AtomicStoreExpr&);
+  void Write(const AtomicRmwExpr&);
+  void Write(const AtomicRmwCmpxchgExpr&);
+  void Write(const AtomicWaitExpr&);
+  void Write(const AtomicNotifyExpr&);
 
   const WriteCOptions& options_;
   const Module* module_ = nullptr;
   const Func* func_ = nullptr;
   Stream* stream_ = nullptr;
   MemoryStream func_stream_;
+  std::vector<Stream*> c_streams_;
+  // The source file being written.
   Stream* c_stream_ = nullptr;
   Stream* h_stream_ = nullptr;
+  // Only used when there are several source files.
+  Stream* impl_h_stream_ = nullptr;
   std::string header_name_;
+  std::string impl_header_name_;
   Result result_ = Result::Ok;
   int indent_ = 0;
   bool should_write_indent_next_ = false;
@@ -286,11 +385,19 @@ class CWriter {
   SymbolSet global_syms_;
   SymbolSet local_syms_;
   SymbolSet import_syms_;
+  // Names of the module state that lives in the instance struct, and the
+  // instance argument to pass to each imported function, keyed by internal
+  // name. Only used with WriteCOptions::instance_struct.
+  SymbolSet instance_syms_;
+  SymbolMap func_import_instance_map_;
   TypeVector type_stack_;
   std::vector<Label> label_stack_;
 };
 
 static const char kImplicitFuncLabel[] = "$Bfunc";
+static const char kInstanceType[] = "WASM_RT_ADD_PREFIX(instance_t)";
+static const char kInstancePtrType[] = "WASM_RT_ADD_PREFIX(instance_t)*";
+static const char kInstanceName[] = "instance";
 
 static const char* s_global_symbols[] = {
     // keywords
@@ -346,34 +453,42 @@ static const char* s_global_symbols[] = {
     "strstr", "strtok", "strxfrm",
 
     // defined
-    "CALL_INDIRECT", "DEFINE_LOAD", "DEFINE_REINTERPRET", "DEFINE_STORE",
-    "DIVREM_U", "DIV_S", "DIV_U", "f32", "f32_load", "f32_reinterpret_i32",
-    "f32_store", "f64", "f64_load", "f64_reinterpret_i64", "f64_store", "FMAX",
-    "FMIN", "FUNC_EPILOGUE", "FUNC_PROLOGUE", "func_types", "I32_CLZ",
-    "I32_CLZ", "I32_DIV_S", "i32_load", "i32_load16_s", "i32_load16_u",
-    "i32_load8_s", "i32_load8_u", "I32_POPCNT", "i32_reinterpret_f32",
-    "I32_REM_S", "I32_ROTL", "I32_ROTR", "i32_store", "i32_store16",
-    "i32_store8", "I32_TRUNC_S_F32", "I32_TRUNC_S_F64", "I32_TRUNC_U_F32",
-    "I32_TRUNC_U_F64", "I64_CTZ", "I64_CTZ", "I64_DIV_S", "i64_load",
-    "i64_load16_s", "i64_load16_u", "i64_load32_s", "i64_load32_u",
-    "i64_load8_s", "i64_load8_u", "I64_POPCNT", "i64_reinterpret_f64",
-    "I64_REM_S", "I64_ROTL", "I64_ROTR", "i64_store", "i64_store16",
-    "i64_store32", "i64_store8", "I64_TRUNC_S_F32", "I64_TRUNC_S_F64",
-    "I64_TRUNC_U_F32", "I64_TRUNC_U_F64", "init", "init_elem_segment",
-    "init_func_types", "init_globals", "init_memory", "init_table", "LIKELY",
-    "MEMCHECK", "REM_S", "REM_U", "ROTL", "ROTR", "s16", "s32", "s64", "s8",
-    "TRAP", "TRUNC_S", "TRUNC_U", "Type", "u16", "u32", "u64", "u8", "UNLIKELY",
-    "UNREACHABLE", "WASM_RT_ADD_PREFIX", "wasm_rt_allocate_memory",
-    "wasm_rt_allocate_table", "wasm_rt_anyfunc_t", "wasm_rt_call_stack_depth",
-    "wasm_rt_elem_t", "WASM_RT_F32", "WASM_RT_F64", "wasm_rt_grow_memory",
-    "WASM_RT_I32", "WASM_RT_I64", "WASM_RT_INCLUDED_",
-    "WASM_RT_MAX_CALL_STACK_DEPTH", "wasm_rt_memory_t", "WASM_RT_MODULE_PREFIX",
-    "WASM_RT_PASTE_", "WASM_RT_PASTE", "wasm_rt_register_func_type",
-    "wasm_rt_table_t", "wasm_rt_trap", "WASM_RT_TRAP_CALL_INDIRECT",
-    "WASM_RT_TRAP_DIV_BY_ZERO", "WASM_RT_TRAP_EXHAUSTION",
-    "WASM_RT_TRAP_INT_OVERFLOW", "WASM_RT_TRAP_INVALID_CONVERSION",
-    "WASM_RT_TRAP_NONE", "WASM_RT_TRAP_OOB", "wasm_rt_trap_t",
+    "CALL_INDIRECT", "CONSUME_FUEL", "DEFINE_LOAD", "DEFINE_REINTERPRET",
+    "DEFINE_STORE", "DIVREM_U", "DIV_S", "DIV_U", "f32", "f32_load",
+    "f32_reinterpret_i32", "f32_store", "f64", "f64_load",
+    "f64_reinterpret_i64", "f64_store", "FMAX", "FMIN", "FUNC_EPILOGUE",
+    "FUNC_PROLOGUE", "func_types", "I32_CLZ", "I32_CLZ", "I32_DIV_S",
+    "i32_load", "i32_load16_s", "i32_load16_u", "i32_load8_s", "i32_load8_u",
+    "I32_POPCNT", "i32_reinterpret_f32", "I32_REM_S", "I32_ROTL", "I32_ROTR",
+    "i32_store", "i32_store16", "i32_store8", "I32_TRUNC_S_F32",
+    "I32_TRUNC_S_F64", "I32_TRUNC_U_F32", "I32_TRUNC_U_F64", "I64_CTZ",
+    "I64_CTZ", "I64_DIV_S", "i64_load", "i64_load16_s", "i64_load16_u",
+    "i64_load32_s", "i64_load32_u", "i64_load8_s", "i64_load8_u", "I64_POPCNT",
+    "i64_reinterpret_f64", "I64_REM_S", "I64_ROTL", "I64_ROTR", "i64_store",
+    "i64_store16", "i64_store32", "i64_store8", "I64_TRUNC_S_F32",
+    "I64_TRUNC_S_F64", "I64_TRUNC_U_F32", "I64_TRUNC_U_F64", "init",
+    "init_elem_segment", "init_func_types", "init_globals", "init_memory",
+    "init_table", "LIKELY", "MEMCHECK", "MEMORY_PAGES", "MEMORY_SIZE",
+    "REM_S", "REM_U", "ROTL", "ROTR", "s16", "s32", "s64", "s8", "TRAP",
+    "TRUNC_S", "TRUNC_U", "Type", "u16", "u32", "u64", "u8", "UNLIKELY",
+    "UNREACHABLE", "v128", "WASM_RT_ADD_PREFIX",
+    "wasm_rt_allocate_memory", "wasm_rt_allocate_shared_memory",
+    "wasm_rt_allocate_table", "wasm_rt_anyfunc_t", "wasm_rt_atomic_notify",
+    "wasm_rt_atomic_wait32", "wasm_rt_atomic_wait64",
+    "WASM_RT_ANYREF", "wasm_rt_call_stack_depth", "wasm_rt_elem_t",
+    "WASM_RT_F32", "WASM_RT_F64", "wasm_rt_fuel", "WASM_RT_FUNCREF",
+    "wasm_rt_grow_memory", "wasm_rt_grow_table", "WASM_RT_I32", "WASM_RT_I64",
+    "WASM_RT_INCLUDED_", "WASM_RT_MAX_CALL_STACK_DEPTH", "wasm_rt_memory_t",
+    "WASM_RT_MODULE_PREFIX", "WASM_RT_NULLREF", "WASM_RT_PASTE_",
+    "WASM_RT_PASTE",
+    "wasm_rt_register_func_type", "wasm_rt_table_t", "wasm_rt_trap",
+    "WASM_RT_TRAP_CALL_INDIRECT", "WASM_RT_TRAP_DIV_BY_ZERO",
+    "WASM_RT_TRAP_EXHAUSTION", "WASM_RT_TRAP_EXPECTED_SHARED",
+    "WASM_RT_TRAP_INT_OVERFLOW",
+    "WASM_RT_TRAP_INVALID_CONVERSION", "WASM_RT_TRAP_NONE", "WASM_RT_TRAP_OOB",
+    "WASM_RT_TRAP_OUT_OF_FUEL", "wasm_rt_trap_t", "WASM_RT_TRAP_UNALIGNED",
     "WASM_RT_TRAP_UNREACHABLE",
+    "WASM_RT_V128", "wasm_rt_v128_t",
 
 };
 
@@ -416,14 +531,14 @@ void CWriter::PushLabel(LabelType label_type,
                         const std::string& name,
                         const FuncSignature& sig,
                         bool used) {
-  // TODO(binji): Add multi-value support.
-  if ((label_type != LabelType::Func && sig.GetNumParams() != 0) ||
-      sig.GetNumResults() > 1) {
-    UNIMPLEMENTED("multi value support");
-  }
-
-  label_stack_.emplace_back(label_type, name, sig.result_types,
-                            type_stack_.size(), used);
+  // The params of a block are already on the stack, but those of a function
+  // are its locals.
+  size_t num_params = label_type == LabelType::Func ? 0 : sig.GetNumParams();
+  assert(type_stack_.size() >= num_params);
+  label_stack_.emplace_back(
+      label_type, name,
+      label_type == LabelType::Loop ? sig.param_types : sig.result_types,
+      type_stack_.size() - num_params, used);
 }
 
 const Label* CWriter::FindLabel(const Var& var) {
@@ -475,6 +590,10 @@ char CWriter::MangleType(Type type) {
     case Type::I64: return 'j';
     case Type::F32: return 'f';
     case Type::F64: return 'd';
+    case Type::V128: return 'o';
+    case Type::Funcref: return 'r';
+    case Type::Anyref: return 'a';
+    case Type::Nullref: return 'n';
     default: WABT_UNREACHABLE;
   }
 }
@@ -491,6 +610,20 @@ std::string CWriter::MangleTypes(const TypeVector& types) {
   return result;
 }
 
+// Functions with several results return them in a struct with this name, e.g.
+// struct wasm_multi_ij for (result i32 i64).
+// static
+std::string CWriter::MangleMultivalueTypes(const TypeVector& types) {
+  assert(types.size() >= 2);
+  return "wasm_multi_" + MangleTypes(types);
+}
+
+// The field of that struct for the result at |index|, e.g. j1.
+// static
+std::string CWriter::MangleMultivalueField(Type type, Index index) {
+  return MangleType(type) + std::to_string(index);
+}
+
 // static
 std::string CWriter::MangleName(string_view name) {
   const char kPrefix = 'Z';
@@ -578,6 +711,29 @@ std::string CWriter::DefineGlobalScopeName(const std::string& name) {
   return unique;
 }
 
+// The functions and state that several source files share can't be static,
+// so they get the module prefix, like the exports do. They are defined once
+// for the declarations in the internal header, and then reused by the
+// definitions in the source files.
+std::string CWriter::DefineSharedName(const std::string& name) {
+  auto iter = global_sym_map_.find(name);
+  if (iter != global_sym_map_.end()) {
+    return iter->second;
+  }
+
+  std::string unique = DefineGlobalScopeName(name);
+  if (!impl_h_stream_) {
+    return unique;
+  }
+
+  // Keep locals from shadowing the prefixed name when the prefix is empty.
+  std::string prefixed = "w2c_" + unique;
+  global_syms_.insert(prefixed);
+  std::string shared = "WASM_RT_ADD_PREFIX(" + prefixed + ")";
+  global_sym_map_[name] = shared;
+  return shared;
+}
+
 std::string CWriter::DefineLocalScopeName(const std::string& name) {
   std::string unique = DefineName(&local_syms_, StripLeadingDollar(name));
   local_sym_map_.insert(SymbolMap::value_type(name, unique));
@@ -666,6 +822,22 @@ std::string CWriter::GetGlobalName(const std::string& name) const {
   return iter->second;
 }
 
+std::string CWriter::GetExternalName(const std::string& name) const {
+  std::string global_name = GetGlobalName(name);
+  if (instance_syms_.count(name) != 0) {
+    return std::string(kInstanceName) + "->" + global_name;
+  }
+  return global_name;
+}
+
+std::string CWriter::GetFuncInstance(const std::string& name) const {
+  auto iter = func_import_instance_map_.find(name);
+  if (iter != func_import_instance_map_.end()) {
+    return std::string(kInstanceName) + "->" + iter->second;
+  }
+  return kInstanceName;
+}
+
 void CWriter::Write(const GlobalName& name) {
   Write(GetGlobalName(name.name));
 }
@@ -673,18 +845,18 @@ void CWriter::Write(const GlobalName& name) {
 void CWriter::Write(const ExternalPtr& name) {
   bool is_import = import_syms_.count(name.name) != 0;
   if (is_import) {
-    Write(GetGlobalName(name.name));
+    Write(GetExternalName(name.name));
   } else {
-    Write(AddressOf(GetGlobalName(name.name)));
+    Write(AddressOf(GetExternalName(name.name)));
   }
 }
 
 void CWriter::Write(const ExternalRef& name) {
   bool is_import = import_syms_.count(name.name) != 0;
   if (is_import) {
-    Write(Deref(GetGlobalName(name.name)));
+    Write(Deref(GetExternalName(name.name)));
   } else {
-    Write(GetGlobalName(name.name));
+    Write(GetExternalName(name.name));
   }
 }
 
@@ -696,11 +868,18 @@ void CWriter::Write(const Var& var) {
 void CWriter::Write(const GotoLabel& goto_label) {
   const Label* label = FindLabel(goto_label.var);
   if (label->HasValue()) {
-    assert(label->sig.size() == 1);
-    assert(type_stack_.size() >= label->type_stack_size);
-    Index dst = type_stack_.size() - label->type_stack_size - 1;
-    if (dst != 0)
-      Write(StackVar(dst, label->sig[0]), " = ", StackVar(0), "; ");
+    Index num_values = label->sig.size();
+    assert(type_stack_.size() >= label->type_stack_size + num_values);
+    Index offset = type_stack_.size() - label->type_stack_size - num_values;
+    if (offset != 0) {
+      // Move the values down, deepest first, so that none is overwritten
+      // before it is read.
+      for (Index i = 0; i < num_values; ++i) {
+        Index src = num_values - i - 1;
+        Write(StackVar(src + offset, label->sig[i]), " = ", StackVar(src),
+              "; ");
+      }
+    }
   }
 
   if (goto_label.var.is_name()) {
@@ -730,6 +909,11 @@ void CWriter::Write(const StackVar& sv) {
     assert(index < type_stack_.size());
     type = type_stack_[index];
   }
+  // References all have the same C type, and a value of one reference type
+  // can flow into a block result of another, so they share stack variables.
+  if (IsRefType(type)) {
+    type = Type::Anyref;
+  }
 
   StackTypePair stp = {index, type};
   auto iter = stack_var_sym_map_.find(stp);
@@ -747,6 +931,10 @@ void CWriter::Write(Type type) {
     case Type::I64: Write("u64"); break;
     case Type::F32: Write("f32"); break;
     case Type::F64: Write("f64"); break;
+    case Type::V128: Write("v128"); break;
+    case Type::Funcref:
+    case Type::Anyref:
+    case Type::Nullref: Write("wasm_rt_elem_t"); break;
     default:
       WABT_UNREACHABLE;
   }
@@ -758,6 +946,10 @@ void CWriter::Write(TypeEnum type) {
     case Type::I64: Write("WASM_RT_I64"); break;
     case Type::F32: Write("WASM_RT_F32"); break;
     case Type::F64: Write("WASM_RT_F64"); break;
+    case Type::V128: Write("WASM_RT_V128"); break;
+    case Type::Funcref: Write("WASM_RT_FUNCREF"); break;
+    case Type::Anyref: Write("WASM_RT_ANYREF"); break;
+    case Type::Nullref: Write("WASM_RT_NULLREF"); break;
     default:
       WABT_UNREACHABLE;
   }
@@ -773,7 +965,9 @@ void CWriter::Write(SignedType type) {
 }
 
 void CWriter::Write(const ResultType& rt) {
-  if (!rt.types.empty()) {
+  if (rt.types.size() > 1) {
+    Write("struct ", MangleMultivalueTypes(rt.types));
+  } else if (!rt.types.empty()) {
     Write(rt.types[0]);
   } else {
     Write("void");
@@ -834,6 +1028,11 @@ void CWriter::Write(const Const& const_) {
       }
       break;
 
+    case Type::V128:
+      Writef("(v128){0x%08xu, 0x%08xu, 0x%08xu, 0x%08xu}", const_.vec128.v[0],
+             const_.vec128.v[1], const_.vec128.v[2], const_.vec128.v[3]);
+      break;
+
     default:
       WABT_UNREACHABLE;
   }
@@ -854,20 +1053,98 @@ void CWriter::WriteInitExpr(const ExprList& expr_list) {
       Write(GlobalVar(cast<GlobalGetExpr>(expr)->var));
       break;
 
+    case ExprType::RefNull:
+      Write("(wasm_rt_elem_t){0}");
+      break;
+
+    case ExprType::RefFunc:
+      WriteRefFunc(module_->GetFunc(cast<RefFuncExpr>(expr)->var));
+      break;
+
     default:
       WABT_UNREACHABLE;
   }
 }
 
+void CWriter::WriteRefFunc(const Func* func) {
+  Index func_type_index = module_->GetFuncTypeIndex(func->decl.type_var);
+  Write("(wasm_rt_elem_t){func_types[", func_type_index,
+        "], (wasm_rt_anyfunc_t)", ExternalPtr(func->name));
+  if (options_.instance_struct) {
+    Write(", ", GetFuncInstance(func->name));
+  }
+  Write("}");
+}
+
+void CWriter::WriteElemExpr(const ElemExpr& elem_expr) {
+  if (elem_expr.kind == ElemExprKind::RefFunc) {
+    WriteRefFunc(module_->GetFunc(elem_expr.var));
+  } else {
+    Write("(wasm_rt_elem_t){0}");
+  }
+}
+
 void CWriter::InitGlobalSymbols() {
   for (const char* symbol : s_global_symbols) {
     global_syms_.insert(symbol);
   }
+  if (options_.instance_struct) {
+    for (const char* symbol : {"free_instance", "init_module", "instance",
+                               "instance_t", "instantiate"}) {
+      global_syms_.insert(symbol);
+    }
+  }
+  if (options_.features.simd_enabled()) {
+    for (uint32_t i = 0; i < Opcode::Invalid; ++i) {
+      Opcode opcode(static_cast<Opcode::Enum>(i));
+      if (IsSimdOpcode(opcode)) {
+        global_syms_.insert(GetOpcodeFuncName(opcode));
+      }
+    }
+    for (const char* symbol :
+         {"DEFINE_ALL_TRUE", "DEFINE_ANY_TRUE", "DEFINE_AVGR", "DEFINE_CMP",
+          "DEFINE_EXTRACT_LANE", "DEFINE_LANEWISE_BINOP",
+          "DEFINE_LANEWISE_UNOP", "DEFINE_LOAD_EXTEND", "DEFINE_LOAD_SPLAT",
+          "DEFINE_MINMAX", "DEFINE_NARROW", "DEFINE_REPLACE_LANE",
+          "DEFINE_SAT_BINOP", "DEFINE_SHIFT", "DEFINE_SPLAT", "DEFINE_UNOP",
+          "DEFINE_BINOP", "DEFINE_WIDEN", "f32x4", "f64x2", "s16x8", "s32x4",
+          "s64x2", "s8x16", "SATURATE", "TRUNC_SAT_S_F32", "TRUNC_SAT_U_F32",
+          "u16x8", "u32x4", "u64x2", "u8x16", "v128_any_true"}) {
+      global_syms_.insert(symbol);
+    }
+  }
+  if (options_.features.threads_enabled()) {
+    for (uint32_t i = 0; i < Opcode::Invalid; ++i) {
+      Opcode opcode(static_cast<Opcode::Enum>(i));
+      if (IsAtomicOpcode(opcode)) {
+        global_syms_.insert(GetOpcodeFuncName(opcode));
+      }
+    }
+    for (const char* symbol :
+         {"ATOMIC_ALIGNMENT_CHECK", "DEFINE_ATOMIC_CMPXCHG",
+          "DEFINE_ATOMIC_LOAD", "DEFINE_ATOMIC_RMW", "DEFINE_ATOMIC_RMW_ALL",
+          "DEFINE_ATOMIC_STORE", "DEFINE_ATOMIC_WAIT"}) {
+      global_syms_.insert(symbol);
+    }
+  }
+  if (options_.features.multi_value_enabled()) {
+    // Holds the results of calls to functions with several results.
+    global_syms_.insert("tmp");
+  }
+  if (options_.features.bulk_memory_enabled()) {
+    for (const char* symbol :
+         {"memory_copy", "memory_fill", "memory_init", "RANGE_CHECK",
+          "table_copy", "table_fill", "table_get", "table_init",
+          "table_set"}) {
+      global_syms_.insert(symbol);
+    }
+  }
 }
 
-std::string CWriter::GenerateHeaderGuard() const {
+std::string CWriter::GenerateHeaderGuard(
+    const std::string& header_name) const {
   std::string result;
-  for (char c : header_name_) {
+  for (char c : header_name) {
     if (isalnum(c) || c == '_') {
       result += toupper(c);
     } else {
@@ -878,15 +1155,37 @@ std::string CWriter::GenerateHeaderGuard() const {
   return result;
 }
 
+const char* CWriter::GetInternalLinkage() const {
+  return impl_h_stream_ ? "" : "static ";
+}
+
 void CWriter::WriteSourceTop() {
   Write(s_source_includes);
   Write(Newline(), "#include \"", header_name_, "\"", Newline());
+  if (impl_h_stream_) {
+    Write("#include \"", impl_header_name_, "\"", Newline());
+  }
+  if (options_.features.threads_enabled()) {
+    Write(s_source_atomic_memory_size);
+  } else {
+    Write(s_source_memory_size);
+  }
   Write(s_source_declarations);
+  if (options_.features.simd_enabled()) {
+    Write(s_source_simd_declarations);
+  }
+  if (options_.features.threads_enabled()) {
+    Write(s_source_atomic_declarations);
+  }
+  if (options_.features.bulk_memory_enabled()) {
+    Write(s_source_bulk_memory_declarations);
+  }
 }
 
 void CWriter::WriteFuncTypes() {
   Write(Newline());
-  Writef("static u32 func_types[%" PRIzd "];", module_->func_types.size());
+  Writef("%su32 func_types[%" PRIzd "];", GetInternalLinkage(),
+         module_->func_types.size());
   Write(Newline(), Newline());
   Write("static void init_func_types(void) {", Newline());
   Index func_type_index = 0;
@@ -909,17 +1208,46 @@ void CWriter::WriteFuncTypes() {
   Write("}", Newline());
 }
 
+void CWriter::WriteMultivalueTypes() {
+  SymbolSet written;
+  for (const FuncType* func_type : module_->func_types) {
+    const TypeVector& types = func_type->sig.result_types;
+    if (types.size() < 2) {
+      continue;
+    }
+    std::string name = MangleMultivalueTypes(types);
+    if (!written.insert(name).second) {
+      continue;
+    }
+    // The headers of several modules may define the same struct.
+    Write(Newline(), "#ifndef ", name, Newline());
+    Write("#define ", name, " ", name, Newline());
+    Write("struct ", name, " ", OpenBrace());
+    for (Index i = 0; i < types.size(); ++i) {
+      Write(types[i], " ", MangleMultivalueField(types[i], i), ";", Newline());
+    }
+    Write(CloseBrace(), ";", Newline());
+    Write("#endif", Newline());
+  }
+}
+
 void CWriter::WriteImports() {
   if (module_->imports.empty())
     return;
 
-  Write(Newline());
+  // With an instance struct, the imports are members that the embedder fills
+  // in before instantiating, rather than external symbols.
+  if (!options_.instance_struct) {
+    Write(Newline());
+  }
 
   // TODO(binji): Write imports ordered by type.
   for (const Import* import : module_->imports) {
     Write("/* import: '", import->module_name, "' '", import->field_name,
           "' */", Newline());
-    Write("extern ");
+    if (!options_.instance_struct) {
+      Write("extern ");
+    }
     switch (import->kind()) {
       case ExternalKind::Func: {
         const Func& func = cast<FuncImport>(import)->func;
@@ -928,7 +1256,8 @@ void CWriter::WriteImports() {
             DefineImportName(
                 func.name, import->module_name,
                 MangleFuncName(import->field_name, func.decl.sig.param_types,
-                               func.decl.sig.result_types)));
+                               func.decl.sig.result_types)),
+            "void*");
         Write(";");
         break;
       }
@@ -965,6 +1294,99 @@ void CWriter::WriteImports() {
   }
 }
 
+void CWriter::WriteImportInstances() {
+  std::set<std::string> module_names;
+  for (const Import* import : module_->imports) {
+    if (import->kind() != ExternalKind::Func ||
+        !module_names.insert(import->module_name).second) {
+      continue;
+    }
+
+    std::string name = MangleName(import->module_name) + "_instance";
+    global_syms_.insert(name);
+    Write("/* instance passed to imports from '", import->module_name,
+          "' */", Newline());
+    Write("void* ", name, ";", Newline());
+
+    for (const Import* func_import : module_->imports) {
+      if (func_import->kind() == ExternalKind::Func &&
+          func_import->module_name == import->module_name) {
+        func_import_instance_map_.insert(SymbolMap::value_type(
+            cast<FuncImport>(func_import)->func.name, name));
+      }
+    }
+  }
+}
+
+void CWriter::WriteInstanceStruct() {
+  Write(Newline(), "typedef struct ", kInstanceType, " ", OpenBrace());
+  WriteImports();
+  WriteImportInstances();
+
+  for (const Import* import : module_->imports) {
+    switch (import->kind()) {
+      case ExternalKind::Func:
+        instance_syms_.insert(cast<FuncImport>(import)->func.name);
+        break;
+      case ExternalKind::Global:
+        instance_syms_.insert(cast<GlobalImport>(import)->global.name);
+        break;
+      case ExternalKind::Memory:
+        instance_syms_.insert(cast<MemoryImport>(import)->memory.name);
+        break;
+      case ExternalKind::Table:
+        instance_syms_.insert(cast<TableImport>(import)->table.name);
+        break;
+      default:
+        break;
+    }
+  }
+
+  Index global_index = 0;
+  for (const Global* global : module_->globals) {
+    if (global_index++ >= module_->num_global_imports) {
+      WriteGlobal(*global, DefineGlobalScopeName(global->name));
+      Write(";", Newline());
+      instance_syms_.insert(global->name);
+    }
+  }
+
+  Index memory_index = 0;
+  for (const Memory* memory : module_->memories) {
+    if (memory_index++ >= module_->num_memory_imports) {
+      WriteMemory(DefineGlobalScopeName(memory->name));
+      Write(Newline());
+      instance_syms_.insert(memory->name);
+    }
+  }
+
+  Index table_index = 0;
+  for (const Table* table : module_->tables) {
+    if (table_index++ >= module_->num_table_imports) {
+      WriteTable(DefineGlobalScopeName(table->name));
+      Write(Newline());
+      instance_syms_.insert(table->name);
+    }
+  }
+
+  WriteSegmentState("");
+
+  if (module_->imports.empty() && module_->globals.empty() &&
+      module_->memories.empty() && module_->tables.empty()) {
+    // C doesn't allow empty structs.
+    Write("char unused;", Newline());
+  }
+  Write(CloseBrace(), " ", kInstanceType, ";", Newline());
+}
+
+void CWriter::WriteInstanceParam() {
+  if (options_.instance_struct) {
+    Write("(", kInstancePtrType, " ", kInstanceName, ") ");
+  } else {
+    Write("(void) ");
+  }
+}
+
 void CWriter::WriteFuncDeclarations() {
   if (module_->funcs.size() == module_->num_func_imports)
     return;
@@ -975,8 +1397,9 @@ void CWriter::WriteFuncDeclarations() {
   for (const Func* func : module_->funcs) {
     bool is_import = func_index < module_->num_func_imports;
     if (!is_import) {
-      Write("static ");
-      WriteFuncDeclaration(func->decl, DefineGlobalScopeName(func->name));
+      Write(GetInternalLinkage());
+      WriteFuncDeclaration(func->decl, DefineSharedName(func->name),
+                           kInstancePtrType);
       Write(";", Newline());
     }
     ++func_index;
@@ -984,9 +1407,15 @@ void CWriter::WriteFuncDeclarations() {
 }
 
 void CWriter::WriteFuncDeclaration(const FuncDeclaration& decl,
-                                   const std::string& name) {
+                                   const std::string& name,
+                                   const char* instance_type) {
   Write(ResultType(decl.sig.result_types), " ", name, "(");
-  if (decl.GetNumParams() == 0) {
+  if (options_.instance_struct) {
+    Write(instance_type);
+    for (Index i = 0; i < decl.GetNumParams(); ++i) {
+      Write(", ", decl.GetParamType(i));
+    }
+  } else if (decl.GetNumParams() == 0) {
     Write("void");
   } else {
     for (Index i = 0; i < decl.GetNumParams(); ++i) {
@@ -998,29 +1427,35 @@ void CWriter::WriteFuncDeclaration(const FuncDeclaration& decl,
   Write(")");
 }
 
-void CWriter::WriteGlobals() {
-  Index global_index = 0;
-  if (module_->globals.size() != module_->num_global_imports) {
-    Write(Newline());
+void CWriter::WriteGlobals(const char* storage_class) {
+  if (options_.instance_struct ||
+      module_->globals.size() == module_->num_global_imports)
+    return;
 
-    for (const Global* global : module_->globals) {
-      bool is_import = global_index < module_->num_global_imports;
-      if (!is_import) {
-        Write("static ");
-        WriteGlobal(*global, DefineGlobalScopeName(global->name));
-        Write(";", Newline());
-      }
-      ++global_index;
+  Write(Newline());
+
+  Index global_index = 0;
+  for (const Global* global : module_->globals) {
+    bool is_import = global_index < module_->num_global_imports;
+    if (!is_import) {
+      Write(storage_class);
+      WriteGlobal(*global, DefineSharedName(global->name));
+      Write(";", Newline());
     }
+    ++global_index;
   }
+}
 
-  Write(Newline(), "static void init_globals(void) ", OpenBrace());
-  global_index = 0;
+void CWriter::WriteInitGlobals() {
+  Write(Newline(), "static void init_globals");
+  WriteInstanceParam();
+  Write(OpenBrace());
+  Index global_index = 0;
   for (const Global* global : module_->globals) {
     bool is_import = global_index < module_->num_global_imports;
     if (!is_import) {
       assert(!global->init_expr.empty());
-      Write(GlobalName(global->name), " = ");
+      Write(ExternalRef(global->name), " = ");
       WriteInitExpr(global->init_expr);
       Write(";", Newline());
     }
@@ -1033,8 +1468,9 @@ void CWriter::WriteGlobal(const Global& global, const std::string& name) {
   Write(global.type, " ", name);
 }
 
-void CWriter::WriteMemories() {
-  if (module_->memories.size() == module_->num_memory_imports)
+void CWriter::WriteMemories(const char* storage_class) {
+  if (options_.instance_struct ||
+      module_->memories.size() == module_->num_memory_imports)
     return;
 
   Write(Newline());
@@ -1044,8 +1480,8 @@ void CWriter::WriteMemories() {
   for (const Memory* memory : module_->memories) {
     bool is_import = memory_index < module_->num_memory_imports;
     if (!is_import) {
-      Write("static ");
-      WriteMemory(DefineGlobalScopeName(memory->name));
+      Write(storage_class);
+      WriteMemory(DefineSharedName(memory->name));
       Write(Newline());
     }
     ++memory_index;
@@ -1056,19 +1492,19 @@ void CWriter::WriteMemory(const std::string& name) {
   Write("wasm_rt_memory_t ", name, ";");
 }
 
-void CWriter::WriteTables() {
-  if (module_->tables.size() == module_->num_table_imports)
+void CWriter::WriteTables(const char* storage_class) {
+  if (options_.instance_struct ||
+      module_->tables.size() == module_->num_table_imports)
     return;
 
   Write(Newline());
 
-  assert(module_->tables.size() <= 1);
   Index table_index = 0;
   for (const Table* table : module_->tables) {
     bool is_import = table_index < module_->num_table_imports;
     if (!is_import) {
-      Write("static ");
-      WriteTable(DefineGlobalScopeName(table->name));
+      Write(storage_class);
+      WriteTable(DefineSharedName(table->name));
       Write(Newline());
     }
     ++table_index;
@@ -1079,46 +1515,90 @@ void CWriter::WriteTable(const std::string& name) {
   Write("wasm_rt_table_t ", name, ";");
 }
 
-void CWriter::WriteDataInitializers() {
-  const Memory* memory = nullptr;
+void CWriter::WriteDataSegments() {
   Index data_segment_index = 0;
-
-  if (!module_->memories.empty()) {
-    if (module_->data_segments.empty()) {
+  for (const DataSegment* data_segment : module_->data_segments) {
+    Write(Newline(), GetInternalLinkage(), "const u8 ",
+          DefineSharedName(GetSegmentName("data", "data", data_segment_index)),
+          "[] = ", OpenBrace());
+    size_t i = 0;
+    for (uint8_t x : data_segment->data) {
+      Writef("0x%02x, ", x);
+      if ((++i % 12) == 0)
+        Write(Newline());
+    }
+    if (i > 0)
       Write(Newline());
-    } else {
-      for (const DataSegment* data_segment : module_->data_segments) {
-        Write(Newline(), "static const u8 data_segment_data_",
-              data_segment_index, "[] = ", OpenBrace());
-        size_t i = 0;
-        for (uint8_t x : data_segment->data) {
-          Writef("0x%02x, ", x);
-          if ((++i % 12) == 0)
-            Write(Newline());
-        }
-        if (i > 0)
-          Write(Newline());
-        Write(CloseBrace(), ";", Newline());
-        ++data_segment_index;
-      }
+    Write(CloseBrace(), ";", Newline());
+    ++data_segment_index;
+  }
+}
+
+// Each instance keeps the size of each passive segment, which is 0 once it
+// has been dropped, and the elements of each passive elem segment, since
+// those refer to the instance's functions.
+void CWriter::WriteSegmentState(const char* storage_class) {
+  auto define_name = [&](const std::string& name) {
+    if (!options_.instance_struct) {
+      return DefineSharedName(name);
     }
+    instance_syms_.insert(name);
+    return DefineGlobalScopeName(name);
+  };
 
-    memory = module_->memories[0];
+  Index data_segment_index = 0;
+  for (const DataSegment* data_segment : module_->data_segments) {
+    if (data_segment->kind == SegmentKind::Passive) {
+      Write(storage_class, "u32 ",
+            define_name(GetSegmentName("data", "size", data_segment_index)),
+            ";", Newline());
+    }
+    ++data_segment_index;
   }
 
-  Write(Newline(), "static void init_memory(void) ", OpenBrace());
+  Index elem_segment_index = 0;
+  for (const ElemSegment* elem_segment : module_->elem_segments) {
+    if (elem_segment->kind == SegmentKind::Passive) {
+      if (!elem_segment->elem_exprs.empty()) {
+        Write(storage_class, "wasm_rt_elem_t ",
+              define_name(GetSegmentName("elem", "data", elem_segment_index)),
+              "[", elem_segment->elem_exprs.size(), "];", Newline());
+      }
+      Write(storage_class, "u32 ",
+            define_name(GetSegmentName("elem", "size", elem_segment_index)),
+            ";", Newline());
+    }
+    ++elem_segment_index;
+  }
+}
+
+void CWriter::WriteDataInitializers() {
+  const Memory* memory =
+      module_->memories.empty() ? nullptr : module_->memories[0];
+
+  Write(Newline(), "static void init_memory");
+  WriteInstanceParam();
+  Write(OpenBrace());
   if (memory && module_->num_memory_imports == 0) {
     uint32_t max =
         memory->page_limits.has_max ? memory->page_limits.max : 65536;
-    Write("wasm_rt_allocate_memory(", ExternalPtr(memory->name), ", ",
-          memory->page_limits.initial, ", ", max, ");", Newline());
+    Write(memory->page_limits.is_shared ? "wasm_rt_allocate_shared_memory("
+                                        : "wasm_rt_allocate_memory(",
+          ExternalPtr(memory->name), ", ", memory->page_limits.initial, ", ",
+          max, ");", Newline());
   }
-  data_segment_index = 0;
+  Index data_segment_index = 0;
   for (const DataSegment* data_segment : module_->data_segments) {
-    Write("memcpy(&(", ExternalRef(memory->name), ".data[");
-    WriteInitExpr(data_segment->offset);
-    Write("]), data_segment_data_", data_segment_index, ", ",
-          data_segment->data.size(), ");", Newline());
+    if (data_segment->kind == SegmentKind::Active) {
+      Write("memcpy(&(", ExternalRef(memory->name), ".data[");
+      WriteInitExpr(data_segment->offset);
+      Write("]), ",
+            GlobalName(GetSegmentName("data", "data", data_segment_index)),
+            ", ", data_segment->data.size(), ");", Newline());
+    } else if (data_segment->kind == SegmentKind::Passive) {
+      Write(ExternalRef(GetSegmentName("data", "size", data_segment_index)),
+            " = ", data_segment->data.size(), ";", Newline());
+    }
     ++data_segment_index;
   }
 
@@ -1126,34 +1606,45 @@ void CWriter::WriteDataInitializers() {
 }
 
 void CWriter::WriteElemInitializers() {
-  const Table* table = module_->tables.empty() ? nullptr : module_->tables[0];
-
-  Write(Newline(), "static void init_table(void) ", OpenBrace());
+  Write(Newline(), "static void init_table");
+  WriteInstanceParam();
+  Write(OpenBrace());
   Write("uint32_t offset;", Newline());
-  if (table && module_->num_table_imports == 0) {
-    uint32_t max =
-        table->elem_limits.has_max ? table->elem_limits.max : UINT32_MAX;
-    Write("wasm_rt_allocate_table(", ExternalPtr(table->name), ", ",
-          table->elem_limits.initial, ", ", max, ");", Newline());
+  Index table_index = 0;
+  for (const Table* table : module_->tables) {
+    if (table_index++ >= module_->num_table_imports) {
+      uint32_t max =
+          table->elem_limits.has_max ? table->elem_limits.max : UINT32_MAX;
+      Write("wasm_rt_allocate_table(", ExternalPtr(table->name), ", ",
+            table->elem_limits.initial, ", ", max, ");", Newline());
+    }
   }
   Index elem_segment_index = 0;
   for (const ElemSegment* elem_segment : module_->elem_segments) {
-    Write("offset = ");
-    WriteInitExpr(elem_segment->offset);
-    Write(";", Newline());
+    if (elem_segment->kind == SegmentKind::Active) {
+      const Table* table = module_->GetTable(elem_segment->table_var);
+      Write("offset = ");
+      WriteInitExpr(elem_segment->offset);
+      Write(";", Newline());
 
-    size_t i = 0;
-    for (const ElemExpr& elem_expr : elem_segment->elem_exprs) {
-      // We don't support the bulk-memory proposal here, so we know that we
-      // don't have any passive segments (where ref.null can be used).
-      assert(elem_expr.kind == ElemExprKind::RefFunc);
-      const Func* func = module_->GetFunc(elem_expr.var);
-      Index func_type_index = module_->GetFuncTypeIndex(func->decl.type_var);
-
-      Write(ExternalRef(table->name), ".data[offset + ", i,
-            "] = (wasm_rt_elem_t){func_types[", func_type_index,
-            "], (wasm_rt_anyfunc_t)", ExternalPtr(func->name), "};", Newline());
-      ++i;
+      size_t i = 0;
+      for (const ElemExpr& elem_expr : elem_segment->elem_exprs) {
+        Write(ExternalRef(table->name), ".data[offset + ", i, "] = ");
+        WriteElemExpr(elem_expr);
+        Write(";", Newline());
+        ++i;
+      }
+    } else if (elem_segment->kind == SegmentKind::Passive) {
+      size_t i = 0;
+      for (const ElemExpr& elem_expr : elem_segment->elem_exprs) {
+        Write(ExternalRef(GetSegmentName("elem", "data", elem_segment_index)),
+              "[", i, "] = ");
+        WriteElemExpr(elem_expr);
+        Write(";", Newline());
+        ++i;
+      }
+      Write(ExternalRef(GetSegmentName("elem", "size", elem_segment_index)),
+            " = ", elem_segment->elem_exprs.size(), ";", Newline());
     }
     ++elem_segment_index;
   }
@@ -1181,6 +1672,12 @@ void CWriter::WriteExports(WriteExportsKind kind) {
       Write("extern ");
     }
 
+    if (options_.instance_struct) {
+      WriteInstanceExport(*export_, kind);
+      Write(Newline());
+      continue;
+    }
+
     std::string mangled_name;
     std::string internal_name;
 
@@ -1192,7 +1689,7 @@ void CWriter::WriteExports(WriteExportsKind kind) {
                                       func->decl.sig.result_types));
         internal_name = func->name;
         if (kind != WriteExportsKind::Initializers) {
-          WriteFuncDeclaration(func->decl, Deref(mangled_name));
+          WriteFuncDeclaration(func->decl, Deref(mangled_name), nullptr);
           Write(";");
         }
         break;
@@ -1242,6 +1739,90 @@ void CWriter::WriteExports(WriteExportsKind kind) {
   }
 }
 
+// With an instance struct, exported functions are wrappers that forward to
+// the internal function, and other exports are accessors that return a
+// pointer into the instance.
+void CWriter::WriteInstanceExport(const Export& export_,
+                                  WriteExportsKind kind) {
+  assert(kind != WriteExportsKind::Initializers);
+  bool is_definition = kind == WriteExportsKind::Definitions;
+  std::string instance_param = kInstancePtrType;
+  if (is_definition) {
+    instance_param += std::string(" ") + kInstanceName;
+  }
+
+  std::string mangled_name;
+  std::string internal_name;
+  const char* result_type = nullptr;
+
+  switch (export_.kind) {
+    case ExternalKind::Func: {
+      const Func* func = module_->GetFunc(export_.var);
+      mangled_name =
+          ExportName(MangleFuncName(export_.name, func->decl.sig.param_types,
+                                    func->decl.sig.result_types));
+      if (!is_definition) {
+        WriteFuncDeclaration(func->decl, mangled_name, kInstancePtrType);
+        Write(";");
+        return;
+      }
+
+      Write(ResultType(func->decl.sig.result_types), " ", mangled_name, "(",
+            instance_param);
+      for (Index i = 0; i < func->GetNumParams(); ++i) {
+        Write(", ", func->GetParamType(i), " p", i);
+      }
+      Write(") ", OpenBrace());
+      if (func->GetNumResults() > 0) {
+        Write("return ");
+      }
+      Write(ExternalRef(func->name), "(", GetFuncInstance(func->name));
+      for (Index i = 0; i < func->GetNumParams(); ++i) {
+        Write(", p", i);
+      }
+      Write(");", Newline(), CloseBrace());
+      return;
+    }
+
+    case ExternalKind::Global: {
+      const Global* global = module_->GetGlobal(export_.var);
+      mangled_name = ExportName(MangleGlobalName(export_.name, global->type));
+      internal_name = global->name;
+      switch (global->type) {
+        case Type::I32: result_type = "u32*"; break;
+        case Type::I64: result_type = "u64*"; break;
+        case Type::F32: result_type = "f32*"; break;
+        case Type::F64: result_type = "f64*"; break;
+        default: WABT_UNREACHABLE;
+      }
+      break;
+    }
+
+    case ExternalKind::Memory:
+      mangled_name = ExportName(MangleName(export_.name));
+      internal_name = module_->GetMemory(export_.var)->name;
+      result_type = "wasm_rt_memory_t*";
+      break;
+
+    case ExternalKind::Table:
+      mangled_name = ExportName(MangleName(export_.name));
+      internal_name = module_->GetTable(export_.var)->name;
+      result_type = "wasm_rt_table_t*";
+      break;
+
+    default:
+      WABT_UNREACHABLE;
+  }
+
+  Write(result_type, " ", mangled_name, "(", instance_param, ")");
+  if (is_definition) {
+    Write(" ", OpenBrace(), "return ", ExternalPtr(internal_name), ";",
+          Newline(), CloseBrace());
+  } else {
+    Write(";");
+  }
+}
+
 void CWriter::WriteInit() {
   Write(Newline(), "void WASM_RT_ADD_PREFIX(init)(void) ", OpenBrace());
   Write("init_func_types();", Newline());
@@ -1255,13 +1836,71 @@ void CWriter::WriteInit() {
   Write(CloseBrace(), Newline());
 }
 
-void CWriter::WriteFuncs() {
-  Index func_index = 0;
-  for (const Func* func : module_->funcs) {
-    bool is_import = func_index < module_->num_func_imports;
-    if (!is_import)
-      Write(Newline(), *func, Newline());
-    ++func_index;
+void CWriter::WriteInstantiate() {
+  Write(Newline(), "void WASM_RT_ADD_PREFIX(init_module)(void) ",
+        OpenBrace());
+  Write("init_func_types();", Newline());
+  Write(CloseBrace(), Newline());
+
+  Write(Newline(), "void WASM_RT_ADD_PREFIX(instantiate)");
+  WriteInstanceParam();
+  Write(OpenBrace());
+  Write("init_globals(", kInstanceName, ");", Newline());
+  Write("init_memory(", kInstanceName, ");", Newline());
+  Write("init_table(", kInstanceName, ");", Newline());
+  for (Var* var : module_->starts) {
+    const Func* func = module_->GetFunc(*var);
+    Write(ExternalRef(func->name), "(", GetFuncInstance(func->name), ");",
+          Newline());
+  }
+  Write(CloseBrace(), Newline());
+
+  Write(Newline(), "void WASM_RT_ADD_PREFIX(free_instance)");
+  WriteInstanceParam();
+  Write(OpenBrace());
+  Index memory_index = 0;
+  for (const Memory* memory : module_->memories) {
+    if (memory_index++ >= module_->num_memory_imports) {
+      Write("wasm_rt_free_memory(", ExternalPtr(memory->name), ");",
+            Newline());
+    }
+  }
+  Index table_index = 0;
+  for (const Table* table : module_->tables) {
+    if (table_index++ >= module_->num_table_imports) {
+      Write("wasm_rt_free_table(", ExternalPtr(table->name), ");", Newline());
+    }
+  }
+  Write(CloseBrace(), Newline());
+}
+
+// Returns the end of each source file's range of functions. The ranges keep
+// the functions in order, and split them so that each file has about the same
+// number of instructions.
+std::vector<Index> CWriter::PartitionFuncs() const {
+  Index num_files = c_streams_.size();
+  std::vector<Index> func_ends(num_files, module_->funcs.size());
+  uint64_t total = 0;
+  for (Index i = module_->num_func_imports; i < module_->funcs.size(); ++i) {
+    total += CountExprs(module_->funcs[i]->exprs) + 1;
+  }
+
+  Index file_index = 0;
+  uint64_t count = 0;
+  for (Index i = module_->num_func_imports;
+       i < module_->funcs.size() && file_index + 1 < num_files; ++i) {
+    count += CountExprs(module_->funcs[i]->exprs) + 1;
+    while (file_index + 1 < num_files &&
+           count * num_files >= total * (file_index + 1)) {
+      func_ends[file_index++] = i + 1;
+    }
+  }
+  return func_ends;
+}
+
+void CWriter::WriteFuncs(Index begin, Index end) {
+  for (Index func_index = begin; func_index < end; ++func_index) {
+    Write(Newline(), *module_->funcs[func_index], Newline());
   }
 }
 
@@ -1272,7 +1911,7 @@ void CWriter::Write(const Func& func) {
   local_sym_map_.clear();
   stack_var_sym_map_.clear();
 
-  Write("static ", ResultType(func.decl.sig.result_types), " ",
+  Write(GetInternalLinkage(), ResultType(func.decl.sig.result_types), " ",
         GlobalName(func.name), "(");
   WriteParamsAndLocals();
   Write("FUNC_PROLOGUE;", Newline());
@@ -1290,7 +1929,18 @@ void CWriter::Write(const Func& func) {
   PushTypes(func.decl.sig.result_types);
   Write("FUNC_EPILOGUE;", Newline());
 
-  if (!func.decl.sig.result_types.empty()) {
+  const TypeVector& result_types = func.decl.sig.result_types;
+  if (result_types.size() > 1) {
+    // Return the values at the top of the stack in a struct.
+    Write(OpenBrace(), "struct ", MangleMultivalueTypes(result_types), " tmp;",
+          Newline());
+    Index num_results = result_types.size();
+    for (Index i = 0; i < num_results; ++i) {
+      Write("tmp.", MangleMultivalueField(result_types[i], i), " = ",
+            StackVar(num_results - i - 1), ";", Newline());
+    }
+    Write("return tmp;", Newline(), CloseBrace(), Newline());
+  } else if (!result_types.empty()) {
     // Return the top of the stack implicitly.
     Write("return ", StackVar(0), ";", Newline());
   }
@@ -1317,14 +1967,19 @@ void CWriter::WriteParamsAndLocals() {
 }
 
 void CWriter::WriteParams(const std::vector<std::string>& index_to_name) {
+  if (options_.instance_struct) {
+    Write(kInstancePtrType, " ", kInstanceName);
+  }
   if (func_->GetNumParams() == 0) {
-    Write("void");
+    if (!options_.instance_struct) {
+      Write("void");
+    }
   } else {
     Indent(4);
     for (Index i = 0; i < func_->GetNumParams(); ++i) {
-      if (i != 0) {
+      if (i != 0 || options_.instance_struct) {
         Write(", ");
-        if ((i % 8) == 0)
+        if (i != 0 && (i % 8) == 0)
           Write(Newline());
       }
       Write(func_->GetParamType(i), " ",
@@ -1337,7 +1992,8 @@ void CWriter::WriteParams(const std::vector<std::string>& index_to_name) {
 
 void CWriter::WriteLocals(const std::vector<std::string>& index_to_name) {
   Index num_params = func_->GetNumParams();
-  for (Type type : {Type::I32, Type::I64, Type::F32, Type::F64}) {
+  for (Type type : {Type::I32, Type::I64, Type::F32, Type::F64, Type::V128,
+                    Type::Funcref, Type::Anyref, Type::Nullref}) {
     Index local_index = 0;
     size_t count = 0;
     for (Type local_type : func_->local_types) {
@@ -1352,7 +2008,7 @@ void CWriter::WriteLocals(const std::vector<std::string>& index_to_name) {
         }
 
         Write(DefineLocalScopeName(index_to_name[num_params + local_index]),
-              " = 0");
+              type == Type::V128 || IsRefType(type) ? " = {0}" : " = 0");
         ++count;
       }
       ++local_index;
@@ -1365,7 +2021,8 @@ void CWriter::WriteLocals(const std::vector<std::string>& index_to_name) {
 }
 
 void CWriter::WriteStackVarDeclarations() {
-  for (Type type : {Type::I32, Type::I64, Type::F32, Type::F64}) {
+  for (Type type : {Type::I32, Type::I64, Type::F32, Type::F64, Type::V128,
+                    Type::Funcref, Type::Anyref, Type::Nullref}) {
     size_t count = 0;
     for (const auto& pair : stack_var_sym_map_) {
       Type stp_type = pair.first.second;
@@ -1392,8 +2049,36 @@ void CWriter::WriteStackVarDeclarations() {
   }
 }
 
+// Charges for the instructions from |begin| up to the end of the basic block:
+// the next block, loop or if, whose contents are charged separately, or the
+// next branch, after which the rest of the list is unreachable.
+void CWriter::WriteConsumeFuel(ExprList::const_iterator begin,
+                               ExprList::const_iterator end) {
+  Index cost = 0;
+  for (auto iter = begin; iter != end; ++iter) {
+    ++cost;
+    ExprType type = iter->type();
+    if (type == ExprType::Block || type == ExprType::Loop ||
+        type == ExprType::If || type == ExprType::Br ||
+        type == ExprType::BrTable || type == ExprType::Return ||
+        type == ExprType::ReturnCall || type == ExprType::ReturnCallIndirect ||
+        type == ExprType::Unreachable) {
+      break;
+    }
+  }
+  Write("CONSUME_FUEL(", cost, ");", Newline());
+}
+
 void CWriter::Write(const ExprList& exprs) {
-  for (const Expr& expr : exprs) {
+  // Each list starts a basic block, as does the code after a nested block,
+  // loop or if, since branches to it may land there.
+  bool starts_block = options_.fuel;
+  for (auto iter = exprs.begin(); iter != exprs.end(); ++iter) {
+    const Expr& expr = *iter;
+    if (starts_block) {
+      WriteConsumeFuel(iter, exprs.end());
+      starts_block = false;
+    }
     switch (expr.type()) {
       case ExprType::Binary:
         Write(*cast<BinaryExpr>(&expr));
@@ -1402,12 +2087,13 @@ void CWriter::Write(const ExprList& exprs) {
       case ExprType::Block: {
         const Block& block = cast<BlockExpr>(&expr)->block;
         std::string label = DefineLocalScopeName(block.label);
-        size_t mark = MarkTypeStack();
+        size_t mark = MarkTypeStack() - block.decl.sig.GetNumParams();
         PushLabel(LabelType::Block, block.label, block.decl.sig);
         Write(block.exprs, LabelDecl(label));
         ResetTypeStack(mark);
         PopLabel();
         PushTypes(block.decl.sig.result_types);
+        starts_block = options_.fuel;
         break;
       }
 
@@ -1443,14 +2129,19 @@ void CWriter::Write(const ExprList& exprs) {
         Index num_params = func.GetNumParams();
         Index num_results = func.GetNumResults();
         assert(type_stack_.size() >= num_params);
-        if (num_results > 0) {
-          assert(num_results == 1);
+        if (num_results > 1) {
+          Write(OpenBrace(), "struct ",
+                MangleMultivalueTypes(func.decl.sig.result_types), " tmp = ");
+        } else if (num_results > 0) {
           Write(StackVar(num_params - 1, func.GetResultType(0)), " = ");
         }
 
         Write(GlobalVar(var), "(");
+        if (options_.instance_struct) {
+          Write(GetFuncInstance(func.name));
+        }
         for (Index i = 0; i < num_params; ++i) {
-          if (i != 0) {
+          if (i != 0 || options_.instance_struct) {
             Write(", ");
           }
           Write(StackVar(num_params - i - 1));
@@ -1458,6 +2149,9 @@ void CWriter::Write(const ExprList& exprs) {
         Write(");", Newline());
         DropTypes(num_params);
         PushTypes(func.decl.sig.result_types);
+        if (num_results > 1) {
+          WriteMultivalueResults(func.decl.sig.result_types);
+        }
         break;
       }
 
@@ -1466,26 +2160,35 @@ void CWriter::Write(const ExprList& exprs) {
         Index num_params = decl.GetNumParams();
         Index num_results = decl.GetNumResults();
         assert(type_stack_.size() > num_params);
-        if (num_results > 0) {
-          assert(num_results == 1);
+        if (num_results > 1) {
+          Write(OpenBrace(), "struct ",
+                MangleMultivalueTypes(decl.sig.result_types), " tmp = ");
+        } else if (num_results > 0) {
           Write(StackVar(num_params, decl.GetResultType(0)), " = ");
         }
 
-        assert(module_->tables.size() == 1);
-        const Table* table = module_->tables[0];
+        const Table* table =
+            module_->GetTable(cast<CallIndirectExpr>(&expr)->table);
 
         assert(decl.has_func_type);
         Index func_type_index = module_->GetFuncTypeIndex(decl.type_var);
 
         Write("CALL_INDIRECT(", ExternalRef(table->name), ", ");
-        WriteFuncDeclaration(decl, "(*)");
+        WriteFuncDeclaration(decl, "(*)", "void*");
         Write(", ", func_type_index, ", ", StackVar(0));
+        if (options_.instance_struct) {
+          Write(", ", ExternalRef(table->name), ".data[", StackVar(0),
+                "].module_instance");
+        }
         for (Index i = 0; i < num_params; ++i) {
           Write(", ", StackVar(num_params - i));
         }
         Write(");", Newline());
         DropTypes(num_params + 1);
         PushTypes(decl.sig.result_types);
+        if (num_results > 1) {
+          WriteMultivalueResults(decl.sig.result_types);
+        }
         break;
       }
 
@@ -1531,13 +2234,17 @@ void CWriter::Write(const ExprList& exprs) {
         PushLabel(LabelType::If, if_.true_.label, if_.true_.decl.sig);
         Write(if_.true_.exprs, CloseBrace());
         if (!if_.false_.empty()) {
-          ResetTypeStack(mark);
+          // The else branch starts with the same params, which the true
+          // branch may have consumed.
+          ResetTypeStack(mark - if_.true_.decl.sig.GetNumParams());
+          PushTypes(if_.true_.decl.sig.param_types);
           Write(" else ", OpenBrace(), if_.false_, CloseBrace());
         }
-        ResetTypeStack(mark);
+        ResetTypeStack(mark - if_.true_.decl.sig.GetNumParams());
         Write(Newline(), LabelDecl(label));
         PopLabel();
         PushTypes(if_.true_.decl.sig.result_types);
+        starts_block = options_.fuel;
         break;
       }
 
@@ -1570,7 +2277,7 @@ void CWriter::Write(const ExprList& exprs) {
         if (!block.exprs.empty()) {
           Write(DefineLocalScopeName(block.label), ": ");
           Indent();
-          size_t mark = MarkTypeStack();
+          size_t mark = MarkTypeStack() - block.decl.sig.GetNumParams();
           PushLabel(LabelType::Loop, block.label, block.decl.sig);
           Write(Newline(), block.exprs);
           ResetTypeStack(mark);
@@ -1578,25 +2285,175 @@ void CWriter::Write(const ExprList& exprs) {
           PushTypes(block.decl.sig.result_types);
           Dedent();
         }
+        starts_block = options_.fuel;
+        break;
+      }
+
+      case ExprType::MemoryCopy: {
+        assert(module_->memories.size() == 1);
+        Memory* memory = module_->memories[0];
+
+        Write("memory_copy(", ExternalPtr(memory->name), ", ", StackVar(2),
+              ", ", StackVar(1), ", ", StackVar(0), ");", Newline());
+        DropTypes(3);
+        break;
+      }
+
+      case ExprType::MemoryFill: {
+        assert(module_->memories.size() == 1);
+        Memory* memory = module_->memories[0];
+
+        Write("memory_fill(", ExternalPtr(memory->name), ", ", StackVar(2),
+              ", ", StackVar(1), ", ", StackVar(0), ");", Newline());
+        DropTypes(3);
+        break;
+      }
+
+      case ExprType::MemoryInit: {
+        assert(module_->memories.size() == 1);
+        Memory* memory = module_->memories[0];
+        const Var& var = cast<MemoryInitExpr>(&expr)->var;
+        Index index = module_->GetDataSegmentIndex(var);
+
+        Write("memory_init(", ExternalPtr(memory->name), ", ");
+        if (module_->GetDataSegment(var)->kind == SegmentKind::Passive) {
+          Write(GlobalName(GetSegmentName("data", "data", index)), ", ",
+                ExternalRef(GetSegmentName("data", "size", index)));
+        } else {
+          Write("NULL, 0");
+        }
+        Write(", ", StackVar(2), ", ", StackVar(1), ", ", StackVar(0), ");",
+              Newline());
+        DropTypes(3);
+        break;
+      }
+
+      case ExprType::DataDrop: {
+        const Var& var = cast<DataDropExpr>(&expr)->var;
+        if (module_->GetDataSegment(var)->kind == SegmentKind::Passive) {
+          Index data_segment_index = module_->GetDataSegmentIndex(var);
+          Write(ExternalRef(GetSegmentName("data", "size", data_segment_index)),
+                " = 0;", Newline());
+        }
+        break;
+      }
+
+      case ExprType::TableCopy: {
+        const TableCopyExpr* copy_expr = cast<TableCopyExpr>(&expr);
+        const Table* dst_table = module_->GetTable(copy_expr->dst_table);
+        const Table* src_table = module_->GetTable(copy_expr->src_table);
+
+        Write("table_copy(", ExternalPtr(dst_table->name), ", ",
+              ExternalPtr(src_table->name), ", ", StackVar(2), ", ",
+              StackVar(1), ", ", StackVar(0), ");", Newline());
+        DropTypes(3);
+        break;
+      }
+
+      case ExprType::TableInit: {
+        const TableInitExpr* init_expr = cast<TableInitExpr>(&expr);
+        const Table* table = module_->GetTable(init_expr->table_index);
+        const ElemSegment* elem_segment =
+            module_->GetElemSegment(init_expr->segment_index);
+        Index index = module_->GetElemSegmentIndex(init_expr->segment_index);
+
+        Write("table_init(", ExternalPtr(table->name), ", ");
+        if (elem_segment->kind == SegmentKind::Passive) {
+          if (elem_segment->elem_exprs.empty()) {
+            Write("NULL");
+          } else {
+            Write(ExternalRef(GetSegmentName("elem", "data", index)));
+          }
+          Write(", ", ExternalRef(GetSegmentName("elem", "size", index)));
+        } else {
+          Write("NULL, 0");
+        }
+        Write(", ", StackVar(2), ", ", StackVar(1), ", ", StackVar(0), ");",
+              Newline());
+        DropTypes(3);
+        break;
+      }
+
+      case ExprType::ElemDrop: {
+        const Var& var = cast<ElemDropExpr>(&expr)->var;
+        if (module_->GetElemSegment(var)->kind == SegmentKind::Passive) {
+          Index elem_segment_index = module_->GetElemSegmentIndex(var);
+          Write(ExternalRef(GetSegmentName("elem", "size", elem_segment_index)),
+                " = 0;", Newline());
+        }
+        break;
+      }
+
+      case ExprType::TableGet: {
+        const Table* table =
+            module_->GetTable(cast<TableGetExpr>(&expr)->var);
+
+        Write(StackVar(0, table->elem_type), " = table_get(",
+              ExternalPtr(table->name), ", ", StackVar(0), ");", Newline());
+        DropTypes(1);
+        PushType(table->elem_type);
+        break;
+      }
+
+      case ExprType::TableSet: {
+        const Table* table =
+            module_->GetTable(cast<TableSetExpr>(&expr)->var);
+
+        Write("table_set(", ExternalPtr(table->name), ", ", StackVar(1), ", ",
+              StackVar(0), ");", Newline());
+        DropTypes(2);
+        break;
+      }
+
+      case ExprType::TableGrow: {
+        const Table* table =
+            module_->GetTable(cast<TableGrowExpr>(&expr)->var);
+
+        Write(StackVar(1, Type::I32), " = wasm_rt_grow_table(",
+              ExternalPtr(table->name), ", ", StackVar(0), ", ", StackVar(1),
+              ");", Newline());
+        DropTypes(2);
+        PushType(Type::I32);
+        break;
+      }
+
+      case ExprType::TableSize: {
+        const Table* table =
+            module_->GetTable(cast<TableSizeExpr>(&expr)->var);
+
+        PushType(Type::I32);
+        Write(StackVar(0), " = ", ExternalRef(table->name), ".size;",
+              Newline());
+        break;
+      }
+
+      case ExprType::TableFill: {
+        const Table* table =
+            module_->GetTable(cast<TableFillExpr>(&expr)->var);
+
+        Write("table_fill(", ExternalPtr(table->name), ", ", StackVar(2),
+              ", ", StackVar(1), ", ", StackVar(0), ");", Newline());
+        DropTypes(3);
         break;
       }
 
-      case ExprType::MemoryCopy:
-      case ExprType::DataDrop:
-      case ExprType::MemoryInit:
-      case ExprType::MemoryFill:
-      case ExprType::TableCopy:
-      case ExprType::ElemDrop:
-      case ExprType::TableInit:
-      case ExprType::TableGet:
-      case ExprType::TableSet:
-      case ExprType::TableGrow:
-      case ExprType::TableSize:
-      case ExprType::TableFill:
       case ExprType::RefFunc:
+        PushType(Type::Funcref);
+        Write(StackVar(0), " = ");
+        WriteRefFunc(module_->GetFunc(cast<RefFuncExpr>(&expr)->var));
+        Write(";", Newline());
+        break;
+
       case ExprType::RefNull:
+        PushType(Type::Nullref);
+        Write(StackVar(0), " = (wasm_rt_elem_t){0};", Newline());
+        break;
+
       case ExprType::RefIsNull:
-        UNIMPLEMENTED("...");
+        Write(StackVar(0, Type::I32), " = ", StackVar(0), ".func == NULL;",
+              Newline());
+        DropTypes(1);
+        PushType(Type::I32);
         break;
 
       case ExprType::MemoryGrow: {
@@ -1613,7 +2470,7 @@ void CWriter::Write(const ExprList& exprs) {
         Memory* memory = module_->memories[0];
 
         PushType(Type::I32);
-        Write(StackVar(0), " = ", ExternalRef(memory->name), ".pages;",
+        Write(StackVar(0), " = MEMORY_PAGES(", ExternalPtr(memory->name), ");",
               Newline());
         break;
       }
@@ -1668,11 +2525,29 @@ void CWriter::Write(const ExprList& exprs) {
         return;
 
       case ExprType::AtomicLoad:
+        Write(*cast<AtomicLoadExpr>(&expr));
+        break;
+
+      case ExprType::AtomicStore:
+        Write(*cast<AtomicStoreExpr>(&expr));
+        break;
+
       case ExprType::AtomicRmw:
+        Write(*cast<AtomicRmwExpr>(&expr));
+        break;
+
       case ExprType::AtomicRmwCmpxchg:
-      case ExprType::AtomicStore:
+        Write(*cast<AtomicRmwCmpxchgExpr>(&expr));
+        break;
+
       case ExprType::AtomicWait:
+        Write(*cast<AtomicWaitExpr>(&expr));
+        break;
+
       case ExprType::AtomicNotify:
+        Write(*cast<AtomicNotifyExpr>(&expr));
+        break;
+
       case ExprType::BrOnExn:
       case ExprType::Rethrow:
       case ExprType::ReturnCall:
@@ -1685,6 +2560,18 @@ void CWriter::Write(const ExprList& exprs) {
   }
 }
 
+// Copies the results of a call, which have just been pushed, from the struct
+// that it returned to their stack variables, and closes the scope of the
+// struct.
+void CWriter::WriteMultivalueResults(const TypeVector& result_types) {
+  Index num_results = result_types.size();
+  for (Index i = 0; i < num_results; ++i) {
+    Write(StackVar(num_results - i - 1), " = tmp.",
+          MangleMultivalueField(result_types[i], i), ";", Newline());
+  }
+  Write(CloseBrace(), Newline());
+}
+
 void CWriter::WriteSimpleUnaryExpr(Opcode opcode, const char* op) {
   Type result_type = opcode.GetResultType();
   Write(StackVar(0, result_type), " = ", op, "(", StackVar(0), ");", Newline());
@@ -1727,6 +2614,11 @@ void CWriter::WriteSignedBinaryExpr(Opcode opcode, const char* op) {
 }
 
 void CWriter::Write(const BinaryExpr& expr) {
+  if (IsSimdOpcode(expr.opcode)) {
+    WritePrefixBinaryExpr(expr.opcode, GetOpcodeFuncName(expr.opcode).c_str());
+    return;
+  }
+
   switch (expr.opcode) {
     case Opcode::I32Add:
     case Opcode::I64Add:
@@ -1859,6 +2751,11 @@ void CWriter::Write(const BinaryExpr& expr) {
 }
 
 void CWriter::Write(const CompareExpr& expr) {
+  if (IsSimdOpcode(expr.opcode)) {
+    WritePrefixBinaryExpr(expr.opcode, GetOpcodeFuncName(expr.opcode).c_str());
+    return;
+  }
+
   switch (expr.opcode) {
     case Opcode::I32Eq:
     case Opcode::I64Eq:
@@ -1928,6 +2825,11 @@ void CWriter::Write(const CompareExpr& expr) {
 }
 
 void CWriter::Write(const ConvertExpr& expr) {
+  if (IsSimdOpcode(expr.opcode)) {
+    WriteSimpleUnaryExpr(expr.opcode, GetOpcodeFuncName(expr.opcode).c_str());
+    return;
+  }
+
   switch (expr.opcode) {
     case Opcode::I32Eqz:
     case Opcode::I64Eqz:
@@ -2065,6 +2967,13 @@ void CWriter::Write(const LoadExpr& expr) {
     case Opcode::I64Load16U: func = "i32_load16_u"; break;
     case Opcode::I64Load32S: func = "i64_load32_s"; break;
     case Opcode::I64Load32U: func = "i64_load32_u"; break;
+    case Opcode::V128Load: func = "v128_load"; break;
+    case Opcode::I16X8Load8X8S: func = "i16x8_load8x8_s"; break;
+    case Opcode::I16X8Load8X8U: func = "i16x8_load8x8_u"; break;
+    case Opcode::I32X4Load16X4S: func = "i32x4_load16x4_s"; break;
+    case Opcode::I32X4Load16X4U: func = "i32x4_load16x4_u"; break;
+    case Opcode::I64X2Load32X2S: func = "i64x2_load32x2_s"; break;
+    case Opcode::I64X2Load32X2U: func = "i64x2_load32x2_u"; break;
 
     default:
       WABT_UNREACHABLE;
@@ -2073,12 +2982,14 @@ void CWriter::Write(const LoadExpr& expr) {
   assert(module_->memories.size() == 1);
   Memory* memory = module_->memories[0];
 
+  // The offset is added in 64 bits, so an access past 4GiB traps rather than
+  // wrapping around.
   Type result_type = expr.opcode.GetResultType();
   Write(StackVar(0, result_type), " = ", func, "(", ExternalPtr(memory->name),
-        ", (u64)(", StackVar(0));
+        ", (u64)(", StackVar(0), ")");
   if (expr.offset != 0)
     Write(" + ", expr.offset);
-  Write("));", Newline());
+  Write(");", Newline());
   DropTypes(1);
   PushType(result_type);
 }
@@ -2095,6 +3006,7 @@ void CWriter::Write(const StoreExpr& expr) {
     case Opcode::I32Store16: func = "i32_store16"; break;
     case Opcode::I64Store16: func = "i64_store16"; break;
     case Opcode::I64Store32: func = "i64_store32"; break;
+    case Opcode::V128Store: func = "v128_store"; break;
 
     default:
       WABT_UNREACHABLE;
@@ -2103,14 +3015,19 @@ void CWriter::Write(const StoreExpr& expr) {
   assert(module_->memories.size() == 1);
   Memory* memory = module_->memories[0];
 
-  Write(func, "(", ExternalPtr(memory->name), ", (u64)(", StackVar(1));
+  Write(func, "(", ExternalPtr(memory->name), ", (u64)(", StackVar(1), ")");
   if (expr.offset != 0)
     Write(" + ", expr.offset);
-  Write("), ", StackVar(0), ");", Newline());
+  Write(", ", StackVar(0), ");", Newline());
   DropTypes(2);
 }
 
 void CWriter::Write(const UnaryExpr& expr) {
+  if (IsSimdOpcode(expr.opcode)) {
+    WriteSimpleUnaryExpr(expr.opcode, GetOpcodeFuncName(expr.opcode).c_str());
+    return;
+  }
+
   switch (expr.opcode) {
     case Opcode::I32Clz:
       WriteSimpleUnaryExpr(expr.opcode, "I32_CLZ");
@@ -2206,8 +3123,8 @@ void CWriter::Write(const TernaryExpr& expr) {
   switch (expr.opcode) {
     case Opcode::V128BitSelect: {
       Type result_type = expr.opcode.GetResultType();
-      Write(StackVar(2, result_type), " = ", "v128.bitselect", "(", StackVar(0),
-            ", ", StackVar(1), ", ", StackVar(2), ");", Newline());
+      Write(StackVar(2, result_type), " = v128_bitselect(", StackVar(2), ", ",
+            StackVar(1), ", ", StackVar(0), ");", Newline());
       DropTypes(3);
       PushType(result_type);
       break;
@@ -2229,8 +3146,8 @@ void CWriter::Write(const SimdLaneOpExpr& expr) {
     case Opcode::I64X2ExtractLane:
     case Opcode::F32X4ExtractLane:
     case Opcode::F64X2ExtractLane: {
-      Write(StackVar(0, result_type), " = ", expr.opcode.GetName(), "(",
-            StackVar(0), ", lane Imm: ", expr.val, ");", Newline());
+      Write(StackVar(0, result_type), " = ", GetOpcodeFuncName(expr.opcode),
+            "(", StackVar(0), ", ", expr.val, ");", Newline());
       DropTypes(1);
       break;
     }
@@ -2240,8 +3157,8 @@ void CWriter::Write(const SimdLaneOpExpr& expr) {
     case Opcode::I64X2ReplaceLane:
     case Opcode::F32X4ReplaceLane:
     case Opcode::F64X2ReplaceLane: {
-      Write(StackVar(1, result_type), " = ", expr.opcode.GetName(), "(",
-            StackVar(0), ", ", StackVar(1), ", lane Imm: ", expr.val, ");",
+      Write(StackVar(1, result_type), " = ", GetOpcodeFuncName(expr.opcode),
+            "(", StackVar(1), ", ", StackVar(0), ", ", expr.val, ");",
             Newline());
       DropTypes(2);
       break;
@@ -2255,10 +3172,12 @@ void CWriter::Write(const SimdLaneOpExpr& expr) {
 
 void CWriter::Write(const SimdShuffleOpExpr& expr) {
   Type result_type = expr.opcode.GetResultType();
-  Write(StackVar(1, result_type), " = ", expr.opcode.GetName(), "(",
-        StackVar(1), " ", StackVar(0), ", lane Imm: $0x%08x %08x %08x %08x",
-        expr.val.v[0], expr.val.v[1], expr.val.v[2], expr.val.v[3], ")",
-        Newline());
+  Write(StackVar(1, result_type), " = v8x16_shuffle(", StackVar(1), ", ",
+        StackVar(0));
+  for (int i = 0; i < 16; ++i) {
+    Writef(", %u", (expr.val.v[i / 4] >> (8 * (i % 4))) & 0xff);
+  }
+  Write(");", Newline());
   DropTypes(2);
   PushType(result_type);
 }
@@ -2268,45 +3187,158 @@ void CWriter::Write(const LoadSplatExpr& expr) {
   Memory* memory = module_->memories[0];
 
   Type result_type = expr.opcode.GetResultType();
-  Write(StackVar(0, result_type), " = ", expr.opcode.GetName(), "(",
-        ExternalPtr(memory->name), ", (u64)(", StackVar(0));
+  Write(StackVar(0, result_type), " = ", GetOpcodeFuncName(expr.opcode), "(",
+        ExternalPtr(memory->name), ", (u64)(", StackVar(0), ")");
   if (expr.offset != 0)
     Write(" + ", expr.offset);
-  Write("));", Newline());
+  Write(");", Newline());
   DropTypes(1);
   PushType(result_type);
 }
 
+// Writes a call to the helper for an atomic instruction, which takes the
+// address and |num_args| other operands from the stack.
+void CWriter::WriteAtomicExpr(Opcode opcode, Address offset, int num_args) {
+  assert(module_->memories.size() == 1);
+  Memory* memory = module_->memories[0];
+
+  Type result_type = opcode.GetResultType();
+  if (result_type != Type::Void) {
+    Write(StackVar(num_args, result_type), " = ");
+  }
+  Write(GetOpcodeFuncName(opcode), "(", ExternalPtr(memory->name), ", (u64)(",
+        StackVar(num_args), ")");
+  if (offset != 0)
+    Write(" + ", offset);
+  for (int i = num_args - 1; i >= 0; --i) {
+    Write(", ", StackVar(i));
+  }
+  Write(");", Newline());
+  DropTypes(num_args + 1);
+  if (result_type != Type::Void) {
+    PushType(result_type);
+  }
+}
+
+void CWriter::Write(const AtomicLoadExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 0);
+}
+
+void CWriter::Write(const AtomicStoreExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 1);
+}
+
+void CWriter::Write(const AtomicRmwExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 1);
+}
+
+void CWriter::Write(const AtomicRmwCmpxchgExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 2);
+}
+
+void CWriter::Write(const AtomicWaitExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 2);
+}
+
+void CWriter::Write(const AtomicNotifyExpr& expr) {
+  WriteAtomicExpr(expr.opcode, expr.offset, 1);
+}
+
 void CWriter::WriteCHeader() {
   stream_ = h_stream_;
-  std::string guard = GenerateHeaderGuard();
+  std::string guard = GenerateHeaderGuard(header_name_);
   Write("#ifndef ", guard, Newline());
   Write("#define ", guard, Newline());
   Write(s_header_top);
-  WriteImports();
+  WriteMultivalueTypes();
+  if (options_.instance_struct) {
+    WriteInstanceStruct();
+    Write(Newline(), "extern void WASM_RT_ADD_PREFIX(init_module)(void);",
+          Newline());
+    Write("extern void WASM_RT_ADD_PREFIX(instantiate)(", kInstancePtrType,
+          ");", Newline());
+    Write("extern void WASM_RT_ADD_PREFIX(free_instance)(", kInstancePtrType,
+          ");", Newline());
+  } else {
+    Write(Newline(), "extern void WASM_RT_ADD_PREFIX(init)(void);", Newline());
+    WriteImports();
+  }
   WriteExports(WriteExportsKind::Declarations);
   Write(s_header_bottom);
   Write(Newline(), "#endif  /* ", guard, " */", Newline());
 }
 
-void CWriter::WriteCSource() {
-  stream_ = c_stream_;
-  WriteSourceTop();
-  WriteFuncTypes();
+void CWriter::WriteImplHeader() {
+  stream_ = impl_h_stream_;
+  std::string guard = GenerateHeaderGuard(impl_header_name_);
+  Write("#ifndef ", guard, Newline());
+  Write("#define ", guard, Newline());
+  Write(Newline(), "#include \"", header_name_, "\"", Newline());
+  Write(Newline(), "#define func_types WASM_RT_ADD_PREFIX(w2c_func_types)",
+        Newline());
+  Writef("extern u32 func_types[%" PRIzd "];", module_->func_types.size());
+  Write(Newline());
   WriteFuncDeclarations();
-  WriteGlobals();
-  WriteMemories();
-  WriteTables();
-  WriteFuncs();
-  WriteDataInitializers();
-  WriteElemInitializers();
-  WriteExports(WriteExportsKind::Definitions);
-  WriteInitExports();
-  WriteInit();
+  WriteGlobals("extern ");
+  WriteMemories("extern ");
+  WriteTables("extern ");
+  Index data_segment_index = 0;
+  for (const DataSegment* data_segment : module_->data_segments) {
+    Write("extern const u8 ",
+          DefineSharedName(GetSegmentName("data", "data", data_segment_index)),
+          "[", data_segment->data.size(), "];", Newline());
+    ++data_segment_index;
+  }
+  if (!options_.instance_struct) {
+    WriteSegmentState("extern ");
+  }
+  Write(Newline(), "#endif  /* ", guard, " */", Newline());
+}
+
+void CWriter::WriteCSource() {
+  if (impl_h_stream_) {
+    WriteImplHeader();
+  }
+
+  std::vector<Index> func_ends = PartitionFuncs();
+  Index func_index = module_->num_func_imports;
+  for (Index i = 0; i < c_streams_.size(); ++i) {
+    c_stream_ = c_streams_[i];
+    stream_ = c_stream_;
+    WriteSourceTop();
+    if (i == 0) {
+      WriteFuncTypes();
+      if (!impl_h_stream_) {
+        WriteFuncDeclarations();
+      }
+      WriteGlobals(GetInternalLinkage());
+      WriteInitGlobals();
+      WriteMemories(GetInternalLinkage());
+      WriteTables(GetInternalLinkage());
+      WriteDataSegments();
+      if (!options_.instance_struct) {
+        WriteSegmentState(GetInternalLinkage());
+      }
+    }
+
+    WriteFuncs(func_index, func_ends[i]);
+    func_index = func_ends[i];
+
+    if (i == 0) {
+      WriteDataInitializers();
+      WriteElemInitializers();
+      WriteExports(WriteExportsKind::Definitions);
+      if (options_.instance_struct) {
+        WriteInstantiate();
+      } else {
+        WriteInitExports();
+        WriteInit();
+      }
+    }
+  }
 }
 
 Result CWriter::WriteModule(const Module& module) {
-  WABT_USE(options_);
   module_ = &module;
   InitGlobalSymbols();
   WriteCHeader();
@@ -2321,7 +3353,22 @@ Result WriteC(Stream* c_stream,
               const char* header_name,
               const Module* module,
               const WriteCOptions& options) {
-  CWriter c_writer(c_stream, h_stream, header_name, options);
+  CWriter c_writer({c_stream}, h_stream, nullptr, header_name, nullptr,
+                   options);
+  return c_writer.WriteModule(*module);
+}
+
+Result WriteC(const std::vector<Stream*>& c_streams,
+              Stream* h_stream,
+              Stream* impl_h_stream,
+              const char* header_name,
+              const char* impl_header_name,
+              const Module* module,
+              const WriteCOptions& options) {
+  assert(!c_streams.empty());
+  CWriter c_writer(c_streams, h_stream,
+                   c_streams.size() > 1 ? impl_h_stream : nullptr, header_name,
+                   impl_header_name, options);
   return c_writer.WriteModule(*module);
 }
 
@@ -17,14 +17,30 @@
 #ifndef WABT_C_WRITER_H_
 #define WABT_C_WRITER_H_
 
+#include <vector>
+
 #include "src/common.h"
+#include "src/feature.h"
 
 namespace wabt {
 
 struct Module;
 class Stream;
 
-struct WriteCOptions {};
+struct WriteCOptions {
+  // Keep all module state in a caller-allocated instance struct that is
+  // passed to every function, instead of in file-scope statics.
+  bool instance_struct = false;
+
+  // Start each basic block with a check that takes the number of instructions
+  // in it from the runtime's wasm_rt_fuel, and traps with
+  // WASM_RT_TRAP_OUT_OF_FUEL when it runs out.
+  bool fuel = false;
+
+  // The features that change the generated code are SIMD and threads, which
+  // declare the helpers for their instructions.
+  Features features;
+};
 
 Result WriteC(Stream* c_stream,
               Stream* h_stream,
@@ -32,6 +48,19 @@ Result WriteC(Stream* c_stream,
               const Module*,
               const WriteCOptions&);
 
+// Splits the module's functions across |c_streams|, balanced by their number
+// of instructions, so that the files can be compiled in parallel. The first
+// file also holds the module's state and initialization. The declarations
+// that the files share are written to |impl_h_stream|, which they include as
+// |impl_header_name|.
+Result WriteC(const std::vector<Stream*>& c_streams,
+              Stream* h_stream,
+              Stream* impl_h_stream,
+              const char* header_name,
+              const char* impl_header_name,
+              const Module*,
+              const WriteCOptions&);
+
 }  // namespace wabt
 
 #endif /* WABT_C_WRITER_H_ */
@@ -16,16 +16,19 @@
 
 #include "src/interp/binary-reader-interp.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cinttypes>
 #include <cstdarg>
 #include <cstdio>
+#include <utility>
 #include <vector>
 
 #include "src/binary-reader-nop.h"
 #include "src/cast.h"
 #include "src/feature.h"
 #include "src/interp/interp.h"
+#include "src/interp/interp-cache.h"
 #include "src/interp/interp-internal.h"
 #include "src/stream.h"
 #include "src/type-checker.h"
@@ -52,10 +55,21 @@ struct GlobalType {
   bool mutable_;
 };
 
+// An instruction that register lowering or superinstruction fusion may still
+// combine with the instruction that follows it. Slots are relative to the value
+// stack height at the start of the instruction; a local.get only uses
+// |lhs_slot|, and a compare uses neither.
+struct RegInstr {
+  IstreamOffset offset;
+  Opcode opcode;
+  Index lhs_slot;
+  Index rhs_slot;
+};
+
 Label::Label(IstreamOffset offset, IstreamOffset fixup_offset)
     : offset(offset), fixup_offset(fixup_offset) {}
 
-class BinaryReaderInterp : public BinaryReaderNop {
+class BinaryReaderInterp : public BinaryReaderNop, public LazyCompiler {
  public:
   BinaryReaderInterp(Environment* env,
                      DefinedModule* module,
@@ -68,6 +82,21 @@ class BinaryReaderInterp : public BinaryReaderNop {
 
   std::unique_ptr<OutputBuffer> ReleaseOutputBuffer();
 
+  // Records the module's types and imports in |cache| as they are read. The
+  // rest is taken from the environment afterward; see CaptureCachedModule.
+  void StartCache(CachedModule* cache);
+  // Adds a module that was recorded with StartCache to the environment,
+  // without reading the binary. Its imports are resolved again, and it fails
+  // if they or the environment don't match the ones it was read with.
+  wabt::Result RestoreCachedModule(const CachedModule&);
+
+  // Only records where each function body is in |data| while the module is
+  // read, keeping a copy of it so they can be lowered later by Compile.
+  void StartLazyCompilation(const void* data, size_t size);
+
+  // Implement LazyCompiler.
+  wabt::Result Compile(Index func_index, Errors*) override;
+
   // Implement BinaryReader.
   bool OnError(const Error&) override;
 
@@ -79,6 +108,7 @@ class BinaryReaderInterp : public BinaryReaderNop {
                       Type* param_types,
                       Index result_count,
                       Type* result_types) override;
+  wabt::Result EndTypeSection() override;
 
   wabt::Result OnImportFunc(Index import_index,
                             string_view module_name,
@@ -102,6 +132,7 @@ class BinaryReaderInterp : public BinaryReaderNop {
                               Index global_index,
                               Type type,
                               bool mutable_) override;
+  wabt::Result EndImportSection() override;
 
   wabt::Result OnFunctionCount(Index count) override;
   wabt::Result OnFunction(Index index, Index sig_index) override;
@@ -264,7 +295,9 @@ class BinaryReaderInterp : public BinaryReaderNop {
   Index TranslateGlobalIndexToEnv(Index global_index);
   Global* GetGlobalByModuleIndex(Index global_index);
   Type GetGlobalTypeByModuleIndex(Index global_index);
-  Index TranslateLocalIndex(Index local_index);
+  Index TranslateLocalIndex(Index local_index, Index stack_slot_count);
+  void AppendLocalSlots(Type type, Index count);
+  Index GetTypeStackSlotCount(size_t type_stack_limit);
   Type GetLocalTypeByIndex(Func* func, Index local_index);
   Index TranslateDataSegmentIndexToEnv(Index data_segment_index);
   Index TranslateElemSegmentIndexToEnv(Index elem_segment_index);
@@ -276,7 +309,6 @@ class BinaryReaderInterp : public BinaryReaderNop {
                           IstreamOffset size);
   wabt::Result EmitData(const void* data, IstreamOffset size);
   wabt::Result EmitOpcode(Opcode opcode);
-  wabt::Result EmitI8(uint8_t value);
   wabt::Result EmitI32(uint32_t value);
   wabt::Result EmitI64(uint64_t value);
   wabt::Result EmitV128(v128 value);
@@ -301,6 +333,13 @@ class BinaryReaderInterp : public BinaryReaderNop {
   wabt::Result EmitBrTableOffset(Index depth);
   wabt::Result FixupTopLabel();
   wabt::Result EmitFuncOffset(DefinedFunc* func, Index func_index);
+  void ResetRegisterLowering();
+  wabt::Result RewindIstream(IstreamOffset offset);
+  wabt::Result EmitBinop(Opcode opcode);
+  wabt::Result EmitLocalSet(Index slot);
+  wabt::Result EmitBrUnless(IstreamOffset* out_fixup_offset);
+  wabt::Result EmitConsumeFuel();
+  wabt::Result FixupConsumeFuel();
 
   wabt::Result CheckDeclaredFunc(Index func_index);
   wabt::Result CheckLocal(Index local_index);
@@ -334,8 +373,19 @@ class BinaryReaderInterp : public BinaryReaderNop {
                              Index sig_index,
                              Export** out_export);
 
+  Environment::MarkPoint GetMarkPoint();
+  void CacheImport(ExternalKind kind,
+                   string_view module_name,
+                   string_view field_name,
+                   Index resolved_index);
+  bool IsCachedModuleInRange(const CachedModule&);
+
   Features features_;
-  const std::vector<Export*>& imports_;
+  std::vector<Export*> imports_;
+  // The registered module of the last import, since imports from the same
+  // module are usually adjacent.
+  std::string last_import_module_name_;
+  Module* last_import_module_ = nullptr;
   Errors* errors_ = nullptr;
   Environment* env_ = nullptr;
   DefinedModule* module_ = nullptr;
@@ -344,7 +394,7 @@ class BinaryReaderInterp : public BinaryReaderNop {
   std::vector<Label> label_stack_;
   IstreamOffsetVectorVector func_fixups_;
   IstreamOffsetVectorVector depth_fixups_;
-  MemoryStream istream_;
+  std::unique_ptr<MemoryStream> istream_;
   IstreamOffset istream_offset_ = 0;
   /* mappings from module index space to env index space; this won't just be a
    * translation, because imported values will be resolved as well */
@@ -368,6 +418,34 @@ class BinaryReaderInterp : public BinaryReaderNop {
   std::vector<bool> declared_funcs_;
   std::vector<Index> init_expr_funcs_;
   bool has_table = false;
+  bool has_data_count_ = false;
+
+  // The value stack slot of each param and local of the current function,
+  // counted from its first param, and the number of slots they take.
+  IndexVector local_slots_;
+  Index local_slot_count_ = 0;
+
+  // Instructions that register lowering or superinstruction fusion may still
+  // rewrite. These are always the most recently emitted instructions of the
+  // current function.
+  std::vector<RegInstr> reg_local_gets_;
+  RegInstr reg_binop_ = {kInvalidIstreamOffset, Opcode::Invalid, 0, 0};
+  RegInstr reg_compare_ = {kInvalidIstreamOffset, Opcode::Invalid, 0, 0};
+  IstreamOffset i32_const_offset_ = kInvalidIstreamOffset;
+  uint32_t i32_const_value_ = 0;
+
+  // With LoweringOptions::fuel, where the cost of the current basic block is
+  // to be written, and the cost of its instructions so far.
+  IstreamOffset fuel_cost_offset_ = kInvalidIstreamOffset;
+  uint32_t fuel_cost_ = 0;
+
+  CachedModule* cache_ = nullptr;
+
+  // With lazy compilation, a copy of the module's binary, and the offset and
+  // size of each defined function's body in it.
+  bool skip_function_bodies_ = false;
+  std::vector<uint8_t> module_data_;
+  std::vector<std::pair<Offset, Offset>> function_bodies_;
 };
 
 BinaryReaderInterp::BinaryReaderInterp(Environment* env,
@@ -382,14 +460,14 @@ BinaryReaderInterp::BinaryReaderInterp(Environment* env,
       env_(env),
       module_(module),
       typechecker_(features),
-      istream_(std::move(istream)),
-      istream_offset_(istream_.output_buffer().size()) {
+      istream_(new MemoryStream(std::move(istream))),
+      istream_offset_(istream_->output_buffer().size()) {
   typechecker_.set_error_callback(
       [this](const char* msg) { PrintError("%s", msg); });
 }
 
 std::unique_ptr<OutputBuffer> BinaryReaderInterp::ReleaseOutputBuffer() {
-  return istream_.ReleaseOutputBuffer();
+  return istream_->ReleaseOutputBuffer();
 }
 
 Label* BinaryReaderInterp::GetLabel(Index depth) {
@@ -484,8 +562,8 @@ IstreamOffset BinaryReaderInterp::GetIstreamOffset() {
 wabt::Result BinaryReaderInterp::EmitDataAt(IstreamOffset offset,
                                             const void* data,
                                             IstreamOffset size) {
-  istream_.WriteDataAt(offset, data, size);
-  return istream_.result();
+  istream_->WriteDataAt(offset, data, size);
+  return istream_->result();
 }
 
 wabt::Result BinaryReaderInterp::EmitData(const void* data,
@@ -499,10 +577,6 @@ wabt::Result BinaryReaderInterp::EmitOpcode(Opcode opcode) {
   return EmitI32(static_cast<uint32_t>(opcode));
 }
 
-wabt::Result BinaryReaderInterp::EmitI8(uint8_t value) {
-  return EmitData(&value, sizeof(value));
-}
-
 wabt::Result BinaryReaderInterp::EmitI32(uint32_t value) {
   return EmitData(&value, sizeof(value));
 }
@@ -557,16 +631,30 @@ wabt::Result BinaryReaderInterp::EmitBrOffset(Index depth,
   return wabt::Result::Ok;
 }
 
+// Returns the number of value stack slots taken by the values above
+// |type_stack_limit| on the type stack.
+Index BinaryReaderInterp::GetTypeStackSlotCount(size_t type_stack_limit) {
+  assert(typechecker_.type_stack_size() >= type_stack_limit);
+  const TypeVector& type_stack = typechecker_.type_stack();
+  if (!features_.simd_enabled()) {
+    return type_stack.size() - type_stack_limit;
+  }
+  Index slot_count = 0;
+  for (size_t i = type_stack_limit; i < type_stack.size(); ++i) {
+    slot_count += GetSlotCount(type_stack[i]);
+  }
+  return slot_count;
+}
+
+// Counts are in value stack slots.
 wabt::Result BinaryReaderInterp::GetDropCount(Index keep_count,
                                               size_t type_stack_limit,
                                               Index* out_drop_count) {
-  assert(typechecker_.type_stack_size() >= type_stack_limit);
-  Index type_stack_count = typechecker_.type_stack_size() - type_stack_limit;
-  // The keep_count may be larger than the type_stack_count if the typechecker
-  // is currently unreachable. In that case, it doesn't matter what value we
+  Index slot_count = GetTypeStackSlotCount(type_stack_limit);
+  // The keep_count may be larger than the slot_count if the typechecker is
+  // currently unreachable. In that case, it doesn't matter what value we
   // drop, but 0 is a reasonable choice.
-  *out_drop_count =
-      type_stack_count >= keep_count ? type_stack_count - keep_count : 0;
+  *out_drop_count = slot_count >= keep_count ? slot_count - keep_count : 0;
   return wabt::Result::Ok;
 }
 
@@ -575,7 +663,7 @@ wabt::Result BinaryReaderInterp::GetBrDropKeepCount(Index depth,
                                                     Index* out_keep_count) {
   TypeChecker::Label* label;
   CHECK_RESULT(typechecker_.GetLabel(depth, &label));
-  Index keep_count = label->br_types().size();
+  Index keep_count = GetSlotCount(label->br_types());
   CHECK_RESULT(
       GetDropCount(keep_count, label->type_stack_limit, out_drop_count));
   *out_keep_count = keep_count;
@@ -586,7 +674,7 @@ wabt::Result BinaryReaderInterp::GetReturnDropKeepCount(Index* out_drop_count,
                                                         Index* out_keep_count) {
   CHECK_RESULT(GetBrDropKeepCount(label_stack_.size() - 1, out_drop_count,
                                   out_keep_count));
-  *out_drop_count += current_func_->param_and_local_types.size();
+  *out_drop_count += local_slot_count_;
   return wabt::Result::Ok;
 }
 
@@ -595,9 +683,9 @@ wabt::Result BinaryReaderInterp::GetReturnCallDropKeepCount(
     Index keep_extra,
     Index* out_drop_count,
     Index* out_keep_count) {
-  Index keep_count = static_cast<Index>(sig->param_types.size()) + keep_extra;
+  Index keep_count = GetSlotCount(sig->param_types) + keep_extra;
   CHECK_RESULT(GetDropCount(keep_count, 0, out_drop_count));
-  *out_drop_count += current_func_->param_and_local_types.size();
+  *out_drop_count += local_slot_count_;
   *out_keep_count = keep_count;
   return wabt::Result::Ok;
 }
@@ -645,6 +733,148 @@ wabt::Result BinaryReaderInterp::EmitFuncOffset(DefinedFunc* func,
   return wabt::Result::Ok;
 }
 
+void BinaryReaderInterp::ResetRegisterLowering() {
+  reg_local_gets_.clear();
+  reg_binop_.offset = kInvalidIstreamOffset;
+  reg_compare_.offset = kInvalidIstreamOffset;
+  i32_const_offset_ = kInvalidIstreamOffset;
+}
+
+wabt::Result BinaryReaderInterp::RewindIstream(IstreamOffset offset) {
+  assert(offset <= istream_offset_);
+  istream_->Truncate(offset);
+  istream_offset_ = offset;
+  return istream_->result();
+}
+
+// With register lowering, "local.get; local.get; <binop>" is emitted as
+// "reg_binop <binop> lhs rhs". i32.add may instead be fused with the
+// instructions before it into "i32.add_const k" or "i32.add_locals lhs rhs".
+// Must be called after the typechecker has accepted the binop.
+wabt::Result BinaryReaderInterp::EmitBinop(Opcode opcode) {
+  const LoweringOptions& options = env_->lowering_options_;
+  if (opcode == Opcode::I32Add) {
+    if (i32_const_offset_ != kInvalidIstreamOffset &&
+        options.IsFusionEnabled(Fusion::I32AddConst)) {
+      IstreamOffset offset = i32_const_offset_;
+      uint32_t value = i32_const_value_;
+      ResetRegisterLowering();
+
+      CHECK_RESULT(RewindIstream(offset));
+      CHECK_RESULT(EmitOpcode(Opcode::InterpI32AddConst));
+      CHECK_RESULT(EmitI32(value));
+      return wabt::Result::Ok;
+    }
+
+    if (reg_local_gets_.size() == 2 &&
+        options.IsFusionEnabled(Fusion::I32AddLocals)) {
+      IstreamOffset offset = reg_local_gets_[0].offset;
+      Index lhs_slot = reg_local_gets_[0].lhs_slot;
+      // The rhs local.get ran with the lhs value already pushed.
+      Index rhs_slot = reg_local_gets_[1].lhs_slot - 1;
+      ResetRegisterLowering();
+
+      CHECK_RESULT(RewindIstream(offset));
+      CHECK_RESULT(EmitOpcode(Opcode::InterpI32AddLocals));
+      CHECK_RESULT(EmitI32(lhs_slot));
+      CHECK_RESULT(EmitI32(rhs_slot));
+      return wabt::Result::Ok;
+    }
+  }
+
+  if (reg_local_gets_.size() < 2 || !options.register_lowering ||
+      !IsRegBinop(opcode)) {
+    // The binop consumes the values of any local.gets before it, so they
+    // can't be fused with a later instruction.
+    ResetRegisterLowering();
+    if (IsI32Compare(opcode) &&
+        options.IsFusionEnabled(Fusion::I32CompareBrUnless)) {
+      reg_compare_ = {GetIstreamOffset(), opcode, 0, 0};
+    }
+    return EmitOpcode(opcode);
+  }
+
+  const RegInstr& lhs = reg_local_gets_[0];
+  const RegInstr& rhs = reg_local_gets_[1];
+  // The rhs local.get ran with the lhs value already pushed.
+  RegInstr binop = {lhs.offset, opcode, lhs.lhs_slot, rhs.lhs_slot - 1};
+  ResetRegisterLowering();
+
+  CHECK_RESULT(RewindIstream(binop.offset));
+  CHECK_RESULT(EmitOpcode(Opcode::InterpRegBinop));
+  CHECK_RESULT(EmitOpcode(binop.opcode));
+  CHECK_RESULT(EmitI32(binop.lhs_slot));
+  CHECK_RESULT(EmitI32(binop.rhs_slot));
+  reg_binop_ = binop;
+  return wabt::Result::Ok;
+}
+
+// With register lowering, "reg_binop <binop> lhs rhs; local.set dst" is
+// emitted as "reg_binop_set <binop> dst lhs rhs". |slot| must be relative to
+// the value stack without the binop's result, which is also the height at the
+// start of reg_binop.
+wabt::Result BinaryReaderInterp::EmitLocalSet(Index slot) {
+  if (reg_binop_.offset == kInvalidIstreamOffset) {
+    CHECK_RESULT(EmitOpcode(Opcode::LocalSet));
+    CHECK_RESULT(EmitI32(slot));
+    return wabt::Result::Ok;
+  }
+
+  RegInstr binop = reg_binop_;
+  ResetRegisterLowering();
+
+  CHECK_RESULT(RewindIstream(binop.offset));
+  CHECK_RESULT(EmitOpcode(Opcode::InterpRegBinopSet));
+  CHECK_RESULT(EmitOpcode(binop.opcode));
+  CHECK_RESULT(EmitI32(slot));
+  CHECK_RESULT(EmitI32(binop.lhs_slot));
+  CHECK_RESULT(EmitI32(binop.rhs_slot));
+  return wabt::Result::Ok;
+}
+
+// Emits "br_unless", or fuses it with the i32 compare just before it into
+// "i32.cmp_br_unless <compare>". Either way the branch target is left to be
+// fixed up at |out_fixup_offset|.
+wabt::Result BinaryReaderInterp::EmitBrUnless(IstreamOffset* out_fixup_offset) {
+  if (reg_compare_.offset == kInvalidIstreamOffset) {
+    CHECK_RESULT(EmitOpcode(Opcode::InterpBrUnless));
+  } else {
+    RegInstr compare = reg_compare_;
+    ResetRegisterLowering();
+
+    CHECK_RESULT(RewindIstream(compare.offset));
+    CHECK_RESULT(EmitOpcode(Opcode::InterpI32CompareBrUnless));
+    CHECK_RESULT(EmitOpcode(compare.opcode));
+  }
+  *out_fixup_offset = GetIstreamOffset();
+  CHECK_RESULT(EmitI32(kInvalidIstreamOffset));
+  return wabt::Result::Ok;
+}
+
+// Starts a basic block with "consume_fuel <cost>", once the block before it
+// is complete. The cost is filled in by the next call, or by
+// FixupConsumeFuel at the end of the function.
+wabt::Result BinaryReaderInterp::EmitConsumeFuel() {
+  if (!env_->lowering_options_.fuel) {
+    return wabt::Result::Ok;
+  }
+  CHECK_RESULT(FixupConsumeFuel());
+  CHECK_RESULT(EmitOpcode(Opcode::InterpConsumeFuel));
+  fuel_cost_offset_ = GetIstreamOffset();
+  fuel_cost_ = 0;
+  CHECK_RESULT(EmitI32(0));
+  return wabt::Result::Ok;
+}
+
+wabt::Result BinaryReaderInterp::FixupConsumeFuel() {
+  if (fuel_cost_offset_ == kInvalidIstreamOffset) {
+    return wabt::Result::Ok;
+  }
+  CHECK_RESULT(EmitI32At(fuel_cost_offset_, fuel_cost_));
+  fuel_cost_offset_ = kInvalidIstreamOffset;
+  return wabt::Result::Ok;
+}
+
 bool BinaryReaderInterp::OnError(const Error& error) {
   errors_->push_back(error);
   return true;
@@ -666,6 +896,7 @@ wabt::Result BinaryReaderInterp::EndModule() {
   for (Index func_index : init_expr_funcs_) {
     CHECK_RESULT(CheckDeclaredFunc(func_index));
   }
+  module_->IndexExports();
   return wabt::Result::Ok;
 }
 
@@ -683,8 +914,18 @@ wabt::Result BinaryReaderInterp::OnType(Index index,
                                         Index result_count,
                                         Type* result_types) {
   assert(TranslateSigIndexToEnv(index) == env_->GetFuncSignatureCount());
-  env_->EmplaceBackFuncSignature(param_count, param_types, result_count,
-                                 result_types);
+  FuncSignature* sig = env_->EmplaceBackFuncSignature(
+      param_count, param_types, result_count, result_types);
+  if (cache_) {
+    cache_->sigs.push_back(*sig);
+  }
+  return wabt::Result::Ok;
+}
+
+wabt::Result BinaryReaderInterp::EndTypeSection() {
+  if (cache_) {
+    cache_->import_mark = GetMarkPoint();
+  }
   return wabt::Result::Ok;
 }
 
@@ -785,6 +1026,11 @@ wabt::Result BinaryReaderInterp::AppendExport(Module* module,
 
 wabt::Result BinaryReaderInterp::FindRegisteredModule(string_view module_name,
                                                       Module** out_module) {
+  if (last_import_module_ && module_name == last_import_module_name_) {
+    *out_module = last_import_module_;
+    return wabt::Result::Ok;
+  }
+
   Module* module = env_->FindRegisteredModule(module_name);
   if (!module) {
     PrintError("unknown import module \"" PRIstringview "\"",
@@ -792,6 +1038,8 @@ wabt::Result BinaryReaderInterp::FindRegisteredModule(string_view module_name,
     return wabt::Result::Error;
   }
 
+  last_import_module_name_ = module_name.to_string();
+  last_import_module_ = module;
   *out_module = module;
   return wabt::Result::Ok;
 }
@@ -848,6 +1096,10 @@ wabt::Result BinaryReaderInterp::OnImportFunc(Index import_index,
 
   func_index_mapping_.push_back(export_->index);
   num_func_imports_++;
+  if (cache_) {
+    CacheImport(ExternalKind::Func, module_name, field_name, export_->index);
+    cache_->imports.back().sig_index = sig_index;
+  }
   return wabt::Result::Ok;
 }
 
@@ -872,6 +1124,11 @@ wabt::Result BinaryReaderInterp::OnImportTable(Index import_index,
   CHECK_RESULT(CheckImportLimits(elem_limits, &table->limits));
 
   table_index_mapping_.push_back(export_->index);
+  if (cache_) {
+    CacheImport(ExternalKind::Table, module_name, field_name, export_->index);
+    cache_->imports.back().type = elem_type;
+    cache_->imports.back().limits = *elem_limits;
+  }
   return wabt::Result::Ok;
 }
 
@@ -893,6 +1150,10 @@ wabt::Result BinaryReaderInterp::OnImportMemory(Index import_index,
   CHECK_RESULT(CheckImportLimits(page_limits, &memory->page_limits));
 
   module_->memory_index = export_->index;
+  if (cache_) {
+    CacheImport(ExternalKind::Memory, module_name, field_name, export_->index);
+    cache_->imports.back().limits = *page_limits;
+  }
   return wabt::Result::Ok;
 }
 
@@ -936,9 +1197,338 @@ wabt::Result BinaryReaderInterp::OnImportGlobal(Index import_index,
 
   global_index_mapping_.push_back(export_->index);
   num_global_imports_++;
+  if (cache_) {
+    CacheImport(ExternalKind::Global, module_name, field_name, export_->index);
+    cache_->imports.back().type = type;
+    cache_->imports.back().mutable_ = mutable_;
+  }
   return wabt::Result::Ok;
 }
 
+wabt::Result BinaryReaderInterp::EndImportSection() {
+  if (cache_) {
+    cache_->import_mark = GetMarkPoint();
+  }
+  return wabt::Result::Ok;
+}
+
+Environment::MarkPoint BinaryReaderInterp::GetMarkPoint() {
+  // Environment::Mark can't be used while the reader owns the istream.
+  Environment::MarkPoint mark;
+  mark.modules_size = env_->GetModuleCount();
+  mark.sigs_size = env_->GetFuncSignatureCount();
+  mark.funcs_size = env_->GetFuncCount();
+  mark.memories_size = env_->GetMemoryCount();
+  mark.tables_size = env_->GetTableCount();
+  mark.globals_size = env_->GetGlobalCount();
+  mark.data_segments_size = env_->GetDataSegmentCount();
+  mark.elem_segments_size = env_->GetElemSegmentCount();
+  mark.istream_size = GetIstreamOffset();
+  return mark;
+}
+
+void BinaryReaderInterp::CacheImport(ExternalKind kind,
+                                     string_view module_name,
+                                     string_view field_name,
+                                     Index resolved_index) {
+  cache_->imports.emplace_back();
+  CachedModule::Import& import = cache_->imports.back();
+  import.kind = kind;
+  import.module_name = module_name.to_string();
+  import.field_name = field_name.to_string();
+  import.resolved_index = resolved_index;
+}
+
+// A cache file is checksummed, but its contents are still checked before
+// anything is added to the environment, so that a file that was written badly
+// can't make the interpreter index out of bounds. The environment must
+// already be at |cached.import_mark|. Segments that don't fit their table or
+// memory are left for instantiation to report, as when reading the binary.
+bool BinaryReaderInterp::IsCachedModuleInRange(const CachedModule& cached) {
+  const Environment::MarkPoint& mark = cached.import_mark;
+  Index num_sigs = mark.sigs_size;
+  Index num_funcs = mark.funcs_size + cached.funcs.size();
+  Index num_tables = mark.tables_size + cached.tables.size();
+  Index num_memories = mark.memories_size + cached.memories.size();
+  Index num_globals = mark.globals_size + cached.globals.size();
+  uint64_t istream_end = mark.istream_size + cached.istream.size();
+
+  auto is_value_type = [](Type type) {
+    switch (type) {
+      case Type::I32:
+      case Type::I64:
+      case Type::F32:
+      case Type::F64:
+      case Type::V128:
+      case Type::Funcref:
+      case Type::Anyref:
+      case Type::Nullref:
+      case Type::Exnref:
+        return true;
+      default:
+        return false;
+    }
+  };
+  auto are_value_types = [&](const std::vector<Type>& types) {
+    return std::all_of(types.begin(), types.end(), is_value_type);
+  };
+  auto is_ref_in_range = [&](const Ref& ref) {
+    return ref.kind == RefType::Null ||
+           (ref.kind == RefType::Func && ref.index < num_funcs);
+  };
+  auto are_refs_in_range = [&](const std::vector<Ref>& refs) {
+    return std::all_of(refs.begin(), refs.end(), is_ref_in_range);
+  };
+  auto fits_in_32_bits = [](uint64_t dst, size_t size) {
+    return dst <= UINT32_MAX && size <= UINT32_MAX - dst + 1;
+  };
+
+  for (const FuncSignature& sig : cached.sigs) {
+    if (!are_value_types(sig.param_types) ||
+        !are_value_types(sig.result_types)) {
+      return false;
+    }
+  }
+  for (const CachedModule::Func& func : cached.funcs) {
+    if (func.sig_index >= num_sigs || func.offset < mark.istream_size ||
+        func.offset >= istream_end ||
+        !are_value_types(func.param_and_local_types) ||
+        env_->GetFuncSignature(func.sig_index)->param_types.size() +
+                func.local_count !=
+            func.param_and_local_types.size()) {
+      return false;
+    }
+  }
+  for (const Table& table : cached.tables) {
+    if (!is_value_type(table.elem_type) ||
+        (table.limits.has_max && table.limits.initial > table.limits.max)) {
+      return false;
+    }
+  }
+  for (const Limits& limits : cached.memories) {
+    if (limits.initial > WABT_MAX_PAGES ||
+        (limits.has_max &&
+         (limits.max > WABT_MAX_PAGES || limits.initial > limits.max))) {
+      return false;
+    }
+  }
+  for (const Global& global : cached.globals) {
+    if (!is_value_type(global.type) || global.typed_value.type != global.type) {
+      return false;
+    }
+  }
+  for (const ElemSegment& segment : cached.elem_segments) {
+    if (!are_refs_in_range(segment.elems)) {
+      return false;
+    }
+  }
+
+  for (const Export& export_ : cached.exports) {
+    Index count;
+    switch (export_.kind) {
+      case ExternalKind::Func:
+        count = num_funcs;
+        break;
+      case ExternalKind::Table:
+        count = num_tables;
+        break;
+      case ExternalKind::Memory:
+        count = num_memories;
+        break;
+      case ExternalKind::Global:
+        count = num_globals;
+        break;
+      default:
+        return false;
+    }
+    if (export_.index >= count) {
+      return false;
+    }
+  }
+  if ((cached.memory_index != kInvalidIndex &&
+       cached.memory_index >= num_memories) ||
+      (cached.start_func_index != kInvalidIndex &&
+       cached.start_func_index >= num_funcs)) {
+    return false;
+  }
+
+  for (const CachedModule::ActiveElemSegment& segment :
+       cached.active_elem_segments) {
+    if (segment.table_index >= num_tables ||
+        !fits_in_32_bits(segment.dst, segment.src.size()) ||
+        !are_refs_in_range(segment.src)) {
+      return false;
+    }
+  }
+  for (const CachedModule::ActiveDataSegment& segment :
+       cached.active_data_segments) {
+    if (segment.memory_index >= num_memories ||
+        !fits_in_32_bits(segment.dst, segment.data.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BinaryReaderInterp::StartCache(CachedModule* cache) {
+  cache_ = cache;
+  cache_->import_mark = GetMarkPoint();
+}
+
+wabt::Result BinaryReaderInterp::RestoreCachedModule(
+    const CachedModule& cached) {
+  CHECK_RESULT(OnTypeCount(cached.sigs.size()));
+  for (const FuncSignature& sig : cached.sigs) {
+    env_->EmplaceBackFuncSignature(sig);
+  }
+
+  Index func_index = 0;
+  Index table_index = 0;
+  Index global_index = 0;
+  for (Index i = 0; i < cached.imports.size(); ++i) {
+    const CachedModule::Import& import = cached.imports[i];
+    Index resolved_index = kInvalidIndex;
+    switch (import.kind) {
+      case ExternalKind::Func:
+        if (import.sig_index >= cached.sigs.size()) {
+          return wabt::Result::Error;
+        }
+        CHECK_RESULT(OnImportFunc(i, import.module_name, import.field_name,
+                                  func_index++, import.sig_index));
+        resolved_index = func_index_mapping_.back();
+        break;
+
+      case ExternalKind::Table:
+        CHECK_RESULT(OnImportTable(i, import.module_name, import.field_name,
+                                   table_index++, import.type,
+                                   &import.limits));
+        resolved_index = table_index_mapping_.back();
+        break;
+
+      case ExternalKind::Memory:
+        CHECK_RESULT(OnImportMemory(i, import.module_name, import.field_name,
+                                    0, &import.limits));
+        resolved_index = module_->memory_index;
+        break;
+
+      case ExternalKind::Global:
+        CHECK_RESULT(OnImportGlobal(i, import.module_name, import.field_name,
+                                    global_index++, import.type,
+                                    import.mutable_));
+        resolved_index = global_index_mapping_.back();
+        break;
+
+      default:
+        return wabt::Result::Error;
+    }
+    if (resolved_index != import.resolved_index) {
+      return wabt::Result::Error;
+    }
+  }
+
+  // The istream refers to everything by its index in the environment, so the
+  // module can only be restored where it gets the same indexes.
+  if (!MarkPointsAreEqual(GetMarkPoint(), cached.import_mark) ||
+      !IsCachedModuleInRange(cached)) {
+    return wabt::Result::Error;
+  }
+
+  for (const CachedModule::Func& cached_func : cached.funcs) {
+    auto* func = new DefinedFunc(cached_func.sig_index);
+    func->offset = cached_func.offset;
+    func->local_decl_count = cached_func.local_decl_count;
+    func->local_count = cached_func.local_count;
+    func->param_and_local_types = cached_func.param_and_local_types;
+    env_->EmplaceBackFunc(func);
+  }
+  for (const Table& table : cached.tables) {
+    env_->EmplaceBackTable(table);
+  }
+  for (const Limits& page_limits : cached.memories) {
+    env_->EmplaceBackMemory(page_limits, env_->memory_backend_);
+  }
+  for (const Global& global : cached.globals) {
+    env_->EmplaceBackGlobal(global);
+  }
+  for (const ElemSegment& segment : cached.elem_segments) {
+    env_->EmplaceBackElemSegment(segment);
+  }
+  for (const DataSegment& segment : cached.data_segments) {
+    env_->EmplaceBackDataSegment(segment);
+  }
+
+  for (const Export& export_ : cached.exports) {
+    module_->AppendExport(export_.kind, export_.index, export_.name);
+  }
+  module_->IndexExports();
+  module_->memory_index = cached.memory_index;
+  module_->start_func_index = cached.start_func_index;
+
+  for (const CachedModule::ActiveElemSegment& segment :
+       cached.active_elem_segments) {
+    module_->active_elem_segments_.emplace_back(
+        env_->GetTable(segment.table_index), segment.dst);
+    module_->active_elem_segments_.back().src = segment.src;
+  }
+  for (const CachedModule::ActiveDataSegment& segment :
+       cached.active_data_segments) {
+    module_->active_data_segments_.emplace_back(
+        env_->GetMemory(segment.memory_index), segment.dst);
+    module_->active_data_segments_.back().data = segment.data;
+  }
+
+  return EmitData(cached.istream.data(), cached.istream.size());
+}
+
+void BinaryReaderInterp::StartLazyCompilation(const void* data, size_t size) {
+  skip_function_bodies_ = true;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  module_data_.assign(bytes, bytes + size);
+}
+
+wabt::Result BinaryReaderInterp::Compile(Index func_index, Errors* errors) {
+  Index defined_index = func_index - func_index_mapping_[num_func_imports_];
+  assert(defined_index < function_bodies_.size());
+  auto* func = cast<DefinedFunc>(env_->GetFunc(func_index));
+  IstreamOffset stub_offset = func->stub_offset;
+
+  BinaryFunctionBodyContext context;
+  context.num_signatures = sig_index_mapping_.size();
+  context.num_funcs = func_index_mapping_.size();
+  context.num_tables = table_index_mapping_.size();
+  context.has_data_count = has_data_count_;
+  ReadBinaryOptions options;
+  options.features = features_;
+
+  errors_ = errors;
+  skip_function_bodies_ = false;
+  istream_.reset(new MemoryStream(env_->ReleaseIstream()));
+  istream_offset_ = istream_->output_buffer().size();
+  IstreamOffset istream_offset = istream_offset_;
+
+  wabt::Result result = ReadBinaryFunctionBody(
+      module_data_.data(), module_data_.size(),
+      num_func_imports_ + defined_index, function_bodies_[defined_index].first,
+      function_bodies_[defined_index].second, context, this, options);
+  if (Succeeded(result)) {
+    result |= EmitI32At(stub_offset, static_cast<uint32_t>(Opcode::Br));
+    result |= EmitI32At(stub_offset + sizeof(uint32_t), func->offset);
+  } else {
+    // Leave the function as it was, so the next call fails the same way.
+    RewindIstream(istream_offset);
+    func->offset = stub_offset;
+    func->local_decl_count = 0;
+    func->local_count = 0;
+    func->param_and_local_types.clear();
+    current_func_ = nullptr;
+  }
+
+  env_->SetIstream(ReleaseOutputBuffer());
+  skip_function_bodies_ = true;
+  errors_ = nullptr;
+  return result;
+}
+
 wabt::Result BinaryReaderInterp::OnFunctionCount(Index count) {
   for (Index i = 0; i < count; ++i)
     func_index_mapping_.push_back(env_->GetFuncCount() + i);
@@ -972,7 +1562,7 @@ wabt::Result BinaryReaderInterp::OnMemory(Index index,
     return wabt::Result::Error;
   }
 
-  env_->EmplaceBackMemory(*page_limits);
+  env_->EmplaceBackMemory(*page_limits, env_->memory_backend_);
   module_->memory_index = env_->GetMemoryCount() - 1;
   return wabt::Result::Ok;
 }
@@ -1209,6 +1799,7 @@ wabt::Result BinaryReaderInterp::OnElemSegmentElemExpr_RefFunc(
 }
 
 wabt::Result BinaryReaderInterp::OnDataCount(Index count) {
+  has_data_count_ = true;
   for (Index i = 0; i < count; ++i) {
     data_segment_index_mapping_.push_back(env_->GetDataSegmentCount() + i);
   }
@@ -1277,13 +1868,32 @@ wabt::Result BinaryReaderInterp::BeginFunctionBody(Index index, Offset size) {
   auto* func = cast<DefinedFunc>(GetFuncByModuleIndex(index));
   FuncSignature* sig = env_->GetFuncSignature(func->sig_index);
 
+  if (skip_function_bodies_) {
+    // Until the function is compiled, calls to it go to a stub that compiles
+    // it. Afterward the stub is patched to branch to the lowered body.
+    function_bodies_.emplace_back(state->offset, size);
+    func->lazy_compiler = this;
+    func->stub_offset = GetIstreamOffset();
+    func->offset = func->stub_offset;
+    CHECK_RESULT(EmitOpcode(Opcode::InterpCompile));
+    CHECK_RESULT(EmitI32(TranslateFuncIndexToEnv(index)));
+    return wabt::Result::Ok;
+  }
+
   func->offset = GetIstreamOffset();
   func->local_decl_count = 0;
   func->local_count = 0;
 
+  if (env_->lowering_options_.jit) {
+    CHECK_RESULT(EmitOpcode(Opcode::InterpFuncEntry));
+    CHECK_RESULT(EmitI32(TranslateFuncIndexToEnv(index)));
+  }
+
   current_func_ = func;
   depth_fixups_.clear();
   label_stack_.clear();
+  ResetRegisterLowering();
+  CHECK_RESULT(EmitConsumeFuel());
 
   /* fixup function references */
   Index defined_index = TranslateModuleFuncIndexToDefined(index);
@@ -1292,8 +1902,12 @@ wabt::Result BinaryReaderInterp::BeginFunctionBody(Index index, Offset size) {
     CHECK_RESULT(EmitI32At(fixup, func->offset));
 
   /* append param types */
-  for (Type param_type : sig->param_types)
+  local_slots_.clear();
+  local_slot_count_ = 0;
+  for (Type param_type : sig->param_types) {
     func->param_and_local_types.push_back(param_type);
+    AppendLocalSlots(param_type, 1);
+  }
 
   CHECK_RESULT(typechecker_.BeginFunction(sig->result_types));
 
@@ -1303,12 +1917,16 @@ wabt::Result BinaryReaderInterp::BeginFunctionBody(Index index, Offset size) {
 }
 
 wabt::Result BinaryReaderInterp::EndFunctionBody(Index index) {
+  if (skip_function_bodies_) {
+    return wabt::Result::Ok;
+  }
   FixupTopLabel();
   Index drop_count, keep_count;
   CHECK_RESULT(GetReturnDropKeepCount(&drop_count, &keep_count));
   CHECK_RESULT(typechecker_.EndFunction());
   CHECK_RESULT(EmitDropKeep(drop_count, keep_count));
   CHECK_RESULT(EmitOpcode(Opcode::Return));
+  CHECK_RESULT(FixupConsumeFuel());
   PopLabel();
   current_func_ = nullptr;
   return wabt::Result::Ok;
@@ -1326,15 +1944,24 @@ wabt::Result BinaryReaderInterp::OnLocalDecl(Index decl_index,
 
   for (Index i = 0; i < count; ++i)
     current_func_->param_and_local_types.push_back(type);
+  AppendLocalSlots(type, count);
 
   if (decl_index == current_func_->local_decl_count - 1) {
     /* last local declaration, allocate space for all locals. */
+    FuncSignature* sig = env_->GetFuncSignature(current_func_->sig_index);
     CHECK_RESULT(EmitOpcode(Opcode::InterpAlloca));
-    CHECK_RESULT(EmitI32(current_func_->local_count));
+    CHECK_RESULT(EmitI32(local_slot_count_ - GetSlotCount(sig->param_types)));
   }
   return wabt::Result::Ok;
 }
 
+void BinaryReaderInterp::AppendLocalSlots(Type type, Index count) {
+  for (Index i = 0; i < count; ++i) {
+    local_slots_.push_back(local_slot_count_);
+    local_slot_count_ += GetSlotCount(type);
+  }
+}
+
 wabt::Result BinaryReaderInterp::CheckHasMemory(wabt::Opcode opcode) {
   if (module_->memory_index == kInvalidIndex) {
     PrintError("%s requires an imported or defined memory.", opcode.GetName());
@@ -1376,11 +2003,35 @@ wabt::Result BinaryReaderInterp::OnOpcode(Opcode opcode) {
     PrintError("Unexpected instruction after end of function");
     return wabt::Result::Error;
   }
+  // Only adjacent instructions are combined, so forget anything that this
+  // instruction can't be combined with.
+  if (opcode != Opcode::LocalGet && opcode != Opcode::I32Load &&
+      !IsRegBinop(opcode)) {
+    reg_local_gets_.clear();
+  }
+  if (opcode != Opcode::LocalSet) {
+    reg_binop_.offset = kInvalidIstreamOffset;
+  }
+  if (opcode != Opcode::BrIf && opcode != Opcode::If) {
+    reg_compare_.offset = kInvalidIstreamOffset;
+  }
+  if (opcode != Opcode::I32Add) {
+    i32_const_offset_ = kInvalidIstreamOffset;
+  }
+  if (fuel_cost_offset_ != kInvalidIstreamOffset) {
+    uint32_t cost = env_->lowering_options_.fuel_costs.GetCost(opcode);
+    fuel_cost_ =
+        cost > UINT32_MAX - fuel_cost_ ? UINT32_MAX : fuel_cost_ + cost;
+  }
   return wabt::Result::Ok;
 }
 
 wabt::Result BinaryReaderInterp::OnUnaryExpr(wabt::Opcode opcode) {
   CHECK_RESULT(typechecker_.OnUnary(opcode));
+  if (opcode == Opcode::I32Eqz &&
+      env_->lowering_options_.IsFusionEnabled(Fusion::I32CompareBrUnless)) {
+    reg_compare_ = {GetIstreamOffset(), opcode, 0, 0};
+  }
   CHECK_RESULT(EmitOpcode(opcode));
   return wabt::Result::Ok;
 }
@@ -1395,7 +2046,9 @@ wabt::Result BinaryReaderInterp::OnSimdLaneOpExpr(wabt::Opcode opcode,
                                                   uint64_t value) {
   CHECK_RESULT(typechecker_.OnSimdLaneOp(opcode, value));
   CHECK_RESULT(EmitOpcode(opcode));
-  CHECK_RESULT(EmitI8(static_cast<uint8_t>(value)));
+  // Lane indexes take 4 bytes so that the operands after them stay aligned;
+  // see Thread::GetIndirectCallee.
+  CHECK_RESULT(EmitI32(static_cast<uint32_t>(value)));
   return wabt::Result::Ok;
 }
 
@@ -1469,7 +2122,7 @@ wabt::Result BinaryReaderInterp::OnAtomicRmwCmpxchgExpr(Opcode opcode,
 
 wabt::Result BinaryReaderInterp::OnBinaryExpr(wabt::Opcode opcode) {
   CHECK_RESULT(typechecker_.OnBinary(opcode));
-  CHECK_RESULT(EmitOpcode(opcode));
+  CHECK_RESULT(EmitBinop(opcode));
   return wabt::Result::Ok;
 }
 
@@ -1485,7 +2138,10 @@ wabt::Result BinaryReaderInterp::OnLoopExpr(Type sig_type) {
   TypeVector param_types, result_types;
   GetBlockSignature(sig_type, &param_types, &result_types);
   CHECK_RESULT(typechecker_.OnLoop(param_types, result_types));
-  PushLabel(GetIstreamOffset(), kInvalidIstreamOffset);
+  // Branches to the loop start a new basic block, so they're charged again.
+  IstreamOffset offset = GetIstreamOffset();
+  CHECK_RESULT(EmitConsumeFuel());
+  PushLabel(offset, kInvalidIstreamOffset);
   return wabt::Result::Ok;
 }
 
@@ -1493,9 +2149,9 @@ wabt::Result BinaryReaderInterp::OnIfExpr(Type sig_type) {
   TypeVector param_types, result_types;
   GetBlockSignature(sig_type, &param_types, &result_types);
   CHECK_RESULT(typechecker_.OnIf(param_types, result_types));
-  CHECK_RESULT(EmitOpcode(Opcode::InterpBrUnless));
-  IstreamOffset fixup_offset = GetIstreamOffset();
-  CHECK_RESULT(EmitI32(kInvalidIstreamOffset));
+  IstreamOffset fixup_offset;
+  CHECK_RESULT(EmitBrUnless(&fixup_offset));
+  CHECK_RESULT(EmitConsumeFuel());
   PushLabel(kInvalidIstreamOffset, fixup_offset);
   return wabt::Result::Ok;
 }
@@ -1508,6 +2164,7 @@ wabt::Result BinaryReaderInterp::OnElseExpr() {
   label->fixup_offset = GetIstreamOffset();
   CHECK_RESULT(EmitI32(kInvalidIstreamOffset));
   CHECK_RESULT(EmitI32At(fixup_cond_offset, GetIstreamOffset()));
+  CHECK_RESULT(EmitConsumeFuel());
   return wabt::Result::Ok;
 }
 
@@ -1521,6 +2178,9 @@ wabt::Result BinaryReaderInterp::OnEndExpr() {
   }
   FixupTopLabel();
   PopLabel();
+  // Branches out of a block or if continue after its end. The end of a loop
+  // also starts a block, so its iterations aren't charged for what follows.
+  CHECK_RESULT(EmitConsumeFuel());
   return wabt::Result::Ok;
 }
 
@@ -1537,9 +2197,8 @@ wabt::Result BinaryReaderInterp::OnBrIfExpr(Index depth) {
   CHECK_RESULT(typechecker_.OnBrIf(depth));
   CHECK_RESULT(GetBrDropKeepCount(depth, &drop_count, &keep_count));
   /* flip the br_if so if <cond> is true it can drop values from the stack */
-  CHECK_RESULT(EmitOpcode(Opcode::InterpBrUnless));
-  IstreamOffset fixup_br_offset = GetIstreamOffset();
-  CHECK_RESULT(EmitI32(kInvalidIstreamOffset));
+  IstreamOffset fixup_br_offset;
+  CHECK_RESULT(EmitBrUnless(&fixup_br_offset));
   CHECK_RESULT(EmitBr(depth, drop_count, keep_count));
   CHECK_RESULT(EmitI32At(fixup_br_offset, GetIstreamOffset()));
   return wabt::Result::Ok;
@@ -1598,6 +2257,8 @@ wabt::Result BinaryReaderInterp::OnCallIndirectExpr(Index sig_index,
   CHECK_RESULT(EmitOpcode(Opcode::CallIndirect));
   CHECK_RESULT(EmitI32(TranslateTableIndexToEnv(table_index)));
   CHECK_RESULT(EmitI32(TranslateSigIndexToEnv(sig_index)));
+  // The inline cache; see Thread::GetIndirectCallee.
+  CHECK_RESULT(EmitI32(kInvalidIndex));
   return wabt::Result::Ok;
 }
 
@@ -1644,6 +2305,8 @@ wabt::Result BinaryReaderInterp::OnReturnCallIndirectExpr(Index sig_index,
   CHECK_RESULT(EmitOpcode(Opcode::ReturnCallIndirect));
   CHECK_RESULT(EmitI32(TranslateTableIndexToEnv(table_index)));
   CHECK_RESULT(EmitI32(TranslateSigIndexToEnv(sig_index)));
+  // The inline cache; see Thread::GetIndirectCallee.
+  CHECK_RESULT(EmitI32(kInvalidIndex));
   return wabt::Result::Ok;
 }
 
@@ -1656,13 +2319,27 @@ wabt::Result BinaryReaderInterp::OnConvertExpr(wabt::Opcode opcode) {
 }
 
 wabt::Result BinaryReaderInterp::OnDropExpr() {
+  TypeChecker::Label* label;
+  CHECK_RESULT(typechecker_.GetLabel(0, &label));
+  Type type = Type::Any;
+  if (typechecker_.type_stack_size() > label->type_stack_limit) {
+    type = typechecker_.type_stack().back();
+  }
   CHECK_RESULT(typechecker_.OnDrop());
-  CHECK_RESULT(EmitOpcode(Opcode::Drop));
+  if (type == Type::V128) {
+    CHECK_RESULT(EmitDropKeep(2, 0));
+  } else {
+    CHECK_RESULT(EmitOpcode(Opcode::Drop));
+  }
   return wabt::Result::Ok;
 }
 
 wabt::Result BinaryReaderInterp::OnI32ConstExpr(uint32_t value) {
   CHECK_RESULT(typechecker_.OnConst(Type::I32));
+  if (env_->lowering_options_.IsFusionEnabled(Fusion::I32AddConst)) {
+    i32_const_offset_ = GetIstreamOffset();
+    i32_const_value_ = value;
+  }
   CHECK_RESULT(EmitOpcode(Opcode::I32Const));
   CHECK_RESULT(EmitI32(value));
   return wabt::Result::Ok;
@@ -1719,9 +2396,13 @@ wabt::Result BinaryReaderInterp::OnGlobalSetExpr(Index global_index) {
   return wabt::Result::Ok;
 }
 
-Index BinaryReaderInterp::TranslateLocalIndex(Index local_index) {
-  return typechecker_.type_stack_size() +
-         current_func_->param_and_local_types.size() - local_index;
+// Returns the depth of the local's first slot, with |stack_slot_count| slots
+// above the locals. A v128 local takes two slots, and is accessed with two
+// instructions that use the same depth, since the first one moves the top of
+// the stack by a slot.
+Index BinaryReaderInterp::TranslateLocalIndex(Index local_index,
+                                              Index stack_slot_count) {
+  return stack_slot_count + local_slot_count_ - local_slots_[local_index];
 }
 
 wabt::Result BinaryReaderInterp::OnLocalGetExpr(Index local_index) {
@@ -1730,8 +2411,27 @@ wabt::Result BinaryReaderInterp::OnLocalGetExpr(Index local_index) {
   // Get the translated index before calling typechecker_.OnLocalGet because it
   // will update the type stack size. We need the index to be relative to the
   // old stack size.
-  Index translated_local_index = TranslateLocalIndex(local_index);
+  Index translated_local_index =
+      TranslateLocalIndex(local_index, GetTypeStackSlotCount(0));
   CHECK_RESULT(typechecker_.OnLocalGet(type));
+  if (type == Type::V128) {
+    ResetRegisterLowering();
+    CHECK_RESULT(EmitOpcode(Opcode::LocalGet));
+    CHECK_RESULT(EmitI32(translated_local_index));
+    CHECK_RESULT(EmitOpcode(Opcode::LocalGet));
+    CHECK_RESULT(EmitI32(translated_local_index));
+    return wabt::Result::Ok;
+  }
+  const LoweringOptions& options = env_->lowering_options_;
+  if (options.register_lowering ||
+      options.IsFusionEnabled(Fusion::I32AddLocals) ||
+      options.IsFusionEnabled(Fusion::I32LoadLocal)) {
+    if (reg_local_gets_.size() == 2) {
+      reg_local_gets_.erase(reg_local_gets_.begin());
+    }
+    reg_local_gets_.push_back({GetIstreamOffset(), Opcode::LocalGet,
+                               translated_local_index, 0});
+  }
   CHECK_RESULT(EmitOpcode(Opcode::LocalGet));
   CHECK_RESULT(EmitI32(translated_local_index));
   return wabt::Result::Ok;
@@ -1741,8 +2441,16 @@ wabt::Result BinaryReaderInterp::OnLocalSetExpr(Index local_index) {
   CHECK_RESULT(CheckLocal(local_index));
   Type type = GetLocalTypeByIndex(current_func_, local_index);
   CHECK_RESULT(typechecker_.OnLocalSet(type));
-  CHECK_RESULT(EmitOpcode(Opcode::LocalSet));
-  CHECK_RESULT(EmitI32(TranslateLocalIndex(local_index)));
+  Index translated_local_index =
+      TranslateLocalIndex(local_index, GetTypeStackSlotCount(0));
+  if (type == Type::V128) {
+    CHECK_RESULT(EmitOpcode(Opcode::LocalSet));
+    CHECK_RESULT(EmitI32(translated_local_index));
+    CHECK_RESULT(EmitOpcode(Opcode::LocalSet));
+    CHECK_RESULT(EmitI32(translated_local_index));
+    return wabt::Result::Ok;
+  }
+  CHECK_RESULT(EmitLocalSet(translated_local_index));
   return wabt::Result::Ok;
 }
 
@@ -1750,8 +2458,20 @@ wabt::Result BinaryReaderInterp::OnLocalTeeExpr(Index local_index) {
   CHECK_RESULT(CheckLocal(local_index));
   Type type = GetLocalTypeByIndex(current_func_, local_index);
   CHECK_RESULT(typechecker_.OnLocalTee(type));
+  if (type == Type::V128) {
+    // Set the local, then get it back.
+    Index translated_local_index =
+        TranslateLocalIndex(local_index, GetTypeStackSlotCount(0) - 2);
+    for (Opcode opcode : {Opcode::LocalSet, Opcode::LocalSet,
+                          Opcode::LocalGet, Opcode::LocalGet}) {
+      CHECK_RESULT(EmitOpcode(opcode));
+      CHECK_RESULT(EmitI32(translated_local_index));
+    }
+    return wabt::Result::Ok;
+  }
   CHECK_RESULT(EmitOpcode(Opcode::LocalTee));
-  CHECK_RESULT(EmitI32(TranslateLocalIndex(local_index)));
+  CHECK_RESULT(EmitI32(
+      TranslateLocalIndex(local_index, GetTypeStackSlotCount(0))));
   return wabt::Result::Ok;
 }
 
@@ -1761,7 +2481,19 @@ wabt::Result BinaryReaderInterp::OnLoadExpr(wabt::Opcode opcode,
   CHECK_RESULT(CheckHasMemory(opcode));
   CHECK_RESULT(CheckAlign(alignment_log2, opcode.GetMemorySize()));
   CHECK_RESULT(typechecker_.OnLoad(opcode));
-  CHECK_RESULT(EmitOpcode(opcode));
+  if (opcode == Opcode::I32Load && !reg_local_gets_.empty() &&
+      env_->lowering_options_.IsFusionEnabled(Fusion::I32LoadLocal)) {
+    // Fuse "local.get; i32.load" into "i32.load_local slot memory offset".
+    RegInstr local_get = reg_local_gets_.back();
+    ResetRegisterLowering();
+
+    CHECK_RESULT(RewindIstream(local_get.offset));
+    CHECK_RESULT(EmitOpcode(Opcode::InterpI32LoadLocal));
+    CHECK_RESULT(EmitI32(local_get.lhs_slot));
+  } else {
+    ResetRegisterLowering();
+    CHECK_RESULT(EmitOpcode(opcode));
+  }
   CHECK_RESULT(EmitI32(module_->memory_index));
   CHECK_RESULT(EmitI32(offset));
   return wabt::Result::Ok;
@@ -1852,8 +2584,15 @@ wabt::Result BinaryReaderInterp::OnReturnExpr() {
 }
 
 wabt::Result BinaryReaderInterp::OnSelectExpr(Type result_type) {
+  // Without a result type, the operands' type is below the condition.
+  Type type = result_type;
+  const TypeVector& type_stack = typechecker_.type_stack();
+  if (type == Type::Any && type_stack.size() >= 2) {
+    type = type_stack[type_stack.size() - 2];
+  }
   CHECK_RESULT(typechecker_.OnSelect(result_type));
-  CHECK_RESULT(EmitOpcode(Opcode::Select));
+  CHECK_RESULT(EmitOpcode(type == Type::V128 ? Opcode::InterpSelectV128
+                                             : Opcode::Select));
   return wabt::Result::Ok;
 }
 
@@ -1968,12 +2707,15 @@ wabt::Result BinaryReaderInterp::OnTableInitExpr(Index segment_index,
 
 }  // end anonymous namespace
 
+namespace {
+
 wabt::Result ReadBinaryInterp(Environment* env,
                               const void* data,
                               size_t size,
                               const ReadBinaryOptions& options,
                               const std::vector<Export*>& imports,
                               Errors* errors,
+                              CachedModule* cache,
                               DefinedModule** out_module) {
   // Need to mark before taking ownership of env->istream.
   Environment::MarkPoint mark = env->Mark();
@@ -1982,11 +2724,110 @@ wabt::Result ReadBinaryInterp(Environment* env,
   IstreamOffset istream_offset = istream->size();
   DefinedModule* module = new DefinedModule(env);
 
-  BinaryReaderInterp reader(env, module, std::move(istream), imports, errors,
-                            options.features);
+  std::unique_ptr<BinaryReaderInterp> reader(new BinaryReaderInterp(
+      env, module, std::move(istream), imports, errors, options.features));
   env->EmplaceBackModule(module);
+  if (cache) {
+    cache->start_mark = mark;
+    reader->StartCache(cache);
+  }
+
+  ReadBinaryOptions read_options = options;
+  if (env->lowering_options_.lazy_compilation) {
+    reader->StartLazyCompilation(data, size);
+    read_options.skip_function_bodies = true;
+  }
+
+  wabt::Result result = ReadBinary(data, size, reader.get(), read_options);
+  env->SetIstream(reader->ReleaseOutputBuffer());
 
-  wabt::Result result = ReadBinary(data, size, &reader, options);
+  if (Failed(result)) {
+    env->ResetToMarkPoint(mark);
+    return result;
+  }
+
+  if (env->lowering_options_.lazy_compilation) {
+    module->lazy_compiler = std::move(reader);
+  }
+  *out_module = module;
+  module->istream_start = istream_offset;
+  module->istream_end = env->istream().size();
+  return result;
+}
+
+// Copies everything the module added to the environment after its imports
+// into |cache|.
+void CaptureCachedModule(Environment* env,
+                         DefinedModule* module,
+                         CachedModule* cache) {
+  const Environment::MarkPoint& mark = cache->import_mark;
+  for (Index i = mark.funcs_size; i < env->GetFuncCount(); ++i) {
+    auto* func = cast<DefinedFunc>(env->GetFunc(i));
+    cache->funcs.push_back({func->sig_index, func->offset,
+                            func->local_decl_count, func->local_count,
+                            func->param_and_local_types});
+  }
+  for (Index i = mark.tables_size; i < env->GetTableCount(); ++i) {
+    Table* table = env->GetTable(i);
+    cache->tables.emplace_back(table->elem_type, table->limits);
+  }
+  for (Index i = mark.memories_size; i < env->GetMemoryCount(); ++i) {
+    cache->memories.push_back(env->GetMemory(i)->page_limits);
+  }
+  for (Index i = mark.globals_size; i < env->GetGlobalCount(); ++i) {
+    cache->globals.push_back(*env->GetGlobal(i));
+  }
+  for (Index i = mark.elem_segments_size; i < env->GetElemSegmentCount();
+       ++i) {
+    cache->elem_segments.push_back(*env->GetElemSegment(i));
+  }
+  for (Index i = mark.data_segments_size; i < env->GetDataSegmentCount();
+       ++i) {
+    cache->data_segments.push_back(*env->GetDataSegment(i));
+  }
+
+  cache->exports = module->exports;
+  cache->memory_index = module->memory_index;
+  cache->start_func_index = module->start_func_index;
+  for (const ElemSegmentInfo& info : module->active_elem_segments_) {
+    Index table_index = 0;
+    while (env->GetTable(table_index) != info.table) {
+      ++table_index;
+    }
+    cache->active_elem_segments.push_back({table_index, info.dst, info.src});
+  }
+  for (const DataSegmentInfo& info : module->active_data_segments_) {
+    Index memory_index = 0;
+    while (env->GetMemory(memory_index) != info.memory) {
+      ++memory_index;
+    }
+    cache->active_data_segments.push_back({memory_index, info.dst, info.data});
+  }
+
+  const std::vector<uint8_t>& istream = env->istream().data;
+  cache->istream.assign(istream.begin() + module->istream_start,
+                        istream.begin() + module->istream_end);
+}
+
+wabt::Result RestoreCachedModule(Environment* env,
+                                 const ReadBinaryOptions& options,
+                                 const CachedModule& cached,
+                                 DefinedModule** out_module) {
+  Environment::MarkPoint mark = env->Mark();
+
+  std::unique_ptr<OutputBuffer> istream = env->ReleaseIstream();
+  IstreamOffset istream_offset = istream->size();
+  DefinedModule* module = new DefinedModule(env);
+
+  // A module that fails to restore is read from the binary instead, which
+  // reports any errors.
+  Errors errors;
+  std::vector<Export*> empty_imports;
+  BinaryReaderInterp reader(env, module, std::move(istream), empty_imports,
+                            &errors, options.features);
+  env->EmplaceBackModule(module);
+
+  wabt::Result result = reader.RestoreCachedModule(cached);
   env->SetIstream(reader.ReleaseOutputBuffer());
 
   if (Failed(result)) {
@@ -2000,6 +2841,19 @@ wabt::Result ReadBinaryInterp(Environment* env,
   return result;
 }
 
+}  // end anonymous namespace
+
+wabt::Result ReadBinaryInterp(Environment* env,
+                              const void* data,
+                              size_t size,
+                              const ReadBinaryOptions& options,
+                              const std::vector<Export*>& imports,
+                              Errors* errors,
+                              DefinedModule** out_module) {
+  return ReadBinaryInterp(env, data, size, options, imports, errors, nullptr,
+                          out_module);
+}
+
 wabt::Result ReadBinaryInterp(Environment* env,
                               const void* data,
                               size_t size,
@@ -2011,4 +2865,42 @@ wabt::Result ReadBinaryInterp(Environment* env,
                           out_module);
 }
 
+wabt::Result ReadBinaryInterpCached(Environment* env,
+                                    const void* data,
+                                    size_t size,
+                                    const ReadBinaryOptions& options,
+                                    string_view cache_dir,
+                                    Errors* errors,
+                                    DefinedModule** out_module) {
+  // A lazily compiled module is lowered as it runs, so there's nothing to
+  // cache.
+  if (env->lowering_options_.lazy_compilation) {
+    return ReadBinaryInterp(env, data, size, options, errors, out_module);
+  }
+
+  uint64_t key =
+      GetCacheKey(data, size, options.features, env->lowering_options_);
+  std::string filename = GetCacheFilename(cache_dir, key);
+
+  CachedModule cached;
+  if (Succeeded(ReadCachedModule(filename, &cached)) && cached.key == key &&
+      cached.data_size == size &&
+      MarkPointsAreEqual(cached.start_mark, env->Mark()) &&
+      Succeeded(RestoreCachedModule(env, options, cached, out_module))) {
+    return wabt::Result::Ok;
+  }
+
+  cached = CachedModule();
+  cached.key = key;
+  cached.data_size = size;
+  std::vector<Export*> empty_imports;
+  CHECK_RESULT(ReadBinaryInterp(env, data, size, options, empty_imports,
+                                errors, &cached, out_module));
+  CaptureCachedModule(env, *out_module, &cached);
+  // The module was read successfully, so failing to update the cache (e.g.
+  // because the directory isn't writable) isn't an error.
+  WriteCachedModule(filename, cached);
+  return wabt::Result::Ok;
+}
+
 }  // namespace wabt
@@ -50,6 +50,20 @@ Result ReadBinaryInterp(interp::Environment* env,
                         Errors*,
                         interp::DefinedModule** out_module);
 
+// Read and instantiate a module in the given environment, like the first
+// ReadBinaryInterp above, but reuse the lowered module from |cache_dir| if it
+// was cached from the same binary and options, in an environment in the same
+// state. Otherwise the binary is read and the result is written to
+// |cache_dir|. Problems with the cache are never errors; they just mean the
+// binary is read as usual. Lazily compiled modules aren't cached.
+Result ReadBinaryInterpCached(interp::Environment* env,
+                              const void* data,
+                              size_t size,
+                              const ReadBinaryOptions& options,
+                              string_view cache_dir,
+                              Errors*,
+                              interp::DefinedModule** out_module);
+
 }  // namespace wabt
 
 #endif /* WABT_BINARY_READER_INTERP_H_ */
@@ -0,0 +1,581 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-cache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "src/feature.h"
+#include "src/stream.h"
+
+// The layout of a cache file is:
+//
+//   magic     "\0wic"
+//   version   u32
+//   checksum  u64, the FNV-1a hash of the module that follows
+//   module    CachedModule, see CacheWriter::WriteModule
+//
+// Integers are little-endian, and vectors and strings are prefixed with their
+// u32 element count. The istream is only meaningful to the interpreter that
+// wrote it, so kCacheVersion must be bumped whenever its encoding, or the
+// layout of the file, changes.
+
+namespace wabt {
+namespace interp {
+
+namespace {
+
+const char kCacheMagic[] = {0, 'w', 'i', 'c'};
+const uint32_t kCacheVersion = 5;
+const size_t kCacheHeaderSize =
+    sizeof(kCacheMagic) + sizeof(uint32_t) + sizeof(uint64_t);
+
+// FNV-1a.
+const uint64_t kHashOffsetBasis = 0xcbf29ce484222325ull;
+const uint64_t kHashPrime = 0x100000001b3ull;
+
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * kHashPrime;
+  }
+  return hash;
+}
+
+uint64_t HashU32(uint64_t hash, uint32_t value) {
+  return HashBytes(hash, &value, sizeof(value));
+}
+
+class CacheWriter {
+ public:
+  explicit CacheWriter(Stream* stream) : stream_(stream) {}
+
+  void WriteModule(const CachedModule&);
+
+ private:
+  void WriteU8(uint8_t value) { stream_->WriteU8(value); }
+  void WriteU32(uint32_t value) { stream_->WriteU32(value); }
+  void WriteU64(uint64_t value) { stream_->WriteU64(value); }
+  void WriteBool(bool value) { WriteU8(value); }
+  void WriteType(Type type) { WriteU32(static_cast<uint32_t>(type)); }
+  void WriteString(const std::string&);
+  void WriteBytes(const void* data, size_t size);
+  void WriteMarkPoint(const Environment::MarkPoint&);
+  void WriteLimits(const Limits&);
+  void WriteTypes(const std::vector<Type>&);
+  void WriteRef(Ref);
+  void WriteRefs(const std::vector<Ref>&);
+  void WriteTypedValue(const TypedValue&);
+
+  Stream* stream_;
+};
+
+void CacheWriter::WriteString(const std::string& s) {
+  WriteBytes(s.data(), s.size());
+}
+
+void CacheWriter::WriteBytes(const void* data, size_t size) {
+  WriteU32(size);
+  stream_->WriteData(data, size);
+}
+
+void CacheWriter::WriteMarkPoint(const Environment::MarkPoint& mark) {
+  WriteU64(mark.modules_size);
+  WriteU64(mark.sigs_size);
+  WriteU64(mark.funcs_size);
+  WriteU64(mark.memories_size);
+  WriteU64(mark.tables_size);
+  WriteU64(mark.globals_size);
+  WriteU64(mark.data_segments_size);
+  WriteU64(mark.elem_segments_size);
+  WriteU64(mark.istream_size);
+}
+
+void CacheWriter::WriteLimits(const Limits& limits) {
+  WriteU64(limits.initial);
+  WriteU64(limits.max);
+  WriteBool(limits.has_max);
+  WriteBool(limits.is_shared);
+}
+
+void CacheWriter::WriteTypes(const std::vector<Type>& types) {
+  WriteU32(types.size());
+  for (Type type : types) {
+    WriteType(type);
+  }
+}
+
+void CacheWriter::WriteRef(Ref ref) {
+  WriteU32(static_cast<uint32_t>(ref.kind));
+  WriteU32(ref.index);
+}
+
+void CacheWriter::WriteRefs(const std::vector<Ref>& refs) {
+  WriteU32(refs.size());
+  for (Ref ref : refs) {
+    WriteRef(ref);
+  }
+}
+
+void CacheWriter::WriteTypedValue(const TypedValue& tv) {
+  WriteType(tv.type);
+  stream_->WriteData(&tv.value, sizeof(tv.value));
+}
+
+void CacheWriter::WriteModule(const CachedModule& module) {
+  WriteU64(module.key);
+  WriteU64(module.data_size);
+  WriteMarkPoint(module.start_mark);
+  WriteMarkPoint(module.import_mark);
+
+  WriteU32(module.sigs.size());
+  for (const FuncSignature& sig : module.sigs) {
+    WriteTypes(sig.param_types);
+    WriteTypes(sig.result_types);
+  }
+
+  WriteU32(module.imports.size());
+  for (const CachedModule::Import& import : module.imports) {
+    WriteU8(static_cast<uint8_t>(import.kind));
+    WriteString(import.module_name);
+    WriteString(import.field_name);
+    WriteU32(import.sig_index);
+    WriteType(import.type);
+    WriteBool(import.mutable_);
+    WriteLimits(import.limits);
+    WriteU32(import.resolved_index);
+  }
+
+  WriteU32(module.funcs.size());
+  for (const CachedModule::Func& func : module.funcs) {
+    WriteU32(func.sig_index);
+    WriteU32(func.offset);
+    WriteU32(func.local_decl_count);
+    WriteU32(func.local_count);
+    WriteTypes(func.param_and_local_types);
+  }
+
+  WriteU32(module.tables.size());
+  for (const Table& table : module.tables) {
+    WriteType(table.elem_type);
+    WriteLimits(table.limits);
+  }
+
+  WriteU32(module.memories.size());
+  for (const Limits& limits : module.memories) {
+    WriteLimits(limits);
+  }
+
+  WriteU32(module.globals.size());
+  for (const Global& global : module.globals) {
+    WriteType(global.type);
+    WriteBool(global.mutable_);
+    WriteTypedValue(global.typed_value);
+  }
+
+  WriteU32(module.elem_segments.size());
+  for (const ElemSegment& segment : module.elem_segments) {
+    WriteU32(segment.flags);
+    WriteRefs(segment.elems);
+  }
+
+  WriteU32(module.data_segments.size());
+  for (const DataSegment& segment : module.data_segments) {
+    WriteBytes(segment.data.data(), segment.data.size());
+  }
+
+  WriteU32(module.exports.size());
+  for (const Export& export_ : module.exports) {
+    WriteString(export_.name);
+    WriteU8(static_cast<uint8_t>(export_.kind));
+    WriteU32(export_.index);
+  }
+
+  WriteU32(module.memory_index);
+  WriteU32(module.start_func_index);
+
+  WriteU32(module.active_elem_segments.size());
+  for (const CachedModule::ActiveElemSegment& segment :
+       module.active_elem_segments) {
+    WriteU32(segment.table_index);
+    WriteU32(segment.dst);
+    WriteRefs(segment.src);
+  }
+
+  WriteU32(module.active_data_segments.size());
+  for (const CachedModule::ActiveDataSegment& segment :
+       module.active_data_segments) {
+    WriteU32(segment.memory_index);
+    WriteU64(segment.dst);
+    WriteBytes(segment.data.data(), segment.data.size());
+  }
+
+  WriteBytes(module.istream.data(), module.istream.size());
+}
+
+// Every read is bounds checked; after the first failure, reads return zeroes
+// and ok_ is false.
+class CacheReader {
+ public:
+  CacheReader(const uint8_t* data, size_t size)
+      : p_(data), end_(data + size) {}
+
+  wabt::Result ReadModule(CachedModule*);
+
+ private:
+  bool Read(void* dst, size_t size);
+  uint8_t ReadU8();
+  uint32_t ReadU32();
+  uint64_t ReadU64();
+  bool ReadBool() { return ReadU8() != 0; }
+  Type ReadType() { return static_cast<Type>(ReadU32()); }
+  // Reads a count of elements that are each at least |min_size| bytes, so a
+  // corrupt count fails here instead of allocating a huge vector.
+  uint32_t ReadCount(size_t min_size);
+  void ReadString(std::string*);
+  template <typename T>
+  void ReadBytes(std::vector<T>*);
+  void ReadMarkPoint(Environment::MarkPoint*);
+  void ReadLimits(Limits*);
+  void ReadTypes(std::vector<Type>*);
+  Ref ReadRef();
+  void ReadRefs(std::vector<Ref>*);
+  void ReadTypedValue(TypedValue*);
+
+  const uint8_t* p_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+bool CacheReader::Read(void* dst, size_t size) {
+  if (!ok_ || static_cast<size_t>(end_ - p_) < size) {
+    ok_ = false;
+    memset(dst, 0, size);
+    return false;
+  }
+  memcpy(dst, p_, size);
+  p_ += size;
+  return true;
+}
+
+uint8_t CacheReader::ReadU8() {
+  uint8_t value;
+  Read(&value, sizeof(value));
+  return value;
+}
+
+uint32_t CacheReader::ReadU32() {
+  uint32_t value;
+  Read(&value, sizeof(value));
+  return value;
+}
+
+uint64_t CacheReader::ReadU64() {
+  uint64_t value;
+  Read(&value, sizeof(value));
+  return value;
+}
+
+uint32_t CacheReader::ReadCount(size_t min_size) {
+  uint32_t count = ReadU32();
+  if (ok_ && static_cast<uint64_t>(count) * min_size >
+                 static_cast<uint64_t>(end_ - p_)) {
+    ok_ = false;
+  }
+  return ok_ ? count : 0;
+}
+
+void CacheReader::ReadString(std::string* out) {
+  uint32_t size = ReadCount(1);
+  out->assign(reinterpret_cast<const char*>(p_), size);
+  p_ += size;
+}
+
+template <typename T>
+void CacheReader::ReadBytes(std::vector<T>* out) {
+  static_assert(sizeof(T) == 1, "ReadBytes only reads bytes");
+  uint32_t size = ReadCount(1);
+  out->assign(p_, p_ + size);
+  p_ += size;
+}
+
+void CacheReader::ReadMarkPoint(Environment::MarkPoint* mark) {
+  mark->modules_size = ReadU64();
+  mark->sigs_size = ReadU64();
+  mark->funcs_size = ReadU64();
+  mark->memories_size = ReadU64();
+  mark->tables_size = ReadU64();
+  mark->globals_size = ReadU64();
+  mark->data_segments_size = ReadU64();
+  mark->elem_segments_size = ReadU64();
+  mark->istream_size = ReadU64();
+}
+
+void CacheReader::ReadLimits(Limits* limits) {
+  limits->initial = ReadU64();
+  limits->max = ReadU64();
+  limits->has_max = ReadBool();
+  limits->is_shared = ReadBool();
+}
+
+void CacheReader::ReadTypes(std::vector<Type>* types) {
+  types->resize(ReadCount(sizeof(uint32_t)));
+  for (Type& type : *types) {
+    type = ReadType();
+  }
+}
+
+Ref CacheReader::ReadRef() {
+  Ref ref;
+  ref.kind = static_cast<RefType>(ReadU32());
+  ref.index = ReadU32();
+  return ref;
+}
+
+void CacheReader::ReadRefs(std::vector<Ref>* refs) {
+  refs->resize(ReadCount(2 * sizeof(uint32_t)));
+  for (Ref& ref : *refs) {
+    ref = ReadRef();
+  }
+}
+
+void CacheReader::ReadTypedValue(TypedValue* tv) {
+  tv->type = ReadType();
+  Read(&tv->value, sizeof(tv->value));
+}
+
+wabt::Result CacheReader::ReadModule(CachedModule* module) {
+  module->key = ReadU64();
+  module->data_size = ReadU64();
+  ReadMarkPoint(&module->start_mark);
+  ReadMarkPoint(&module->import_mark);
+
+  module->sigs.resize(ReadCount(2 * sizeof(uint32_t)));
+  for (FuncSignature& sig : module->sigs) {
+    ReadTypes(&sig.param_types);
+    ReadTypes(&sig.result_types);
+  }
+
+  module->imports.resize(ReadCount(1));
+  for (CachedModule::Import& import : module->imports) {
+    import.kind = static_cast<ExternalKind>(ReadU8());
+    ReadString(&import.module_name);
+    ReadString(&import.field_name);
+    import.sig_index = ReadU32();
+    import.type = ReadType();
+    import.mutable_ = ReadBool();
+    ReadLimits(&import.limits);
+    import.resolved_index = ReadU32();
+  }
+
+  module->funcs.resize(ReadCount(5 * sizeof(uint32_t)));
+  for (CachedModule::Func& func : module->funcs) {
+    func.sig_index = ReadU32();
+    func.offset = ReadU32();
+    func.local_decl_count = ReadU32();
+    func.local_count = ReadU32();
+    ReadTypes(&func.param_and_local_types);
+  }
+
+  uint32_t table_count = ReadCount(sizeof(uint32_t));
+  for (uint32_t i = 0; i < table_count; ++i) {
+    Type elem_type = ReadType();
+    Limits limits;
+    ReadLimits(&limits);
+    // Don't allocate the entries of a corrupt table.
+    if (!ok_ || limits.initial > kInvalidIndex) {
+      return wabt::Result::Error;
+    }
+    module->tables.emplace_back(elem_type, limits);
+  }
+
+  module->memories.resize(ReadCount(1));
+  for (Limits& limits : module->memories) {
+    ReadLimits(&limits);
+  }
+
+  module->globals.resize(ReadCount(1));
+  for (Global& global : module->globals) {
+    global.type = ReadType();
+    global.mutable_ = ReadBool();
+    ReadTypedValue(&global.typed_value);
+  }
+
+  uint32_t elem_segment_count = ReadCount(2 * sizeof(uint32_t));
+  for (uint32_t i = 0; i < elem_segment_count; ++i) {
+    module->elem_segments.emplace_back(static_cast<SegmentFlags>(ReadU32()));
+    ReadRefs(&module->elem_segments.back().elems);
+  }
+
+  module->data_segments.resize(ReadCount(sizeof(uint32_t)));
+  for (DataSegment& segment : module->data_segments) {
+    ReadBytes(&segment.data);
+  }
+
+  uint32_t export_count = ReadCount(1);
+  for (uint32_t i = 0; i < export_count; ++i) {
+    std::string name;
+    ReadString(&name);
+    ExternalKind kind = static_cast<ExternalKind>(ReadU8());
+    Index index = ReadU32();
+    module->exports.emplace_back(name, kind, index);
+  }
+
+  module->memory_index = ReadU32();
+  module->start_func_index = ReadU32();
+
+  module->active_elem_segments.resize(ReadCount(3 * sizeof(uint32_t)));
+  for (CachedModule::ActiveElemSegment& segment :
+       module->active_elem_segments) {
+    segment.table_index = ReadU32();
+    segment.dst = ReadU32();
+    ReadRefs(&segment.src);
+  }
+
+  module->active_data_segments.resize(ReadCount(1));
+  for (CachedModule::ActiveDataSegment& segment :
+       module->active_data_segments) {
+    segment.memory_index = ReadU32();
+    segment.dst = ReadU64();
+    ReadBytes(&segment.data);
+  }
+
+  ReadBytes(&module->istream);
+  return ok_ && p_ == end_ ? wabt::Result::Ok : wabt::Result::Error;
+}
+
+}  // end anonymous namespace
+
+uint64_t GetCacheKey(const void* data,
+                     size_t size,
+                     const Features& features,
+                     const LoweringOptions& lowering_options) {
+  uint64_t hash = HashBytes(kHashOffsetBasis, data, size);
+#define WABT_FEATURE(variable, flag, default_, help) \
+  hash = HashU32(hash, features.variable##_enabled());
+#include "src/feature.def"
+#undef WABT_FEATURE
+  hash = HashU32(hash, lowering_options.register_lowering);
+  hash = HashU32(hash, lowering_options.fusions);
+  hash = HashU32(hash, lowering_options.jit);
+  hash = HashU32(hash, lowering_options.fuel);
+  if (lowering_options.fuel) {
+    for (uint32_t i = 0; i < Opcode::Invalid; ++i) {
+      Opcode opcode = static_cast<Opcode::Enum>(i);
+      hash = HashU32(hash, lowering_options.fuel_costs.GetCost(opcode));
+    }
+  }
+  return hash;
+}
+
+std::string GetCacheFilename(string_view cache_dir, uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".wic", key);
+  std::string filename = cache_dir.to_string();
+  if (!filename.empty() && filename.back() != '/' && filename.back() != '\\') {
+    filename += '/';
+  }
+  return filename + name;
+}
+
+wabt::Result WriteCachedModule(string_view filename, const CachedModule& module) {
+  MemoryStream module_stream;
+  CacheWriter writer(&module_stream);
+  writer.WriteModule(module);
+  const std::vector<uint8_t>& module_data =
+      module_stream.output_buffer().data;
+
+  MemoryStream stream;
+  stream.WriteData(kCacheMagic, sizeof(kCacheMagic));
+  stream.WriteU32(kCacheVersion);
+  stream.WriteU64(
+      HashBytes(kHashOffsetBasis, module_data.data(), module_data.size()));
+  stream.WriteData(module_data.data(), module_data.size());
+
+  // Write the file directly rather than with OutputBuffer::WriteToFile, which
+  // prints an error if the cache directory isn't writable.
+  std::string temp_filename = filename.to_string() + ".tmp";
+  FILE* file = fopen(temp_filename.c_str(), "wb");
+  if (!file) {
+    return wabt::Result::Error;
+  }
+  const std::vector<uint8_t>& data = stream.output_buffer().data;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok &= fclose(file) == 0;
+  if (!ok ||
+      rename(temp_filename.c_str(), filename.to_string().c_str()) != 0) {
+    remove(temp_filename.c_str());
+    return wabt::Result::Error;
+  }
+  return wabt::Result::Ok;
+}
+
+wabt::Result ReadCachedModule(string_view filename, CachedModule* out_module) {
+  FILE* file = fopen(filename.to_string().c_str(), "rb");
+  if (!file) {
+    return wabt::Result::Error;
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t buffer[65536];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + bytes);
+  }
+  bool read_error = ferror(file);
+  fclose(file);
+  if (read_error) {
+    return wabt::Result::Error;
+  }
+
+  // The checksum catches a file that was corrupted or truncated, which could
+  // otherwise restore a module whose istream or indexes are garbage.
+  uint32_t version;
+  uint64_t checksum;
+  if (data.size() < kCacheHeaderSize ||
+      memcmp(data.data(), kCacheMagic, sizeof(kCacheMagic)) != 0) {
+    return wabt::Result::Error;
+  }
+  memcpy(&version, data.data() + sizeof(kCacheMagic), sizeof(version));
+  memcpy(&checksum, data.data() + sizeof(kCacheMagic) + sizeof(version),
+         sizeof(checksum));
+  const uint8_t* module_data = data.data() + kCacheHeaderSize;
+  size_t module_size = data.size() - kCacheHeaderSize;
+  if (version != kCacheVersion ||
+      checksum != HashBytes(kHashOffsetBasis, module_data, module_size)) {
+    return wabt::Result::Error;
+  }
+
+  CacheReader reader(module_data, module_size);
+  return reader.ReadModule(out_module);
+}
+
+bool MarkPointsAreEqual(const Environment::MarkPoint& lhs,
+                        const Environment::MarkPoint& rhs) {
+  return lhs.modules_size == rhs.modules_size &&
+         lhs.sigs_size == rhs.sigs_size && lhs.funcs_size == rhs.funcs_size &&
+         lhs.memories_size == rhs.memories_size &&
+         lhs.tables_size == rhs.tables_size &&
+         lhs.globals_size == rhs.globals_size &&
+         lhs.data_segments_size == rhs.data_segments_size &&
+         lhs.elem_segments_size == rhs.elem_segments_size &&
+         lhs.istream_size == rhs.istream_size;
+}
+
+}  // namespace interp
+}  // namespace wabt
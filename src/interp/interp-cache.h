@@ -0,0 +1,123 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_CACHE_H_
+#define WABT_INTERP_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include "src/common.h"
+#include "src/interp/interp.h"
+
+namespace wabt {
+
+class Features;
+
+namespace interp {
+
+// Everything that ReadBinaryInterp adds to an Environment for one module: the
+// lowered istream and the functions, tables, memories, globals, segments and
+// exports that it refers to. A module read into an Environment in the same
+// state can be restored from this without reading the binary again. Indexes
+// are into the environment unless noted otherwise.
+struct CachedModule {
+  struct Import {
+    ExternalKind kind;
+    std::string module_name;
+    std::string field_name;
+    Index sig_index = kInvalidIndex;  // Into the module's types, for funcs.
+    Type type = Type::Void;           // The elem type of a table, for tables.
+    bool mutable_ = false;
+    Limits limits;
+    Index resolved_index = kInvalidIndex;
+  };
+
+  struct Func {
+    Index sig_index;
+    IstreamOffset offset;
+    Index local_decl_count;
+    Index local_count;
+    std::vector<Type> param_and_local_types;
+  };
+
+  struct ActiveElemSegment {
+    Index table_index;
+    Index dst;
+    std::vector<Ref> src;
+  };
+
+  struct ActiveDataSegment {
+    Index memory_index;
+    Address dst;
+    std::vector<char> data;
+  };
+
+  // Identifies the binary and the options it was read with; see
+  // GetCacheKey.
+  uint64_t key = 0;
+  uint64_t data_size = 0;
+
+  // The state of the environment before the module was read, and after its
+  // imports were resolved. Indexes in the istream are only valid in an
+  // environment that matches both.
+  Environment::MarkPoint start_mark;
+  Environment::MarkPoint import_mark;
+
+  std::vector<FuncSignature> sigs;
+  std::vector<Import> imports;
+  std::vector<Func> funcs;
+  std::vector<Table> tables;
+  std::vector<Limits> memories;
+  std::vector<Global> globals;
+  std::vector<ElemSegment> elem_segments;
+  std::vector<DataSegment> data_segments;
+
+  std::vector<Export> exports;
+  Index memory_index = kInvalidIndex;
+  Index start_func_index = kInvalidIndex;
+  std::vector<ActiveElemSegment> active_elem_segments;
+  std::vector<ActiveDataSegment> active_data_segments;
+
+  std::vector<uint8_t> istream;
+};
+
+// Returns a hash of |data| and everything else that changes how it is lowered.
+uint64_t GetCacheKey(const void* data,
+                     size_t size,
+                     const Features&,
+                     const LoweringOptions&);
+
+// Returns the path of the cache file for |key| in |cache_dir|.
+std::string GetCacheFilename(string_view cache_dir, uint64_t key);
+
+// The file is written to a temporary name first and then renamed, so
+// concurrent readers never see a partial file.
+wabt::Result WriteCachedModule(string_view filename, const CachedModule&);
+
+// Fails, without printing anything, if the file doesn't exist, was written by
+// a different version of the format, doesn't match its checksum, or is
+// malformed. The indexes in the module are not checked here; see
+// BinaryReaderInterp::RestoreCachedModule.
+wabt::Result ReadCachedModule(string_view filename, CachedModule*);
+
+bool MarkPointsAreEqual(const Environment::MarkPoint&,
+                        const Environment::MarkPoint&);
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif /* WABT_INTERP_CACHE_H_ */
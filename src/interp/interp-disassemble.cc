@@ -45,6 +45,7 @@ void Environment::Disassemble(Stream* stream,
       case Opcode::Select:
       case Opcode::SelectT:
       case Opcode::V128BitSelect:
+      case Opcode::InterpSelectV128:
         stream->Writef("%s %%[-3], %%[-2], %%[-1]\n", opcode.GetName());
         break;
 
@@ -114,12 +115,16 @@ void Environment::Disassemble(Stream* stream,
       case Opcode::CallIndirect:
       case Opcode::ReturnCallIndirect: {
         const Index table_index = ReadU32(&pc);
+        const Index sig_index = ReadU32(&pc);
+        ReadU32(&pc);  // The inline cache.
         stream->Writef("%s $%" PRIindex ":%u, %%[-1]\n", opcode.GetName(),
-                       table_index, ReadU32(&pc));
+                       table_index, sig_index);
         break;
       }
 
       case Opcode::InterpCallHost:
+      case Opcode::InterpCompile:
+      case Opcode::InterpFuncEntry:
         stream->Writef("%s $%u\n", opcode.GetName(), ReadU32(&pc));
         break;
 
@@ -536,7 +541,7 @@ void Environment::Disassemble(Stream* stream,
       case Opcode::F32X4ExtractLane:
       case Opcode::F64X2ExtractLane: {
         stream->Writef("%s %%[-1] : (Lane imm: %d)\n", opcode.GetName(),
-                       ReadU8(&pc));
+                       ReadU32(&pc));
         break;
       }
 
@@ -547,7 +552,7 @@ void Environment::Disassemble(Stream* stream,
       case Opcode::F32X4ReplaceLane:
       case Opcode::F64X2ReplaceLane: {
         stream->Writef("%s %%[-1], %%[-2] : (Lane imm: %d)\n",
-                       opcode.GetName(), ReadU8(&pc));
+                       opcode.GetName(), ReadU32(&pc));
         break;
       }
 
@@ -566,6 +571,7 @@ void Environment::Disassemble(Stream* stream,
       }
 
       case Opcode::InterpAlloca:
+      case Opcode::InterpConsumeFuel:
         stream->Writef("%s $%u\n", opcode.GetName(), ReadU32(&pc));
         break;
 
@@ -573,6 +579,51 @@ void Environment::Disassemble(Stream* stream,
         stream->Writef("%s @%u, %%[-1]\n", opcode.GetName(), ReadU32(&pc));
         break;
 
+      case Opcode::InterpRegBinop: {
+        const Opcode binop = ReadOpcode(&pc);
+        const uint32_t lhs = ReadU32(&pc);
+        const uint32_t rhs = ReadU32(&pc);
+        stream->Writef("%s %s $%u, $%u\n", opcode.GetName(), binop.GetName(),
+                       lhs, rhs);
+        break;
+      }
+
+      case Opcode::InterpRegBinopSet: {
+        const Opcode binop = ReadOpcode(&pc);
+        const uint32_t dst = ReadU32(&pc);
+        const uint32_t lhs = ReadU32(&pc);
+        const uint32_t rhs = ReadU32(&pc);
+        stream->Writef("%s %s $%u, $%u, $%u\n", opcode.GetName(),
+                       binop.GetName(), dst, lhs, rhs);
+        break;
+      }
+
+      case Opcode::InterpI32AddLocals: {
+        const uint32_t lhs = ReadU32(&pc);
+        const uint32_t rhs = ReadU32(&pc);
+        stream->Writef("%s $%u, $%u\n", opcode.GetName(), lhs, rhs);
+        break;
+      }
+
+      case Opcode::InterpI32AddConst:
+        stream->Writef("%s %%[-1], %u\n", opcode.GetName(), ReadU32(&pc));
+        break;
+
+      case Opcode::InterpI32LoadLocal: {
+        const uint32_t slot = ReadU32(&pc);
+        const Index memory_index = ReadU32(&pc);
+        stream->Writef("%s $%" PRIindex ":$%u+$%u\n", opcode.GetName(),
+                       memory_index, slot, ReadU32(&pc));
+        break;
+      }
+
+      case Opcode::InterpI32CompareBrUnless: {
+        const Opcode compare = ReadOpcode(&pc);
+        stream->Writef("%s %s @%u\n", opcode.GetName(), compare.GetName(),
+                       ReadU32(&pc));
+        break;
+      }
+
       case Opcode::InterpDropKeep: {
         const uint32_t drop = ReadU32(&pc);
         const uint32_t keep = ReadU32(&pc);
@@ -60,6 +60,10 @@ inline uint32_t ReadU32(const uint8_t** pc) {
   return ReadUx<uint32_t>(pc);
 }
 
+inline void WriteU32At(uint8_t* pc, uint32_t value) {
+  memcpy(pc, &value, sizeof(value));
+}
+
 inline uint64_t ReadU64At(const uint8_t* pc) {
   return ReadUxAt<uint64_t>(pc);
 }
@@ -90,5 +94,128 @@ inline void ReadTableEntryAt(const uint8_t* pc,
   *out_keep = ReadU32At(pc + WABT_TABLE_ENTRY_KEEP_OFFSET);
 }
 
+// Binary operators that can be lowered to InterpRegBinop/InterpRegBinopSet,
+// along with the Thread helper and function used to evaluate them.
+//
+//   V(Name, helper, func)
+#define WABT_FOREACH_REG_BINOP(V)              \
+  V(I32Add, Binop, Add<uint32_t>)              \
+  V(I32Sub, Binop, Sub<uint32_t>)              \
+  V(I32Mul, Binop, Mul<uint32_t>)              \
+  V(I32DivS, BinopTrap, IntDivS<int32_t>)      \
+  V(I32DivU, BinopTrap, IntDivU<uint32_t>)     \
+  V(I32RemS, BinopTrap, IntRemS<int32_t>)      \
+  V(I32RemU, BinopTrap, IntRemU<uint32_t>)     \
+  V(I32And, Binop, IntAnd<uint32_t>)           \
+  V(I32Or, Binop, IntOr<uint32_t>)             \
+  V(I32Xor, Binop, IntXor<uint32_t>)           \
+  V(I32Shl, Binop, IntShl<uint32_t>)           \
+  V(I32ShrU, Binop, IntShr<uint32_t>)          \
+  V(I32ShrS, Binop, IntShr<int32_t>)           \
+  V(I32Rotl, Binop, IntRotl<uint32_t>)         \
+  V(I32Rotr, Binop, IntRotr<uint32_t>)         \
+  V(I32Eq, Binop, Eq<uint32_t>)                \
+  V(I32Ne, Binop, Ne<uint32_t>)                \
+  V(I32LtS, Binop, Lt<int32_t>)                \
+  V(I32LeS, Binop, Le<int32_t>)                \
+  V(I32LtU, Binop, Lt<uint32_t>)               \
+  V(I32LeU, Binop, Le<uint32_t>)               \
+  V(I32GtS, Binop, Gt<int32_t>)                \
+  V(I32GeS, Binop, Ge<int32_t>)                \
+  V(I32GtU, Binop, Gt<uint32_t>)               \
+  V(I32GeU, Binop, Ge<uint32_t>)               \
+  V(I64Add, Binop, Add<uint64_t>)              \
+  V(I64Sub, Binop, Sub<uint64_t>)              \
+  V(I64Mul, Binop, Mul<uint64_t>)              \
+  V(I64DivS, BinopTrap, IntDivS<int64_t>)      \
+  V(I64DivU, BinopTrap, IntDivU<uint64_t>)     \
+  V(I64RemS, BinopTrap, IntRemS<int64_t>)      \
+  V(I64RemU, BinopTrap, IntRemU<uint64_t>)     \
+  V(I64And, Binop, IntAnd<uint64_t>)           \
+  V(I64Or, Binop, IntOr<uint64_t>)             \
+  V(I64Xor, Binop, IntXor<uint64_t>)           \
+  V(I64Shl, Binop, IntShl<uint64_t>)           \
+  V(I64ShrU, Binop, IntShr<uint64_t>)          \
+  V(I64ShrS, Binop, IntShr<int64_t>)           \
+  V(I64Rotl, Binop, IntRotl<uint64_t>)         \
+  V(I64Rotr, Binop, IntRotr<uint64_t>)         \
+  V(I64Eq, Binop, Eq<uint64_t>)                \
+  V(I64Ne, Binop, Ne<uint64_t>)                \
+  V(I64LtS, Binop, Lt<int64_t>)                \
+  V(I64LeS, Binop, Le<int64_t>)                \
+  V(I64LtU, Binop, Lt<uint64_t>)               \
+  V(I64LeU, Binop, Le<uint64_t>)               \
+  V(I64GtS, Binop, Gt<int64_t>)                \
+  V(I64GeS, Binop, Ge<int64_t>)                \
+  V(I64GtU, Binop, Gt<uint64_t>)               \
+  V(I64GeU, Binop, Ge<uint64_t>)               \
+  V(F32Add, Binop, Add<float>)                 \
+  V(F32Sub, Binop, Sub<float>)                 \
+  V(F32Mul, Binop, Mul<float>)                 \
+  V(F32Div, Binop, FloatDiv<float>)            \
+  V(F32Min, Binop, FloatMin<float>)            \
+  V(F32Max, Binop, FloatMax<float>)            \
+  V(F32Copysign, Binop, FloatCopySign<float>)  \
+  V(F32Eq, Binop, Eq<float>)                   \
+  V(F32Ne, Binop, Ne<float>)                   \
+  V(F32Lt, Binop, Lt<float>)                   \
+  V(F32Le, Binop, Le<float>)                   \
+  V(F32Gt, Binop, Gt<float>)                   \
+  V(F32Ge, Binop, Ge<float>)                   \
+  V(F64Add, Binop, Add<double>)                \
+  V(F64Sub, Binop, Sub<double>)                \
+  V(F64Mul, Binop, Mul<double>)                \
+  V(F64Div, Binop, FloatDiv<double>)           \
+  V(F64Min, Binop, FloatMin<double>)           \
+  V(F64Max, Binop, FloatMax<double>)           \
+  V(F64Copysign, Binop, FloatCopySign<double>) \
+  V(F64Eq, Binop, Eq<double>)                  \
+  V(F64Ne, Binop, Ne<double>)                  \
+  V(F64Lt, Binop, Lt<double>)                  \
+  V(F64Le, Binop, Le<double>)                  \
+  V(F64Gt, Binop, Gt<double>)                  \
+  V(F64Ge, Binop, Ge<double>)
+
+inline bool IsRegBinop(Opcode opcode) {
+  switch (opcode) {
+#define V(Name, helper, func) case Opcode::Name:
+    WABT_FOREACH_REG_BINOP(V)
+#undef V
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// i32 comparisons that can be fused with a following br_if or if into
+// InterpI32CompareBrUnless, along with the function used to evaluate them.
+// i32.eqz can be fused too, but is unary so it is handled separately.
+//
+//   V(Name, func)
+#define WABT_FOREACH_I32_COMPARE(V) \
+  V(I32Eq, Eq<uint32_t>)            \
+  V(I32Ne, Ne<uint32_t>)            \
+  V(I32LtS, Lt<int32_t>)            \
+  V(I32LeS, Le<int32_t>)            \
+  V(I32LtU, Lt<uint32_t>)           \
+  V(I32LeU, Le<uint32_t>)           \
+  V(I32GtS, Gt<int32_t>)            \
+  V(I32GeS, Ge<int32_t>)            \
+  V(I32GtU, Gt<uint32_t>)           \
+  V(I32GeU, Ge<uint32_t>)
+
+inline bool IsI32Compare(Opcode opcode) {
+  switch (opcode) {
+#define V(Name, func) case Opcode::Name:
+    WABT_FOREACH_I32_COMPARE(V)
+#undef V
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 }  // namespace interp
 }  // namespace wabt
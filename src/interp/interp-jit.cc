@@ -0,0 +1,1513 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-jit.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <vector>
+
+#if WABT_INTERP_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "src/interp/interp-internal.h"
+
+namespace wabt {
+namespace interp {
+
+JitCode::JitCode(void* data, size_t size, Index memory_index)
+    : data_(data), size_(size), memory_index_(memory_index) {}
+
+JitCode::~JitCode() {
+#if WABT_INTERP_JIT
+  munmap(data_, size_);
+#endif
+}
+
+bool IsJitSupported() {
+  return WABT_INTERP_JIT;
+}
+
+#if WABT_INTERP_JIT
+
+namespace {
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI };
+enum Xmm : uint8_t { XMM0, XMM1 };
+
+enum class Cond : uint8_t {
+  B = 0x2,
+  AE = 0x3,
+  E = 0x4,
+  NE = 0x5,
+  BE = 0x6,
+  A = 0x7,
+  P = 0xa,
+  NP = 0xb,
+  L = 0xc,
+  GE = 0xd,
+  LE = 0xe,
+  G = 0xf,
+};
+
+Cond Negate(Cond cond) {
+  return static_cast<Cond>(static_cast<uint8_t>(cond) ^ 1);
+}
+
+// The "op r/m, r" forms of the arithmetic instructions.
+enum AluOp : uint8_t {
+  ADD = 0x01,
+  OR = 0x09,
+  AND = 0x21,
+  SUB = 0x29,
+  XOR = 0x31,
+  CMP = 0x39,
+  TEST = 0x85,
+  MOV = 0x89,
+};
+
+// The /digit extensions of the 0x81 (op r/m, imm32) instructions.
+enum AluImmOp : uint8_t {
+  ADD_IMM = 0,
+  AND_IMM = 4,
+  XOR_IMM = 6,
+  CMP_IMM = 7,
+};
+
+// The /digit extensions of the 0xd3 (shift r/m by cl) instructions.
+enum ShiftOp : uint8_t {
+  ROL = 0,
+  ROR = 1,
+  SHL = 4,
+  SHR = 5,
+  SAR = 7,
+};
+
+// Encodes the small subset of x86-64 that the compiler uses. Only the first
+// eight registers are used, so the REX prefix is only needed for 64-bit
+// operands, and memory operands are always [base + disp32].
+class Assembler {
+ public:
+  size_t offset() const { return code_.size(); }
+  const std::vector<uint8_t>& code() const { return code_; }
+
+  void U8(uint8_t value) { code_.push_back(value); }
+
+  void U32(uint32_t value) {
+    uint8_t bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    code_.insert(code_.end(), bytes, bytes + sizeof(value));
+  }
+
+  void U64(uint64_t value) {
+    uint8_t bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    code_.insert(code_.end(), bytes, bytes + sizeof(value));
+  }
+
+  // <opcode> reg, [base + disp]
+  void RegMem(uint8_t prefix,
+              bool wide,
+              std::initializer_list<uint8_t> opcode,
+              uint8_t reg,
+              Reg base,
+              int32_t disp) {
+    assert(base != RSP);
+    Prefix(prefix, wide, opcode);
+    U8(0x80 | (reg << 3) | base);
+    U32(disp);
+  }
+
+  // <opcode> reg, rm
+  void RegReg(uint8_t prefix,
+              bool wide,
+              std::initializer_list<uint8_t> opcode,
+              uint8_t reg,
+              uint8_t rm) {
+    Prefix(prefix, wide, opcode);
+    U8(0xc0 | (reg << 3) | rm);
+  }
+
+  void Load(bool wide, Reg dst, Reg base, int32_t disp) {
+    RegMem(0, wide, {0x8b}, dst, base, disp);
+  }
+
+  void Store(bool wide, Reg base, int32_t disp, Reg src) {
+    RegMem(0, wide, {0x89}, src, base, disp);
+  }
+
+  void Store32Imm(Reg base, int32_t disp, uint32_t value) {
+    RegMem(0, false, {0xc7}, 0, base, disp);
+    U32(value);
+  }
+
+  void Lea(Reg dst, Reg base, int32_t disp) {
+    RegMem(0, true, {0x8d}, dst, base, disp);
+  }
+
+  void Alu(bool wide, AluOp op, Reg dst, Reg src) {
+    RegReg(0, wide, {op}, src, dst);
+  }
+
+  void AluImm(bool wide, AluImmOp op, Reg dst, uint32_t value) {
+    RegReg(0, wide, {0x81}, op, dst);
+    U32(value);
+  }
+
+  void Shift(bool wide, ShiftOp op, Reg dst) {
+    RegReg(0, wide, {0xd3}, op, dst);
+  }
+
+  void MovImm32(Reg dst, uint32_t value) {
+    U8(0xb8 + dst);
+    U32(value);
+  }
+
+  void MovImm64(Reg dst, uint64_t value) {
+    U8(0x48);
+    U8(0xb8 + dst);
+    U64(value);
+  }
+
+  void SetccMovzx(Cond cond, Reg dst) {
+    RegReg(0, false, {0x0f, static_cast<uint8_t>(0x90 | uint8_t(cond))}, 0,
+           dst);
+    RegReg(0, false, {0x0f, 0xb6}, dst, dst);
+  }
+
+  void Cmov(bool wide, Cond cond, Reg dst, Reg src) {
+    RegReg(0, wide, {0x0f, static_cast<uint8_t>(0x40 | uint8_t(cond))}, dst,
+           src);
+  }
+
+  void Push(Reg reg) { U8(0x50 + reg); }
+  void Pop(Reg reg) { U8(0x58 + reg); }
+  void Ret() { U8(0xc3); }
+  void CallRax() { RegReg(0, false, {0xff}, 2, RAX); }
+
+  // Returns the offset of the rel32 operand, to be patched with Bind.
+  size_t Jmp() {
+    U8(0xe9);
+    return Rel32();
+  }
+
+  size_t Jcc(Cond cond) {
+    U8(0x0f);
+    U8(0x80 | static_cast<uint8_t>(cond));
+    return Rel32();
+  }
+
+  void Patch(size_t rel32_offset, size_t target) {
+    uint32_t rel = static_cast<uint32_t>(target - (rel32_offset + 4));
+    memcpy(&code_[rel32_offset], &rel, sizeof(rel));
+  }
+
+  void Bind(size_t rel32_offset) { Patch(rel32_offset, offset()); }
+
+ private:
+  void Prefix(uint8_t prefix,
+              bool wide,
+              std::initializer_list<uint8_t> opcode) {
+    if (prefix) {
+      U8(prefix);
+    }
+    if (wide) {
+      U8(0x48);
+    }
+    for (uint8_t byte : opcode) {
+      U8(byte);
+    }
+  }
+
+  size_t Rel32() {
+    size_t at = offset();
+    U32(0);
+    return at;
+  }
+
+  std::vector<uint8_t> code_;
+};
+
+const uint32_t kF32SignMask = 0x80000000U;
+const uint64_t kF64SignMask = 0x8000000000000000ULL;
+const uint32_t kF32QuietNan = 0x7fc00000U;
+const uint64_t kF64QuietNan = 0x7ff8000000000000ULL;
+
+const int32_t kContextSp = offsetof(JitContext, sp);
+const int32_t kContextStackEnd = offsetof(JitContext, stack_end);
+const int32_t kContextMemoryData = offsetof(JitContext, memory_data);
+const int32_t kContextMemorySize = offsetof(JitContext, memory_size);
+const int32_t kContextFuel = offsetof(JitContext, fuel);
+
+// The MVP numeric instructions, the sign-extension instructions and the
+// saturating float-to-int conversions have no immediates, and their stack
+// effect is given by their types.
+bool IsNumeric(Opcode opcode) {
+  uint32_t code = opcode.GetCode();
+  return (opcode.GetPrefix() == 0 && code >= 0x45 && code <= 0xc4) ||
+         (opcode.GetPrefix() == 0xfc && code <= 0x07);
+}
+
+bool IsFloatUnop(Opcode opcode) {
+  uint32_t code = opcode.GetCode();
+  return opcode.GetPrefix() == 0 && ((code >= 0x8b && code <= 0x91) ||
+                                     (code >= 0x99 && code <= 0x9f));
+}
+
+int GetNumericStackDelta(Opcode opcode) {
+  // opcode.def lists the float unops, like f32.neg, with two parameters.
+  if (IsFloatUnop(opcode)) {
+    return 0;
+  }
+  int delta = opcode.GetResultType() == Type::Void ? 0 : 1;
+  for (Type type : {opcode.GetParamType1(), opcode.GetParamType2(),
+                    opcode.GetParamType3()}) {
+    if (type != Type::Void) {
+      --delta;
+    }
+  }
+  return delta;
+}
+
+}  // end anonymous namespace
+
+// Translates a function's istream to machine code, one instruction at a time.
+// The value stack stays in memory, in the slots the interpreter would use:
+// since the istream is validated, the stack height before each instruction is
+// known, so every slot is at a fixed offset from the height on entry, which is
+// kept in rbx. rbp holds the JitContext. Instructions that the compiler
+// doesn't translate itself, like global.get or the float-to-int conversions,
+// are run by calling back into the Thread to interpret just that instruction.
+class JitCompiler {
+ public:
+  JitCompiler(Environment* env, DefinedFunc* func)
+      : env_(env), func_(func), istream_(env->istream().data.data()) {}
+
+  std::unique_ptr<JitCode> Compile();
+
+ private:
+  bool Analyze();
+  bool AddTarget(IstreamOffset pc, int height);
+  bool AnalyzeInstr(IstreamOffset pc, int height);
+  bool GetStackDelta(Opcode, const uint8_t** pc, int* out_delta);
+  bool GetCallee(IstreamOffset offset, Index* out_func_index);
+  int GetCallDelta(Index sig_index);
+  bool UseMemory(Index memory_index);
+
+  static int32_t Slot(int height) {
+    return height * static_cast<int32_t>(sizeof(ValueSlot));
+  }
+
+  void EmitPrologue();
+  void EmitEpilogue();
+  void EmitInstr(IstreamOffset pc, int height);
+  void EmitBranch(IstreamOffset target);
+  void EmitBranch(Cond cond, IstreamOffset target);
+  void EmitTrap(ResultType);
+  void EmitTrap(Cond cond, ResultType);
+  void EmitCopySlot(int from, int to);
+  void EmitDropKeep(int height, uint32_t drop_count, uint32_t keep_count);
+  void EmitReturn(int height);
+  void EmitHelperCall(uintptr_t helper,
+                      int height,
+                      uint32_t arg0,
+                      uint32_t arg1);
+  void EmitStep(IstreamOffset pc, int height);
+  void EmitAddress(int addr_slot, uint32_t offset, uint32_t size);
+  bool EmitLoad(Opcode, int addr_slot, uint32_t offset, int dst);
+  bool EmitStore(Opcode, int height, uint32_t offset);
+  bool EmitUnop(Opcode, int slot);
+  bool EmitBinop(Opcode, int lhs, int rhs, int dst);
+  void EmitIntCompare(bool wide, Cond, int lhs, int rhs, int dst);
+  void EmitFloatCompare(bool wide, Opcode, int lhs, int rhs, int dst);
+  void EmitFloatBinop(bool wide, uint8_t op, int lhs, int rhs, int dst);
+  void EmitCanonicalizeNan(bool wide, int dst);
+  void EmitDivRem(bool wide, bool is_signed, bool is_rem, int lhs, int rhs,
+                  int dst);
+
+  Environment* env_;
+  DefinedFunc* func_;
+  const uint8_t* istream_;
+
+  // The stack height before each reachable instruction, relative to the
+  // height on entry, so the parameters are at negative heights.
+  std::map<IstreamOffset, int> heights_;
+  std::vector<IstreamOffset> worklist_;
+  int max_height_ = 0;
+  Index memory_index_ = kInvalidIndex;
+
+  Assembler a_;
+  std::map<IstreamOffset, size_t> labels_;
+  std::vector<std::pair<size_t, IstreamOffset>> branch_fixups_;
+  std::map<ResultType, std::vector<size_t>> trap_fixups_;
+  std::vector<size_t> exit_fixups_;
+
+  // The instruction being emitted, and the out-of-bounds accesses, which are
+  // stepped in the interpreter to trap with its message.
+  IstreamOffset pc_ = kInvalidIstreamOffset;
+  int height_ = 0;
+  struct OutOfBounds {
+    size_t fixup;
+    IstreamOffset pc;
+    int height;
+  };
+  std::vector<OutOfBounds> oob_fixups_;
+};
+
+std::unique_ptr<JitCode> JitCompiler::Compile() {
+  if (!Analyze()) {
+    return nullptr;
+  }
+
+  EmitPrologue();
+  for (const auto& pair : heights_) {
+    labels_[pair.first] = a_.offset();
+    pc_ = pair.first;
+    height_ = pair.second;
+    EmitInstr(pair.first, pair.second);
+  }
+  EmitEpilogue();
+
+  for (const auto& fixup : branch_fixups_) {
+    a_.Patch(fixup.first, labels_.at(fixup.second));
+  }
+
+  const std::vector<uint8_t>& code = a_.code();
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = (code.size() + page_size - 1) & ~(page_size - 1);
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  memcpy(data, code.data(), code.size());
+  if (mprotect(data, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(data, size);
+    return nullptr;
+  }
+  return MakeUnique<JitCode>(data, size, memory_index_);
+}
+
+bool JitCompiler::Analyze() {
+  const uint8_t* pc = istream_ + func_->offset;
+  if (ReadOpcode(&pc) != Opcode::InterpFuncEntry) {
+    return false;
+  }
+  ReadU32(&pc);
+
+  AddTarget(pc - istream_, 0);
+  while (!worklist_.empty()) {
+    IstreamOffset offset = worklist_.back();
+    worklist_.pop_back();
+    if (!AnalyzeInstr(offset, heights_[offset])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JitCompiler::AddTarget(IstreamOffset pc, int height) {
+  auto iter = heights_.find(pc);
+  if (iter != heights_.end()) {
+    return iter->second == height;
+  }
+  heights_.emplace(pc, height);
+  worklist_.push_back(pc);
+  max_height_ = std::max(max_height_, height);
+  return true;
+}
+
+bool JitCompiler::AnalyzeInstr(IstreamOffset offset, int height) {
+  const uint8_t* pc = istream_ + offset;
+  Opcode opcode = ReadOpcode(&pc);
+  switch (opcode) {
+    case Opcode::Unreachable:
+    case Opcode::Return:
+      return true;
+
+    case Opcode::Br:
+      return AddTarget(ReadU32(&pc), height);
+
+    case Opcode::BrIf:
+    case Opcode::InterpBrUnless: {
+      IstreamOffset target = ReadU32(&pc);
+      return AddTarget(target, height - 1) &&
+             AddTarget(pc - istream_, height - 1);
+    }
+
+    case Opcode::InterpI32CompareBrUnless: {
+      Opcode compare = ReadOpcode(&pc);
+      IstreamOffset target = ReadU32(&pc);
+      height -= compare == Opcode::I32Eqz ? 1 : 2;
+      return AddTarget(target, height) && AddTarget(pc - istream_, height);
+    }
+
+    case Opcode::BrTable: {
+      Index num_targets = ReadU32(&pc);
+      IstreamOffset table_offset = ReadU32(&pc);
+      for (Index i = 0; i <= num_targets; ++i) {
+        IstreamOffset target;
+        uint32_t drop_count;
+        uint32_t keep_count;
+        ReadTableEntryAt(istream_ + table_offset + i * WABT_TABLE_ENTRY_SIZE,
+                         &target, &drop_count, &keep_count);
+        if (!AddTarget(target, height - 1 - drop_count)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    default: {
+      int delta;
+      if (!GetStackDelta(opcode, &pc, &delta)) {
+        return false;
+      }
+      return AddTarget(pc - istream_, height + delta);
+    }
+  }
+}
+
+// Advances |pc| past the immediates of |opcode|. Returns false for the
+// instructions that the compiler can't handle at all, i.e. that it can neither
+// translate nor run by calling back into the Thread.
+bool JitCompiler::GetStackDelta(Opcode opcode,
+                                const uint8_t** pc,
+                                int* out_delta) {
+  if (IsNumeric(opcode)) {
+    *out_delta = GetNumericStackDelta(opcode);
+    return true;
+  }
+
+  switch (opcode) {
+    case Opcode::Nop:
+      *out_delta = 0;
+      return true;
+
+    case Opcode::Drop:
+      *out_delta = -1;
+      return true;
+
+    case Opcode::Select:
+    case Opcode::SelectT:
+      *out_delta = -2;
+      return true;
+
+    case Opcode::I32Const:
+    case Opcode::F32Const:
+      ReadU32(pc);
+      *out_delta = 1;
+      return true;
+
+    case Opcode::I64Const:
+    case Opcode::F64Const:
+      ReadU64(pc);
+      *out_delta = 1;
+      return true;
+
+    case Opcode::LocalGet:
+      ReadU32(pc);
+      *out_delta = 1;
+      return true;
+
+    case Opcode::LocalSet:
+      ReadU32(pc);
+      *out_delta = -1;
+      return true;
+
+    case Opcode::GlobalGet:
+    case Opcode::GlobalSet: {
+      int slot_count = GetSlotCount(env_->GetGlobal(ReadU32(pc))->type);
+      *out_delta = opcode == Opcode::GlobalGet ? slot_count : -slot_count;
+      return true;
+    }
+
+    case Opcode::LocalTee:
+    case Opcode::InterpI32AddConst:
+      ReadU32(pc);
+      *out_delta = 0;
+      return true;
+
+    case Opcode::InterpAlloca:
+      *out_delta = ReadU32(pc);
+      return true;
+
+    case Opcode::InterpConsumeFuel:
+      *out_delta = 0;
+      ReadU32(pc);
+      return true;
+
+    case Opcode::InterpDropKeep:
+      *out_delta = -static_cast<int>(ReadU32(pc));
+      ReadU32(pc);
+      return true;
+
+    case Opcode::InterpRegBinop:
+      *pc += 3 * sizeof(uint32_t);
+      *out_delta = 1;
+      return true;
+
+    case Opcode::InterpRegBinopSet:
+      *pc += 4 * sizeof(uint32_t);
+      *out_delta = 0;
+      return true;
+
+    case Opcode::InterpI32AddLocals:
+      *pc += 2 * sizeof(uint32_t);
+      *out_delta = 1;
+      return true;
+
+    case Opcode::InterpI32LoadLocal: {
+      ReadU32(pc);
+      Index memory_index = ReadU32(pc);
+      ReadU32(pc);
+      *out_delta = 1;
+      return UseMemory(memory_index);
+    }
+
+    case Opcode::Call: {
+      Index func_index;
+      if (!GetCallee(ReadU32(pc), &func_index)) {
+        return false;
+      }
+      *out_delta = GetCallDelta(env_->GetFunc(func_index)->sig_index);
+      return true;
+    }
+
+    case Opcode::InterpCallHost:
+      *out_delta = GetCallDelta(env_->GetFunc(ReadU32(pc))->sig_index);
+      return true;
+
+    case Opcode::CallIndirect: {
+      ReadU32(pc);
+      Index sig_index = ReadU32(pc);
+      ReadU32(pc);  // The inline cache.
+      *out_delta = GetCallDelta(sig_index) - 1;
+      return true;
+    }
+
+    case Opcode::MemorySize:
+      *out_delta = 1;
+      return UseMemory(ReadU32(pc));
+
+    case Opcode::MemoryGrow:
+      *out_delta = 0;
+      return UseMemory(ReadU32(pc));
+
+    case Opcode::I32Load:
+    case Opcode::I64Load:
+    case Opcode::F32Load:
+    case Opcode::F64Load:
+    case Opcode::I32Load8S:
+    case Opcode::I32Load8U:
+    case Opcode::I32Load16S:
+    case Opcode::I32Load16U:
+    case Opcode::I64Load8S:
+    case Opcode::I64Load8U:
+    case Opcode::I64Load16S:
+    case Opcode::I64Load16U:
+    case Opcode::I64Load32S:
+    case Opcode::I64Load32U:
+      *out_delta = 0;
+      break;
+
+    case Opcode::I32Store:
+    case Opcode::I64Store:
+    case Opcode::F32Store:
+    case Opcode::F64Store:
+    case Opcode::I32Store8:
+    case Opcode::I32Store16:
+    case Opcode::I64Store8:
+    case Opcode::I64Store16:
+    case Opcode::I64Store32:
+      *out_delta = -2;
+      break;
+
+    default:
+      return false;
+  }
+
+  // The memory index and the offset of a load or store.
+  Index memory_index = ReadU32(pc);
+  ReadU32(pc);
+  return UseMemory(memory_index);
+}
+
+bool JitCompiler::GetCallee(IstreamOffset offset, Index* out_func_index) {
+  const uint8_t* pc = istream_ + offset;
+  Opcode opcode = ReadOpcode(&pc);
+  if (opcode == Opcode::Br) {
+    // The stub of a lazily compiled function that has been compiled.
+    pc = istream_ + ReadU32(&pc);
+    opcode = ReadOpcode(&pc);
+  }
+  if (opcode != Opcode::InterpFuncEntry && opcode != Opcode::InterpCompile) {
+    return false;
+  }
+  *out_func_index = ReadU32(&pc);
+  return true;
+}
+
+int JitCompiler::GetCallDelta(Index sig_index) {
+  FuncSignature* sig = env_->GetFuncSignature(sig_index);
+  return static_cast<int>(GetSlotCount(sig->result_types)) -
+         static_cast<int>(GetSlotCount(sig->param_types));
+}
+
+// Loads and stores are translated for a single memory, the one whose data and
+// size are in the JitContext.
+bool JitCompiler::UseMemory(Index memory_index) {
+  if (memory_index_ == kInvalidIndex) {
+    memory_index_ = memory_index;
+  }
+  return memory_index_ == memory_index;
+}
+
+void JitCompiler::EmitPrologue() {
+  // rbp and rbx are callee-saved, and the extra 8 bytes keep the stack
+  // 16-byte aligned for calls.
+  a_.Push(RBP);
+  a_.Push(RBX);
+  a_.RegReg(0, true, {0x83}, 5, RSP);  // sub rsp, 8
+  a_.U8(8);
+  a_.Alu(true, MOV, RBP, RDI);
+  a_.Load(true, RBX, RBP, kContextSp);
+  if (max_height_ > 0) {
+    a_.Lea(RAX, RBX, Slot(max_height_));
+    a_.RegMem(0, true, {0x3b}, RAX, RBP, kContextStackEnd);  // cmp
+    EmitTrap(Cond::A, ResultType::TrapValueStackExhausted);
+  }
+}
+
+void JitCompiler::EmitEpilogue() {
+  for (const OutOfBounds& oob : oob_fixups_) {
+    a_.Bind(oob.fixup);
+    EmitStep(oob.pc, oob.height);
+    EmitTrap(ResultType::TrapMemoryAccessOutOfBounds);
+  }
+
+  for (const auto& pair : trap_fixups_) {
+    for (size_t fixup : pair.second) {
+      a_.Bind(fixup);
+    }
+    a_.MovImm32(RAX, static_cast<uint32_t>(pair.first));
+    exit_fixups_.push_back(a_.Jmp());
+  }
+
+  for (size_t fixup : exit_fixups_) {
+    a_.Bind(fixup);
+  }
+  a_.RegReg(0, true, {0x83}, 0, RSP);  // add rsp, 8
+  a_.U8(8);
+  a_.Pop(RBX);
+  a_.Pop(RBP);
+  a_.Ret();
+}
+
+void JitCompiler::EmitBranch(IstreamOffset target) {
+  branch_fixups_.emplace_back(a_.Jmp(), target);
+}
+
+void JitCompiler::EmitBranch(Cond cond, IstreamOffset target) {
+  branch_fixups_.emplace_back(a_.Jcc(cond), target);
+}
+
+void JitCompiler::EmitTrap(ResultType type) {
+  trap_fixups_[type].push_back(a_.Jmp());
+}
+
+void JitCompiler::EmitTrap(Cond cond, ResultType type) {
+  trap_fixups_[type].push_back(a_.Jcc(cond));
+}
+
+void JitCompiler::EmitCopySlot(int from, int to) {
+  if (from == to) {
+    return;
+  }
+  a_.Load(true, RAX, RBX, Slot(from));
+  a_.Store(true, RBX, Slot(to), RAX);
+}
+
+void JitCompiler::EmitDropKeep(int height,
+                               uint32_t drop_count,
+                               uint32_t keep_count) {
+  if (drop_count == 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < keep_count; ++i) {
+    int from = height - keep_count + i;
+    EmitCopySlot(from, from - drop_count);
+  }
+}
+
+void JitCompiler::EmitReturn(int height) {
+  a_.Lea(RAX, RBX, Slot(height));
+  a_.Store(true, RBP, kContextSp, RAX);
+  a_.Alu(false, XOR, RAX, RAX);
+  exit_fixups_.push_back(a_.Jmp());
+}
+
+// Calls |helper|, with the stack pointer in the JitContext, and exits if it
+// returns a trap.
+void JitCompiler::EmitHelperCall(uintptr_t helper,
+                                 int height,
+                                 uint32_t arg0,
+                                 uint32_t arg1) {
+  a_.Lea(RAX, RBX, Slot(height));
+  a_.Store(true, RBP, kContextSp, RAX);
+  a_.Alu(true, MOV, RDI, RBP);
+  a_.MovImm32(RSI, arg0);
+  a_.MovImm32(RDX, arg1);
+  a_.MovImm64(RAX, helper);
+  a_.CallRax();
+  a_.Alu(false, TEST, RAX, RAX);
+  exit_fixups_.push_back(a_.Jcc(Cond::NE));
+}
+
+void JitCompiler::EmitStep(IstreamOffset pc, int height) {
+  EmitHelperCall(reinterpret_cast<uintptr_t>(&Thread::JitStep), height, pc, 0);
+}
+
+// Leaves the address of an access of |size| bytes in rax, or traps if it is
+// out of bounds.
+void JitCompiler::EmitAddress(int addr_slot, uint32_t offset, uint32_t size) {
+  // Loading the 32-bit address zero-extends it, and the sum of it, the offset
+  // and the size can't overflow 64 bits.
+  a_.Load(false, RCX, RBX, Slot(addr_slot));
+  if (offset != 0) {
+    a_.MovImm32(RDX, offset);
+    a_.Alu(true, ADD, RCX, RDX);
+  }
+  a_.Lea(RDX, RCX, size);
+  a_.RegMem(0, true, {0x3b}, RDX, RBP, kContextMemorySize);  // cmp
+  oob_fixups_.push_back({a_.Jcc(Cond::A), pc_, height_});
+  a_.Load(true, RAX, RBP, kContextMemoryData);
+  a_.Alu(true, ADD, RAX, RCX);
+}
+
+bool JitCompiler::EmitLoad(Opcode opcode,
+                           int addr_slot,
+                           uint32_t offset,
+                           int dst) {
+  bool wide = opcode.GetResultType() == Type::I64 ||
+              opcode.GetResultType() == Type::F64;
+  EmitAddress(addr_slot, offset, opcode.GetMemorySize());
+  switch (opcode) {
+    case Opcode::I32Load:
+    case Opcode::F32Load:
+    case Opcode::I64Load32U:
+      a_.Load(false, RAX, RAX, 0);
+      break;
+
+    case Opcode::I64Load:
+    case Opcode::F64Load:
+      a_.Load(true, RAX, RAX, 0);
+      break;
+
+    case Opcode::I32Load8S:
+    case Opcode::I64Load8S:
+      a_.RegMem(0, wide, {0x0f, 0xbe}, RAX, RAX, 0);  // movsx
+      break;
+
+    case Opcode::I32Load8U:
+    case Opcode::I64Load8U:
+      a_.RegMem(0, false, {0x0f, 0xb6}, RAX, RAX, 0);  // movzx
+      break;
+
+    case Opcode::I32Load16S:
+    case Opcode::I64Load16S:
+      a_.RegMem(0, wide, {0x0f, 0xbf}, RAX, RAX, 0);  // movsx
+      break;
+
+    case Opcode::I32Load16U:
+    case Opcode::I64Load16U:
+      a_.RegMem(0, false, {0x0f, 0xb7}, RAX, RAX, 0);  // movzx
+      break;
+
+    case Opcode::I64Load32S:
+      a_.RegMem(0, true, {0x63}, RAX, RAX, 0);  // movsxd
+      break;
+
+    default:
+      return false;
+  }
+  a_.Store(wide, RBX, Slot(dst), RAX);
+  return true;
+}
+
+bool JitCompiler::EmitStore(Opcode opcode, int height, uint32_t offset) {
+  uint32_t size = opcode.GetMemorySize();
+  EmitAddress(height - 2, offset, size);
+  a_.Load(size == 8, RCX, RBX, Slot(height - 1));
+  switch (size) {
+    case 1: a_.RegMem(0, false, {0x88}, RCX, RAX, 0); break;
+    case 2: a_.RegMem(0x66, false, {0x89}, RCX, RAX, 0); break;
+    case 4: a_.Store(false, RAX, 0, RCX); break;
+    case 8: a_.Store(true, RAX, 0, RCX); break;
+    default: return false;
+  }
+  return true;
+}
+
+void JitCompiler::EmitCanonicalizeNan(bool wide, int dst) {
+  a_.RegReg(wide ? 0x66 : 0, false, {0x0f, 0x2e}, XMM0, XMM0);  // ucomis
+  size_t skip = a_.Jcc(Cond::NP);
+  if (wide) {
+    a_.MovImm64(RAX, kF64QuietNan);
+    a_.Store(true, RBX, Slot(dst), RAX);
+  } else {
+    a_.Store32Imm(RBX, Slot(dst), kF32QuietNan);
+  }
+  a_.Bind(skip);
+}
+
+void JitCompiler::EmitFloatBinop(bool wide,
+                                 uint8_t op,
+                                 int lhs,
+                                 int rhs,
+                                 int dst) {
+  uint8_t prefix = wide ? 0xf2 : 0xf3;
+  a_.RegMem(prefix, false, {0x0f, 0x10}, XMM0, RBX, Slot(lhs));  // movs
+  a_.RegMem(prefix, false, {0x0f, op}, XMM0, RBX, Slot(rhs));
+  a_.RegMem(prefix, false, {0x0f, 0x11}, XMM0, RBX, Slot(dst));  // movs
+  EmitCanonicalizeNan(wide, dst);
+}
+
+void JitCompiler::EmitIntCompare(bool wide,
+                                 Cond cond,
+                                 int lhs,
+                                 int rhs,
+                                 int dst) {
+  a_.Load(wide, RAX, RBX, Slot(lhs));
+  a_.Load(wide, RCX, RBX, Slot(rhs));
+  a_.Alu(wide, CMP, RAX, RCX);
+  a_.SetccMovzx(cond, RAX);
+  a_.Store(false, RBX, Slot(dst), RAX);
+}
+
+void JitCompiler::EmitFloatCompare(bool wide,
+                                   Opcode opcode,
+                                   int lhs,
+                                   int rhs,
+                                   int dst) {
+  uint8_t prefix = wide ? 0xf2 : 0xf3;
+  a_.RegMem(prefix, false, {0x0f, 0x10}, XMM0, RBX, Slot(lhs));  // movs
+  a_.RegMem(prefix, false, {0x0f, 0x10}, XMM1, RBX, Slot(rhs));  // movs
+
+  // ucomis sets ZF, PF and CF when either operand is NaN, so only "above"
+  // and "above or equal" are false for NaN; "less than" is done by swapping
+  // the operands.
+  uint8_t ucomis_prefix = wide ? 0x66 : 0;
+  Xmm first = XMM0;
+  Xmm second = XMM1;
+  if (opcode == Opcode::F32Lt || opcode == Opcode::F64Lt ||
+      opcode == Opcode::F32Le || opcode == Opcode::F64Le) {
+    std::swap(first, second);
+  }
+  a_.RegReg(ucomis_prefix, false, {0x0f, 0x2e}, first, second);
+
+  switch (opcode) {
+    case Opcode::F32Eq:
+    case Opcode::F64Eq:
+      a_.SetccMovzx(Cond::E, RAX);
+      a_.SetccMovzx(Cond::NP, RCX);
+      a_.Alu(false, AND, RAX, RCX);
+      break;
+
+    case Opcode::F32Ne:
+    case Opcode::F64Ne:
+      a_.SetccMovzx(Cond::NE, RAX);
+      a_.SetccMovzx(Cond::P, RCX);
+      a_.Alu(false, OR, RAX, RCX);
+      break;
+
+    case Opcode::F32Lt:
+    case Opcode::F64Lt:
+    case Opcode::F32Gt:
+    case Opcode::F64Gt:
+      a_.SetccMovzx(Cond::A, RAX);
+      break;
+
+    default:
+      a_.SetccMovzx(Cond::AE, RAX);
+      break;
+  }
+  a_.Store(false, RBX, Slot(dst), RAX);
+}
+
+void JitCompiler::EmitDivRem(bool wide,
+                             bool is_signed,
+                             bool is_rem,
+                             int lhs,
+                             int rhs,
+                             int dst) {
+  a_.Load(wide, RAX, RBX, Slot(lhs));
+  a_.Load(wide, RCX, RBX, Slot(rhs));
+  a_.Alu(wide, TEST, RCX, RCX);
+  EmitTrap(Cond::E, ResultType::TrapIntegerDivideByZero);
+
+  size_t done = 0;
+  if (is_signed) {
+    // idiv faults on the minimum value divided by -1. The quotient overflows,
+    // and the remainder is 0.
+    a_.AluImm(wide, CMP_IMM, RCX, 0xffffffff);
+    size_t divide = a_.Jcc(Cond::NE);
+    if (is_rem) {
+      a_.Alu(false, XOR, RDX, RDX);
+      done = a_.Jmp();
+    } else {
+      if (wide) {
+        a_.MovImm64(RDX, kF64SignMask);
+        a_.Alu(true, CMP, RAX, RDX);
+      } else {
+        a_.AluImm(false, CMP_IMM, RAX, kF32SignMask);
+      }
+      EmitTrap(Cond::E, ResultType::TrapIntegerOverflow);
+    }
+    a_.Bind(divide);
+    if (wide) {
+      a_.U8(0x48);
+    }
+    a_.U8(0x99);  // cdq/cqo
+    a_.RegReg(0, wide, {0xf7}, 7, RCX);  // idiv
+  } else {
+    a_.Alu(false, XOR, RDX, RDX);
+    a_.RegReg(0, wide, {0xf7}, 6, RCX);  // div
+  }
+
+  if (done) {
+    a_.Bind(done);
+  }
+  a_.Store(wide, RBX, Slot(dst), is_rem ? RDX : RAX);
+}
+
+bool JitCompiler::EmitBinop(Opcode opcode, int lhs, int rhs, int dst) {
+  bool wide = opcode.GetParamType1() == Type::I64 ||
+              opcode.GetParamType1() == Type::F64;
+  switch (opcode) {
+    case Opcode::I32Add:
+    case Opcode::I32Sub:
+    case Opcode::I32And:
+    case Opcode::I32Or:
+    case Opcode::I32Xor:
+    case Opcode::I32Mul:
+    case Opcode::I64Add:
+    case Opcode::I64Sub:
+    case Opcode::I64And:
+    case Opcode::I64Or:
+    case Opcode::I64Xor:
+    case Opcode::I64Mul:
+      a_.Load(wide, RAX, RBX, Slot(lhs));
+      a_.Load(wide, RCX, RBX, Slot(rhs));
+      switch (opcode) {
+        case Opcode::I32Add:
+        case Opcode::I64Add:
+          a_.Alu(wide, ADD, RAX, RCX);
+          break;
+        case Opcode::I32Sub:
+        case Opcode::I64Sub:
+          a_.Alu(wide, SUB, RAX, RCX);
+          break;
+        case Opcode::I32And:
+        case Opcode::I64And:
+          a_.Alu(wide, AND, RAX, RCX);
+          break;
+        case Opcode::I32Or:
+        case Opcode::I64Or:
+          a_.Alu(wide, OR, RAX, RCX);
+          break;
+        case Opcode::I32Xor:
+        case Opcode::I64Xor:
+          a_.Alu(wide, XOR, RAX, RCX);
+          break;
+        default:
+          a_.RegReg(0, wide, {0x0f, 0xaf}, RAX, RCX);  // imul
+          break;
+      }
+      a_.Store(wide, RBX, Slot(dst), RAX);
+      return true;
+
+    case Opcode::I32Shl:
+    case Opcode::I32ShrS:
+    case Opcode::I32ShrU:
+    case Opcode::I32Rotl:
+    case Opcode::I32Rotr:
+    case Opcode::I64Shl:
+    case Opcode::I64ShrS:
+    case Opcode::I64ShrU:
+    case Opcode::I64Rotl:
+    case Opcode::I64Rotr: {
+      // The shift count is masked the same way as in wasm.
+      ShiftOp op;
+      switch (opcode) {
+        case Opcode::I32Shl: case Opcode::I64Shl: op = SHL; break;
+        case Opcode::I32ShrS: case Opcode::I64ShrS: op = SAR; break;
+        case Opcode::I32ShrU: case Opcode::I64ShrU: op = SHR; break;
+        case Opcode::I32Rotl: case Opcode::I64Rotl: op = ROL; break;
+        default: op = ROR; break;
+      }
+      a_.Load(wide, RAX, RBX, Slot(lhs));
+      a_.Load(false, RCX, RBX, Slot(rhs));
+      a_.Shift(wide, op, RAX);
+      a_.Store(wide, RBX, Slot(dst), RAX);
+      return true;
+    }
+
+    case Opcode::I32DivS: case Opcode::I64DivS:
+      EmitDivRem(wide, true, false, lhs, rhs, dst);
+      return true;
+    case Opcode::I32DivU: case Opcode::I64DivU:
+      EmitDivRem(wide, false, false, lhs, rhs, dst);
+      return true;
+    case Opcode::I32RemS: case Opcode::I64RemS:
+      EmitDivRem(wide, true, true, lhs, rhs, dst);
+      return true;
+    case Opcode::I32RemU: case Opcode::I64RemU:
+      EmitDivRem(wide, false, true, lhs, rhs, dst);
+      return true;
+
+    case Opcode::I32Eq: case Opcode::I64Eq:
+      EmitIntCompare(wide, Cond::E, lhs, rhs, dst);
+      return true;
+    case Opcode::I32Ne: case Opcode::I64Ne:
+      EmitIntCompare(wide, Cond::NE, lhs, rhs, dst);
+      return true;
+    case Opcode::I32LtS: case Opcode::I64LtS:
+      EmitIntCompare(wide, Cond::L, lhs, rhs, dst);
+      return true;
+    case Opcode::I32LtU: case Opcode::I64LtU:
+      EmitIntCompare(wide, Cond::B, lhs, rhs, dst);
+      return true;
+    case Opcode::I32GtS: case Opcode::I64GtS:
+      EmitIntCompare(wide, Cond::G, lhs, rhs, dst);
+      return true;
+    case Opcode::I32GtU: case Opcode::I64GtU:
+      EmitIntCompare(wide, Cond::A, lhs, rhs, dst);
+      return true;
+    case Opcode::I32LeS: case Opcode::I64LeS:
+      EmitIntCompare(wide, Cond::LE, lhs, rhs, dst);
+      return true;
+    case Opcode::I32LeU: case Opcode::I64LeU:
+      EmitIntCompare(wide, Cond::BE, lhs, rhs, dst);
+      return true;
+    case Opcode::I32GeS: case Opcode::I64GeS:
+      EmitIntCompare(wide, Cond::GE, lhs, rhs, dst);
+      return true;
+    case Opcode::I32GeU: case Opcode::I64GeU:
+      EmitIntCompare(wide, Cond::AE, lhs, rhs, dst);
+      return true;
+
+    case Opcode::F32Add: case Opcode::F64Add:
+      EmitFloatBinop(wide, 0x58, lhs, rhs, dst);
+      return true;
+    case Opcode::F32Sub: case Opcode::F64Sub:
+      EmitFloatBinop(wide, 0x5c, lhs, rhs, dst);
+      return true;
+    case Opcode::F32Mul: case Opcode::F64Mul:
+      EmitFloatBinop(wide, 0x59, lhs, rhs, dst);
+      return true;
+    case Opcode::F32Div: case Opcode::F64Div:
+      // Division by zero gives the same infinities and NaNs as in wasm.
+      EmitFloatBinop(wide, 0x5e, lhs, rhs, dst);
+      return true;
+
+    case Opcode::F32Eq: case Opcode::F64Eq:
+    case Opcode::F32Ne: case Opcode::F64Ne:
+    case Opcode::F32Lt: case Opcode::F64Lt:
+    case Opcode::F32Gt: case Opcode::F64Gt:
+    case Opcode::F32Le: case Opcode::F64Le:
+    case Opcode::F32Ge: case Opcode::F64Ge:
+      EmitFloatCompare(wide, opcode, lhs, rhs, dst);
+      return true;
+
+    case Opcode::F32Copysign:
+    case Opcode::F64Copysign:
+      if (wide) {
+        a_.MovImm64(RDX, kF64SignMask);
+      } else {
+        a_.MovImm32(RDX, kF32SignMask);
+      }
+      a_.Load(wide, RCX, RBX, Slot(rhs));
+      a_.Alu(wide, AND, RCX, RDX);
+      a_.RegReg(0, wide, {0xf7}, 2, RDX);  // not
+      a_.Load(wide, RAX, RBX, Slot(lhs));
+      a_.Alu(wide, AND, RAX, RDX);
+      a_.Alu(wide, OR, RAX, RCX);
+      a_.Store(wide, RBX, Slot(dst), RAX);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool JitCompiler::EmitUnop(Opcode opcode, int slot) {
+  bool wide = opcode.GetResultType() == Type::I64 ||
+              opcode.GetResultType() == Type::F64;
+  switch (opcode) {
+    case Opcode::I32Eqz:
+    case Opcode::I64Eqz: {
+      bool wide_param = opcode == Opcode::I64Eqz;
+      a_.Load(wide_param, RAX, RBX, Slot(slot));
+      a_.Alu(wide_param, TEST, RAX, RAX);
+      a_.SetccMovzx(Cond::E, RAX);
+      a_.Store(false, RBX, Slot(slot), RAX);
+      return true;
+    }
+
+    case Opcode::I32Clz:
+    case Opcode::I64Clz:
+      // bsr leaves the destination undefined for 0, where clz is the width.
+      a_.Load(wide, RAX, RBX, Slot(slot));
+      a_.MovImm64(RCX, ~uint64_t(0));
+      a_.RegReg(0, wide, {0x0f, 0xbd}, RAX, RAX);  // bsr
+      a_.Cmov(wide, Cond::E, RAX, RCX);
+      a_.MovImm32(RDX, wide ? 63 : 31);
+      a_.Alu(wide, SUB, RDX, RAX);
+      a_.Store(wide, RBX, Slot(slot), RDX);
+      return true;
+
+    case Opcode::I32Ctz:
+    case Opcode::I64Ctz:
+      a_.Load(wide, RAX, RBX, Slot(slot));
+      a_.MovImm32(RCX, wide ? 64 : 32);
+      a_.RegReg(0, wide, {0x0f, 0xbc}, RAX, RAX);  // bsf
+      a_.Cmov(wide, Cond::E, RAX, RCX);
+      a_.Store(wide, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::I32Extend8S:
+    case Opcode::I64Extend8S:
+      a_.RegMem(0, wide, {0x0f, 0xbe}, RAX, RBX, Slot(slot));  // movsx
+      a_.Store(wide, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::I32Extend16S:
+    case Opcode::I64Extend16S:
+      a_.RegMem(0, wide, {0x0f, 0xbf}, RAX, RBX, Slot(slot));  // movsx
+      a_.Store(wide, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::I64Extend32S:
+    case Opcode::I64ExtendI32S:
+      a_.RegMem(0, true, {0x63}, RAX, RBX, Slot(slot));  // movsxd
+      a_.Store(true, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::I64ExtendI32U:
+      a_.Load(false, RAX, RBX, Slot(slot));
+      a_.Store(true, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::I32WrapI64:
+    case Opcode::I32ReinterpretF32:
+    case Opcode::I64ReinterpretF64:
+    case Opcode::F32ReinterpretI32:
+    case Opcode::F64ReinterpretI64:
+      // The low bits of the slot already hold the result.
+      return true;
+
+    case Opcode::F32Neg:
+    case Opcode::F32Abs:
+      a_.Load(false, RAX, RBX, Slot(slot));
+      if (opcode == Opcode::F32Neg) {
+        a_.AluImm(false, XOR_IMM, RAX, kF32SignMask);
+      } else {
+        a_.AluImm(false, AND_IMM, RAX, ~kF32SignMask);
+      }
+      a_.Store(false, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::F64Neg:
+    case Opcode::F64Abs:
+      a_.MovImm64(RCX, opcode == Opcode::F64Neg ? kF64SignMask : ~kF64SignMask);
+      a_.Load(true, RAX, RBX, Slot(slot));
+      a_.Alu(true, opcode == Opcode::F64Neg ? XOR : AND, RAX, RCX);
+      a_.Store(true, RBX, Slot(slot), RAX);
+      return true;
+
+    case Opcode::F32Sqrt:
+    case Opcode::F64Sqrt: {
+      uint8_t prefix = wide ? 0xf2 : 0xf3;
+      a_.RegMem(prefix, false, {0x0f, 0x51}, XMM0, RBX, Slot(slot));  // sqrts
+      a_.RegMem(prefix, false, {0x0f, 0x11}, XMM0, RBX, Slot(slot));  // movs
+      EmitCanonicalizeNan(wide, slot);
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+void JitCompiler::EmitInstr(IstreamOffset offset, int height) {
+  const uint8_t* pc = istream_ + offset;
+  Opcode opcode = ReadOpcode(&pc);
+  switch (opcode) {
+    case Opcode::Nop:
+    case Opcode::Drop:
+      break;
+
+    case Opcode::Unreachable:
+      EmitTrap(ResultType::TrapUnreachable);
+      break;
+
+    case Opcode::Return:
+      EmitReturn(height);
+      break;
+
+    case Opcode::Br:
+      EmitBranch(ReadU32(&pc));
+      break;
+
+    case Opcode::BrIf:
+    case Opcode::InterpBrUnless:
+      a_.Load(false, RAX, RBX, Slot(height - 1));
+      a_.Alu(false, TEST, RAX, RAX);
+      EmitBranch(opcode == Opcode::BrIf ? Cond::NE : Cond::E, ReadU32(&pc));
+      break;
+
+    case Opcode::InterpI32CompareBrUnless: {
+      Opcode compare = ReadOpcode(&pc);
+      IstreamOffset target = ReadU32(&pc);
+      Cond cond;
+      if (compare == Opcode::I32Eqz) {
+        a_.Load(false, RAX, RBX, Slot(height - 1));
+        a_.Alu(false, TEST, RAX, RAX);
+        cond = Cond::E;
+      } else {
+        a_.Load(false, RAX, RBX, Slot(height - 2));
+        a_.Load(false, RCX, RBX, Slot(height - 1));
+        a_.Alu(false, CMP, RAX, RCX);
+        switch (compare) {
+          case Opcode::I32Eq: cond = Cond::E; break;
+          case Opcode::I32Ne: cond = Cond::NE; break;
+          case Opcode::I32LtS: cond = Cond::L; break;
+          case Opcode::I32LtU: cond = Cond::B; break;
+          case Opcode::I32GtS: cond = Cond::G; break;
+          case Opcode::I32GtU: cond = Cond::A; break;
+          case Opcode::I32LeS: cond = Cond::LE; break;
+          case Opcode::I32LeU: cond = Cond::BE; break;
+          case Opcode::I32GeS: cond = Cond::GE; break;
+          default: cond = Cond::AE; break;
+        }
+      }
+      EmitBranch(Negate(cond), target);
+      break;
+    }
+
+    case Opcode::BrTable: {
+      Index num_targets = ReadU32(&pc);
+      IstreamOffset table_offset = ReadU32(&pc);
+      a_.Load(false, RAX, RBX, Slot(height - 1));
+      for (Index i = 0; i <= num_targets; ++i) {
+        IstreamOffset target;
+        uint32_t drop_count;
+        uint32_t keep_count;
+        ReadTableEntryAt(istream_ + table_offset + i * WABT_TABLE_ENTRY_SIZE,
+                         &target, &drop_count, &keep_count);
+        if (i == num_targets) {
+          EmitDropKeep(height - 1, drop_count, keep_count);
+          EmitBranch(target);
+        } else if (drop_count == 0) {
+          a_.AluImm(false, CMP_IMM, RAX, i);
+          EmitBranch(Cond::E, target);
+        } else {
+          a_.AluImm(false, CMP_IMM, RAX, i);
+          size_t next = a_.Jcc(Cond::NE);
+          EmitDropKeep(height - 1, drop_count, keep_count);
+          EmitBranch(target);
+          a_.Bind(next);
+          // EmitDropKeep clobbers rax.
+          a_.Load(false, RAX, RBX, Slot(height - 1));
+        }
+      }
+      break;
+    }
+
+    case Opcode::Select:
+    case Opcode::SelectT: {
+      a_.Load(false, RAX, RBX, Slot(height - 1));
+      a_.Alu(false, TEST, RAX, RAX);
+      size_t skip = a_.Jcc(Cond::NE);
+      EmitCopySlot(height - 2, height - 3);
+      a_.Bind(skip);
+      break;
+    }
+
+    case Opcode::I32Const:
+    case Opcode::F32Const:
+      a_.Store32Imm(RBX, Slot(height), ReadU32(&pc));
+      break;
+
+    case Opcode::I64Const:
+    case Opcode::F64Const:
+      a_.MovImm64(RAX, ReadU64(&pc));
+      a_.Store(true, RBX, Slot(height), RAX);
+      break;
+
+    case Opcode::LocalGet:
+      EmitCopySlot(height - ReadU32(&pc), height);
+      break;
+
+    case Opcode::LocalSet:
+      EmitCopySlot(height - 1, height - 1 - ReadU32(&pc));
+      break;
+
+    case Opcode::LocalTee:
+      EmitCopySlot(height - 1, height - ReadU32(&pc));
+      break;
+
+    case Opcode::InterpConsumeFuel: {
+      // The fuel is left as it is if there isn't enough.
+      a_.Load(true, RAX, RBP, kContextFuel);
+      a_.Load(true, RCX, RAX, 0);
+      a_.MovImm32(RDX, ReadU32(&pc));
+      a_.Alu(true, SUB, RCX, RDX);
+      EmitTrap(Cond::B, ResultType::TrapOutOfFuel);
+      a_.Store(true, RAX, 0, RCX);
+      break;
+    }
+
+    case Opcode::InterpAlloca: {
+      uint32_t count = ReadU32(&pc);
+      if (count != 0) {
+        // rep stosq
+        a_.Lea(RDI, RBX, Slot(height));
+        a_.MovImm32(RCX, count * sizeof(ValueSlot) / sizeof(uint64_t));
+        a_.Alu(false, XOR, RAX, RAX);
+        a_.U8(0xf3);
+        a_.U8(0x48);
+        a_.U8(0xab);
+      }
+      break;
+    }
+
+    case Opcode::InterpDropKeep: {
+      uint32_t drop_count = ReadU32(&pc);
+      uint32_t keep_count = ReadU32(&pc);
+      EmitDropKeep(height, drop_count, keep_count);
+      break;
+    }
+
+    case Opcode::Call: {
+      Index func_index;
+      GetCallee(ReadU32(&pc), &func_index);
+      EmitHelperCall(reinterpret_cast<uintptr_t>(&Thread::JitCall), height,
+                     func_index, 0);
+      break;
+    }
+
+    case Opcode::CallIndirect:
+      // The Thread reads the operands itself, so it can use and update the
+      // call site's inline cache.
+      EmitHelperCall(reinterpret_cast<uintptr_t>(&Thread::JitCallIndirect),
+                     height, pc - istream_, 0);
+      break;
+
+    case Opcode::MemorySize:
+      a_.Load(true, RAX, RBP, kContextMemorySize);
+      a_.RegReg(0, true, {0xc1}, SHR, RAX);  // shr rax, 16
+      a_.U8(16);
+      a_.Store(false, RBX, Slot(height), RAX);
+      break;
+
+    case Opcode::InterpRegBinop: {
+      Opcode binop = ReadOpcode(&pc);
+      int lhs = height - ReadU32(&pc);
+      int rhs = height - ReadU32(&pc);
+      if (!EmitBinop(binop, lhs, rhs, height)) {
+        EmitStep(offset, height);
+      }
+      break;
+    }
+
+    case Opcode::InterpRegBinopSet: {
+      Opcode binop = ReadOpcode(&pc);
+      int dst = height - ReadU32(&pc);
+      int lhs = height - ReadU32(&pc);
+      int rhs = height - ReadU32(&pc);
+      if (!EmitBinop(binop, lhs, rhs, dst)) {
+        EmitStep(offset, height);
+      }
+      break;
+    }
+
+    case Opcode::InterpI32AddLocals: {
+      int lhs = height - ReadU32(&pc);
+      int rhs = height - ReadU32(&pc);
+      EmitBinop(Opcode::I32Add, lhs, rhs, height);
+      break;
+    }
+
+    case Opcode::InterpI32AddConst:
+      a_.Load(false, RAX, RBX, Slot(height - 1));
+      a_.AluImm(false, ADD_IMM, RAX, ReadU32(&pc));
+      a_.Store(false, RBX, Slot(height - 1), RAX);
+      break;
+
+    case Opcode::InterpI32LoadLocal: {
+      int addr_slot = height - ReadU32(&pc);
+      ReadU32(&pc);
+      EmitLoad(Opcode::I32Load, addr_slot, ReadU32(&pc), height);
+      break;
+    }
+
+    default:
+      if (opcode.GetMemorySize() != 0) {
+        ReadU32(&pc);
+        uint32_t mem_offset = ReadU32(&pc);
+        if (opcode.GetResultType() != Type::Void) {
+          EmitLoad(opcode, height - 1, mem_offset, height - 1);
+        } else {
+          EmitStore(opcode, height, mem_offset);
+        }
+      } else if (IsNumeric(opcode) && GetNumericStackDelta(opcode) == 0) {
+        if (!EmitUnop(opcode, height - 1)) {
+          EmitStep(offset, height);
+        }
+      } else if (IsNumeric(opcode)) {
+        if (!EmitBinop(opcode, height - 2, height - 1, height - 2)) {
+          EmitStep(offset, height);
+        }
+      } else {
+        // global.get, global.set, memory.grow and calls to host functions.
+        EmitStep(offset, height);
+      }
+      break;
+  }
+}
+
+std::unique_ptr<JitCode> CompileJit(Environment* env, DefinedFunc* func) {
+  JitCompiler compiler(env, func);
+  return compiler.Compile();
+}
+
+#else
+
+std::unique_ptr<JitCode> CompileJit(Environment*, DefinedFunc*) {
+  return nullptr;
+}
+
+#endif  // WABT_INTERP_JIT
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_JIT_H_
+#define WABT_INTERP_JIT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "src/common.h"
+#include "src/interp/interp.h"
+
+// Machine code is only generated for x86-64 with the System V calling
+// convention, in pages from mmap.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define WABT_INTERP_JIT 1
+#else
+#define WABT_INTERP_JIT 0
+#endif
+
+namespace wabt {
+namespace interp {
+
+// The state shared by a Thread and the machine code it runs. The code keeps
+// its values in the Thread's value stack, in the same slots the interpreter
+// would use, so it can call back into the Thread for anything it doesn't
+// handle itself.
+struct JitContext {
+  Thread* thread;
+  // The top of the value stack, on entry and exit, and whenever the code calls
+  // back into the Thread.
+  ValueSlot* sp;
+  // The code traps with ValueStackExhausted instead of pushing past this.
+  ValueSlot* stack_end;
+  // The memory the function accesses, or null. The Thread updates the data
+  // and size whenever the code calls back into it, since the memory may have
+  // grown in the meantime.
+  Memory* memory;
+  char* memory_data;
+  uint64_t memory_size;
+  // Where the Thread stores the message of a trap that happened in a call
+  // back into it.
+  Result* trap;
+  // The Thread's fuel, for functions lowered with LoweringOptions::fuel.
+  uint64_t* fuel;
+};
+
+// Machine code compiled from the istream of a single function.
+class JitCode {
+ public:
+  // Runs the function to completion, with its arguments at the top of the
+  // value stack, and returns a ResultType: Ok with the results at the top of
+  // the value stack, or a trap.
+  typedef uint32_t (*Entry)(JitContext*);
+
+  JitCode(void* data, size_t size, Index memory_index);
+  ~JitCode();
+
+  Entry entry() const { return reinterpret_cast<Entry>(data_); }
+  size_t size() const { return size_; }
+  // The environment's index of the memory that the code accesses, or
+  // kInvalidIndex.
+  Index memory_index() const { return memory_index_; }
+
+ private:
+  WABT_DISALLOW_COPY_AND_ASSIGN(JitCode);
+
+  void* data_;
+  size_t size_;
+  Index memory_index_;
+};
+
+// Compiles |func|, which must have been lowered with LoweringOptions::jit.
+// Returns null if the function contains an instruction that the JIT doesn't
+// support, e.g. SIMD or atomics, in which case it should be interpreted.
+std::unique_ptr<JitCode> CompileJit(Environment*, DefinedFunc*);
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif /* WABT_INTERP_JIT_H_ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+
+#include "src/cast.h"
+#include "src/stream.h"
+
+namespace wabt {
+namespace interp {
+
+namespace {
+
+uint64_t MakeEdgeKey(Index caller, Index callee) {
+  return (static_cast<uint64_t>(caller) << 32) | callee;
+}
+
+double GetPercent(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+}  // end anonymous namespace
+
+Profiler::Profiler(Environment* env, uint32_t sample_interval)
+    : env_(env), sample_interval_(std::max(sample_interval, 1u)) {}
+
+void Profiler::UpdateFuncOffsets() {
+  func_offsets_.clear();
+  for (Index i = 0; i < env_->GetFuncCount(); ++i) {
+    auto* func = dyn_cast<DefinedFunc>(env_->GetFunc(i));
+    if (!func || func->offset == kInvalidIstreamOffset) {
+      continue;
+    }
+    func_offsets_.emplace_back(func->offset, i);
+    if (func->stub_offset != kInvalidIstreamOffset && func->is_compiled()) {
+      func_offsets_.emplace_back(func->stub_offset, i);
+    }
+  }
+  std::sort(func_offsets_.begin(), func_offsets_.end());
+  func_offsets_istream_size_ = env_->istream().size();
+}
+
+Index Profiler::GetFuncIndex(IstreamOffset offset) {
+  if (env_->istream().size() != func_offsets_istream_size_) {
+    UpdateFuncOffsets();
+  }
+  auto iter = std::upper_bound(
+      func_offsets_.begin(), func_offsets_.end(),
+      std::make_pair(offset, kInvalidIndex));
+  if (iter == func_offsets_.begin()) {
+    return kInvalidIndex;
+  }
+  return (iter - 1)->second;
+}
+
+Profiler::FuncProfile& Profiler::GetOrAddFuncProfile(Index func_index) {
+  if (func_index >= funcs_.size()) {
+    funcs_.resize(func_index + 1);
+  }
+  return funcs_[func_index];
+}
+
+void Profiler::OnCall(IstreamOffset caller_pc, IstreamOffset callee_offset) {
+  Index caller = caller_pc == kInvalidIstreamOffset ? kInvalidIndex
+                                                    : GetFuncIndex(caller_pc);
+  Index callee = GetFuncIndex(callee_offset);
+  if (callee == kInvalidIndex) {
+    return;
+  }
+  GetOrAddFuncProfile(callee).calls++;
+  edges_[MakeEdgeKey(caller, callee)]++;
+}
+
+void Profiler::OnSampleBegin(IstreamOffset pc,
+                             const IstreamOffset* call_stack,
+                             uint32_t call_stack_size) {
+  sample_stack_.clear();
+  for (uint32_t i = 0; i < call_stack_size; ++i) {
+    // Calls from machine code leave an entry with no return address.
+    if (call_stack[i] != kInvalidIstreamOffset) {
+      sample_stack_.push_back(GetFuncIndex(call_stack[i]));
+    }
+  }
+  sample_stack_.push_back(GetFuncIndex(pc));
+}
+
+void Profiler::OnSampleEnd(uint64_t num_instructions) {
+  if (num_instructions == 0 || sample_stack_.back() == kInvalidIndex) {
+    return;
+  }
+  total_instructions_ += num_instructions;
+
+  GetOrAddFuncProfile(sample_stack_.back()).self_instructions +=
+      num_instructions;
+  // Each function on the stack is charged once per sample, however many
+  // frames it has.
+  ++sample_count_;
+  for (Index func_index : sample_stack_) {
+    if (func_index == kInvalidIndex) {
+      continue;
+    }
+    FuncProfile& profile = GetOrAddFuncProfile(func_index);
+    if (last_sample_.size() < funcs_.size()) {
+      last_sample_.resize(funcs_.size());
+    }
+    if (last_sample_[func_index] != sample_count_) {
+      last_sample_[func_index] = sample_count_;
+      profile.total_instructions += num_instructions;
+    }
+  }
+  stacks_[sample_stack_] += num_instructions;
+}
+
+Profiler::FuncProfile Profiler::GetFuncProfile(Index func_index) const {
+  return func_index < funcs_.size() ? funcs_[func_index] : FuncProfile();
+}
+
+uint64_t Profiler::GetCallCount(Index caller_func_index,
+                                Index callee_func_index) const {
+  auto iter = edges_.find(MakeEdgeKey(caller_func_index, callee_func_index));
+  return iter == edges_.end() ? 0 : iter->second;
+}
+
+std::string Profiler::GetFuncName(Index func_index) const {
+  if (func_index == kInvalidIndex) {
+    return "<unknown>";
+  }
+  for (Index i = 0; i < env_->GetModuleCount(); ++i) {
+    for (const Export& export_ : env_->GetModule(i)->exports) {
+      if (export_.kind == ExternalKind::Func && export_.index == func_index) {
+        return export_.name;
+      }
+    }
+  }
+  return StringPrintf("func[%" PRIindex "]", func_index);
+}
+
+void Profiler::WriteFoldedStacks(Stream* stream) const {
+  for (const auto& pair : stacks_) {
+    const char* separator = "";
+    for (Index func_index : pair.first) {
+      std::string name = GetFuncName(func_index);
+      // These separate the frames and the count.
+      std::replace(name.begin(), name.end(), ';', '_');
+      std::replace(name.begin(), name.end(), ' ', '_');
+      stream->Writef("%s%s", separator, name.c_str());
+      separator = ";";
+    }
+    stream->Writef(" %" PRIu64 "\n", pair.second);
+  }
+}
+
+void Profiler::WriteReport(Stream* stream, size_t count) const {
+  std::vector<Index> func_indexes;
+  for (Index i = 0; i < funcs_.size(); ++i) {
+    if (funcs_[i].calls != 0 || funcs_[i].total_instructions != 0) {
+      func_indexes.push_back(i);
+    }
+  }
+  std::stable_sort(func_indexes.begin(), func_indexes.end(),
+                   [&](Index lhs, Index rhs) {
+                     return funcs_[lhs].self_instructions >
+                            funcs_[rhs].self_instructions;
+                   });
+  if (func_indexes.size() > count) {
+    func_indexes.resize(count);
+  }
+
+  stream->Writef("%" PRIu64 " instructions, sampled every %u\n",
+                 total_instructions_, sample_interval_);
+  stream->Writef("%12s %12s %6s %12s %6s  %s\n", "calls", "self", "self%",
+                 "total", "total%", "function");
+  for (Index func_index : func_indexes) {
+    const FuncProfile& profile = funcs_[func_index];
+    stream->Writef(
+        "%12" PRIu64 " %12" PRIu64 " %6.2f %12" PRIu64 " %6.2f  %s\n",
+        profile.calls, profile.self_instructions,
+        GetPercent(profile.self_instructions, total_instructions_),
+        profile.total_instructions,
+        GetPercent(profile.total_instructions, total_instructions_),
+        GetFuncName(func_index).c_str());
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> edges(edges_.begin(),
+                                                   edges_.end());
+  // Most calls first, then by caller and callee, so the order is stable.
+  std::sort(edges.begin(), edges.end(),
+            [](const std::pair<uint64_t, uint64_t>& lhs,
+               const std::pair<uint64_t, uint64_t>& rhs) {
+              return lhs.second != rhs.second ? lhs.second > rhs.second
+                                              : lhs.first < rhs.first;
+            });
+  if (edges.size() > count) {
+    edges.resize(count);
+  }
+
+  stream->Writef("\n%12s  %s\n", "calls", "caller -> callee");
+  for (const auto& edge : edges) {
+    Index caller = edge.first >> 32;
+    Index callee = static_cast<Index>(edge.first);
+    std::string caller_name =
+        caller == kInvalidIndex ? "<host>" : GetFuncName(caller);
+    stream->Writef("%12" PRIu64 "  %s -> %s\n", edge.second,
+                   caller_name.c_str(), GetFuncName(callee).c_str());
+  }
+}
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_PROFILER_H_
+#define WABT_INTERP_PROFILER_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/common.h"
+#include "src/interp/interp.h"
+
+namespace wabt {
+
+class Stream;
+
+namespace interp {
+
+// Collects a profile of the defined functions that Threads with
+// Thread::Options::profiler run. Calls and caller-callee edges are counted
+// exactly. Instructions are sampled: every |sample_interval| instructions the
+// Thread's call stack is charged for the instructions it runs until the next
+// sample, so the counts are exact with an interval of 1 and approximate, but
+// much cheaper, with larger ones. A Profiler must not be used by Threads that
+// run at the same time.
+class Profiler {
+ public:
+  static const uint32_t kDefaultSampleInterval = 1000;
+
+  struct FuncProfile {
+    uint64_t calls = 0;
+    // Instructions run in the function itself.
+    uint64_t self_instructions = 0;
+    // Instructions run in the function and everything it calls. Recursive
+    // calls are only counted once.
+    uint64_t total_instructions = 0;
+  };
+
+  explicit Profiler(Environment*,
+                    uint32_t sample_interval = kDefaultSampleInterval);
+
+  uint32_t sample_interval() const { return sample_interval_; }
+  uint64_t total_instructions() const { return total_instructions_; }
+
+  // Called by the Thread. |caller_pc| is an offset in the calling function,
+  // or kInvalidIstreamOffset for calls into the Thread from outside.
+  void OnCall(IstreamOffset caller_pc, IstreamOffset callee_offset);
+  // |call_stack| holds the return addresses of the frames below the one at
+  // |pc|, outermost first. The next OnSampleEnd charges this stack.
+  void OnSampleBegin(IstreamOffset pc,
+                     const IstreamOffset* call_stack,
+                     uint32_t call_stack_size);
+  void OnSampleEnd(uint64_t num_instructions);
+
+  // Indexes are of functions in the environment. Functions that were never
+  // seen have an empty profile.
+  FuncProfile GetFuncProfile(Index func_index) const;
+  uint64_t GetCallCount(Index caller_func_index, Index callee_func_index) const;
+
+  // Returns the name of the first export of the function, or "func[N]".
+  std::string GetFuncName(Index func_index) const;
+  // Returns the index of the defined function whose body contains |offset|,
+  // or kInvalidIndex.
+  Index GetFuncIndex(IstreamOffset offset);
+
+  // Writes one line for each call stack that was sampled, with its frames
+  // outermost first and separated by ';', followed by its instruction count.
+  // This is the "folded" format that flame graph tools read.
+  void WriteFoldedStacks(Stream*) const;
+  // Writes a table of the |count| functions with the most instructions of
+  // their own, then the |count| most frequent caller-callee edges.
+  void WriteReport(Stream*, size_t count) const;
+
+ private:
+  WABT_DISALLOW_COPY_AND_ASSIGN(Profiler);
+
+  void UpdateFuncOffsets();
+  FuncProfile& GetOrAddFuncProfile(Index func_index);
+
+  Environment* env_;
+  uint32_t sample_interval_;
+  uint64_t total_instructions_ = 0;
+  std::vector<FuncProfile> funcs_;
+  // Keyed by the caller's index in the high 32 bits and the callee's in the
+  // low ones. Calls from outside have kInvalidIndex as the caller.
+  std::unordered_map<uint64_t, uint64_t> edges_;
+  std::map<std::vector<Index>, uint64_t> stacks_;
+
+  // The start of each defined function's body and lazy compilation stub,
+  // sorted, so that an offset belongs to the last one that starts at or
+  // before it. It is rebuilt when the istream grows, since modules and lazily
+  // compiled bodies are appended to it.
+  std::vector<std::pair<IstreamOffset, Index>> func_offsets_;
+  size_t func_offsets_istream_size_ = 0;
+
+  // The stack of the current sample, and scratch space for charging it.
+  std::vector<Index> sample_stack_;
+  std::vector<uint64_t> last_sample_;
+  uint64_t sample_count_ = 0;
+};
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif /* WABT_INTERP_PROFILER_H_ */
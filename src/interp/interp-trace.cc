@@ -41,6 +41,10 @@ void Thread::Trace(Stream* stream) {
       stream->Writef("%s %u, %%[-2], %%[-1]\n", opcode.GetName(), Pick(3).i32);
       break;
 
+    case Opcode::InterpSelectV128:
+      stream->Writef("%s %u, %%[-2], %%[-1]\n", opcode.GetName(), Top().i32);
+      break;
+
     case Opcode::Br:
       stream->Writef("%s @%u\n", opcode.GetName(), ReadU32At(pc));
       break;
@@ -114,6 +118,8 @@ void Thread::Trace(Stream* stream) {
       break;
 
     case Opcode::InterpCallHost:
+    case Opcode::InterpCompile:
+    case Opcode::InterpFuncEntry:
       stream->Writef("%s $%u\n", opcode.GetName(), ReadU32At(pc));
       break;
 
@@ -274,9 +280,9 @@ void Thread::Trace(Stream* stream) {
     case Opcode::V128Store: {
       const Index memory_index = ReadU32(&pc);
       stream->Writef("%s $%" PRIindex ":%u+$%u, $0x%08x 0x%08x 0x%08x 0x%08x\n",
-                     opcode.GetName(), memory_index, Pick(2).i32, ReadU32At(pc),
-                     Pick(1).vec128.v[0], Pick(1).vec128.v[1],
-                     Pick(1).vec128.v[2], Pick(1).vec128.v[3]);
+                     opcode.GetName(), memory_index, Pick(3).i32, ReadU32At(pc),
+                     PickV128(1).v[0], PickV128(1).v[1],
+                     PickV128(1).v[2], PickV128(1).v[3]);
       break;
     }
 
@@ -470,6 +476,7 @@ void Thread::Trace(Stream* stream) {
       break;
 
     case Opcode::InterpAlloca:
+    case Opcode::InterpConsumeFuel:
       stream->Writef("%s $%u\n", opcode.GetName(), ReadU32At(pc));
       break;
 
@@ -478,6 +485,52 @@ void Thread::Trace(Stream* stream) {
                      Top().i32);
       break;
 
+    case Opcode::InterpRegBinop: {
+      const Opcode binop(static_cast<Opcode::Enum>(ReadU32At(pc)));
+      stream->Writef("%s %s $%u, $%u\n", opcode.GetName(), binop.GetName(),
+                     ReadU32At(pc + 4), ReadU32At(pc + 8));
+      break;
+    }
+
+    case Opcode::InterpRegBinopSet: {
+      const Opcode binop(static_cast<Opcode::Enum>(ReadU32At(pc)));
+      stream->Writef("%s %s $%u, $%u, $%u\n", opcode.GetName(),
+                     binop.GetName(), ReadU32At(pc + 4), ReadU32At(pc + 8),
+                     ReadU32At(pc + 12));
+      break;
+    }
+
+    case Opcode::InterpI32AddLocals:
+      stream->Writef("%s $%u, $%u\n", opcode.GetName(), ReadU32At(pc),
+                     ReadU32At(pc + 4));
+      break;
+
+    case Opcode::InterpI32AddConst:
+      stream->Writef("%s %u, %u\n", opcode.GetName(), Top().i32,
+                     ReadU32At(pc));
+      break;
+
+    case Opcode::InterpI32LoadLocal: {
+      const uint32_t slot = ReadU32(&pc);
+      const Index memory_index = ReadU32(&pc);
+      stream->Writef("%s $%" PRIindex ":%u+$%u\n", opcode.GetName(),
+                     memory_index, Pick(slot).i32, ReadU32At(pc));
+      break;
+    }
+
+    case Opcode::InterpI32CompareBrUnless: {
+      const Opcode compare(static_cast<Opcode::Enum>(ReadU32At(pc)));
+      if (compare == Opcode::I32Eqz) {
+        stream->Writef("%s %s @%u, %u\n", opcode.GetName(), compare.GetName(),
+                       ReadU32At(pc + 4), Top().i32);
+      } else {
+        stream->Writef("%s %s @%u, %u, %u\n", opcode.GetName(),
+                       compare.GetName(), ReadU32At(pc + 4), Pick(2).i32,
+                       Pick(1).i32);
+      }
+      break;
+    }
+
     case Opcode::InterpDropKeep:
       stream->Writef("%s $%u $%u\n", opcode.GetName(), ReadU32At(pc),
                      ReadU32At(pc + 4));
@@ -520,8 +573,8 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I32X4WidenLowI16X8U:
     case Opcode::I32X4WidenHighI16X8U: {
       stream->Writef("%s $0x%08x 0x%08x 0x%08x 0x%08x\n", opcode.GetName(),
-                     Top().vec128.v[0], Top().vec128.v[1],
-                     Top().vec128.v[2], Top().vec128.v[3]);
+                     PickV128(1).v[0], PickV128(1).v[1],
+                     PickV128(1).v[2], PickV128(1).v[3]);
       break;
     }
 
@@ -529,12 +582,12 @@ void Thread::Trace(Stream* stream) {
       stream->Writef(
           "%s $0x%08x %08x %08x %08x $0x%08x %08x %08x %08x $0x%08x %08x %08x "
           "%08x\n",
-          opcode.GetName(), Pick(3).vec128.v[0], Pick(3).vec128.v[1],
-          Pick(3).vec128.v[2], Pick(3).vec128.v[3],
-          Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-          Pick(2).vec128.v[2], Pick(2).vec128.v[3],
-          Pick(1).vec128.v[0], Pick(1).vec128.v[1],
-          Pick(1).vec128.v[2], Pick(1).vec128.v[3]);
+          opcode.GetName(), PickV128(5).v[0], PickV128(5).v[1],
+          PickV128(5).v[2], PickV128(5).v[3],
+          PickV128(3).v[0], PickV128(3).v[1],
+          PickV128(3).v[2], PickV128(3).v[3],
+          PickV128(1).v[0], PickV128(1).v[1],
+          PickV128(1).v[2], PickV128(1).v[3]);
       break;
 
     case Opcode::I8X16ExtractLaneS:
@@ -546,9 +599,9 @@ void Thread::Trace(Stream* stream) {
     case Opcode::F32X4ExtractLane:
     case Opcode::F64X2ExtractLane: {
       stream->Writef("%s : LaneIdx %d From $0x%08x 0x%08x 0x%08x 0x%08x\n",
-                     opcode.GetName(), ReadU8At(pc), Top().vec128.v[0],
-                     Top().vec128.v[1], Top().vec128.v[2],
-                     Top().vec128.v[3]);
+                     opcode.GetName(), ReadU32At(pc), PickV128(1).v[0],
+                     PickV128(1).v[1], PickV128(1).v[2],
+                     PickV128(1).v[3]);
       break;
     }
 
@@ -557,34 +610,34 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I32X4ReplaceLane: {
       stream->Writef(
           "%s : Set %u to LaneIdx %d In $0x%08x 0x%08x 0x%08x 0x%08x\n",
-          opcode.GetName(), Pick(1).i32, ReadU8At(pc), Pick(2).vec128.v[0],
-          Pick(2).vec128.v[1], Pick(2).vec128.v[2],
-          Pick(2).vec128.v[3]);
+          opcode.GetName(), Pick(1).i32, ReadU32At(pc), PickV128(2).v[0],
+          PickV128(2).v[1], PickV128(2).v[2],
+          PickV128(2).v[3]);
       break;
     }
     case Opcode::I64X2ReplaceLane: {
       stream->Writef("%s : Set %" PRIu64
                      " to LaneIdx %d In $0x%08x 0x%08x 0x%08x 0x%08x\n",
-                     opcode.GetName(), Pick(1).i64, ReadU8At(pc),
-                     Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-                     Pick(2).vec128.v[2], Pick(2).vec128.v[3]);
+                     opcode.GetName(), Pick(1).i64, ReadU32At(pc),
+                     PickV128(2).v[0], PickV128(2).v[1],
+                     PickV128(2).v[2], PickV128(2).v[3]);
       break;
     }
     case Opcode::F32X4ReplaceLane: {
       stream->Writef(
           "%s : Set %g to LaneIdx %d In $0x%08x 0x%08x 0x%08x 0x%08x\n",
-          opcode.GetName(), Bitcast<float>(Pick(1).f32_bits), ReadU8At(pc),
-          Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-          Pick(2).vec128.v[2], Pick(2).vec128.v[3]);
+          opcode.GetName(), Bitcast<float>(Pick(1).f32_bits), ReadU32At(pc),
+          PickV128(2).v[0], PickV128(2).v[1],
+          PickV128(2).v[2], PickV128(2).v[3]);
 
       break;
     }
     case Opcode::F64X2ReplaceLane: {
       stream->Writef(
           "%s : Set %g to LaneIdx %d In $0x%08x 0x%08x 0x%08x 0x%08x\n",
-          opcode.GetName(), Bitcast<double>(Pick(1).f64_bits), ReadU8At(pc),
-          Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-          Pick(2).vec128.v[2], Pick(2).vec128.v[3]);
+          opcode.GetName(), Bitcast<double>(Pick(1).f64_bits), ReadU32At(pc),
+          PickV128(2).v[0], PickV128(2).v[1],
+          PickV128(2).v[2], PickV128(2).v[3]);
       break;
     }
 
@@ -592,10 +645,10 @@ void Thread::Trace(Stream* stream) {
       stream->Writef(
           "%s $0x%08x %08x %08x %08x $0x%08x %08x %08x %08x : with lane imm: "
           "$0x%08x %08x %08x %08x\n",
-          opcode.GetName(), Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-          Pick(2).vec128.v[2], Pick(2).vec128.v[3],
-          Pick(1).vec128.v[0], Pick(1).vec128.v[1],
-          Pick(1).vec128.v[2], Pick(1).vec128.v[3], ReadU32At(pc),
+          opcode.GetName(), PickV128(3).v[0], PickV128(3).v[1],
+          PickV128(3).v[2], PickV128(3).v[3],
+          PickV128(1).v[0], PickV128(1).v[1],
+          PickV128(1).v[2], PickV128(1).v[3], ReadU32At(pc),
           ReadU32At(pc + 4), ReadU32At(pc + 8), ReadU32At(pc + 12));
       break;
 
@@ -696,11 +749,11 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I8X16AvgrU:
     case Opcode::I16X8AvgrU: {
       stream->Writef("%s $0x%08x %08x %08x %08x  $0x%08x %08x %08x %08x\n",
-                     opcode.GetName(), Pick(2).vec128.v[0],
-                     Pick(2).vec128.v[1], Pick(2).vec128.v[2],
-                     Pick(2).vec128.v[3], Pick(1).vec128.v[0],
-                     Pick(1).vec128.v[1], Pick(1).vec128.v[2],
-                     Pick(1).vec128.v[3]);
+                     opcode.GetName(), PickV128(3).v[0],
+                     PickV128(3).v[1], PickV128(3).v[2],
+                     PickV128(3).v[3], PickV128(1).v[0],
+                     PickV128(1).v[1], PickV128(1).v[2],
+                     PickV128(1).v[3]);
       break;
     }
 
@@ -717,8 +770,8 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I64X2ShrS:
     case Opcode::I64X2ShrU: {
       stream->Writef("%s $0x%08x %08x %08x %08x  $0x%08x\n", opcode.GetName(),
-                     Pick(2).vec128.v[0], Pick(2).vec128.v[1],
-                     Pick(2).vec128.v[2], Pick(2).vec128.v[3],
+                     PickV128(2).v[0], PickV128(2).v[1],
+                     PickV128(2).v[2], PickV128(2).v[3],
                      Pick(1).i32);
       break;
     }
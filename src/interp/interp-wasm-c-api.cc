@@ -16,6 +16,8 @@
 
 #include <wasm.h>
 
+#include "src/interp/interp-wasm-c-api.h"
+
 #include "src/binary-reader.h"
 #include "src/error-formatter.h"
 #include "src/error.h"
@@ -44,7 +46,9 @@ struct wasm_valtype_t {
   wasm_valkind_t kind;
 };
 
-struct wasm_config_t {};
+struct wasm_config_t {
+  MemoryBackend memory_backend = MemoryBackend::Heap;
+};
 
 struct wasm_externtype_t {
   wasm_externkind_t kind;
@@ -90,7 +94,9 @@ struct wasm_exporttype_t {
   std::unique_ptr<wasm_externtype_t> type;
 };
 
-struct wasm_engine_t {};
+struct wasm_engine_t {
+  MemoryBackend memory_backend = MemoryBackend::Heap;
+};
 
 struct wasm_store_t {
   wasm_store_t(Environment* env, Executor* executor)
@@ -670,15 +676,34 @@ void wasm_trap_trace(const wasm_trap_t* trap, wasm_frame_vec_t* out) {
   return;
 }
 
+// wasm_config
+
+wasm_config_t* wasm_config_new() {
+  return new wasm_config_t();
+}
+
+bool wabt_config_set_guard_pages(wasm_config_t* config, bool enable) {
+  assert(config);
+  if (enable && !IsGuardPageMemorySupported()) {
+    return false;
+  }
+  config->memory_backend =
+      enable ? MemoryBackend::GuardPages : MemoryBackend::Heap;
+  return true;
+}
+
 // wasm_engine
 
 wasm_engine_t* wasm_engine_new() {
   return new wasm_engine_t();
 }
 
-wasm_engine_t* wasm_engine_new_with_config(wasm_config_t*) {
-  assert(false);
-  return nullptr;
+wasm_engine_t* wasm_engine_new_with_config(wasm_config_t* config) {
+  assert(config);
+  wasm_engine_t* engine = new wasm_engine_t();
+  engine->memory_backend = config->memory_backend;
+  wasm_config_delete(config);
+  return engine;
 }
 
 // wasm_store
@@ -689,6 +714,7 @@ wasm_store_t* wasm_store_new(wasm_engine_t* engine) {
     s_trace_stream = s_stdout_stream.get();
   }
   Environment* env = new Environment(s_features);
+  env->memory_backend_ = engine->memory_backend;
   Executor* executor = new Executor(env, s_trace_stream, s_thread_options);
   return new wasm_store_t(env, executor);
 }
@@ -1182,7 +1208,8 @@ bool wasm_table_grow(wasm_table_t* t,
 wasm_memory_t* wasm_memory_new(wasm_store_t* store,
                                const wasm_memorytype_t* type) {
   TRACE("wasm_memory_new\n");
-  store->env->EmplaceBackMemory(Limits(type->limits.min, type->limits.max));
+  store->env->EmplaceBackMemory(Limits(type->limits.min, type->limits.max),
+                                store->env->memory_backend_);
   Index index = store->env->GetMemoryCount() - 1;
   auto instance = std::make_shared<WasmInstance>(store, nullptr);
   return new wasm_memory_t(instance, index);
@@ -1211,8 +1238,7 @@ bool wasm_memory_grow(wasm_memory_t* m, wasm_memory_pages_t delta) {
     return false;
   }
   TRACE("wasm_memory_grow %" PRIzx " -> %" PRIzx "\n", cursize, newsize);
-  memory->data.resize(newsize * WABT_PAGE_SIZE);
-  return true;
+  return memory->data.resize(newsize * WABT_PAGE_SIZE);
 }
 
 // wasm_frame
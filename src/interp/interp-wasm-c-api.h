@@ -0,0 +1,40 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* wabt extensions to the wasm C API. */
+
+#ifndef WABT_INTERP_WASM_C_API_H_
+#define WABT_INTERP_WASM_C_API_H_
+
+#include <stdbool.h>
+
+#include <wasm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reserve the address space for each linear memory up front, and catch
+ * out-of-bounds accesses with guard pages instead of bounds checks. Applies
+ * to stores of engines created with this config. Returns false, leaving the
+ * config unchanged, if guard pages aren't supported on this platform. */
+WASM_API_EXTERN bool wabt_config_set_guard_pages(wasm_config_t*, bool enable);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* WABT_INTERP_WASM_C_API_H_ */
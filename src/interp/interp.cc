@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
 #include <cmath>
 #include <limits>
@@ -25,11 +26,35 @@
 #include <vector>
 
 #include "src/interp/interp-internal.h"
+#include "src/interp/interp-jit.h"
+#include "src/interp/interp-profiler.h"
 
 #include "src/cast.h"
 #include "src/stream.h"
 #include "src/type-checker.h"
 
+// Guard pages need mmap, signals, and enough address space to reserve 8GiB per
+// memory.
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && SIZE_MAX > UINT32_MAX
+#define WABT_INTERP_GUARD_PAGES 1
+#else
+#define WABT_INTERP_GUARD_PAGES 0
+#endif
+
+#if WABT_INTERP_GUARD_PAGES
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Copy-on-write memory images are kept in anonymous files from memfd_create.
+#if WABT_INTERP_GUARD_PAGES && defined(__linux__)
+#define WABT_INTERP_MAPPABLE_IMAGES 1
+#else
+#define WABT_INTERP_MAPPABLE_IMAGES 0
+#endif
+
 namespace wabt {
 namespace interp {
 
@@ -170,6 +195,320 @@ void WriteCall(Stream* stream,
   }
 }
 
+const char* GetFusionName(Fusion fusion) {
+  switch (fusion) {
+#define V(Name, name, sequence) \
+  case Fusion::Name:            \
+    return name;
+    WABT_FOREACH_FUSION(V)
+#undef V
+  }
+  WABT_UNREACHABLE;
+}
+
+bool ParseFusionName(string_view name, Fusion* out_fusion) {
+#define V(Name, name_str, sequence) \
+  if (name == name_str) {           \
+    *out_fusion = Fusion::Name;     \
+    return true;                    \
+  }
+  WABT_FOREACH_FUSION(V)
+#undef V
+  return false;
+}
+
+bool GetFusionForSequence(const std::vector<Opcode>& sequence,
+                          Fusion* out_fusion) {
+  if (sequence.size() == 3 && sequence[0] == Opcode::LocalGet &&
+      sequence[1] == Opcode::LocalGet && sequence[2] == Opcode::I32Add) {
+    *out_fusion = Fusion::I32AddLocals;
+    return true;
+  }
+  if (sequence.size() != 2) {
+    return false;
+  }
+  if (sequence[0] == Opcode::I32Const && sequence[1] == Opcode::I32Add) {
+    *out_fusion = Fusion::I32AddConst;
+    return true;
+  }
+  if (sequence[0] == Opcode::LocalGet && sequence[1] == Opcode::I32Load) {
+    *out_fusion = Fusion::I32LoadLocal;
+    return true;
+  }
+  if ((sequence[0] == Opcode::I32Eqz || IsI32Compare(sequence[0])) &&
+      (sequence[1] == Opcode::BrIf || sequence[1] == Opcode::If)) {
+    *out_fusion = Fusion::I32CompareBrUnless;
+    return true;
+  }
+  return false;
+}
+
+FuelCosts::FuelCosts()
+    : costs_(Opcode::Invalid, 1), unit_costs_(Opcode::Invalid, 0) {}
+
+#if WABT_INTERP_GUARD_PAGES
+namespace {
+
+// Every wasm32 access is below 4GiB plus a 4GiB offset, and no access is
+// larger than a page, so this covers them all.
+const size_t kGuardPageReservedSize = (1ull << 33) + WABT_PAGE_SIZE;
+
+// Set while an Executor runs code that can hit guard pages.
+struct GuardPageTrapContext {
+  Environment* env;
+  sigjmp_buf jmp_buf;
+  // Set by the signal handler before it jumps back.
+  Memory* memory;
+};
+
+thread_local GuardPageTrapContext* tl_guard_page_context;
+struct sigaction s_prev_sigsegv_action;
+struct sigaction s_prev_sigbus_action;
+
+void GuardPageSignalHandler(int signal_number, siginfo_t* info, void* ucontext) {
+  // A signal sent with kill has si_code <= 0, and wasn't caused by a fault.
+  GuardPageTrapContext* context = tl_guard_page_context;
+  if (context && info->si_code > 0) {
+    Memory* memory = context->env->FindGuardPageMemory(info->si_addr);
+    if (memory) {
+      context->memory = memory;
+      siglongjmp(context->jmp_buf, 1);
+    }
+  }
+
+  // Not a guard page access, so defer to the previous handler.
+  const struct sigaction& prev_action = signal_number == SIGSEGV
+                                            ? s_prev_sigsegv_action
+                                            : s_prev_sigbus_action;
+  if (prev_action.sa_flags & SA_SIGINFO) {
+    prev_action.sa_sigaction(signal_number, info, ucontext);
+  } else if (prev_action.sa_handler == SIG_DFL ||
+             prev_action.sa_handler == SIG_IGN) {
+    // Returning reruns the faulting instruction, which then gets the default
+    // action. A signal that wasn't caused by a fault has to be raised again,
+    // unless it was ignored.
+    signal(signal_number, SIG_DFL);
+    if (info->si_code <= 0 && prev_action.sa_handler == SIG_DFL) {
+      raise(signal_number);
+    }
+  } else {
+    prev_action.sa_handler(signal_number);
+  }
+}
+
+bool InstallGuardPageSignalHandlerOnce() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = GuardPageSignalHandler;
+  // SA_NODEFER keeps the signal unblocked after siglongjmp leaves the handler,
+  // so sigsetjmp doesn't need to save the signal mask.
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+  // macOS raises SIGBUS for protected pages, other systems raise SIGSEGV.
+  sigaction(SIGSEGV, &action, &s_prev_sigsegv_action);
+  sigaction(SIGBUS, &action, &s_prev_sigbus_action);
+  return true;
+}
+
+void InstallGuardPageSignalHandler() {
+  static bool s_installed = InstallGuardPageSignalHandlerOnce();
+  WABT_USE(s_installed);
+}
+
+}  // end anonymous namespace
+#endif  // WABT_INTERP_GUARD_PAGES
+
+bool IsGuardPageMemorySupported() {
+  return WABT_INTERP_GUARD_PAGES;
+}
+
+MemoryData::MemoryData(size_t size, MemoryBackend backend) {
+#if WABT_INTERP_GUARD_PAGES
+  if (backend == MemoryBackend::GuardPages) {
+    void* reserved =
+        mmap(nullptr, kGuardPageReservedSize, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved != MAP_FAILED) {
+      InstallGuardPageSignalHandler();
+      data_ = static_cast<char*>(reserved);
+      reserved_size_ = kGuardPageReservedSize;
+      if (resize(size)) {
+        return;
+      }
+      munmap(reserved, kGuardPageReservedSize);
+      data_ = nullptr;
+      reserved_size_ = 0;
+    }
+  }
+#endif
+  resize(size);
+}
+
+MemoryData::MemoryData(MemoryData&& other) noexcept {
+  Swap(other);
+}
+
+MemoryData& MemoryData::operator=(MemoryData&& other) noexcept {
+  MemoryData moved(std::move(other));
+  Swap(moved);
+  return *this;
+}
+
+MemoryData::~MemoryData() {
+#if WABT_INTERP_GUARD_PAGES
+  if (has_guard_pages()) {
+    munmap(data_, reserved_size_);
+  }
+#endif
+}
+
+void MemoryData::Swap(MemoryData& other) {
+  heap_.swap(other.heap_);
+  std::swap(data_, other.data_);
+  size_ = other.size_.exchange(size_);
+  std::swap(reserved_size_, other.reserved_size_);
+}
+
+bool MemoryData::resize(size_t size) {
+  if (!has_guard_pages()) {
+    heap_.resize(size);
+    // A shared memory has reserved its maximum size, so its data doesn't
+    // move, and |data_| isn't written while other threads read it.
+    if (data_ != heap_.data()) {
+      data_ = heap_.data();
+    }
+    size_.store(size, std::memory_order_release);
+    return true;
+  }
+
+#if WABT_INTERP_GUARD_PAGES
+  // Sizes are multiples of WABT_PAGE_SIZE, so they are also multiples of the
+  // system page size.
+  size_t old_size = size_.load(std::memory_order_relaxed);
+  if (size > reserved_size_) {
+    return false;
+  } else if (size > old_size) {
+    if (mprotect(data_ + old_size, size - old_size, PROT_READ | PROT_WRITE) !=
+        0) {
+      return false;
+    }
+  } else if (size < old_size) {
+    // Replace the pages rather than just protecting them, so they are zeroed
+    // if the memory grows again.
+    if (mmap(data_ + size, old_size - size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+             0) == MAP_FAILED) {
+      return false;
+    }
+  }
+  size_.store(size, std::memory_order_release);
+  return true;
+#else
+  WABT_UNREACHABLE;
+#endif
+}
+
+void MemoryData::reserve(size_t size) {
+  if (!has_guard_pages()) {
+    heap_.reserve(size);
+    data_ = heap_.data();
+  }
+}
+
+bool MemoryData::IsGuardPageAddress(const void* address) const {
+  const char* p = static_cast<const char*>(address);
+  return has_guard_pages() && p >= data_ + size() &&
+         p < data_ + reserved_size_;
+}
+
+void MemoryData::Restore(const MemoryImage& image) {
+#if WABT_INTERP_MAPPABLE_IMAGES
+  if (has_guard_pages() && image.is_mappable() && image.size_ > 0) {
+    // Discard the current pages rather than copying over them; the private
+    // mapping shares the image's pages until they are written.
+    if (image.size_ <= reserved_size_ &&
+        mmap(data_, image.size_, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, image.fd_, 0) != MAP_FAILED) {
+      if (size() > image.size_) {
+        mmap(data_ + image.size_, size() - image.size_, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+      }
+      size_.store(image.size_, std::memory_order_release);
+      return;
+    }
+  }
+#endif
+
+  resize(image.size_);
+  if (!image.is_mappable()) {
+    std::copy(image.heap_.begin(), image.heap_.end(), data_);
+    return;
+  }
+
+#if WABT_INTERP_MAPPABLE_IMAGES
+  size_t offset = 0;
+  while (offset < image.size_) {
+    ssize_t bytes = pread(image.fd_, data_ + offset, image.size_ - offset,
+                          offset);
+    if (bytes <= 0) {
+      break;
+    }
+    offset += bytes;
+  }
+#endif
+}
+
+MemoryImage::MemoryImage(const MemoryData& data) : size_(data.size()) {
+#if WABT_INTERP_MAPPABLE_IMAGES
+  if (data.has_guard_pages()) {
+    int fd = memfd_create("wabt-memory-image", MFD_CLOEXEC);
+    if (fd != -1 && ftruncate(fd, size_) == 0) {
+      size_t offset = 0;
+      while (offset < size_) {
+        ssize_t bytes =
+            pwrite(fd, data.data() + offset, size_ - offset, offset);
+        if (bytes <= 0) {
+          break;
+        }
+        offset += bytes;
+      }
+      if (offset == size_) {
+        fd_ = fd;
+        return;
+      }
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+#endif
+  heap_.assign(data.data(), data.data() + size_);
+}
+
+MemoryImage::MemoryImage(MemoryImage&& other) noexcept {
+  Swap(other);
+}
+
+MemoryImage& MemoryImage::operator=(MemoryImage&& other) noexcept {
+  MemoryImage moved(std::move(other));
+  Swap(moved);
+  return *this;
+}
+
+MemoryImage::~MemoryImage() {
+#if WABT_INTERP_MAPPABLE_IMAGES
+  if (fd_ != -1) {
+    close(fd_);
+  }
+#endif
+}
+
+void MemoryImage::Swap(MemoryImage& other) {
+  heap_.swap(other.heap_);
+  std::swap(fd_, other.fd_);
+  std::swap(size_, other.size_);
+}
+
 Environment::Environment(const Features& features)
     : features_(features), istream_(new OutputBuffer()) {}
 
@@ -181,6 +520,24 @@ Index Environment::FindModuleIndex(string_view name) const {
   return iter->second.index;
 }
 
+bool Environment::HasGuardPageMemory() const {
+  for (const Memory& memory : memories_) {
+    if (memory.data.has_guard_pages()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Memory* Environment::FindGuardPageMemory(const void* address) {
+  for (Memory& memory : memories_) {
+    if (memory.data.IsGuardPageAddress(address)) {
+      return &memory;
+    }
+  }
+  return nullptr;
+}
+
 Module* Environment::FindModule(string_view name) {
   Index index = FindModuleIndex(name);
   return index == kInvalidIndex ? nullptr : modules_[index].get();
@@ -216,7 +573,20 @@ Thread::Options::Options(uint32_t value_stack_size, uint32_t call_stack_size)
 Thread::Thread(Environment* env, const Options& options)
     : env_(env),
       value_stack_(options.value_stack_size),
-      call_stack_(options.call_stack_size) {}
+      call_stack_(options.call_stack_size),
+      jit_threshold_(IsJitSupported() && !options.profiler
+                         ? options.jit_threshold
+                         : 0),
+      fuel_(options.fuel),
+      profiler_(options.profiler) {}
+
+DefinedFunc::DefinedFunc(Index sig_index)
+    : Func(sig_index, false),
+      offset(kInvalidIstreamOffset),
+      local_decl_count(0),
+      local_count(0) {}
+
+DefinedFunc::~DefinedFunc() {}
 
 FuncSignature::FuncSignature(std::vector<Type> param_types,
                              std::vector<Type> result_types)
@@ -240,13 +610,27 @@ Module::Module(Environment* env, string_view name, bool is_host)
       is_host(is_host),
       env(env) {}
 
+std::pair<Module::SortedExportIter, Module::SortedExportIter>
+Module::FindExports(string_view name) const {
+  assert(sorted_exports_.size() == exports.size());
+  auto first = std::lower_bound(
+      sorted_exports_.cbegin(), sorted_exports_.cend(), name,
+      [this](Index lhs, string_view rhs) {
+        return string_view(exports[lhs].name) < rhs;
+      });
+  auto last = std::upper_bound(
+      first, sorted_exports_.cend(), name, [this](string_view lhs, Index rhs) {
+        return lhs < string_view(exports[rhs].name);
+      });
+  return {first, last};
+}
+
 Export* Module::GetFuncExport(Environment* env,
                               string_view name,
                               Index sig_index) {
-  auto range = export_bindings.equal_range(name.to_string());
+  auto range = FindExports(name);
   for (auto iter = range.first; iter != range.second; ++iter) {
-    const Binding& binding = iter->second;
-    Export* export_ = &exports[binding.index];
+    Export* export_ = &exports[*iter];
     if (export_->kind == ExternalKind::Func) {
       const Func* func = env->GetFunc(export_->index);
       if (env->FuncSignaturesAreEqual(sig_index, func->sig_index)) {
@@ -271,11 +655,11 @@ Export* Module::GetFuncExport(Environment* env,
 }
 
 Export* Module::GetExport(string_view name) {
-  int field_index = export_bindings.FindIndex(name);
-  if (field_index < 0) {
+  auto range = FindExports(name);
+  if (range.first == range.second) {
     return nullptr;
   }
-  return &exports[field_index];
+  return &exports[*range.first];
 }
 
 Index Module::AppendExport(ExternalKind kind,
@@ -283,8 +667,39 @@ Index Module::AppendExport(ExternalKind kind,
                            string_view name) {
   exports.emplace_back(name, kind, item_index);
   Export* export_ = &exports.back();
-  export_bindings.emplace(export_->name, Binding(exports.size() - 1));
-  return exports.size() - 1;
+  Index export_index = exports.size() - 1;
+  export_bindings.emplace(export_->name, Binding(export_index));
+  if (is_host) {
+    // Host modules are usually small, and have exports appended at any time,
+    // so insert each one after any others with the same name.
+    auto iter = std::upper_bound(
+        sorted_exports_.begin(), sorted_exports_.end(), export_->name,
+        [this](const std::string& lhs, Index rhs) {
+          return lhs < exports[rhs].name;
+        });
+    sorted_exports_.insert(iter, export_index);
+  }
+  return export_index;
+}
+
+void Module::IndexExports() {
+  sorted_exports_.resize(exports.size());
+  for (Index i = 0; i < exports.size(); ++i) {
+    sorted_exports_[i] = i;
+  }
+  std::stable_sort(sorted_exports_.begin(), sorted_exports_.end(),
+                   [this](Index lhs, Index rhs) {
+                     return exports[lhs].name < exports[rhs].name;
+                   });
+}
+
+void Module::TruncateExports(Index size) {
+  exports.erase(exports.begin() + size, exports.end());
+  export_bindings.clear();
+  for (Index i = 0; i < exports.size(); ++i) {
+    export_bindings.emplace(exports[i].name, Binding(i));
+  }
+  IndexExports();
 }
 
 DefinedModule::DefinedModule(Environment* env)
@@ -324,6 +739,19 @@ std::pair<HostFunc*, Index> HostModule::AppendFuncExport(
   return {host_func, export_index};
 }
 
+std::pair<HostFunc*, Index> HostModule::AppendValueFuncExport(
+    string_view name,
+    const FuncSignature& sig,
+    HostFunc::ValueCallback value_callback) {
+  env->EmplaceBackFuncSignature(sig);
+  Index sig_index = env->GetFuncSignatureCount() - 1;
+  auto* host_func = new HostFunc(this->name, name, sig_index, value_callback);
+  env->EmplaceBackFunc(host_func);
+  Index func_env_index = env->GetFuncCount() - 1;
+  Index export_index = AppendExport(ExternalKind::Func, func_env_index, name);
+  return {host_func, export_index};
+}
+
 std::pair<Table*, Index> HostModule::AppendTableExport(string_view name,
                                                        Type elem_type,
                                                        const Limits& limits) {
@@ -335,7 +763,7 @@ std::pair<Table*, Index> HostModule::AppendTableExport(string_view name,
 
 std::pair<Memory*, Index> HostModule::AppendMemoryExport(string_view name,
                                                          const Limits& limits) {
-  Memory* memory = env->EmplaceBackMemory(limits);
+  Memory* memory = env->EmplaceBackMemory(limits, env->memory_backend_);
   Index memory_env_index = env->GetMemoryCount() - 1;
   Index export_index =
       AppendExport(ExternalKind::Memory, memory_env_index, name);
@@ -388,6 +816,14 @@ std::pair<Global*, Index> HostModule::AppendGlobalExport(string_view name,
   return pair;
 }
 
+void Environment::InternFuncSignature() {
+  const FuncSignature& sig = sigs_.back();
+  Index sig_index = sigs_.size() - 1;
+  auto pair = sig_ids_by_types_.emplace(
+      std::make_pair(sig.param_types, sig.result_types), sig_index);
+  sig_ids_.push_back(pair.first->second);
+}
+
 Environment::MarkPoint Environment::Mark() {
   MarkPoint mark;
   mark.modules_size = modules_.size();
@@ -423,7 +859,46 @@ void Environment::ResetToMarkPoint(const MarkPoint& mark) {
   }
 
   modules_.erase(modules_.begin() + mark.modules_size, modules_.end());
+
+  // Host modules can export items that were added after the mark, e.g. the
+  // functions that on_unknown_func_export creates to resolve the imports of a
+  // module that then failed to load. Those are the last exports they added.
+  auto is_removed = [&mark](const Export& export_) {
+    switch (export_.kind) {
+      case ExternalKind::Func:
+        return export_.index >= mark.funcs_size;
+      case ExternalKind::Table:
+        return export_.index >= mark.tables_size;
+      case ExternalKind::Memory:
+        return export_.index >= mark.memories_size;
+      case ExternalKind::Global:
+        return export_.index >= mark.globals_size;
+      default:
+        return false;
+    }
+  };
+  for (const std::unique_ptr<Module>& module : modules_) {
+    Index size = module->exports.size();
+    while (size > 0 && is_removed(module->exports[size - 1])) {
+      --size;
+    }
+    if (size != module->exports.size()) {
+      module->TruncateExports(size);
+    }
+  }
+
   sigs_.erase(sigs_.begin() + mark.sigs_size, sigs_.end());
+  sig_ids_.erase(sig_ids_.begin() + mark.sigs_size, sig_ids_.end());
+  // An id is the index of the first signature with its types, so the ids of
+  // the signatures that remain are all below the mark.
+  auto sig_iter = sig_ids_by_types_.begin();
+  while (sig_iter != sig_ids_by_types_.end()) {
+    if (sig_iter->second >= mark.sigs_size) {
+      sig_iter = sig_ids_by_types_.erase(sig_iter);
+    } else {
+      ++sig_iter;
+    }
+  }
   funcs_.erase(funcs_.begin() + mark.funcs_size, funcs_.end());
   memories_.erase(memories_.begin() + mark.memories_size, memories_.end());
   tables_.erase(tables_.begin() + mark.tables_size, tables_.end());
@@ -433,6 +908,111 @@ void Environment::ResetToMarkPoint(const MarkPoint& mark) {
   elem_segments_.erase(elem_segments_.begin() + mark.elem_segments_size,
                        elem_segments_.end());
   istream_->data.resize(mark.istream_size);
+
+  // Lazily compiled functions that were lowered after the mark are lowered
+  // again the next time they're called.
+  for (Index i = 0; i < funcs_.size(); ++i) {
+    auto* func = dyn_cast<DefinedFunc>(funcs_[i].get());
+    if (func && func->lazy_compiler && func->is_compiled() &&
+        func->offset >= mark.istream_size) {
+      uint8_t* stub = &istream_->data[func->stub_offset];
+      WriteU32At(stub, static_cast<uint32_t>(Opcode::InterpCompile));
+      WriteU32At(stub + sizeof(uint32_t), i);
+      func->offset = func->stub_offset;
+      func->call_count = 0;
+      func->jit_code = nullptr;
+      func->jit_code_storage.reset();
+    }
+  }
+}
+
+Environment::Snapshot Environment::TakeSnapshot() const {
+  Snapshot snapshot;
+  for (const Global& global : globals_) {
+    snapshot.globals.push_back(global.typed_value);
+  }
+  snapshot.tables = tables_;
+  for (const Memory& memory : memories_) {
+    snapshot.memory_limits.push_back(memory.page_limits);
+    snapshot.memory_images.emplace_back(memory.data);
+  }
+  for (const DataSegment& segment : data_segments_) {
+    snapshot.data_segments.push_back(segment.data);
+  }
+  for (const ElemSegment& segment : elem_segments_) {
+    snapshot.elem_segments.push_back(segment.elems);
+  }
+  return snapshot;
+}
+
+void Environment::RestoreSnapshot(const Snapshot& snapshot) {
+  assert(snapshot.globals.size() <= globals_.size());
+  assert(snapshot.tables.size() <= tables_.size());
+  assert(snapshot.memory_images.size() <= memories_.size());
+  assert(snapshot.data_segments.size() <= data_segments_.size());
+  assert(snapshot.elem_segments.size() <= elem_segments_.size());
+
+  for (size_t i = 0; i < snapshot.globals.size(); ++i) {
+    globals_[i].typed_value = snapshot.globals[i];
+  }
+  for (size_t i = 0; i < snapshot.tables.size(); ++i) {
+    tables_[i] = snapshot.tables[i];
+  }
+  for (size_t i = 0; i < snapshot.memory_images.size(); ++i) {
+    memories_[i].page_limits = snapshot.memory_limits[i];
+    memories_[i].data.Restore(snapshot.memory_images[i]);
+  }
+  // Segments only change when they are dropped, which clears them.
+  for (size_t i = 0; i < snapshot.data_segments.size(); ++i) {
+    if (data_segments_[i].data.size() != snapshot.data_segments[i].size()) {
+      data_segments_[i].data = snapshot.data_segments[i];
+    }
+  }
+  for (size_t i = 0; i < snapshot.elem_segments.size(); ++i) {
+    if (elem_segments_[i].elems.size() != snapshot.elem_segments[i].size()) {
+      elem_segments_[i].elems = snapshot.elem_segments[i];
+    }
+  }
+}
+
+wabt::Result Environment::LinkImports(const std::vector<Import>& imports,
+                                     std::vector<Export*>* out_exports,
+                                     Errors* errors) {
+  out_exports->clear();
+  out_exports->reserve(imports.size());
+  Module* module = nullptr;
+  const std::string* module_name = nullptr;
+  for (const Import& import : imports) {
+    if (!module_name || import.module_name != *module_name) {
+      module = FindRegisteredModule(import.module_name);
+      if (!module) {
+        errors->emplace_back(
+            ErrorLevel::Error, Location(),
+            StringPrintf("unknown import module \"%s\"",
+                         import.module_name.c_str()));
+        return wabt::Result::Error;
+      }
+      module_name = &import.module_name;
+    }
+
+    Export* export_ = module->GetExport(import.field_name);
+    if (!export_) {
+      errors->emplace_back(ErrorLevel::Error, Location(),
+                           StringPrintf("unknown module field \"%s\"",
+                                        import.field_name.c_str()));
+      return wabt::Result::Error;
+    }
+    if (export_->kind != import.kind) {
+      errors->emplace_back(
+          ErrorLevel::Error, Location(),
+          StringPrintf("expected import \"%s.%s\" to have kind %s, not %s",
+                       import.module_name.c_str(), import.field_name.c_str(),
+                       GetKindName(import.kind), GetKindName(export_->kind)));
+      return wabt::Result::Error;
+    }
+    out_exports->push_back(export_);
+  }
+  return wabt::Result::Ok;
 }
 
 HostModule* Environment::AppendHostModule(string_view name) {
@@ -780,6 +1360,31 @@ template<> uint64_t GetValue<double>(Value v) { return v.f64_bits; }
 template<> v128 GetValue<v128>(Value v) { return v.vec128; }
 template<> Ref GetValue<Ref>(Value v) { return v.ref; }
 
+// The members of ValueSlot are at the same offsets as those of Value, so a
+// scalar converts by copying its first eight bytes.
+ValueSlot ToSlot(const Value& value) {
+  ValueSlot slot;
+  memcpy(&slot, &value, sizeof(slot));
+  return slot;
+}
+
+Value ToValue(ValueSlot slot) {
+  Value value;
+  memset(&value, 0, sizeof(value));
+  memcpy(&value, &slot, sizeof(slot));
+  return value;
+}
+
+template <typename T>
+ValueSlot MakeSlot(ValueTypeRep<T> rep) {
+  return ToSlot(MakeValue<T>(rep));
+}
+
+template <typename T>
+ValueTypeRep<T> GetSlot(ValueSlot slot) {
+  return GetValue<T>(ToValue(slot));
+}
+
 template <typename T>
 ValueTypeRep<T> CanonicalizeNan(ValueTypeRep<T> rep) {
   return rep;
@@ -810,14 +1415,21 @@ ValueTypeRep<double> CanonicalizeNan<double>(ValueTypeRep<double> rep) {
 #define CHECK_STACK() \
   TRAP_IF(value_stack_top_ >= value_stack_.size(), ValueStackExhausted)
 
-#define PUSH_NEG_1_AND_BREAK_IF(cond) \
-  if (WABT_UNLIKELY(cond)) {          \
-    CHECK_TRAP(Push<int32_t>(-1));    \
-    break;                            \
+#define PUSH_NEG_1_AND_NEXT_IF(cond) \
+  if (WABT_UNLIKELY(cond)) {         \
+    CHECK_TRAP(Push<int32_t>(-1));   \
+    NEXT();                          \
   }
 
 #define GOTO(offset) pc = &istream[offset]
 
+#define PROFILE_CALL(offset)                     \
+  do {                                           \
+    if (profiler_) {                             \
+      profiler_->OnCall(pc - istream, (offset)); \
+    }                                            \
+  } while (0)
+
 Memory* Thread::ReadMemory(const uint8_t** pc) {
   Index memory_index = ReadU32(pc);
   return &env_->memories_[memory_index];
@@ -830,19 +1442,36 @@ Table* Thread::ReadTable(const uint8_t** pc) {
 
 template <typename MemType>
 Result Thread::GetAccessAddress(const uint8_t** pc, void** out_address) {
+  return GetAccessAddress<MemType>(pc, Pop<uint32_t>(), out_address);
+}
+
+template <typename MemType>
+Result Thread::GetAccessAddress(const uint8_t** pc,
+                                uint32_t base,
+                                void** out_address) {
   Memory* memory = ReadMemory(pc);
-  uint64_t addr = static_cast<uint64_t>(Pop<uint32_t>()) + ReadU32(pc);
-  if (addr + sizeof(MemType) > memory->data.size()) {
-    TRAP_MSG(MemoryAccessOutOfBounds,
-             "access at %" PRIu64 "+%" PRIzd " >= max value %" PRIzd, addr,
-             sizeof(MemType), memory->data.size());
+  uint64_t addr = static_cast<uint64_t>(base) + ReadU32(pc);
+  access_addr_ = addr;
+  access_size_ = sizeof(MemType);
+  if (addr + sizeof(MemType) > memory->data.access_limit()) {
+    return MemoryAccessOutOfBounds(memory);
   }
-  *out_address = memory->data.data() + static_cast<IstreamOffset>(addr);
+  // With guard pages, |addr| isn't checked and may be 4GiB or more; it must
+  // not wrap back into the accessible pages.
+  *out_address = memory->data.data() + addr;
   return ResultType::Ok;
 }
 
+Result Thread::MemoryAccessOutOfBounds(const Memory* memory) const {
+  TRAP_MSG(MemoryAccessOutOfBounds,
+           "access at %" PRIu64 "+%" PRIzd " >= max value %" PRIzd,
+           access_addr_, access_size_, memory->data.size());
+}
+
 template <typename MemType>
-Result Thread::GetAtomicAccessAddress(const uint8_t** pc, void** out_address) {
+Result Thread::GetAtomicAccessAddress(const uint8_t** pc,
+                                      void** out_address,
+                                      Memory** out_memory) {
   Memory* memory = ReadMemory(pc);
   uint64_t addr = static_cast<uint64_t>(Pop<uint32_t>()) + ReadU32(pc);
   if (addr + sizeof(MemType) > memory->data.size()) {
@@ -851,7 +1480,10 @@ Result Thread::GetAtomicAccessAddress(const uint8_t** pc, void** out_address) {
              addr, sizeof(MemType), memory->data.size());
   }
   TRAP_IF((addr & (sizeof(MemType) - 1)) != 0, AtomicMemoryAccessUnaligned);
-  *out_address = memory->data.data() + static_cast<IstreamOffset>(addr);
+  *out_address = memory->data.data() + addr;
+  if (out_memory) {
+    *out_memory = memory;
+  }
   return ResultType::Ok;
 }
 
@@ -867,53 +1499,96 @@ ElemSegment* Thread::ReadElemSegment(const uint8_t** pc) {
   return &env_->elem_segments_[index];
 }
 
-Value& Thread::Top() {
+ValueSlot& Thread::Top() {
   return Pick(1);
 }
 
-Value& Thread::Pick(Index depth) {
+ValueSlot& Thread::Pick(Index depth) {
   return value_stack_[value_stack_top_ - depth];
 }
 
+v128 Thread::PickV128(Index depth) const {
+  return ValueAt(Type::V128, value_stack_top_ - depth - 1).vec128;
+}
+
 void Thread::Reset() {
   pc_ = 0;
   value_stack_top_ = 0;
   call_stack_top_ = 0;
+  call_stack_base_ = 0;
+  jit_depth_ = 0;
+  suspended_func_ = nullptr;
+  resume_returns_ = false;
+  resumed_ = false;
 }
 
-Result Thread::Push(Value value) {
+Result Thread::PushSlot(ValueSlot slot) {
   CHECK_STACK();
-  value_stack_[value_stack_top_++] = value;
+  value_stack_[value_stack_top_++] = slot;
   return ResultType::Ok;
 }
 
-Value Thread::Pop() {
+ValueSlot Thread::PopSlot() {
   return value_stack_[--value_stack_top_];
 }
 
-Value Thread::ValueAt(Index at) const {
-  assert(at < value_stack_top_);
-  return value_stack_[at];
+template <typename T>
+Result Thread::PushRep(ValueTypeRep<T> value) {
+  return PushSlot(MakeSlot<T>(value));
 }
 
-template <typename T>
-Result Thread::Push(T value) {
-  return PushRep<T>(ToRep(value));
+template <>
+Result Thread::PushRep<v128>(v128 value) {
+  TRAP_IF(value_stack_top_ + 2 > value_stack_.size(), ValueStackExhausted);
+  memcpy(&value_stack_[value_stack_top_], &value, sizeof(value));
+  value_stack_top_ += 2;
+  return ResultType::Ok;
 }
 
 template <typename T>
-T Thread::Pop() {
-  return FromRep<T>(PopRep<T>());
+ValueTypeRep<T> Thread::PopRep() {
+  return GetSlot<T>(PopSlot());
+}
+
+template <>
+v128 Thread::PopRep<v128>() {
+  value_stack_top_ -= 2;
+  v128 value;
+  memcpy(&value, &value_stack_[value_stack_top_], sizeof(value));
+  return value;
+}
+
+Result Thread::Push(Type type, Value value) {
+  if (type == Type::V128) {
+    return PushRep<v128>(value.vec128);
+  }
+  return PushSlot(ToSlot(value));
+}
+
+Value Thread::Pop(Type type) {
+  if (type == Type::V128) {
+    return MakeValue<v128>(PopRep<v128>());
+  }
+  return ToValue(PopSlot());
+}
+
+Value Thread::ValueAt(Type type, Index at) const {
+  assert(at + GetSlotCount(type) <= value_stack_top_);
+  Value value = ToValue(value_stack_[at]);
+  if (type == Type::V128) {
+    memcpy(&value.vec128, &value_stack_[at], sizeof(v128));
+  }
+  return value;
 }
 
 template <typename T>
-Result Thread::PushRep(ValueTypeRep<T> value) {
-  return Push(MakeValue<T>(value));
+Result Thread::Push(T value) {
+  return PushRep<T>(ToRep(value));
 }
 
 template <typename T>
-ValueTypeRep<T> Thread::PopRep() {
-  return GetValue<T>(Pop());
+T Thread::Pop() {
+  return FromRep<T>(PopRep<T>());
 }
 
 void Thread::DropKeep(uint32_t drop_count, uint32_t keep_count) {
@@ -968,6 +1643,135 @@ Result Thread::Store(const uint8_t** pc) {
   return ResultType::Ok;
 }
 
+// Atomic accesses are always aligned (see GetAtomicAccessAddress), so they can
+// use the compiler's atomic builtins directly on linear memory. They are all
+// sequentially consistent, as required by the threads proposal.
+#if COMPILER_IS_CLANG || COMPILER_IS_GNU
+
+template <typename T>
+T AtomicLoadFromMemory(const void* src) {
+  return __atomic_load_n(static_cast<const T*>(src), __ATOMIC_SEQ_CST);
+}
+
+template <typename T>
+void AtomicStoreToMemory(void* dst, T value) {
+  __atomic_store_n(static_cast<T*>(dst), value, __ATOMIC_SEQ_CST);
+}
+
+// Like std::atomic::compare_exchange_strong: if |addr| contains |*expected|,
+// replaces it with |replace| and returns true. Otherwise, stores the current
+// value in |*expected| and returns false.
+template <typename T>
+bool AtomicCompareExchange(void* addr, T* expected, T replace) {
+  return __atomic_compare_exchange_n(static_cast<T*>(addr), expected, replace,
+                                     false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_SEQ_CST);
+}
+
+#else  // COMPILER_IS_MSVC
+
+// The interlocked intrinsics for each access size. They are all full barriers.
+// Only the compare-exchanges are used, since they are available for every
+// size on every target.
+template <size_t size>
+struct Interlocked;
+
+template <>
+struct Interlocked<1> {
+  typedef char Type;
+  static Type CompareExchange(void* addr, Type replace, Type expected) {
+    return _InterlockedCompareExchange8(static_cast<volatile Type*>(addr),
+                                        replace, expected);
+  }
+};
+
+template <>
+struct Interlocked<2> {
+  typedef short Type;
+  static Type CompareExchange(void* addr, Type replace, Type expected) {
+    return _InterlockedCompareExchange16(static_cast<volatile Type*>(addr),
+                                         replace, expected);
+  }
+};
+
+template <>
+struct Interlocked<4> {
+  typedef long Type;
+  static Type CompareExchange(void* addr, Type replace, Type expected) {
+    return _InterlockedCompareExchange(static_cast<volatile Type*>(addr),
+                                       replace, expected);
+  }
+};
+
+template <>
+struct Interlocked<8> {
+  typedef __int64 Type;
+  static Type CompareExchange(void* addr, Type replace, Type expected) {
+    return _InterlockedCompareExchange64(static_cast<volatile Type*>(addr),
+                                         replace, expected);
+  }
+};
+
+template <typename T>
+T AtomicLoadFromMemory(const void* src) {
+  typedef Interlocked<sizeof(T)> I;
+  // Replacing 0 with 0 never changes the memory, but still returns its value.
+  return Bitcast<T>(I::CompareExchange(const_cast<void*>(src), 0, 0));
+}
+
+template <typename T>
+bool AtomicCompareExchange(void* addr, T* expected, T replace) {
+  typedef Interlocked<sizeof(T)> I;
+  typename I::Type expected_rep = Bitcast<typename I::Type>(*expected);
+  typename I::Type read = I::CompareExchange(
+      addr, Bitcast<typename I::Type>(replace), expected_rep);
+  if (read != expected_rep) {
+    *expected = Bitcast<T>(read);
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+void AtomicStoreToMemory(void* dst, T value) {
+  T expected = AtomicLoadFromMemory<T>(dst);
+  while (!AtomicCompareExchange<T>(dst, &expected, value)) {
+  }
+}
+
+#endif
+
+// Each call site has an inline cache: the operand after the signature is the
+// index of the last function it called, or kInvalidIndex. That function's
+// signature has already been checked, so calling it again only needs the
+// table bounds check. Threads on other OS threads may share the istream, so
+// the cache is accessed atomically; every operand in the istream is a multiple
+// of 4 bytes, so it is always aligned.
+Result Thread::GetIndirectCallee(const uint8_t** pc, Func** out_func) {
+  Table* table = ReadTable(pc);
+  Index sig_index = ReadU32(pc);
+  uint8_t* cache = env_->istream_->data.data() + (*pc - GetIstream());
+  *pc += sizeof(Index);
+  assert((reinterpret_cast<uintptr_t>(cache) & (sizeof(Index) - 1)) == 0);
+  Index cached_func_index = AtomicLoadFromMemory<Index>(cache);
+  Index entry_index = Pop<uint32_t>();
+  TRAP_IF(entry_index >= table->size(), UndefinedTableIndex);
+  Ref ref = table->entries[entry_index];
+  if (WABT_LIKELY(ref.kind == RefType::Func &&
+                  ref.index == cached_func_index)) {
+    *out_func = env_->funcs_[ref.index].get();
+    return ResultType::Ok;
+  }
+  TRAP_IF(ref.kind == RefType::Null, UninitializedTableElement);
+  assert(ref.kind == RefType::Func && ref.index != kInvalidIndex);
+  Func* func = env_->GetFunc(ref.index);
+  TRAP_UNLESS(env_->FuncSignaturesAreEqual(func->sig_index, sig_index),
+              IndirectCallSignatureMismatch);
+  AtomicStoreToMemory<Index>(cache, ref.index);
+  *out_func = func;
+  return ResultType::Ok;
+}
+
 template <typename MemType, typename ResultValueType>
 Result Thread::AtomicLoad(const uint8_t** pc) {
   typedef typename ExtendMemType<ResultValueType, MemType>::type ExtendedType;
@@ -975,8 +1779,7 @@ Result Thread::AtomicLoad(const uint8_t** pc) {
                 "AtomicLoad type can't be float");
   void* src;
   CHECK_TRAP(GetAtomicAccessAddress<MemType>(pc, &src));
-  MemType value;
-  LoadFromMemory<MemType>(&value, src);
+  MemType value = AtomicLoadFromMemory<MemType>(src);
   return Push<ResultValueType>(static_cast<ExtendedType>(value));
 }
 
@@ -986,7 +1789,7 @@ Result Thread::AtomicStore(const uint8_t** pc) {
   WrappedType value = PopRep<ResultValueType>();
   void* dst;
   CHECK_TRAP(GetAtomicAccessAddress<MemType>(pc, &dst));
-  StoreToMemory<WrappedType>(dst, value);
+  AtomicStoreToMemory<WrappedType>(dst, value);
   return ResultType::Ok;
 }
 
@@ -997,9 +1800,11 @@ Result Thread::AtomicRmw(BinopFunc<ResultValueType, ResultValueType> func,
   MemType rhs = PopRep<ResultValueType>();
   void* addr;
   CHECK_TRAP(GetAtomicAccessAddress<MemType>(pc, &addr));
-  MemType read;
-  LoadFromMemory<MemType>(&read, addr);
-  StoreToMemory<MemType>(addr, func(read, rhs));
+  // On failure, the compare-exchange reloads |read|, so this retries until no
+  // other thread has written to |addr| in between.
+  MemType read = AtomicLoadFromMemory<MemType>(addr);
+  while (!AtomicCompareExchange<MemType>(addr, &read, func(read, rhs))) {
+  }
   return Push<ResultValueType>(static_cast<ExtendedType>(read));
 }
 
@@ -1007,17 +1812,259 @@ template <typename MemType, typename ResultValueType>
 Result Thread::AtomicRmwCmpxchg(const uint8_t** pc) {
   typedef typename ExtendMemType<ResultValueType, MemType>::type ExtendedType;
   MemType replace = PopRep<ResultValueType>();
-  MemType expect = PopRep<ResultValueType>();
+  MemType read = PopRep<ResultValueType>();
   void* addr;
   CHECK_TRAP(GetAtomicAccessAddress<MemType>(pc, &addr));
-  MemType read;
-  LoadFromMemory<MemType>(&read, addr);
-  if (read == expect) {
-    StoreToMemory<MemType>(addr, replace);
-  }
+  // |read| is the expected value if the exchange succeeds, and is replaced by
+  // the current value if it fails; either way, it is the value that was read.
+  AtomicCompareExchange<MemType>(addr, &read, replace);
   return Push<ResultValueType>(static_cast<ExtendedType>(read));
 }
 
+template <typename T>
+WaitQueues::WaitResult WaitQueues::Wait(T* address,
+                                        T expected,
+                                        int64_t timeout_ns) {
+  typedef std::chrono::steady_clock Clock;
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Notify takes the same lock, so it can't be missed between this check and
+  // adding the waiter to the queue.
+  if (AtomicLoadFromMemory<T>(address) != expected) {
+    return WaitResult::NotEqual;
+  }
+
+  Waiter waiter;
+  std::list<Waiter*>& queue = waiters_[address];
+  auto iter = queue.insert(queue.end(), &waiter);
+  auto is_notified = [&waiter]() { return waiter.notified; };
+
+  Clock::time_point now = Clock::now();
+  Clock::duration remaining = Clock::time_point::max() - now;
+  if (timeout_ns < 0 || std::chrono::nanoseconds(timeout_ns) >= remaining) {
+    waiter.cond.wait(lock, is_notified);
+  } else {
+    waiter.cond.wait_until(lock, now + std::chrono::nanoseconds(timeout_ns),
+                           is_notified);
+  }
+
+  if (waiter.notified) {
+    // Notify already removed the waiter from the queue.
+    return WaitResult::Ok;
+  }
+  queue.erase(iter);
+  if (queue.empty()) {
+    waiters_.erase(address);
+  }
+  return WaitResult::TimedOut;
+}
+
+uint32_t WaitQueues::Notify(void* address, uint32_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = waiters_.find(address);
+  if (iter == waiters_.end()) {
+    return 0;
+  }
+
+  std::list<Waiter*>& queue = iter->second;
+  uint32_t woken = 0;
+  while (woken < count && !queue.empty()) {
+    Waiter* waiter = queue.front();
+    queue.pop_front();
+    waiter->notified = true;
+    waiter->cond.notify_one();
+    ++woken;
+  }
+  if (queue.empty()) {
+    waiters_.erase(iter);
+  }
+  return woken;
+}
+
+template <typename T>
+Result Thread::AtomicWait(const uint8_t** pc) {
+  int64_t timeout_ns = Pop<int64_t>();
+  T expected = PopRep<T>();
+  void* addr;
+  Memory* memory;
+  CHECK_TRAP(GetAtomicAccessAddress<T>(pc, &addr, &memory));
+  TRAP_IF(!memory->page_limits.is_shared, ExpectedSharedMemory);
+  WaitQueues::WaitResult result =
+      env_->wait_queues_.Wait<T>(static_cast<T*>(addr), expected, timeout_ns);
+  return Push<uint32_t>(static_cast<uint32_t>(result));
+}
+
+Result Thread::AtomicNotify(const uint8_t** pc) {
+  uint32_t count = Pop<uint32_t>();
+  void* addr;
+  Memory* memory;
+  CHECK_TRAP(GetAtomicAccessAddress<uint32_t>(pc, &addr, &memory));
+  // Nothing can be waiting on a memory that isn't shared.
+  uint32_t woken = memory->page_limits.is_shared
+                       ? env_->wait_queues_.Notify(addr, count)
+                       : 0;
+  return Push<uint32_t>(woken);
+}
+
+uint32_t Thread::GrowMemory(Memory* memory, uint32_t grow_pages) {
+  // Other threads may be growing a shared memory at the same time.
+  std::unique_lock<std::mutex> lock;
+  if (memory->page_limits.is_shared) {
+    lock = std::unique_lock<std::mutex>(env_->shared_memory_grow_mutex_);
+  }
+  uint32_t old_page_size = memory->page_limits.initial;
+  uint32_t new_page_size = old_page_size + grow_pages;
+  uint32_t max_page_size = memory->page_limits.has_max ? memory->page_limits.max
+                                                       : WABT_MAX_PAGES;
+  if (new_page_size > max_page_size ||
+      static_cast<uint64_t>(new_page_size) * WABT_PAGE_SIZE > UINT32_MAX ||
+      !memory->data.resize(new_page_size * WABT_PAGE_SIZE)) {
+    return static_cast<uint32_t>(-1);
+  }
+  // Only grows read |page_limits.initial|, under the lock; memory.size reads
+  // the size that resize() published.
+  memory->page_limits.initial = new_page_size;
+  return old_page_size;
+}
+
+Result Thread::CompileFunction(Index func_index) {
+  auto* func = cast<DefinedFunc>(env_->funcs_[func_index].get());
+  assert(func->lazy_compiler && !func->is_compiled());
+  // Compiling appends to the istream, which may move it while other Threads
+  // are running code in it.
+  TRAP_IF(env_->num_executors_.load() > 1, LazyCompileWithManyExecutors);
+  Errors errors;
+  if (Failed(func->lazy_compiler->Compile(func_index, &errors))) {
+    assert(!errors.empty());
+    TRAP_MSG(InvalidFunctionBody, "%s", errors[0].message.c_str());
+  }
+  return ResultType::Ok;
+}
+
+bool Thread::ShouldRunJitCode(DefinedFunc* func) {
+  JitCode* code = func->jit_code.load(std::memory_order_acquire);
+  if (!code &&
+      func->call_count.fetch_add(1, std::memory_order_relaxed) + 1 ==
+          jit_threshold_) {
+    // Threads with different thresholds may both reach theirs.
+    std::lock_guard<std::mutex> lock(env_->jit_mutex_);
+    code = func->jit_code.load(std::memory_order_relaxed);
+    if (!code) {
+      func->jit_code_storage = CompileJit(env_, func);
+      code = func->jit_code_storage.get();
+      func->jit_code.store(code, std::memory_order_release);
+    }
+  }
+  return code && jit_depth_ < kMaxJitDepth;
+}
+
+Result Thread::RunJitCode(DefinedFunc* func) {
+  JitCode* code = func->jit_code.load(std::memory_order_acquire);
+  Result trap = ResultType::Ok;
+  JitContext context;
+  context.thread = this;
+  context.sp = value_stack_.data() + value_stack_top_;
+  context.stack_end = value_stack_.data() + value_stack_.size();
+  context.memory = code->memory_index() == kInvalidIndex
+                       ? nullptr
+                       : &env_->memories_[code->memory_index()];
+  context.trap = &trap;
+  context.fuel = &fuel_;
+  FinishJitCall(&context, ResultType::Ok);
+
+  ++jit_depth_;
+  auto type = static_cast<ResultType>(code->entry()(&context));
+  --jit_depth_;
+  if (type != ResultType::Ok) {
+    // Traps in the machine code itself have no message.
+    return trap.type == type ? trap : Result(type);
+  }
+  value_stack_top_ = context.sp - value_stack_.data();
+  return ResultType::Ok;
+}
+
+Result Thread::RunNested(IstreamOffset offset) {
+  IstreamOffset saved_pc = pc_;
+  uint32_t saved_call_stack_base = call_stack_base_;
+  pc_ = offset;
+  call_stack_base_ = call_stack_top_;
+  ++jit_depth_;
+  Result result = RunUntilReturn();
+  --jit_depth_;
+  call_stack_base_ = saved_call_stack_base;
+  pc_ = saved_pc;
+  if (result.type != ResultType::Returned) {
+    return result;
+  }
+  return ResultType::Ok;
+}
+
+Result Thread::CallFromJit(Func* func) {
+  if (func->is_host) {
+    return CallHost(cast<HostFunc>(func));
+  }
+
+  // The call stack only holds interpreter return addresses, but machine code
+  // calls use up an entry too, so runaway recursion traps the same way.
+  TRAP_IF(call_stack_top_ >= call_stack_.size(), CallStackExhausted);
+  call_stack_[call_stack_top_++] = kInvalidIstreamOffset;
+  auto* defined = cast<DefinedFunc>(func);
+  Result result = ResultType::Ok;
+  if (defined->jit_code.load(std::memory_order_acquire) &&
+      jit_depth_ < kMaxJitDepth) {
+    result = RunJitCode(defined);
+  } else {
+    result = RunNested(defined->offset);
+  }
+  --call_stack_top_;
+  return result;
+}
+
+Result Thread::CallIndirectFromJit(IstreamOffset operands) {
+  const uint8_t* pc = GetIstream() + operands;
+  Func* func;
+  CHECK_TRAP(GetIndirectCallee(&pc, &func));
+  return CallFromJit(func);
+}
+
+// static
+uint32_t Thread::FinishJitCall(JitContext* context, Result result) {
+  if (Memory* memory = context->memory) {
+    context->memory_data = memory->data.data();
+    context->memory_size = memory->data.size();
+  }
+  if (!result.ok()) {
+    *context->trap = result;
+  }
+  return static_cast<uint32_t>(result.type);
+}
+
+// static
+uint32_t Thread::JitStep(JitContext* context, IstreamOffset offset) {
+  Thread* thread = context->thread;
+  thread->value_stack_top_ = context->sp - thread->value_stack_.data();
+  IstreamOffset saved_pc = thread->pc_;
+  thread->pc_ = offset;
+  Result result = thread->Run(1);
+  thread->pc_ = saved_pc;
+  return FinishJitCall(context, result);
+}
+
+// static
+uint32_t Thread::JitCall(JitContext* context, Index func_index) {
+  Thread* thread = context->thread;
+  thread->value_stack_top_ = context->sp - thread->value_stack_.data();
+  Result result = thread->CallFromJit(thread->env_->GetFunc(func_index));
+  return FinishJitCall(context, result);
+}
+
+// static
+uint32_t Thread::JitCallIndirect(JitContext* context, IstreamOffset operands) {
+  Thread* thread = context->thread;
+  thread->value_stack_top_ = context->sp - thread->value_stack_.data();
+  Result result = thread->CallIndirectFromJit(operands);
+  return FinishJitCall(context, result);
+}
+
 static bool CheckBounds(uint32_t start, uint32_t length, uint32_t max) {
   if (start > max) {
     return false;
@@ -1034,6 +2081,7 @@ Result Thread::MemoryInit(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   uint32_t src = Pop<uint32_t>();
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::MemoryInit, size));
   bool ok = CheckBounds(dst, size, memory_size);
   ok &= CheckBounds(src, size, segment_size);
   if (!ok) {
@@ -1057,6 +2105,7 @@ Result Thread::MemoryCopy(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   uint32_t src = Pop<uint32_t>();
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::MemoryCopy, size));
   bool ok = CheckBounds(dst, size, memory_size);
   ok &= CheckBounds(src, size, memory_size);
   if (!ok) {
@@ -1075,6 +2124,7 @@ Result Thread::MemoryFill(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   uint8_t value = static_cast<uint8_t>(Pop<uint32_t>());
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::MemoryFill, size));
   if (!CheckBounds(dst, size, memory_size)) {
     TRAP_MSG(MemoryAccessOutOfBounds, "memory.fill out of bounds");
   }
@@ -1094,6 +2144,7 @@ Result Thread::TableInit(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   uint32_t src = Pop<uint32_t>();
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::TableInit, size));
   bool ok = CheckBounds(dst, size, table->size());
   ok &= CheckBounds(src, size, segment_size);
   if (!ok) {
@@ -1133,6 +2184,7 @@ Result Thread::TableFill(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   Ref value = static_cast<Ref>(Pop<Ref>());
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::TableFill, size));
   bool ok = CheckBounds(dst, size, table->size());
   if (!ok) {
     TRAP_MSG(TableAccessOutOfBounds, "table.fill out of bounds");
@@ -1156,6 +2208,7 @@ Result Thread::TableCopy(const uint8_t** pc) {
   uint32_t size = Pop<uint32_t>();
   uint32_t src = Pop<uint32_t>();
   uint32_t dst = Pop<uint32_t>();
+  CHECK_TRAP(ConsumeFuelPerUnit(Opcode::TableCopy, size));
   bool ok = CheckBounds(dst, size, dst_table->size());
   ok &= CheckBounds(src, size, dst_table->size());
   if (!ok) {
@@ -1175,6 +2228,18 @@ Result Thread::RefFunc(const uint8_t** pc) {
   return Push(Ref{RefType::Func, index});
 }
 
+Result Thread::ConsumeFuelPerUnit(Opcode opcode, uint32_t count) {
+  if (!env_->lowering_options_.fuel) {
+    return ResultType::Ok;
+  }
+  uint64_t cost =
+      uint64_t(env_->lowering_options_.fuel_costs.GetCostPerUnit(opcode)) *
+      count;
+  TRAP_IF(cost > fuel_, OutOfFuel);
+  fuel_ -= cost;
+  return ResultType::Ok;
+}
+
 template <typename R, typename T>
 Result Thread::Unop(UnopFunc<R, T> func) {
   auto value = PopRep<T>();
@@ -1749,27 +2814,35 @@ ValueTypeRep<R> SimdReplaceLane(V value, uint32_t lane_idx, T lane_val) {
   return ToRep(Bitcast<R>(simd_data_0));
 }
 
-bool Environment::FuncSignaturesAreEqual(Index sig_index_0,
-                                         Index sig_index_1) const {
-  if (sig_index_0 == sig_index_1) {
-    return true;
-  }
-  const FuncSignature* sig_0 = &sigs_[sig_index_0];
-  const FuncSignature* sig_1 = &sigs_[sig_index_1];
-  return sig_0->param_types == sig_1->param_types &&
-         sig_0->result_types == sig_1->result_types;
-}
-
 Result Thread::CallHost(HostFunc* func) {
   FuncSignature* sig = &env_->sigs_[func->sig_index];
 
   size_t num_params = sig->param_types.size();
   size_t num_results = sig->result_types.size();
+
+  if (func->value_callback) {
+    // The arguments are replaced by the results in place.
+    uint32_t base = value_stack_top_ - GetSlotCount(sig->param_types);
+    TRAP_IF(base + GetSlotCount(sig->result_types) > value_stack_.size(),
+            ValueStackExhausted);
+    Result call_result =
+        func->value_callback(func, value_stack_.data() + base);
+    if (call_result.type == ResultType::Suspended) {
+      value_stack_top_ = base;
+      return Suspend(func);
+    }
+    TRAP_UNLESS(call_result.ok(), HostTrapped);
+    value_stack_top_ = base + GetSlotCount(sig->result_types);
+    return ResultType::Ok;
+  }
+
   TypedValues params(num_params);
   TypedValues results(num_results);
 
-  for (size_t i = num_params; i > 0; --i)
-    params[i - 1] = {sig->param_types[i - 1], Pop()};
+  for (size_t i = num_params; i > 0; --i) {
+    Type type = sig->param_types[i - 1];
+    params[i - 1] = {type, Pop(type)};
+  }
 
   for (size_t i = 0; i < num_results; ++i) {
     results[i].type = sig->result_types[i];
@@ -1777,8 +2850,16 @@ Result Thread::CallHost(HostFunc* func) {
   }
 
   Result call_result = func->callback(func, sig, params, results);
+  if (call_result.type == ResultType::Suspended) {
+    return Suspend(func);
+  }
   TRAP_UNLESS(call_result.ok(), HostTrapped);
+  return PushHostResults(sig, results);
+}
 
+Result Thread::PushHostResults(const FuncSignature* sig,
+                               const TypedValues& results) {
+  size_t num_results = sig->result_types.size();
   if (results.size() != num_results) {
     TRAP_MSG(HostResultTypeMismatch,
              "expected %" PRIzd " results but got %" PRIzd, num_results,
@@ -1789,43 +2870,166 @@ Result Thread::CallHost(HostFunc* func) {
         wabt::Result::Ok) {
       TRAP_MSG(HostResultTypeMismatch, "result mistmatch at %" PRIzx, i);
     }
-    CHECK_TRAP(Push(results[i].value));
   }
+  for (size_t i = 0; i < num_results; ++i) {
+    CHECK_TRAP(Push(sig->result_types[i], results[i].value));
+  }
+  return ResultType::Ok;
+}
 
+Result Thread::Suspend(HostFunc* func) {
+  // The native frames of machine code can't be kept until the Thread is
+  // resumed.
+  TRAP_IF(jit_depth_ > 0, SuspendedInJit);
+  suspended_func_ = func;
+  return ResultType::Suspended;
+}
+
+Result Thread::Resume(const TypedValues& results) {
+  assert(is_suspended());
+  CHECK_TRAP(PushHostResults(&env_->sigs_[suspended_func_->sig_index],
+                             results));
+  suspended_func_ = nullptr;
+  resumed_ = true;
+  if (resume_returns_) {
+    resume_returns_ = false;
+    if (call_stack_top_ == call_stack_base_) {
+      return ResultType::Returned;
+    }
+    pc_ = PopCall();
+  }
+  return ResultType::Ok;
+}
+
+template <typename R, typename T>
+Result RegBinop(R (*func)(T, T),
+                ValueSlot lhs,
+                ValueSlot rhs,
+                ValueSlot* out) {
+  *out = MakeSlot<R>(func(GetSlot<T>(lhs), GetSlot<T>(rhs)));
+  return ResultType::Ok;
+}
+
+template <typename R, typename T>
+Result RegBinopTrap(Result (*func)(T, T, R*),
+                    ValueSlot lhs,
+                    ValueSlot rhs,
+                    ValueSlot* out) {
+  R result_value;
+  CHECK_TRAP(func(GetSlot<T>(lhs), GetSlot<T>(rhs), &result_value));
+  *out = MakeSlot<R>(result_value);
   return ResultType::Ok;
 }
 
+static Result EvalRegBinop(Opcode opcode,
+                           ValueSlot lhs,
+                           ValueSlot rhs,
+                           ValueSlot* out) {
+  switch (opcode) {
+#define V(Name, helper, func) \
+  case Opcode::Name:          \
+    return Reg##helper(func, lhs, rhs, out);
+    WABT_FOREACH_REG_BINOP(V)
+#undef V
+
+    default:
+      WABT_UNREACHABLE;
+  }
+}
+
+static bool EvalI32Compare(Opcode opcode, uint32_t lhs, uint32_t rhs) {
+  switch (opcode) {
+#define V(Name, func) \
+  case Opcode::Name:  \
+    return func(lhs, rhs) != 0;
+    WABT_FOREACH_I32_COMPARE(V)
+#undef V
+
+    default:
+      WABT_UNREACHABLE;
+  }
+}
+
+Result Thread::RunUntilReturn() {
+  if (profiler_) {
+    return RunProfiled();
+  }
+
+  const int kNumInstructions = 1000;
+  Result result = ResultType::Ok;
+  while (result.ok()) {
+    result = Run(kNumInstructions);
+  }
+  return result;
+}
+
+Result Thread::RunProfiled() {
+  // A resumed function was counted when it was called.
+  if (!resumed_) {
+    profiler_->OnCall(kInvalidIstreamOffset, pc_);
+  }
+  resumed_ = false;
+  const int num_instructions = profiler_->sample_interval();
+  Result result = ResultType::Ok;
+  while (result.ok()) {
+    profiler_->OnSampleBegin(pc_, call_stack_.data(), call_stack_top_);
+    result = Run(num_instructions);
+    // The instructions run before a trap aren't counted.
+    if (result.ok() || result.type == ResultType::Returned ||
+        result.type == ResultType::Suspended) {
+      profiler_->OnSampleEnd(num_instructions_run_);
+    }
+  }
+  return result;
+}
+
+// Each opcode handler starts with CASE and ends with NEXT, which continues
+// with the next instruction.
+#define CASE(name) case Opcode::name
+#define NEXT() break
+
+// Leaves the loop if a host call traps or suspends the Thread, saving the pc
+// after the call so that a suspended Thread continues there.
+#define CHECK_HOST_CALL(...)     \
+  do {                           \
+    result = (__VA_ARGS__);      \
+    if (!result.ok()) {          \
+      goto exit_loop;            \
+    }                            \
+  } while (0)
+
 Result Thread::Run(int num_instructions) {
   Result result = ResultType::Ok;
 
   const uint8_t* istream = GetIstream();
   const uint8_t* pc = &istream[pc_];
-  for (int i = 0; i < num_instructions; ++i) {
+  int i = 0;
+  for (; i < num_instructions; ++i) {
     Opcode opcode = ReadOpcode(&pc);
     assert(!opcode.IsInvalid());
     switch (opcode) {
-      case Opcode::SelectT:
-      case Opcode::Select: {
+      CASE(SelectT):
+      CASE(Select): {
         uint32_t cond = Pop<uint32_t>();
-        Value false_ = Pop();
-        Value true_ = Pop();
-        CHECK_TRAP(Push(cond ? true_ : false_));
-        break;
+        ValueSlot false_ = PopSlot();
+        ValueSlot true_ = PopSlot();
+        CHECK_TRAP(PushSlot(cond ? true_ : false_));
+        NEXT();
       }
 
-      case Opcode::Br:
+      CASE(Br):
         GOTO(ReadU32(&pc));
-        break;
+        NEXT();
 
-      case Opcode::BrIf: {
+      CASE(BrIf): {
         IstreamOffset new_pc = ReadU32(&pc);
         if (Pop<uint32_t>()) {
           GOTO(new_pc);
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::BrTable: {
+      CASE(BrTable): {
         Index num_targets = ReadU32(&pc);
         IstreamOffset table_offset = ReadU32(&pc);
         uint32_t key = Pop<uint32_t>();
@@ -1838,302 +3042,296 @@ Result Thread::Run(int num_instructions) {
         ReadTableEntryAt(entry, &new_pc, &drop_count, &keep_count);
         DropKeep(drop_count, keep_count);
         GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case Opcode::Return:
-        if (call_stack_top_ == 0) {
+      CASE(Return):
+        if (call_stack_top_ == call_stack_base_) {
           result = ResultType::Returned;
           goto exit_loop;
         }
         GOTO(PopCall());
-        break;
+        NEXT();
 
-      case Opcode::Unreachable:
+      CASE(Unreachable):
         TRAP(Unreachable);
-        break;
+        NEXT();
 
-      case Opcode::I32Const:
+      CASE(I32Const):
         CHECK_TRAP(Push<uint32_t>(ReadU32(&pc)));
-        break;
+        NEXT();
 
-      case Opcode::I64Const:
+      CASE(I64Const):
         CHECK_TRAP(Push<uint64_t>(ReadU64(&pc)));
-        break;
+        NEXT();
 
-      case Opcode::F32Const:
+      CASE(F32Const):
         CHECK_TRAP(PushRep<float>(ReadU32(&pc)));
-        break;
+        NEXT();
 
-      case Opcode::F64Const:
+      CASE(F64Const):
         CHECK_TRAP(PushRep<double>(ReadU64(&pc)));
-        break;
+        NEXT();
 
-      case Opcode::GlobalGet: {
+      CASE(GlobalGet): {
         Index index = ReadU32(&pc);
         assert(index < env_->globals_.size());
-        CHECK_TRAP(Push(env_->globals_[index].typed_value.value));
-        break;
+        Global& global = env_->globals_[index];
+        CHECK_TRAP(Push(global.type, global.typed_value.value));
+        NEXT();
       }
 
-      case Opcode::GlobalSet: {
+      CASE(GlobalSet): {
         Index index = ReadU32(&pc);
         assert(index < env_->globals_.size());
-        env_->globals_[index].typed_value = {env_->globals_[index].type, Pop()};
-        break;
+        Global& global = env_->globals_[index];
+        global.typed_value = {global.type, Pop(global.type)};
+        NEXT();
       }
 
-      case Opcode::LocalGet: {
-        Value value = Pick(ReadU32(&pc));
-        CHECK_TRAP(Push(value));
-        break;
+      // These move one slot, so a v128 local is accessed with two of them.
+      CASE(LocalGet): {
+        ValueSlot slot = Pick(ReadU32(&pc));
+        CHECK_TRAP(PushSlot(slot));
+        NEXT();
       }
 
-      case Opcode::LocalSet: {
-        Value value = Pop();
-        Pick(ReadU32(&pc)) = value;
-        break;
+      CASE(LocalSet): {
+        ValueSlot slot = PopSlot();
+        Pick(ReadU32(&pc)) = slot;
+        NEXT();
       }
 
-      case Opcode::LocalTee:
+      CASE(LocalTee):
         Pick(ReadU32(&pc)) = Top();
-        break;
+        NEXT();
 
-      case Opcode::Call: {
+      CASE(Call): {
         IstreamOffset offset = ReadU32(&pc);
+        PROFILE_CALL(offset);
         CHECK_TRAP(PushCall(pc));
         GOTO(offset);
-        break;
+        NEXT();
       }
 
-      case Opcode::CallIndirect: {
-        Table* table = ReadTable(&pc);
-        Index sig_index = ReadU32(&pc);
-        Index entry_index = Pop<uint32_t>();
-        TRAP_IF(entry_index >= table->size(), UndefinedTableIndex);
-        Ref ref = table->entries[entry_index];
-        TRAP_IF(ref.kind == RefType::Null, UninitializedTableElement);
-        assert(ref.kind == RefType::Func && ref.index != kInvalidIndex);
-        Func* func = env_->GetFunc(ref.index);
-        TRAP_UNLESS(env_->FuncSignaturesAreEqual(func->sig_index, sig_index),
-                    IndirectCallSignatureMismatch);
+      CASE(CallIndirect): {
+        Func* func;
+        CHECK_TRAP(GetIndirectCallee(&pc, &func));
         if (func->is_host) {
-          CHECK_TRAP(CallHost(cast<HostFunc>(func)));
+          CHECK_HOST_CALL(CallHost(cast<HostFunc>(func)));
         } else {
+          PROFILE_CALL(cast<DefinedFunc>(func)->offset);
           CHECK_TRAP(PushCall(pc));
           GOTO(cast<DefinedFunc>(func)->offset);
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::InterpCallHost: {
+      CASE(InterpCallHost): {
         Index func_index = ReadU32(&pc);
-        CHECK_TRAP(CallHost(cast<HostFunc>(env_->funcs_[func_index].get())));
-        break;
+        CHECK_HOST_CALL(
+            CallHost(cast<HostFunc>(env_->funcs_[func_index].get())));
+        NEXT();
       }
 
-      case Opcode::ReturnCall: {
+      CASE(ReturnCall): {
         IstreamOffset offset = ReadU32(&pc);
+        PROFILE_CALL(offset);
         GOTO(offset);
 
-        break;
+        NEXT();
       }
 
-      case Opcode::ReturnCallIndirect:{
-        Table* table = ReadTable(&pc);
-        Index sig_index = ReadU32(&pc);
-        Index entry_index = Pop<uint32_t>();
-        TRAP_IF(entry_index >= table->size(), UndefinedTableIndex);
-        Ref ref = table->entries[entry_index];
-        assert(ref.kind == RefType::Func);
-        TRAP_IF(ref.kind == RefType::Null, UninitializedTableElement);
-        assert(ref.kind == RefType::Func && ref.index != kInvalidIndex);
-        Func* func = env_->GetFunc(ref.index);
-        TRAP_UNLESS(env_->FuncSignaturesAreEqual(func->sig_index, sig_index),
-                    IndirectCallSignatureMismatch);
+      CASE(ReturnCallIndirect): {
+        Func* func;
+        CHECK_TRAP(GetIndirectCallee(&pc, &func));
         if (func->is_host) { // Emulate a call/return for imported functions
-          CHECK_TRAP(CallHost(cast<HostFunc>(func)));
-          if (call_stack_top_ == 0) {
+          result = CallHost(cast<HostFunc>(func));
+          // There's nothing after this instruction, so Resume returns.
+          resume_returns_ = result.type == ResultType::Suspended;
+          CHECK_HOST_CALL(result);
+          if (call_stack_top_ == call_stack_base_) {
             result = ResultType::Returned;
             goto exit_loop;
           }
           GOTO(PopCall());
         } else {
+          PROFILE_CALL(cast<DefinedFunc>(func)->offset);
           GOTO(cast<DefinedFunc>(func)->offset);
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Load8S:
+      CASE(I32Load8S):
         CHECK_TRAP(Load<int8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load8U:
+      CASE(I32Load8U):
         CHECK_TRAP(Load<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load16S:
+      CASE(I32Load16S):
         CHECK_TRAP(Load<int16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load16U:
+      CASE(I32Load16U):
         CHECK_TRAP(Load<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load8S:
+      CASE(I64Load8S):
         CHECK_TRAP(Load<int8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load8U:
+      CASE(I64Load8U):
         CHECK_TRAP(Load<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load16S:
+      CASE(I64Load16S):
         CHECK_TRAP(Load<int16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load16U:
+      CASE(I64Load16U):
         CHECK_TRAP(Load<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load32S:
+      CASE(I64Load32S):
         CHECK_TRAP(Load<int32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load32U:
+      CASE(I64Load32U):
         CHECK_TRAP(Load<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load:
+      CASE(I32Load):
         CHECK_TRAP(Load<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load:
+      CASE(I64Load):
         CHECK_TRAP(Load<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F32Load:
+      CASE(F32Load):
         CHECK_TRAP(Load<float>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F64Load:
+      CASE(F64Load):
         CHECK_TRAP(Load<double>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store8:
+      CASE(I32Store8):
         CHECK_TRAP(Store<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store16:
+      CASE(I32Store16):
         CHECK_TRAP(Store<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store8:
+      CASE(I64Store8):
         CHECK_TRAP(Store<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store16:
+      CASE(I64Store16):
         CHECK_TRAP(Store<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store32:
+      CASE(I64Store32):
         CHECK_TRAP(Store<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store:
+      CASE(I32Store):
         CHECK_TRAP(Store<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store:
+      CASE(I64Store):
         CHECK_TRAP(Store<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F32Store:
+      CASE(F32Store):
         CHECK_TRAP(Store<float>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F64Store:
+      CASE(F64Store):
         CHECK_TRAP(Store<double>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad8U:
+      CASE(I32AtomicLoad8U):
         CHECK_TRAP(AtomicLoad<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad16U:
+      CASE(I32AtomicLoad16U):
         CHECK_TRAP(AtomicLoad<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad8U:
+      CASE(I64AtomicLoad8U):
         CHECK_TRAP(AtomicLoad<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad16U:
+      CASE(I64AtomicLoad16U):
         CHECK_TRAP(AtomicLoad<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad32U:
+      CASE(I64AtomicLoad32U):
         CHECK_TRAP(AtomicLoad<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad:
+      CASE(I32AtomicLoad):
         CHECK_TRAP(AtomicLoad<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad:
+      CASE(I64AtomicLoad):
         CHECK_TRAP(AtomicLoad<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore8:
+      CASE(I32AtomicStore8):
         CHECK_TRAP(AtomicStore<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore16:
+      CASE(I32AtomicStore16):
         CHECK_TRAP(AtomicStore<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore8:
+      CASE(I64AtomicStore8):
         CHECK_TRAP(AtomicStore<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore16:
+      CASE(I64AtomicStore16):
         CHECK_TRAP(AtomicStore<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore32:
+      CASE(I64AtomicStore32):
         CHECK_TRAP(AtomicStore<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore:
+      CASE(I32AtomicStore):
         CHECK_TRAP(AtomicStore<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore:
+      CASE(I64AtomicStore):
         CHECK_TRAP(AtomicStore<uint64_t>(&pc));
-        break;
+        NEXT();
 
 #define ATOMIC_RMW(rmwop, func)                                     \
-  case Opcode::I32AtomicRmw##rmwop:                                 \
+  CASE(I32AtomicRmw##rmwop):                                        \
     CHECK_TRAP(AtomicRmw<uint32_t, uint32_t>(func<uint32_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw##rmwop:                                 \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw##rmwop):                                        \
     CHECK_TRAP(AtomicRmw<uint64_t, uint64_t>(func<uint64_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I32AtomicRmw8##rmwop##U:                             \
+    NEXT();                                                         \
+  CASE(I32AtomicRmw8##rmwop##U):                                    \
     CHECK_TRAP(AtomicRmw<uint8_t, uint32_t>(func<uint32_t>, &pc));  \
-    break;                                                          \
-  case Opcode::I32AtomicRmw16##rmwop##U:                            \
+    NEXT();                                                         \
+  CASE(I32AtomicRmw16##rmwop##U):                                   \
     CHECK_TRAP(AtomicRmw<uint16_t, uint32_t>(func<uint32_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw8##rmwop##U:                             \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw8##rmwop##U):                                    \
     CHECK_TRAP(AtomicRmw<uint8_t, uint64_t>(func<uint64_t>, &pc));  \
-    break;                                                          \
-  case Opcode::I64AtomicRmw16##rmwop##U:                            \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw16##rmwop##U):                                   \
     CHECK_TRAP(AtomicRmw<uint16_t, uint64_t>(func<uint64_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw32##rmwop##U:                            \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw32##rmwop##U):                                   \
     CHECK_TRAP(AtomicRmw<uint32_t, uint64_t>(func<uint64_t>, &pc)); \
-    break /* no semicolon */
+    NEXT() /* no semicolon */
 
         ATOMIC_RMW(Add, Add);
         ATOMIC_RMW(Sub, Sub);
@@ -2144,520 +3342,514 @@ Result Thread::Run(int num_instructions) {
 
 #undef ATOMIC_RMW
 
-      case Opcode::I32AtomicRmwCmpxchg:
+      CASE(I32AtomicRmwCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint32_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmwCmpxchg:
+      CASE(I64AtomicRmwCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint64_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicRmw8CmpxchgU:
+      CASE(I32AtomicRmw8CmpxchgU):
         CHECK_TRAP(AtomicRmwCmpxchg<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicRmw16CmpxchgU:
+      CASE(I32AtomicRmw16CmpxchgU):
         CHECK_TRAP(AtomicRmwCmpxchg<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw8CmpxchgU:
+      CASE(I64AtomicRmw8CmpxchgU):
         CHECK_TRAP(AtomicRmwCmpxchg<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw16CmpxchgU:
+      CASE(I64AtomicRmw16CmpxchgU):
         CHECK_TRAP(AtomicRmwCmpxchg<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw32CmpxchgU:
+      CASE(I64AtomicRmw32CmpxchgU):
         CHECK_TRAP(AtomicRmwCmpxchg<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::MemorySize:
-        CHECK_TRAP(Push<uint32_t>(ReadMemory(&pc)->page_limits.initial));
-        break;
+      CASE(MemorySize): {
+        // Another thread may be growing a shared memory; its page count is
+        // published by the acquire-loaded data size, not |page_limits|.
+        Memory* memory = ReadMemory(&pc);
+        CHECK_TRAP(Push<uint32_t>(memory->data.size() / WABT_PAGE_SIZE));
+        NEXT();
+      }
 
-      case Opcode::MemoryGrow: {
+      CASE(MemoryGrow): {
         Memory* memory = ReadMemory(&pc);
-        uint32_t old_page_size = memory->page_limits.initial;
         uint32_t grow_pages = Pop<uint32_t>();
-        uint32_t new_page_size = old_page_size + grow_pages;
-        uint32_t max_page_size = memory->page_limits.has_max
-                                     ? memory->page_limits.max
-                                     : WABT_MAX_PAGES;
-        PUSH_NEG_1_AND_BREAK_IF(new_page_size > max_page_size);
-        PUSH_NEG_1_AND_BREAK_IF(
-            static_cast<uint64_t>(new_page_size) * WABT_PAGE_SIZE > UINT32_MAX);
-        memory->data.resize(new_page_size * WABT_PAGE_SIZE);
-        memory->page_limits.initial = new_page_size;
-        CHECK_TRAP(Push<uint32_t>(old_page_size));
-        break;
-      }
-
-      case Opcode::I32Add:
+        CHECK_TRAP(Push<uint32_t>(GrowMemory(memory, grow_pages)));
+        NEXT();
+      }
+
+      CASE(I32Add):
         CHECK_TRAP(Binop(Add<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Sub:
+      CASE(I32Sub):
         CHECK_TRAP(Binop(Sub<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Mul:
+      CASE(I32Mul):
         CHECK_TRAP(Binop(Mul<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32DivS:
+      CASE(I32DivS):
         CHECK_TRAP(BinopTrap(IntDivS<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32DivU:
+      CASE(I32DivU):
         CHECK_TRAP(BinopTrap(IntDivU<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32RemS:
+      CASE(I32RemS):
         CHECK_TRAP(BinopTrap(IntRemS<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32RemU:
+      CASE(I32RemU):
         CHECK_TRAP(BinopTrap(IntRemU<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32And:
+      CASE(I32And):
         CHECK_TRAP(Binop(IntAnd<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Or:
+      CASE(I32Or):
         CHECK_TRAP(Binop(IntOr<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Xor:
+      CASE(I32Xor):
         CHECK_TRAP(Binop(IntXor<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Shl:
+      CASE(I32Shl):
         CHECK_TRAP(Binop(IntShl<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32ShrU:
+      CASE(I32ShrU):
         CHECK_TRAP(Binop(IntShr<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32ShrS:
+      CASE(I32ShrS):
         CHECK_TRAP(Binop(IntShr<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Eq:
+      CASE(I32Eq):
         CHECK_TRAP(Binop(Eq<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Ne:
+      CASE(I32Ne):
         CHECK_TRAP(Binop(Ne<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32LtS:
+      CASE(I32LtS):
         CHECK_TRAP(Binop(Lt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32LeS:
+      CASE(I32LeS):
         CHECK_TRAP(Binop(Le<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32LtU:
+      CASE(I32LtU):
         CHECK_TRAP(Binop(Lt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32LeU:
+      CASE(I32LeU):
         CHECK_TRAP(Binop(Le<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32GtS:
+      CASE(I32GtS):
         CHECK_TRAP(Binop(Gt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32GeS:
+      CASE(I32GeS):
         CHECK_TRAP(Binop(Ge<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32GtU:
+      CASE(I32GtU):
         CHECK_TRAP(Binop(Gt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32GeU:
+      CASE(I32GeU):
         CHECK_TRAP(Binop(Ge<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Clz:
+      CASE(I32Clz):
         CHECK_TRAP(Push<uint32_t>(Clz(Pop<uint32_t>())));
-        break;
+        NEXT();
 
-      case Opcode::I32Ctz:
+      CASE(I32Ctz):
         CHECK_TRAP(Push<uint32_t>(Ctz(Pop<uint32_t>())));
-        break;
+        NEXT();
 
-      case Opcode::I32Popcnt:
+      CASE(I32Popcnt):
         CHECK_TRAP(Push<uint32_t>(Popcount(Pop<uint32_t>())));
-        break;
+        NEXT();
 
-      case Opcode::I32Eqz:
+      CASE(I32Eqz):
         CHECK_TRAP(Unop(IntEqz<uint32_t, uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Add:
+      CASE(I64Add):
         CHECK_TRAP(Binop(Add<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Sub:
+      CASE(I64Sub):
         CHECK_TRAP(Binop(Sub<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Mul:
+      CASE(I64Mul):
         CHECK_TRAP(Binop(Mul<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64DivS:
+      CASE(I64DivS):
         CHECK_TRAP(BinopTrap(IntDivS<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64DivU:
+      CASE(I64DivU):
         CHECK_TRAP(BinopTrap(IntDivU<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64RemS:
+      CASE(I64RemS):
         CHECK_TRAP(BinopTrap(IntRemS<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64RemU:
+      CASE(I64RemU):
         CHECK_TRAP(BinopTrap(IntRemU<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64And:
+      CASE(I64And):
         CHECK_TRAP(Binop(IntAnd<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Or:
+      CASE(I64Or):
         CHECK_TRAP(Binop(IntOr<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Xor:
+      CASE(I64Xor):
         CHECK_TRAP(Binop(IntXor<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Shl:
+      CASE(I64Shl):
         CHECK_TRAP(Binop(IntShl<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64ShrU:
+      CASE(I64ShrU):
         CHECK_TRAP(Binop(IntShr<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64ShrS:
+      CASE(I64ShrS):
         CHECK_TRAP(Binop(IntShr<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Eq:
+      CASE(I64Eq):
         CHECK_TRAP(Binop(Eq<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Ne:
+      CASE(I64Ne):
         CHECK_TRAP(Binop(Ne<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64LtS:
+      CASE(I64LtS):
         CHECK_TRAP(Binop(Lt<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64LeS:
+      CASE(I64LeS):
         CHECK_TRAP(Binop(Le<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64LtU:
+      CASE(I64LtU):
         CHECK_TRAP(Binop(Lt<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64LeU:
+      CASE(I64LeU):
         CHECK_TRAP(Binop(Le<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64GtS:
+      CASE(I64GtS):
         CHECK_TRAP(Binop(Gt<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64GeS:
+      CASE(I64GeS):
         CHECK_TRAP(Binop(Ge<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64GtU:
+      CASE(I64GtU):
         CHECK_TRAP(Binop(Gt<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64GeU:
+      CASE(I64GeU):
         CHECK_TRAP(Binop(Ge<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Clz:
+      CASE(I64Clz):
         CHECK_TRAP(Push<uint64_t>(Clz(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::I64Ctz:
+      CASE(I64Ctz):
         CHECK_TRAP(Push<uint64_t>(Ctz(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::I64Popcnt:
+      CASE(I64Popcnt):
         CHECK_TRAP(Push<uint64_t>(Popcount(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F32Add:
+      CASE(F32Add):
         CHECK_TRAP(Binop(Add<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Sub:
+      CASE(F32Sub):
         CHECK_TRAP(Binop(Sub<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Mul:
+      CASE(F32Mul):
         CHECK_TRAP(Binop(Mul<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Div:
+      CASE(F32Div):
         CHECK_TRAP(Binop(FloatDiv<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Min:
+      CASE(F32Min):
         CHECK_TRAP(Binop(FloatMin<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Max:
+      CASE(F32Max):
         CHECK_TRAP(Binop(FloatMax<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Abs:
+      CASE(F32Abs):
         CHECK_TRAP(Unop(FloatAbs<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Neg:
+      CASE(F32Neg):
         CHECK_TRAP(Unop(FloatNeg<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Copysign:
+      CASE(F32Copysign):
         CHECK_TRAP(Binop(FloatCopySign<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Ceil:
+      CASE(F32Ceil):
         CHECK_TRAP(Unop(FloatCeil<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Floor:
+      CASE(F32Floor):
         CHECK_TRAP(Unop(FloatFloor<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Trunc:
+      CASE(F32Trunc):
         CHECK_TRAP(Unop(FloatTrunc<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Nearest:
+      CASE(F32Nearest):
         CHECK_TRAP(Unop(FloatNearest<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Sqrt:
+      CASE(F32Sqrt):
         CHECK_TRAP(Unop(FloatSqrt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Eq:
+      CASE(F32Eq):
         CHECK_TRAP(Binop(Eq<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Ne:
+      CASE(F32Ne):
         CHECK_TRAP(Binop(Ne<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Lt:
+      CASE(F32Lt):
         CHECK_TRAP(Binop(Lt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Le:
+      CASE(F32Le):
         CHECK_TRAP(Binop(Le<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Gt:
+      CASE(F32Gt):
         CHECK_TRAP(Binop(Gt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F32Ge:
+      CASE(F32Ge):
         CHECK_TRAP(Binop(Ge<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64Add:
+      CASE(F64Add):
         CHECK_TRAP(Binop(Add<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Sub:
+      CASE(F64Sub):
         CHECK_TRAP(Binop(Sub<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Mul:
+      CASE(F64Mul):
         CHECK_TRAP(Binop(Mul<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Div:
+      CASE(F64Div):
         CHECK_TRAP(Binop(FloatDiv<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Min:
+      CASE(F64Min):
         CHECK_TRAP(Binop(FloatMin<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Max:
+      CASE(F64Max):
         CHECK_TRAP(Binop(FloatMax<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Abs:
+      CASE(F64Abs):
         CHECK_TRAP(Unop(FloatAbs<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Neg:
+      CASE(F64Neg):
         CHECK_TRAP(Unop(FloatNeg<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Copysign:
+      CASE(F64Copysign):
         CHECK_TRAP(Binop(FloatCopySign<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Ceil:
+      CASE(F64Ceil):
         CHECK_TRAP(Unop(FloatCeil<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Floor:
+      CASE(F64Floor):
         CHECK_TRAP(Unop(FloatFloor<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Trunc:
+      CASE(F64Trunc):
         CHECK_TRAP(Unop(FloatTrunc<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Nearest:
+      CASE(F64Nearest):
         CHECK_TRAP(Unop(FloatNearest<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Sqrt:
+      CASE(F64Sqrt):
         CHECK_TRAP(Unop(FloatSqrt<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Eq:
+      CASE(F64Eq):
         CHECK_TRAP(Binop(Eq<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Ne:
+      CASE(F64Ne):
         CHECK_TRAP(Binop(Ne<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Lt:
+      CASE(F64Lt):
         CHECK_TRAP(Binop(Lt<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Le:
+      CASE(F64Le):
         CHECK_TRAP(Binop(Le<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Gt:
+      CASE(F64Gt):
         CHECK_TRAP(Binop(Gt<double>));
-        break;
+        NEXT();
 
-      case Opcode::F64Ge:
+      CASE(F64Ge):
         CHECK_TRAP(Binop(Ge<double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncF32S:
+      CASE(I32TruncF32S):
         CHECK_TRAP(UnopTrap(IntTrunc<int32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSatF32S:
+      CASE(I32TruncSatF32S):
         CHECK_TRAP(Unop(IntTruncSat<int32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncF64S:
+      CASE(I32TruncF64S):
         CHECK_TRAP(UnopTrap(IntTrunc<int32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSatF64S:
+      CASE(I32TruncSatF64S):
         CHECK_TRAP(Unop(IntTruncSat<int32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncF32U:
+      CASE(I32TruncF32U):
         CHECK_TRAP(UnopTrap(IntTrunc<uint32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSatF32U:
+      CASE(I32TruncSatF32U):
         CHECK_TRAP(Unop(IntTruncSat<uint32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncF64U:
+      CASE(I32TruncF64U):
         CHECK_TRAP(UnopTrap(IntTrunc<uint32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSatF64U:
+      CASE(I32TruncSatF64U):
         CHECK_TRAP(Unop(IntTruncSat<uint32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32WrapI64:
+      CASE(I32WrapI64):
         CHECK_TRAP(Push<uint32_t>(Pop<uint64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncF32S:
+      CASE(I64TruncF32S):
         CHECK_TRAP(UnopTrap(IntTrunc<int64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSatF32S:
+      CASE(I64TruncSatF32S):
         CHECK_TRAP(Unop(IntTruncSat<int64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncF64S:
+      CASE(I64TruncF64S):
         CHECK_TRAP(UnopTrap(IntTrunc<int64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSatF64S:
+      CASE(I64TruncSatF64S):
         CHECK_TRAP(Unop(IntTruncSat<int64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncF32U:
+      CASE(I64TruncF32U):
         CHECK_TRAP(UnopTrap(IntTrunc<uint64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSatF32U:
+      CASE(I64TruncSatF32U):
         CHECK_TRAP(Unop(IntTruncSat<uint64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncF64U:
+      CASE(I64TruncF64U):
         CHECK_TRAP(UnopTrap(IntTrunc<uint64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSatF64U:
+      CASE(I64TruncSatF64U):
         CHECK_TRAP(Unop(IntTruncSat<uint64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64ExtendI32S:
+      CASE(I64ExtendI32S):
         CHECK_TRAP(Push<uint64_t>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I64ExtendI32U:
+      CASE(I64ExtendI32U):
         CHECK_TRAP(Push<uint64_t>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertI32S:
+      CASE(F32ConvertI32S):
         CHECK_TRAP(Push<float>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertI32U:
+      CASE(F32ConvertI32U):
         CHECK_TRAP(Push<float>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertI64S:
+      CASE(F32ConvertI64S):
         CHECK_TRAP(Push<float>(wabt_convert_int64_to_float(Pop<int64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertI64U:
+      CASE(F32ConvertI64U):
         CHECK_TRAP(Push<float>(wabt_convert_uint64_to_float(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F32DemoteF64: {
+      CASE(F32DemoteF64): {
         typedef FloatTraits<float> F32Traits;
 
         uint64_t value = PopRep<double>();
@@ -2674,298 +3866,401 @@ Result Thread::Run(int num_instructions) {
           uint32_t sign = (value >> 32) & F32Traits::kSignMask;
           CHECK_TRAP(PushRep<float>(sign | F32Traits::kInf));
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::F32ReinterpretI32:
+      CASE(F32ReinterpretI32):
         CHECK_TRAP(PushRep<float>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertI32S:
+      CASE(F64ConvertI32S):
         CHECK_TRAP(Push<double>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertI32U:
+      CASE(F64ConvertI32U):
         CHECK_TRAP(Push<double>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertI64S:
+      CASE(F64ConvertI64S):
         CHECK_TRAP(Push<double>(wabt_convert_int64_to_double(Pop<int64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertI64U:
+      CASE(F64ConvertI64U):
         CHECK_TRAP(
             Push<double>(wabt_convert_uint64_to_double(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F64PromoteF32: {
+      CASE(F64PromoteF32): {
         uint32_t value = PopRep<float>();
         if (WABT_UNLIKELY(FloatTraits<float>::IsNan(value))) {
           CHECK_TRAP(PushRep<double>(FloatTraits<double>::kQuietNan));
         } else {
           CHECK_TRAP(Push<double>(Bitcast<float>(value)));
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::F64ReinterpretI64:
+      CASE(F64ReinterpretI64):
         CHECK_TRAP(PushRep<double>(Pop<uint64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I32ReinterpretF32:
+      CASE(I32ReinterpretF32):
         CHECK_TRAP(Push<uint32_t>(PopRep<float>()));
-        break;
+        NEXT();
 
-      case Opcode::I64ReinterpretF64:
+      CASE(I64ReinterpretF64):
         CHECK_TRAP(Push<uint64_t>(PopRep<double>()));
-        break;
+        NEXT();
 
-      case Opcode::I32Rotr:
+      CASE(I32Rotr):
         CHECK_TRAP(Binop(IntRotr<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Rotl:
+      CASE(I32Rotl):
         CHECK_TRAP(Binop(IntRotl<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Rotr:
+      CASE(I64Rotr):
         CHECK_TRAP(Binop(IntRotr<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Rotl:
+      CASE(I64Rotl):
         CHECK_TRAP(Binop(IntRotl<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Eqz:
+      CASE(I64Eqz):
         CHECK_TRAP(Unop(IntEqz<uint32_t, uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Extend8S:
+      CASE(I32Extend8S):
         CHECK_TRAP(Unop(IntExtendS<uint32_t, int8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32Extend16S:
+      CASE(I32Extend16S):
         CHECK_TRAP(Unop(IntExtendS<uint32_t, int16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Extend8S:
+      CASE(I64Extend8S):
         CHECK_TRAP(Unop(IntExtendS<uint64_t, int8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Extend16S:
+      CASE(I64Extend16S):
         CHECK_TRAP(Unop(IntExtendS<uint64_t, int16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64Extend32S:
+      CASE(I64Extend32S):
         CHECK_TRAP(Unop(IntExtendS<uint64_t, int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::InterpAlloca: {
+      CASE(InterpAlloca): {
         uint32_t old_value_stack_top = value_stack_top_;
         size_t count = ReadU32(&pc);
         value_stack_top_ += count;
         CHECK_STACK();
-        memset(&value_stack_[old_value_stack_top], 0, count * sizeof(Value));
-        break;
+        memset(&value_stack_[old_value_stack_top], 0,
+               count * sizeof(ValueSlot));
+        NEXT();
       }
 
-      case Opcode::InterpBrUnless: {
+      CASE(InterpBrUnless): {
         IstreamOffset new_pc = ReadU32(&pc);
         if (!Pop<uint32_t>()) {
           GOTO(new_pc);
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::Drop:
-        (void)Pop();
-        break;
+      CASE(InterpRegBinop): {
+        Opcode binop = ReadOpcode(&pc);
+        ValueSlot lhs = Pick(ReadU32(&pc));
+        ValueSlot rhs = Pick(ReadU32(&pc));
+        ValueSlot slot;
+        CHECK_TRAP(EvalRegBinop(binop, lhs, rhs, &slot));
+        CHECK_TRAP(PushSlot(slot));
+        NEXT();
+      }
+
+      CASE(InterpRegBinopSet): {
+        Opcode binop = ReadOpcode(&pc);
+        ValueSlot& dst = Pick(ReadU32(&pc));
+        ValueSlot lhs = Pick(ReadU32(&pc));
+        ValueSlot rhs = Pick(ReadU32(&pc));
+        CHECK_TRAP(EvalRegBinop(binop, lhs, rhs, &dst));
+        NEXT();
+      }
+
+      CASE(InterpI32AddLocals): {
+        uint32_t lhs = Pick(ReadU32(&pc)).i32;
+        uint32_t rhs = Pick(ReadU32(&pc)).i32;
+        CHECK_TRAP(Push<uint32_t>(lhs + rhs));
+        NEXT();
+      }
+
+      CASE(InterpI32AddConst):
+        Top().i32 += ReadU32(&pc);
+        NEXT();
+
+      CASE(InterpI32LoadLocal): {
+        uint32_t base = Pick(ReadU32(&pc)).i32;
+        void* src;
+        CHECK_TRAP(GetAccessAddress<uint32_t>(&pc, base, &src));
+        uint32_t value;
+        LoadFromMemory<uint32_t>(&value, src);
+        CHECK_TRAP(Push<uint32_t>(value));
+        NEXT();
+      }
+
+      CASE(InterpI32CompareBrUnless): {
+        Opcode compare = ReadOpcode(&pc);
+        IstreamOffset new_pc = ReadU32(&pc);
+        uint32_t rhs = Pop<uint32_t>();
+        bool cond;
+        if (compare == Opcode::I32Eqz) {
+          cond = rhs == 0;
+        } else {
+          uint32_t lhs = Pop<uint32_t>();
+          cond = EvalI32Compare(compare, lhs, rhs);
+        }
+        if (!cond) {
+          GOTO(new_pc);
+        }
+        NEXT();
+      }
+
+      CASE(InterpCompile): {
+        Index func_index = ReadU32(&pc);
+        CHECK_TRAP(CompileFunction(func_index));
+        istream = GetIstream();
+        GOTO(cast<DefinedFunc>(env_->funcs_[func_index].get())->offset);
+        NEXT();
+      }
+
+      CASE(InterpConsumeFuel): {
+        uint32_t cost = ReadU32(&pc);
+        TRAP_IF(cost > fuel_, OutOfFuel);
+        fuel_ -= cost;
+        NEXT();
+      }
+
+      CASE(InterpFuncEntry): {
+        auto* func = cast<DefinedFunc>(env_->funcs_[ReadU32(&pc)].get());
+        if (jit_threshold_ != 0 && ShouldRunJitCode(func)) {
+          // The machine code runs the whole function, so return from it.
+          // Functions it called may have been lazily compiled, which may
+          // have reallocated the istream.
+          CHECK_TRAP(RunJitCode(func));
+          istream = GetIstream();
+          if (call_stack_top_ == call_stack_base_) {
+            result = ResultType::Returned;
+            goto exit_loop;
+          }
+          GOTO(PopCall());
+        }
+        NEXT();
+      }
+
+      CASE(Drop):
+        (void)PopSlot();
+        NEXT();
+
+      CASE(InterpSelectV128): {
+        uint32_t cond = Pop<uint32_t>();
+        v128 false_ = PopRep<v128>();
+        v128 true_ = PopRep<v128>();
+        CHECK_TRAP(PushRep<v128>(cond ? true_ : false_));
+        NEXT();
+      }
 
-      case Opcode::InterpDropKeep: {
+      CASE(InterpDropKeep): {
         uint32_t drop_count = ReadU32(&pc);
         uint32_t keep_count = ReadU32(&pc);
         DropKeep(drop_count, keep_count);
-        break;
+        NEXT();
       }
 
-      case Opcode::Nop:
-        break;
+      CASE(Nop):
+        NEXT();
 
-      case Opcode::I32AtomicWait:
-      case Opcode::I64AtomicWait:
-      case Opcode::AtomicNotify:
-        // TODO(binji): Implement.
-        TRAP(Unreachable);
-        break;
+      CASE(I32AtomicWait):
+        CHECK_TRAP(AtomicWait<uint32_t>(&pc));
+        NEXT();
+
+      CASE(I64AtomicWait):
+        CHECK_TRAP(AtomicWait<uint64_t>(&pc));
+        NEXT();
 
-      case Opcode::V128Const: {
+      CASE(AtomicNotify):
+        CHECK_TRAP(AtomicNotify(&pc));
+        NEXT();
+
+      CASE(V128Const): {
         CHECK_TRAP(PushRep<v128>(ReadV128(&pc)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V128Load:
+      CASE(V128Load):
         CHECK_TRAP(Load<v128>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::V128Store:
+      CASE(V128Store):
         CHECK_TRAP(Store<v128>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I8X16Splat: {
+      CASE(I8X16Splat): {
         uint8_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint8_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8Splat: {
+      CASE(I16X8Splat): {
         uint16_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint16_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4Splat: {
+      CASE(I32X4Splat): {
         uint32_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint32_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2Splat: {
+      CASE(I64X2Splat): {
         uint64_t lane_data = Pop<uint64_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint64_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F32X4Splat: {
+      CASE(F32X4Splat): {
         float lane_data = Pop<float>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, float>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F64X2Splat: {
+      CASE(F64X2Splat): {
         double lane_data = Pop<double>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, double>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16ExtractLaneS: {
+      CASE(I8X16ExtractLaneS): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int32_t>(
             SimdExtractLane<int32_t, v128, int8_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16ExtractLaneU: {
+      CASE(I8X16ExtractLaneU): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int32_t>(
             SimdExtractLane<int32_t, v128, uint8_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8ExtractLaneS: {
+      CASE(I16X8ExtractLaneS): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int32_t>(
             SimdExtractLane<int32_t, v128, int16_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8ExtractLaneU: {
+      CASE(I16X8ExtractLaneU): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int32_t>(
             SimdExtractLane<int32_t, v128, uint16_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4ExtractLane: {
+      CASE(I32X4ExtractLane): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int32_t>(
             SimdExtractLane<int32_t, v128, int32_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2ExtractLane: {
+      CASE(I64X2ExtractLane): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<int64_t>(
             SimdExtractLane<int64_t, v128, int64_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F32X4ExtractLane: {
+      CASE(F32X4ExtractLane): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<float>(
             SimdExtractLane<int32_t, v128, int32_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F64X2ExtractLane: {
+      CASE(F64X2ExtractLane): {
         v128 lane_val = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(PushRep<double>(
             SimdExtractLane<int64_t, v128, int64_t>(lane_val, lane_idx)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16ReplaceLane: {
+      CASE(I8X16ReplaceLane): {
         int8_t lane_val = static_cast<int8_t>(Pop<int32_t>());
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, int8_t>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8ReplaceLane: {
+      CASE(I16X8ReplaceLane): {
         int16_t lane_val = static_cast<int16_t>(Pop<int32_t>());
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, int16_t>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4ReplaceLane: {
+      CASE(I32X4ReplaceLane): {
         int32_t lane_val = Pop<int32_t>();
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, int32_t>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2ReplaceLane: {
+      CASE(I64X2ReplaceLane): {
         int64_t lane_val = Pop<int64_t>();
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, int64_t>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F32X4ReplaceLane: {
+      CASE(F32X4ReplaceLane): {
         float lane_val = Pop<float>();
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, float>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::F64X2ReplaceLane: {
+      CASE(F64X2ReplaceLane): {
         double lane_val = Pop<double>();
         v128 value = static_cast<v128>(Pop<v128>());
-        uint32_t lane_idx = ReadU8(&pc);
+        uint32_t lane_idx = ReadU32(&pc);
         CHECK_TRAP(Push<v128>(
             SimdReplaceLane<v128, v128, double>(value, lane_idx, lane_val)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V8X16Swizzle: {
+      CASE(V8X16Swizzle): {
         const int32_t lanes = 16;
         // Define SIMD data array for SIMD add by lanes.
         int8_t simd_data_ret[lanes];
@@ -2986,10 +4281,10 @@ Result Thread::Run(int num_instructions) {
         }
 
         CHECK_TRAP(PushRep<v128>(Bitcast<v128>(simd_data_ret)));
-        break;
+        NEXT();
       }
 
-    case Opcode::V8X16Shuffle: {
+      CASE(V8X16Shuffle): {
         const int32_t lanes = 16;
         // Define SIMD data array for SIMD add by lanes.
         int8_t simd_data_ret[lanes];
@@ -3014,242 +4309,242 @@ Result Thread::Run(int num_instructions) {
         }
 
         CHECK_TRAP(PushRep<v128>(Bitcast<v128>(simd_data_ret)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V8X16LoadSplat: {
+      CASE(V8X16LoadSplat): {
         CHECK_TRAP(Load<uint8_t, uint32_t>(&pc));
         uint8_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint8_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V16X8LoadSplat: {
+      CASE(V16X8LoadSplat): {
         CHECK_TRAP(Load<uint16_t, uint32_t>(&pc));
         uint16_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint16_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V32X4LoadSplat: {
+      CASE(V32X4LoadSplat): {
         CHECK_TRAP(Load<uint32_t, uint32_t>(&pc));
         uint32_t lane_data = Pop<uint32_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint32_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::V64X2LoadSplat: {
+      CASE(V64X2LoadSplat): {
         CHECK_TRAP(Load<uint64_t, uint64_t>(&pc));
         uint64_t lane_data = Pop<uint64_t>();
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint64_t>(lane_data)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16Add:
+      CASE(I8X16Add):
         CHECK_TRAP(SimdBinop<v128, uint8_t>(Add<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Add:
+      CASE(I16X8Add):
         CHECK_TRAP(SimdBinop<v128, uint16_t>(Add<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Add:
+      CASE(I32X4Add):
         CHECK_TRAP(SimdBinop<v128, uint32_t>(Add<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64X2Add:
+      CASE(I64X2Add):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(Add<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16Sub:
+      CASE(I8X16Sub):
         CHECK_TRAP(SimdBinop<v128, uint8_t>(Sub<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Sub:
+      CASE(I16X8Sub):
         CHECK_TRAP(SimdBinop<v128, uint16_t>(Sub<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Sub:
+      CASE(I32X4Sub):
         CHECK_TRAP(SimdBinop<v128, uint32_t>(Sub<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64X2Sub:
+      CASE(I64X2Sub):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(Sub<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Mul:
+      CASE(I16X8Mul):
         CHECK_TRAP(SimdBinop<v128, uint16_t>(Mul<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Mul:
+      CASE(I32X4Mul):
         CHECK_TRAP(SimdBinop<v128, uint32_t>(Mul<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64X2Mul:
+      CASE(I64X2Mul):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(Mul<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16Neg:
+      CASE(I8X16Neg):
         CHECK_TRAP(SimdUnop<v128, int8_t>(IntNeg<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Neg:
+      CASE(I16X8Neg):
         CHECK_TRAP(SimdUnop<v128, int16_t>(IntNeg<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Neg:
+      CASE(I32X4Neg):
         CHECK_TRAP(SimdUnop<v128, int32_t>(IntNeg<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I64X2Neg:
+      CASE(I64X2Neg):
         CHECK_TRAP(SimdUnop<v128, int64_t>(IntNeg<int64_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16AddSaturateS:
+      CASE(I8X16AddSaturateS):
         CHECK_TRAP(SimdBinop<v128, int8_t>(AddSaturate<int32_t, int8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16AddSaturateU:
+      CASE(I8X16AddSaturateU):
         CHECK_TRAP(SimdBinop<v128, uint8_t>(AddSaturate<uint32_t, uint8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8AddSaturateS:
+      CASE(I16X8AddSaturateS):
         CHECK_TRAP(SimdBinop<v128, int16_t>(AddSaturate<int32_t, int16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8AddSaturateU:
+      CASE(I16X8AddSaturateU):
         CHECK_TRAP(SimdBinop<v128, uint16_t>(AddSaturate<uint32_t, uint16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16SubSaturateS:
+      CASE(I8X16SubSaturateS):
         CHECK_TRAP(SimdBinop<v128, int8_t>(SubSaturate<int32_t, int8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16SubSaturateU:
+      CASE(I8X16SubSaturateU):
         CHECK_TRAP(SimdBinop<v128, uint8_t>(SubSaturate<int32_t, uint8_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8SubSaturateS:
+      CASE(I16X8SubSaturateS):
         CHECK_TRAP(SimdBinop<v128, int16_t>(SubSaturate<int32_t, int16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8SubSaturateU:
+      CASE(I16X8SubSaturateU):
         CHECK_TRAP(SimdBinop<v128, uint16_t>(SubSaturate<int32_t, uint16_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16Shl: {
+      CASE(I8X16Shl): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 8;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint8_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint8_t>(IntShl<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8Shl: {
+      CASE(I16X8Shl): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 16;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint16_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint16_t>(IntShl<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4Shl: {
+      CASE(I32X4Shl): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 32;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint32_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint32_t>(IntShl<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2Shl: {
+      CASE(I64X2Shl): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 64;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint64_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntShl<uint64_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16ShrS: {
+      CASE(I8X16ShrS): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 8;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint8_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, int8_t>(IntShr<int32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16ShrU: {
+      CASE(I8X16ShrU): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 8;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint8_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint8_t>(IntShr<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8ShrS: {
+      CASE(I16X8ShrS): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 16;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint16_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, int16_t>(IntShr<int32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8ShrU: {
+      CASE(I16X8ShrU): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 16;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint16_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint16_t>(IntShr<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4ShrS: {
+      CASE(I32X4ShrS): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 32;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint32_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, int32_t>(IntShr<int32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4ShrU: {
+      CASE(I32X4ShrU): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 32;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint32_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint32_t>(IntShr<uint32_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2ShrS: {
+      CASE(I64X2ShrS): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 64;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint64_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, int64_t>(IntShr<int64_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64X2ShrU: {
+      CASE(I64X2ShrU): {
         uint32_t shift_count = Pop<uint32_t>();
         shift_count = shift_count % 64;
         CHECK_TRAP(Push<v128>(SimdSplat<v128, uint64_t>(shift_count)));
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntShr<uint64_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::V128And:
+      CASE(V128And):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntAnd<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::V128Or:
+      CASE(V128Or):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntOr<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::V128Xor:
+      CASE(V128Xor):
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntXor<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::V128Not:
+      CASE(V128Not):
         CHECK_TRAP(SimdUnop<v128, uint64_t>(IntNot<uint64_t>));
-        break;
+        NEXT();
 
-      case Opcode::V128BitSelect: {
+      CASE(V128BitSelect): {
         // Follow Wasm Simd spec to compute V128BitSelect:
         // v128.or(v128.and(v1, c), v128.and(v2, v128.not(c)))
         v128 c_mask = PopRep<v128>();
@@ -3266,435 +4561,459 @@ Result Thread::Run(int num_instructions) {
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntAnd<uint64_t>));
         // 3. v128.or( 1 , 2)
         CHECK_TRAP(SimdBinop<v128, uint64_t>(IntOr<uint64_t>));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16AnyTrue: {
+      CASE(I8X16AnyTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint8_t>(value, 1)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8AnyTrue: {
+      CASE(I16X8AnyTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint16_t>(value, 1)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4AnyTrue: {
+      CASE(I32X4AnyTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint32_t>(value, 1)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16AllTrue: {
+      CASE(I8X16AllTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint8_t>(value, 16)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I16X8AllTrue: {
+      CASE(I16X8AllTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint16_t>(value, 8)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32X4AllTrue: {
+      CASE(I32X4AllTrue): {
         v128 value = PopRep<v128>();
         CHECK_TRAP(Push<int32_t>(SimdIsLaneTrue<v128, uint32_t>(value, 4)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I8X16Eq:
+      CASE(I8X16Eq):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Eq<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Eq:
+      CASE(I16X8Eq):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Eq<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Eq:
+      CASE(I32X4Eq):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Eq<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Eq:
+      CASE(F32X4Eq):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Eq<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Eq:
+      CASE(F64X2Eq):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Eq<double>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16Ne:
+      CASE(I8X16Ne):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Ne<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8Ne:
+      CASE(I16X8Ne):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Ne<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4Ne:
+      CASE(I32X4Ne):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Ne<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Ne:
+      CASE(F32X4Ne):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Ne<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Ne:
+      CASE(F64X2Ne):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Ne<double>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16LtS:
+      CASE(I8X16LtS):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Lt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16LtU:
+      CASE(I8X16LtU):
         CHECK_TRAP(SimdRelBinop<v128, uint8_t>(Lt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8LtS:
+      CASE(I16X8LtS):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Lt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8LtU:
+      CASE(I16X8LtU):
         CHECK_TRAP(SimdRelBinop<v128, uint16_t>(Lt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4LtS:
+      CASE(I32X4LtS):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Lt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4LtU:
+      CASE(I32X4LtU):
         CHECK_TRAP(SimdRelBinop<v128, uint32_t>(Lt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Lt:
+      CASE(F32X4Lt):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Lt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Lt:
+      CASE(F64X2Lt):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Lt<double>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16LeS:
+      CASE(I8X16LeS):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Le<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16LeU:
+      CASE(I8X16LeU):
         CHECK_TRAP(SimdRelBinop<v128, uint8_t>(Le<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8LeS:
+      CASE(I16X8LeS):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Le<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8LeU:
+      CASE(I16X8LeU):
         CHECK_TRAP(SimdRelBinop<v128, uint16_t>(Le<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4LeS:
+      CASE(I32X4LeS):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Le<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4LeU:
+      CASE(I32X4LeU):
         CHECK_TRAP(SimdRelBinop<v128, uint32_t>(Le<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Le:
+      CASE(F32X4Le):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Le<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Le:
+      CASE(F64X2Le):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Le<double>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16GtS:
+      CASE(I8X16GtS):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Gt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16GtU:
+      CASE(I8X16GtU):
         CHECK_TRAP(SimdRelBinop<v128, uint8_t>(Gt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8GtS:
+      CASE(I16X8GtS):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Gt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8GtU:
+      CASE(I16X8GtU):
         CHECK_TRAP(SimdRelBinop<v128, uint16_t>(Gt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4GtS:
+      CASE(I32X4GtS):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Gt<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4GtU:
+      CASE(I32X4GtU):
         CHECK_TRAP(SimdRelBinop<v128, uint32_t>(Gt<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Gt:
+      CASE(F32X4Gt):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Gt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Gt:
+      CASE(F64X2Gt):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Gt<double>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16GeS:
+      CASE(I8X16GeS):
         CHECK_TRAP(SimdRelBinop<v128, int8_t>(Ge<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I8X16GeU:
+      CASE(I8X16GeU):
         CHECK_TRAP(SimdRelBinop<v128, uint8_t>(Ge<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8GeS:
+      CASE(I16X8GeS):
         CHECK_TRAP(SimdRelBinop<v128, int16_t>(Ge<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I16X8GeU:
+      CASE(I16X8GeU):
         CHECK_TRAP(SimdRelBinop<v128, uint16_t>(Ge<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4GeS:
+      CASE(I32X4GeS):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Ge<int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4GeU:
+      CASE(I32X4GeU):
         CHECK_TRAP(SimdRelBinop<v128, uint32_t>(Ge<uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Ge:
+      CASE(F32X4Ge):
         CHECK_TRAP(SimdRelBinop<v128, int32_t>(Ge<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Ge:
+      CASE(F64X2Ge):
         CHECK_TRAP(SimdRelBinop<v128, int64_t>(Ge<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Neg:
+      CASE(F32X4Neg):
         CHECK_TRAP(SimdUnop<v128, int32_t>(FloatNeg<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Neg:
+      CASE(F64X2Neg):
         CHECK_TRAP(SimdUnop<v128, int64_t>(FloatNeg<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Abs:
+      CASE(F32X4Abs):
         CHECK_TRAP(SimdUnop<v128, int32_t>(FloatAbs<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Abs:
+      CASE(F64X2Abs):
         CHECK_TRAP(SimdUnop<v128, int64_t>(FloatAbs<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Min:
+      CASE(F32X4Min):
         CHECK_TRAP(SimdBinop<v128, int32_t>(FloatMin<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Min:
+      CASE(F64X2Min):
         CHECK_TRAP(SimdBinop<v128, int64_t>(FloatMin<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Max:
+      CASE(F32X4Max):
         CHECK_TRAP(SimdBinop<v128, int32_t>(FloatMax<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Max:
+      CASE(F64X2Max):
         CHECK_TRAP(SimdBinop<v128, int64_t>(FloatMax<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Add:
+      CASE(F32X4Add):
         CHECK_TRAP(SimdBinop<v128, int32_t>(Add<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Add:
+      CASE(F64X2Add):
         CHECK_TRAP(SimdBinop<v128, int64_t>(Add<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Sub:
+      CASE(F32X4Sub):
         CHECK_TRAP(SimdBinop<v128, int32_t>(Sub<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Sub:
+      CASE(F64X2Sub):
         CHECK_TRAP(SimdBinop<v128, int64_t>(Sub<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Div:
+      CASE(F32X4Div):
         CHECK_TRAP(SimdBinop<v128, int32_t>(FloatDiv<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Div:
+      CASE(F64X2Div):
         CHECK_TRAP(SimdBinop<v128, int64_t>(FloatDiv<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Mul:
+      CASE(F32X4Mul):
         CHECK_TRAP(SimdBinop<v128, int32_t>(Mul<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Mul:
+      CASE(F64X2Mul):
         CHECK_TRAP(SimdBinop<v128, int64_t>(Mul<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4Sqrt:
+      CASE(F32X4Sqrt):
         CHECK_TRAP(SimdUnop<v128, int32_t>(FloatSqrt<float>));
-        break;
+        NEXT();
 
-      case Opcode::F64X2Sqrt:
+      CASE(F64X2Sqrt):
         CHECK_TRAP(SimdUnop<v128, int64_t>(FloatSqrt<double>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4ConvertI32X4S:
+      CASE(F32X4ConvertI32X4S):
         CHECK_TRAP(SimdUnop<v128, int32_t>(SimdConvert<float, int32_t>));
-        break;
+        NEXT();
 
-      case Opcode::F32X4ConvertI32X4U:
+      CASE(F32X4ConvertI32X4U):
         CHECK_TRAP(SimdUnop<v128, uint32_t>(SimdConvert<float, uint32_t>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4TruncSatF32X4S:
+      CASE(I32X4TruncSatF32X4S):
         CHECK_TRAP(SimdUnop<v128, int32_t>(IntTruncSat<int32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32X4TruncSatF32X4U:
+      CASE(I32X4TruncSatF32X4U):
         CHECK_TRAP(SimdUnop<v128, uint32_t>(IntTruncSat<uint32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::RefIsNull:
+      CASE(RefIsNull):
         CHECK_TRAP(Unop(RefIsNull));
-        break;
+        NEXT();
 
-      case Opcode::TableGet:
+      CASE(TableGet):
         CHECK_TRAP(TableGet(&pc));
-        break;
+        NEXT();
 
-      case Opcode::TableSet:
+      CASE(TableSet):
         CHECK_TRAP(TableSet(&pc));
-        break;
+        NEXT();
 
-      case Opcode::RefFunc:
+      CASE(RefFunc):
         CHECK_TRAP(RefFunc(&pc));
-        break;
+        NEXT();
 
-      case Opcode::RefNull:
+      CASE(RefNull):
         CHECK_TRAP(Push(Ref{RefType::Null, kInvalidIndex}));
-        break;
+        NEXT();
 
-      case Opcode::TableGrow: {
+      CASE(TableGrow): {
         Table* table = ReadTable(&pc);
         uint32_t increment = Pop<uint32_t>();
         Ref ref = Pop<Ref>();
         uint32_t old_size = table->size();
         uint32_t max = table->limits.has_max ? table->limits.max : UINT32_MAX;
-        PUSH_NEG_1_AND_BREAK_IF(int64_t(old_size) + increment > max);
+        PUSH_NEG_1_AND_NEXT_IF(int64_t(old_size) + increment > max);
         uint32_t new_size = old_size + increment;
         table->resize(new_size, ref);
         CHECK_TRAP(Push<uint32_t>(old_size));
-        break;
+        NEXT();
       }
 
-      case Opcode::TableSize: {
+      CASE(TableSize): {
         Table* table = ReadTable(&pc);
         CHECK_TRAP(Push<uint32_t>(table->entries.size()));
-        break;
+        NEXT();
       }
 
-      case Opcode::TableFill:
+      CASE(TableFill):
         CHECK_TRAP(TableFill(&pc));
-        break;
+        NEXT();
 
-      case Opcode::MemoryInit:
+      CASE(MemoryInit):
         CHECK_TRAP(MemoryInit(&pc));
-        break;
+        NEXT();
 
-      case Opcode::DataDrop:
+      CASE(DataDrop):
         CHECK_TRAP(DataDrop(&pc));
-        break;
+        NEXT();
 
-      case Opcode::MemoryCopy:
+      CASE(MemoryCopy):
         CHECK_TRAP(MemoryCopy(&pc));
-        break;
+        NEXT();
 
-      case Opcode::MemoryFill:
+      CASE(MemoryFill):
         CHECK_TRAP(MemoryFill(&pc));
-        break;
+        NEXT();
 
-      case Opcode::TableInit:
+      CASE(TableInit):
         CHECK_TRAP(TableInit(&pc));
-        break;
+        NEXT();
 
-      case Opcode::ElemDrop:
+      CASE(ElemDrop):
         CHECK_TRAP(ElemDrop(&pc));
-        break;
+        NEXT();
 
-      case Opcode::TableCopy:
+      CASE(TableCopy):
         CHECK_TRAP(TableCopy(&pc));
-        break;
-
-      case Opcode::I8X16NarrowI16X8S:
-      case Opcode::I8X16NarrowI16X8U:
-      case Opcode::I16X8NarrowI32X4S:
-      case Opcode::I16X8NarrowI32X4U:
-      case Opcode::I16X8WidenLowI8X16S:
-      case Opcode::I16X8WidenHighI8X16S:
-      case Opcode::I16X8WidenLowI8X16U:
-      case Opcode::I16X8WidenHighI8X16U:
-      case Opcode::I32X4WidenLowI16X8S:
-      case Opcode::I32X4WidenHighI16X8S:
-      case Opcode::I32X4WidenLowI16X8U:
-      case Opcode::I32X4WidenHighI16X8U:
-      case Opcode::I16X8Load8X8S:
-      case Opcode::I16X8Load8X8U:
-      case Opcode::I32X4Load16X4S:
-      case Opcode::I32X4Load16X4U:
-      case Opcode::I64X2Load32X2S:
-      case Opcode::I64X2Load32X2U:
-      case Opcode::V128Andnot:
-      case Opcode::I8X16AvgrU:
-      case Opcode::I16X8AvgrU:
-      case Opcode::I8X16MinS:
-      case Opcode::I8X16MinU:
-      case Opcode::I8X16MaxS:
-      case Opcode::I8X16MaxU:
-      case Opcode::I16X8MinS:
-      case Opcode::I16X8MinU:
-      case Opcode::I16X8MaxS:
-      case Opcode::I16X8MaxU:
-      case Opcode::I32X4MinS:
-      case Opcode::I32X4MinU:
-      case Opcode::I32X4MaxS:
-      case Opcode::I32X4MaxU:
+        NEXT();
+
+      CASE(I8X16NarrowI16X8S):
+      CASE(I8X16NarrowI16X8U):
+      CASE(I16X8NarrowI32X4S):
+      CASE(I16X8NarrowI32X4U):
+      CASE(I16X8WidenLowI8X16S):
+      CASE(I16X8WidenHighI8X16S):
+      CASE(I16X8WidenLowI8X16U):
+      CASE(I16X8WidenHighI8X16U):
+      CASE(I32X4WidenLowI16X8S):
+      CASE(I32X4WidenHighI16X8S):
+      CASE(I32X4WidenLowI16X8U):
+      CASE(I32X4WidenHighI16X8U):
+      CASE(I16X8Load8X8S):
+      CASE(I16X8Load8X8U):
+      CASE(I32X4Load16X4S):
+      CASE(I32X4Load16X4U):
+      CASE(I64X2Load32X2S):
+      CASE(I64X2Load32X2U):
+      CASE(V128Andnot):
+      CASE(I8X16AvgrU):
+      CASE(I16X8AvgrU):
+      CASE(I8X16MinS):
+      CASE(I8X16MinU):
+      CASE(I8X16MaxS):
+      CASE(I8X16MaxU):
+      CASE(I16X8MinS):
+      CASE(I16X8MinU):
+      CASE(I16X8MaxS):
+      CASE(I16X8MaxU):
+      CASE(I32X4MinS):
+      CASE(I32X4MinU):
+      CASE(I32X4MaxS):
+      CASE(I32X4MaxU):
         return ResultType::NotImplemented;
 
       // The following opcodes are either never generated or should never be
       // executed.
-      case Opcode::Block:
-      case Opcode::BrOnExn:
-      case Opcode::Catch:
-      case Opcode::Else:
-      case Opcode::End:
-      case Opcode::If:
-      case Opcode::InterpData:
+      CASE(Block):
+      CASE(BrOnExn):
+      CASE(Catch):
+      CASE(Else):
+      CASE(End):
+      CASE(If):
+      CASE(InterpData):
       case Opcode::Invalid:
-      case Opcode::Loop:
-      case Opcode::Rethrow:
-      case Opcode::Throw:
-      case Opcode::Try:
+      CASE(Loop):
+      CASE(Rethrow):
+      CASE(Throw):
+      CASE(Try):
         WABT_UNREACHABLE;
-        break;
+        NEXT();
     }
   }
 
 exit_loop:
   pc_ = pc - istream;
+  // Leaving the loop early skips the increment of the last instruction.
+  num_instructions_run_ = result.ok() ? i : i + 1;
   return result;
 }
 
+#undef CASE
+#undef NEXT
+#undef CHECK_HOST_CALL
+#undef PROFILE_CALL
+
+// Tracing shows every instruction, so it needs every function interpreted.
+static Thread::Options GetExecutorThreadOptions(Stream* trace_stream,
+                                                Thread::Options options) {
+  if (trace_stream) {
+    options.jit_threshold = 0;
+  }
+  return options;
+}
+
 Executor::Executor(Environment* env,
                    Stream* trace_stream,
                    const Thread::Options& options)
-    : env_(env), trace_stream_(trace_stream), thread_(env, options) {}
+    : env_(env),
+      trace_stream_(trace_stream),
+      thread_(env, GetExecutorThreadOptions(trace_stream, options)) {
+  ++env_->num_executors_;
+}
+
+Executor::~Executor() {
+  --env_->num_executors_;
+}
 
 ExecResult Executor::RunFunction(Index func_index, const TypedValues& args) {
   ExecResult exec_result;
@@ -3704,9 +5023,7 @@ ExecResult Executor::RunFunction(Index func_index, const TypedValues& args) {
   thread_.Reset();
   exec_result.result = PushArgs(sig, args);
   if (exec_result.ok()) {
-    exec_result.result =
-        func->is_host ? thread_.CallHost(cast<HostFunc>(func))
-                      : RunDefinedFunction(cast<DefinedFunc>(func)->offset);
+    exec_result.result = RunFunc(func);
     if (exec_result.ok()) {
       CopyResults(sig, &exec_result.values);
     }
@@ -3715,6 +5032,72 @@ ExecResult Executor::RunFunction(Index func_index, const TypedValues& args) {
   return exec_result;
 }
 
+Result Executor::RunFunc(Func* func) {
+  func_ = func;
+  return func->is_host ? thread_.CallHost(cast<HostFunc>(func))
+                       : RunDefinedFunction(cast<DefinedFunc>(func)->offset);
+}
+
+CallHandle Executor::GetFuncCallHandle(Index func_index) {
+  CallHandle handle;
+  handle.func = env_->GetFunc(func_index);
+  handle.sig_index = handle.func->sig_index;
+  return handle;
+}
+
+CallHandle Executor::GetCallHandle(const Export* export_) {
+  assert(export_->kind == ExternalKind::Func);
+  return GetFuncCallHandle(export_->index);
+}
+
+Result Executor::GetCallHandle(Module* module,
+                               string_view name,
+                               CallHandle* out) {
+  Export* export_ = module->GetExport(name);
+  if (!export_) {
+    return ResultType::UnknownExport;
+  }
+  if (export_->kind != ExternalKind::Func) {
+    return ResultType::ExportKindMismatch;
+  }
+  *out = GetCallHandle(export_);
+  return ResultType::Ok;
+}
+
+Result Executor::Call(const CallHandle& handle,
+                      const Value* args,
+                      Index num_args,
+                      Value* results,
+                      Index num_results) {
+  assert(handle.is_valid());
+  const FuncSignature* sig = env_->GetFuncSignature(handle.sig_index);
+  if (num_args != sig->param_types.size() ||
+      num_results != sig->result_types.size()) {
+    return ResultType::ArgumentTypeMismatch;
+  }
+
+  thread_.Reset();
+  for (Index i = 0; i < num_args; ++i) {
+    Result result = thread_.Push(sig->param_types[i], args[i]);
+    if (!result.ok()) {
+      return result;
+    }
+  }
+
+  Result result = RunFunc(handle.func);
+  if (!result.ok()) {
+    return result;
+  }
+  assert(GetSlotCount(sig->result_types) == thread_.NumSlots());
+  Index slot = 0;
+  for (Index i = 0; i < num_results; ++i) {
+    Type type = sig->result_types[i];
+    results[i] = thread_.ValueAt(type, slot);
+    slot += GetSlotCount(type);
+  }
+  return ResultType::Ok;
+}
+
 ExecResult Executor::Initialize(DefinedModule* module) {
   ExecResult exec_result;
   exec_result.result = InitializeSegments(module);
@@ -3815,9 +5198,51 @@ ExecResult Executor::RunExportByName(Module* module,
   return RunExport(export_, args);
 }
 
+ExecResult Executor::Resume(const TypedValues& results) {
+  assert(func_ && thread_.is_suspended());
+  ExecResult exec_result;
+  exec_result.result = thread_.Resume(results);
+  if (exec_result.ok() && !func_->is_host) {
+    exec_result.result = RunThread();
+  } else if (exec_result.result.type == ResultType::Returned) {
+    exec_result.result = ResultType::Ok;
+  }
+  if (exec_result.ok()) {
+    CopyResults(env_->GetFuncSignature(func_->sig_index), &exec_result.values);
+  }
+  return exec_result;
+}
+
 Result Executor::RunDefinedFunction(IstreamOffset function_offset) {
-  Result result = ResultType::Ok;
   thread_.set_pc(function_offset);
+  return RunThread();
+}
+
+Result Executor::RunThread() {
+#if WABT_INTERP_GUARD_PAGES
+  if (env_->HasGuardPageMemory()) {
+    // Out-of-bounds accesses to memories with guard pages aren't bounds
+    // checked. Instead the signal handler jumps back here, abandoning the
+    // thread's state, which RunFunction resets anyway.
+    GuardPageTrapContext context;
+    context.env = env_;
+    GuardPageTrapContext* prev_context = tl_guard_page_context;
+    tl_guard_page_context = &context;
+    Result result = ResultType::Ok;
+    if (sigsetjmp(context.jmp_buf, 0) == 0) {
+      result = RunThreadUnguarded();
+    } else {
+      result = thread_.MemoryAccessOutOfBounds(context.memory);
+    }
+    tl_guard_page_context = prev_context;
+    return result;
+  }
+#endif
+  return RunThreadUnguarded();
+}
+
+Result Executor::RunThreadUnguarded() {
+  Result result = ResultType::Ok;
   if (trace_stream_) {
     const int kNumInstructions = 1;
     while (result.ok()) {
@@ -3825,10 +5250,7 @@ Result Executor::RunDefinedFunction(IstreamOffset function_offset) {
       result = thread_.Run(kNumInstructions);
     }
   } else {
-    const int kNumInstructions = 1000;
-    while (result.ok()) {
-      result = thread_.Run(kNumInstructions);
-    }
+    result = thread_.RunUntilReturn();
   }
   if (result.type != ResultType::Returned) {
     return result;
@@ -3848,7 +5270,7 @@ Result Executor::PushArgs(const FuncSignature* sig, const TypedValues& args) {
       return ResultType::ArgumentTypeMismatch;
     }
 
-    Result result = thread_.Push(args[i].value);
+    Result result = thread_.Push(sig->param_types[i], args[i].value);
     if (!result.ok()) {
       return result;
     }
@@ -3857,12 +5279,13 @@ Result Executor::PushArgs(const FuncSignature* sig, const TypedValues& args) {
 }
 
 void Executor::CopyResults(const FuncSignature* sig, TypedValues* out_results) {
-  size_t expected_results = sig->result_types.size();
-  assert(expected_results == thread_.NumValues());
+  assert(GetSlotCount(sig->result_types) == thread_.NumSlots());
 
   out_results->clear();
-  for (size_t i = 0; i < expected_results; ++i) {
-    out_results->emplace_back(sig->result_types[i], thread_.ValueAt(i));
+  Index slot = 0;
+  for (Type type : sig->result_types) {
+    out_results->emplace_back(type, thread_.ValueAt(type, slot));
+    slot += GetSlotCount(type);
   }
 }
 
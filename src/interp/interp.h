@@ -19,14 +19,19 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
 #include "src/binding-hash.h"
 #include "src/common.h"
+#include "src/error.h"
 #include "src/feature.h"
 #include "src/opcode.h"
 #include "src/stream.h"
@@ -39,6 +44,8 @@ namespace interp {
   V(Ok, "ok")                                                               \
   /* returned from the top-most function */                                 \
   V(Returned, "returned")                                                   \
+  /* a host function suspended the thread; see Thread::Resume */            \
+  V(Suspended, "suspended")                                                 \
   /* memory access is out of bounds */                                      \
   V(TrapMemoryAccessOutOfBounds, "out of bounds memory access")             \
   /* atomic memory access is unaligned  */                                  \
@@ -68,6 +75,19 @@ namespace interp {
   V(TrapHostTrapped, "host function trapped")                               \
   /* table access is out of bounds */                                       \
   V(TrapTableAccessOutOfBounds, "out of bounds table access")               \
+  /* memory.atomic.wait on a memory that isn't shared */                    \
+  V(TrapExpectedSharedMemory, "expected shared memory")                     \
+  /* a lazily compiled function failed to validate when it was called */    \
+  V(TrapInvalidFunctionBody, "invalid function body")                       \
+  /* the thread ran out of fuel; see LoweringOptions::fuel */               \
+  V(TrapOutOfFuel, "out of fuel")                                           \
+  /* a host function suspended the thread while it ran machine code, */     \
+  /* which can't be resumed */                                              \
+  V(TrapSuspendedInJit, "host function suspended machine code")             \
+  /* a function that hasn't been lazily compiled yet was called while */    \
+  /* more than one Executor shares the Environment */                       \
+  V(TrapLazyCompileWithManyExecutors,                                       \
+    "lazy compilation with more than one executor")                         \
   /* we attempted to call a function with the an argument list that doesn't \
    * match the function signature */                                        \
   V(ArgumentTypeMismatch, "argument type mismatch")                         \
@@ -135,13 +155,117 @@ struct Table {
   std::vector<Ref> entries;
 };
 
+enum class MemoryBackend {
+  // Linear memory is a heap allocation that may move when it grows, and every
+  // access is bounds checked.
+  Heap,
+  // Linear memory reserves all the address space a wasm32 access can reach
+  // (4GiB plus a 4GiB offset) up front, and pages are committed as it grows,
+  // so it never moves. Out-of-bounds accesses hit guard pages, which the
+  // Executor turns into MemoryAccessOutOfBounds traps. Only available where
+  // IsGuardPageMemorySupported() returns true.
+  GuardPages,
+};
+
+bool IsGuardPageMemorySupported();
+
+class MemoryData;
+
+// A read-only copy of the bytes of a linear memory. When it is taken from
+// memory with guard pages, it is kept in an anonymous file where supported, so
+// MemoryData::Restore can map it copy-on-write instead of copying it.
+class MemoryImage {
+ public:
+  MemoryImage() = default;
+  explicit MemoryImage(const MemoryData&);
+  MemoryImage(MemoryImage&&) noexcept;
+  MemoryImage& operator=(MemoryImage&&) noexcept;
+  ~MemoryImage();
+
+  size_t size() const { return size_; }
+  bool is_mappable() const { return fd_ != -1; }
+
+ private:
+  friend class MemoryData;
+
+  void Swap(MemoryImage&);
+
+  std::vector<char> heap_;
+  int fd_ = -1;
+  size_t size_ = 0;
+};
+
+// The bytes of a linear memory. This has the parts of the std::vector
+// interface that the interpreter uses.
+class MemoryData {
+ public:
+  MemoryData() = default;
+  // Falls back to MemoryBackend::Heap if the address space for
+  // MemoryBackend::GuardPages can't be reserved.
+  MemoryData(size_t size, MemoryBackend backend);
+  MemoryData(MemoryData&&) noexcept;
+  MemoryData& operator=(MemoryData&&) noexcept;
+  ~MemoryData();
+
+  char* data() { return data_; }
+  const char* data() const { return data_; }
+  // Other threads may grow a shared memory, so the size is read with an
+  // acquire load, and resize() stores it only once the new bytes are ready.
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+  char* begin() { return data_; }
+  char* end() { return data_ + size(); }
+  char& operator[](size_t index) { return data_[index]; }
+
+  // New bytes are zeroed. Returns false, leaving the data unchanged, if the
+  // memory can't be resized.
+  bool resize(size_t size);
+  // Ensures that resizing up to |size| doesn't move the data. This is a no-op
+  // for memory with guard pages, which never moves.
+  void reserve(size_t size);
+
+  bool has_guard_pages() const { return reserved_size_ != 0; }
+
+  // Accesses that end past this limit must be bounds checked. Memory with
+  // guard pages doesn't need to be.
+  uint64_t access_limit() const {
+    return has_guard_pages() ? UINT64_MAX : size();
+  }
+
+  // Returns true if |address| is in the guard pages of this memory, i.e. it is
+  // in the reserved address space but past the end of the data.
+  bool IsGuardPageAddress(const void* address) const;
+
+  // Replaces the contents and size with those of |image|. Memory with guard
+  // pages maps a mappable image copy-on-write, so this doesn't touch the
+  // bytes, and only the pages that are written afterward are copied.
+  void Restore(const MemoryImage& image);
+
+ private:
+  void Swap(MemoryData&);
+
+  std::vector<char> heap_;
+  char* data_ = nullptr;
+  std::atomic<size_t> size_{0};
+  size_t reserved_size_ = 0;
+};
+
 struct Memory {
   Memory() = default;
-  explicit Memory(const Limits& limits)
-      : page_limits(limits), data(limits.initial * WABT_PAGE_SIZE) {}
+  // Shared memories can be accessed by other threads while they grow, so
+  // their data never moves: they use guard pages where possible, and reserve
+  // their maximum size on the heap otherwise.
+  explicit Memory(const Limits& limits,
+                  MemoryBackend backend = MemoryBackend::Heap)
+      : page_limits(limits),
+        data(limits.initial * WABT_PAGE_SIZE,
+             limits.is_shared ? MemoryBackend::GuardPages : backend) {
+    if (limits.is_shared) {
+      data.reserve(limits.max * WABT_PAGE_SIZE);
+    }
+  }
 
   Limits page_limits;
-  std::vector<char> data;
+  MemoryData data;
 };
 
 struct DataSegment {
@@ -204,6 +328,31 @@ union Value {
   Ref ref;
 };
 
+// A slot of a Thread's value stack. A v128 takes two slots, low half first,
+// and every other value takes one, so the stack of scalar code is half the
+// size it would be with a Value per slot.
+union ValueSlot {
+  uint32_t i32;
+  uint64_t i64;
+  ValueTypeRep<float> f32_bits;
+  ValueTypeRep<double> f64_bits;
+  Ref ref;
+};
+
+static_assert(sizeof(ValueSlot) == 8, "ValueSlot should be 8 bytes");
+
+inline Index GetSlotCount(Type type) {
+  return type == Type::V128 ? 2 : 1;
+}
+
+inline Index GetSlotCount(const TypeVector& types) {
+  Index count = 0;
+  for (Type type : types) {
+    count += GetSlotCount(type);
+  }
+  return count;
+}
+
 struct TypedValue {
   TypedValue() = default;
   explicit TypedValue(Type type) : type(type) {}
@@ -295,19 +444,48 @@ struct Func {
   bool is_host;
 };
 
+// Lowers the functions of a module that was read with
+// LoweringOptions::lazy_compilation, the first time each one is called.
+class LazyCompiler {
+ public:
+  virtual ~LazyCompiler() {}
+
+  // Appends the lowered body of the function at |func_index| in the
+  // environment to the istream, and points its stub at it.
+  virtual wabt::Result Compile(Index func_index, Errors*) = 0;
+};
+
+class JitCode;
+
 struct DefinedFunc : Func {
-  DefinedFunc(Index sig_index)
-      : Func(sig_index, false),
-        offset(kInvalidIstreamOffset),
-        local_decl_count(0),
-        local_count(0) {}
+  // Defined out of line, where JitCode is complete.
+  DefinedFunc(Index sig_index);
+  ~DefinedFunc() override;
 
   static bool classof(const Func* func) { return !func->is_host; }
 
+  bool is_compiled() const { return offset != stub_offset; }
+
   IstreamOffset offset;
   Index local_decl_count;
   Index local_count;
   std::vector<Type> param_and_local_types;
+
+  // For lazily compiled functions, the compiler and the offset of the stub
+  // that calls it. Until the function is compiled, |offset| is the stub.
+  LazyCompiler* lazy_compiler = nullptr;
+  IstreamOffset stub_offset = kInvalidIstreamOffset;
+
+  // For functions lowered with LoweringOptions::jit, the number of calls so
+  // far, and the machine code they were compiled to once they became hot. It
+  // stays null if the function uses an instruction the JIT doesn't support.
+  // Threads sharing the Environment update these concurrently: the code is
+  // compiled under Environment::jit_mutex_ and published with a release
+  // store, so read |jit_code| with an acquire load.
+  std::atomic<uint32_t> call_count{0};
+  std::atomic<JitCode*> jit_code{nullptr};
+  // Owns |jit_code|.
+  std::unique_ptr<JitCode> jit_code_storage;
 };
 
 struct HostFunc : Func {
@@ -315,6 +493,11 @@ struct HostFunc : Func {
                                         const FuncSignature*,
                                         const TypedValues& args,
                                         TypedValues& results)>;
+  // Called with |slots| pointing at the arguments on the Thread's value
+  // stack, which it overwrites with the results. There is room for the
+  // results even if they take more slots than the arguments.
+  using ValueCallback =
+      std::function<Result(const HostFunc*, ValueSlot* slots)>;
 
   HostFunc(string_view module_name,
            string_view field_name,
@@ -325,11 +508,124 @@ struct HostFunc : Func {
         field_name(field_name.to_string()),
         callback(callback) {}
 
+  HostFunc(string_view module_name,
+           string_view field_name,
+           Index sig_index,
+           ValueCallback value_callback)
+      : Func(sig_index, true),
+        module_name(module_name.to_string()),
+        field_name(field_name.to_string()),
+        value_callback(value_callback) {}
+
   static bool classof(const Func* func) { return func->is_host; }
 
   std::string module_name;
   std::string field_name;
+  // Exactly one of these is set. The Thread calls |value_callback| without
+  // copying the arguments and results into TypedValues.
   Callback callback;
+  ValueCallback value_callback;
+};
+
+// HostValue<T> converts between a ValueSlot and the C++ type of a parameter or
+// result of a typed host function. See HostModule::AppendFuncExport.
+template <typename T>
+struct HostValue;
+
+template <>
+struct HostValue<uint32_t> {
+  static Type type() { return Type::I32; }
+  static uint32_t Get(ValueSlot slot) { return slot.i32; }
+  static ValueSlot Make(uint32_t x) {
+    ValueSlot slot;
+    slot.i32 = x;
+    return slot;
+  }
+};
+
+template <>
+struct HostValue<int32_t> {
+  static Type type() { return Type::I32; }
+  static int32_t Get(ValueSlot slot) { return Bitcast<int32_t>(slot.i32); }
+  static ValueSlot Make(int32_t x) { return HostValue<uint32_t>::Make(x); }
+};
+
+template <>
+struct HostValue<uint64_t> {
+  static Type type() { return Type::I64; }
+  static uint64_t Get(ValueSlot slot) { return slot.i64; }
+  static ValueSlot Make(uint64_t x) {
+    ValueSlot slot;
+    slot.i64 = x;
+    return slot;
+  }
+};
+
+template <>
+struct HostValue<int64_t> {
+  static Type type() { return Type::I64; }
+  static int64_t Get(ValueSlot slot) { return Bitcast<int64_t>(slot.i64); }
+  static ValueSlot Make(int64_t x) { return HostValue<uint64_t>::Make(x); }
+};
+
+template <>
+struct HostValue<float> {
+  static Type type() { return Type::F32; }
+  static float Get(ValueSlot slot) { return Bitcast<float>(slot.f32_bits); }
+  static ValueSlot Make(float x) {
+    ValueSlot slot;
+    slot.f32_bits = Bitcast<uint32_t>(x);
+    return slot;
+  }
+};
+
+template <>
+struct HostValue<double> {
+  static Type type() { return Type::F64; }
+  static double Get(ValueSlot slot) { return Bitcast<double>(slot.f64_bits); }
+  static ValueSlot Make(double x) {
+    ValueSlot slot;
+    slot.f64_bits = Bitcast<uint64_t>(x);
+    return slot;
+  }
+};
+
+// std::index_sequence is C++14.
+template <size_t... I>
+struct HostIndexSequence {};
+
+template <size_t N, size_t... I>
+struct MakeHostIndexSequence : MakeHostIndexSequence<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeHostIndexSequence<0, I...> {
+  typedef HostIndexSequence<I...> type;
+};
+
+// Calls a typed host function with the arguments in |slots|, and stores its
+// result, if it has one, in slots[0]. None of the types take two slots.
+template <typename R, typename... Args>
+struct HostCall {
+  static TypeVector result_types() { return {HostValue<R>::type()}; }
+
+  template <size_t... I>
+  static void Call(const std::function<R(Args...)>& func,
+                   ValueSlot* slots,
+                   HostIndexSequence<I...>) {
+    slots[0] = HostValue<R>::Make(func(HostValue<Args>::Get(slots[I])...));
+  }
+};
+
+template <typename... Args>
+struct HostCall<void, Args...> {
+  static TypeVector result_types() { return {}; }
+
+  template <size_t... I>
+  static void Call(const std::function<void(Args...)>& func,
+                   ValueSlot* slots,
+                   HostIndexSequence<I...>) {
+    func(HostValue<Args>::Get(slots[I])...);
+  }
 };
 
 struct Export {
@@ -362,8 +658,16 @@ struct Module {
   Export* GetExport(string_view name);
   virtual Index OnUnknownFuncExport(string_view name, Index sig_index) = 0;
 
-  // Returns export index.
+  // Returns export index. A host module's export can be looked up right away;
+  // a DefinedModule's exports can be looked up once IndexExports is called.
   Index AppendExport(ExternalKind kind, Index item_index, string_view name);
+  // Builds the index that GetExport and GetFuncExport search, once all the
+  // exports are appended. Lookups don't modify the module, so they may run on
+  // several threads at once.
+  void IndexExports();
+  // Removes the exports from |size| on, e.g. those of items that were removed
+  // from the Environment by ResetToMarkPoint.
+  void TruncateExports(Index size);
 
   std::string name;
   std::vector<Export> exports;
@@ -373,6 +677,18 @@ struct Module {
 
  protected:
   Environment* env;
+
+ private:
+  typedef std::vector<Index>::const_iterator SortedExportIter;
+
+  // Returns the range of |sorted_exports_| with |name|.
+  std::pair<SortedExportIter, SortedExportIter> FindExports(
+      string_view name) const;
+
+  // The indexes of |exports|, sorted by name and then by index. Lookups
+  // search it with string_view comparisons, so unlike |export_bindings| they
+  // don't hash the name or copy it into a std::string.
+  std::vector<Index> sorted_exports_;
 };
 
 struct DefinedModule : Module {
@@ -396,6 +712,9 @@ struct DefinedModule : Module {
   // no further segments are processed.
   std::vector<ElemSegmentInfo> active_elem_segments_;
   std::vector<DataSegmentInfo> active_data_segments_;
+
+  // Set if the module was read with LoweringOptions::lazy_compilation.
+  std::unique_ptr<LazyCompiler> lazy_compiler;
 };
 
 struct HostModule : Module {
@@ -410,6 +729,36 @@ struct HostModule : Module {
   std::pair<HostFunc*, Index> AppendFuncExport(string_view name,
                                                Index sig_index,
                                                HostFunc::Callback);
+  std::pair<HostFunc*, Index> AppendValueFuncExport(
+      string_view name,
+      const FuncSignature&,
+      HostFunc::ValueCallback);
+
+  // Appends a typed host function, whose signature is derived from its C++
+  // one. The Thread calls it with the arguments read straight from the value
+  // stack, so calls to it don't allocate. The parameters and result may be
+  // any type with a HostValue specialization.
+  template <typename R, typename... Args>
+  std::pair<HostFunc*, Index> AppendFuncExport(string_view name,
+                                               R (*func)(Args...)) {
+    return AppendFuncExport(name, std::function<R(Args...)>(func));
+  }
+
+  template <typename R, typename... Args>
+  std::pair<HostFunc*, Index> AppendFuncExport(
+      string_view name,
+      std::function<R(Args...)> func) {
+    FuncSignature sig({HostValue<Args>::type()...},
+                      HostCall<R, Args...>::result_types());
+    return AppendValueFuncExport(
+        name, sig, [func](const HostFunc*, ValueSlot* slots) -> Result {
+          HostCall<R, Args...>::Call(
+              func, slots,
+              typename MakeHostIndexSequence<sizeof...(Args)>::type());
+          return ResultType::Ok;
+        });
+  }
+
   std::pair<Table*, Index> AppendTableExport(string_view name,
                                              Type elem_type,
                                              const Limits&);
@@ -439,6 +788,139 @@ struct HostModule : Module {
       on_unknown_func_export;
 };
 
+// Superinstructions that BinaryReaderInterp can fuse from a sequence of
+// adjacent instructions.
+//
+//   V(Name, name, sequence)
+#define WABT_FOREACH_FUSION(V)                                    \
+  V(I32AddLocals, "i32.add_locals", "local.get local.get i32.add") \
+  V(I32AddConst, "i32.add_const", "i32.const i32.add")             \
+  V(I32LoadLocal, "i32.load_local", "local.get i32.load")          \
+  V(I32CompareBrUnless, "i32.cmp_br_unless", "<i32 compare> br_if|if")
+
+enum class Fusion {
+#define V(Name, name, sequence) Name,
+  WABT_FOREACH_FUSION(V)
+#undef V
+};
+
+#define V(Name, name, sequence) +1
+static const int kFusionCount = WABT_FOREACH_FUSION(V);
+#undef V
+
+const char* GetFusionName(Fusion);
+bool ParseFusionName(string_view name, Fusion* out_fusion);
+
+// Returns true and sets |out_fusion| if |sequence| is exactly the sequence of
+// opcodes that |out_fusion| replaces.
+bool GetFusionForSequence(const std::vector<Opcode>& sequence,
+                          Fusion* out_fusion);
+
+// What each instruction costs in fuel, in modules lowered with
+// LoweringOptions::fuel. By default every instruction costs 1.
+class FuelCosts {
+ public:
+  FuelCosts();
+
+  // The cost of executing |opcode| once. The costs of the instructions in a
+  // basic block are summed when it is lowered, so changing these only affects
+  // modules that are read afterward.
+  uint32_t GetCost(Opcode opcode) const { return costs_[opcode]; }
+  void SetCost(Opcode opcode, uint32_t cost) { costs_[opcode] = cost; }
+
+  // An additional cost for each byte that memory.copy, memory.fill or
+  // memory.init writes, or each element that table.copy, table.fill or
+  // table.init writes, charged when the instruction runs. 0 by default.
+  uint32_t GetCostPerUnit(Opcode opcode) const { return unit_costs_[opcode]; }
+  void SetCostPerUnit(Opcode opcode, uint32_t cost) {
+    unit_costs_[opcode] = cost;
+  }
+
+ private:
+  // Indexed by Opcode::Enum.
+  std::vector<uint32_t> costs_;
+  std::vector<uint32_t> unit_costs_;
+};
+
+// Options that control how BinaryReaderInterp lowers function bodies to the
+// istream.
+struct LoweringOptions {
+  // Lower "local.get; local.get; <binop>", optionally followed by local.set,
+  // to a single instruction that reads and writes the frame slots directly
+  // instead of round-tripping through the value stack.
+  bool register_lowering = false;
+
+  // The superinstructions to fuse, as a bitmask indexed by Fusion.
+  uint32_t fusions = 0;
+
+  void EnableFusion(Fusion fusion) {
+    fusions |= 1u << static_cast<int>(fusion);
+  }
+  bool IsFusionEnabled(Fusion fusion) const {
+    return (fusions & (1u << static_cast<int>(fusion))) != 0;
+  }
+
+  // Only record where each function body is when a module is read, and lower
+  // it the first time the function is called. A body that fails to validate
+  // then traps instead of failing to load.
+  bool lazy_compilation = false;
+
+  // Start each function with an instruction that counts its calls, so that
+  // Threads with Thread::Options::jit_threshold set can compile the hot ones
+  // to machine code.
+  bool jit = false;
+
+  // Start each basic block with an instruction that takes the cost of the
+  // instructions in it, according to |fuel_costs|, from the Thread's fuel,
+  // and traps with OutOfFuel if there isn't enough. A block is charged in
+  // full when it is entered, even if a branch leaves it early.
+  bool fuel = false;
+  FuelCosts fuel_costs;
+};
+
+// Returns true if Threads can compile functions to machine code on this
+// platform; see Thread::Options::jit_threshold.
+bool IsJitSupported();
+
+// The threads that are blocked in memory.atomic.wait, grouped by the address
+// they are waiting on. All the Threads running in an Environment share one.
+class WaitQueues {
+ public:
+  // The values returned by memory.atomic.wait.
+  enum class WaitResult : uint32_t {
+    Ok = 0,
+    NotEqual = 1,
+    TimedOut = 2,
+  };
+
+  // Blocks until |address| is notified, unless it doesn't contain |expected|.
+  // A negative |timeout_ns| never times out.
+  template <typename T>
+  WaitResult Wait(T* address, T expected, int64_t timeout_ns);
+  // Wakes up to |count| of the threads waiting on |address|, in the order they
+  // started waiting. Returns the number of threads woken.
+  uint32_t Notify(void* address, uint32_t count);
+
+ private:
+  struct Waiter {
+    std::condition_variable cond;
+    bool notified = false;
+  };
+
+  std::mutex mutex_;
+  std::map<void*, std::list<Waiter*>> waiters_;
+};
+
+// Once its modules are loaded and initialized, an Environment can be shared by
+// Executors running on different threads; each Executor has its own Thread,
+// with its own stacks. Only shared memories may be accessed concurrently, with
+// the usual rules of the threads proposal. Loading modules, taking or restoring
+// snapshots and resetting to a mark point must not overlap with execution.
+// Lazily compiled functions are lowered by the Thread that first calls them,
+// appending to the istream that other Threads are reading, so calling one that
+// isn't compiled yet traps while more than one Executor uses the Environment.
+// Hot functions are compiled to machine code by the Thread whose call makes
+// them hot, under a lock.
 class Environment {
  public:
   // Used to track and reset the state of the environment.
@@ -454,6 +936,20 @@ class Environment {
     size_t istream_size = 0;
   };
 
+  // A copy of the mutable state of the environment: its globals, tables,
+  // memories and segments. Restoring a snapshot taken after
+  // Executor::Initialize resets the modules to their freshly instantiated
+  // state without reading them or rerunning their initializers and start
+  // functions again.
+  struct Snapshot {
+    std::vector<TypedValue> globals;
+    std::vector<Table> tables;
+    std::vector<Limits> memory_limits;
+    std::vector<MemoryImage> memory_images;
+    std::vector<std::vector<char>> data_segments;
+    std::vector<std::vector<Ref>> elem_segments;
+  };
+
   explicit Environment(const Features& features);
 
   OutputBuffer& istream() { return *istream_; }
@@ -490,6 +986,9 @@ class Environment {
     assert(index < memories_.size());
     return &memories_[index];
   }
+  bool HasGuardPageMemory() const;
+  // Returns the memory whose guard pages contain |address|, or nullptr.
+  Memory* FindGuardPageMemory(const void* address);
   Table* GetTable(Index index) {
     assert(index < tables_.size());
     return &tables_[index];
@@ -513,9 +1012,20 @@ class Environment {
   Module* FindModule(string_view name);
   Module* FindRegisteredModule(string_view name);
 
+  // Resolves all of |imports| in one pass, to the exports of the registered
+  // modules they name, for the ReadBinaryInterp overload that takes resolved
+  // imports. Each registered module is only looked up once for a run of
+  // imports from it. Since the signatures of function imports aren't known,
+  // they resolve to the first export with their name; ReadBinaryInterp still
+  // checks that the signatures match.
+  wabt::Result LinkImports(const std::vector<Import>& imports,
+                           std::vector<Export*>* out_exports,
+                           Errors*);
+
   template <typename... Args>
   FuncSignature* EmplaceBackFuncSignature(Args&&... args) {
     sigs_.emplace_back(std::forward<Args>(args)...);
+    InternFuncSignature();
     return &sigs_.back();
   }
 
@@ -579,11 +1089,23 @@ class Environment {
 
   HostModule* AppendHostModule(string_view name);
 
-  bool FuncSignaturesAreEqual(Index sig_index_0, Index sig_index_1) const;
+  // Signatures with the same types have the same id: the index of the first
+  // of them that was added.
+  Index GetFuncSignatureId(Index sig_index) const {
+    return sig_ids_[sig_index];
+  }
+  bool FuncSignaturesAreEqual(Index sig_index_0, Index sig_index_1) const {
+    return sig_ids_[sig_index_0] == sig_ids_[sig_index_1];
+  }
 
   MarkPoint Mark();
   void ResetToMarkPoint(const MarkPoint&);
 
+  Snapshot TakeSnapshot() const;
+  // Items added to the environment after the snapshot was taken are left
+  // as-is.
+  void RestoreSnapshot(const Snapshot&);
+
   void Disassemble(Stream* stream, IstreamOffset from, IstreamOffset to);
   void DisassembleModule(Stream* stream, Module*);
 
@@ -593,12 +1115,21 @@ class Environment {
   std::function<bool(Environment*, string_view name)> on_unknown_module;
 
   Features features_;
+  LoweringOptions lowering_options_;
+  // The backend used for memories defined in this environment.
+  MemoryBackend memory_backend_ = MemoryBackend::Heap;
 
  private:
+  friend class Executor;
   friend class Thread;
 
+  // Gives the last signature in sigs_ its id.
+  void InternFuncSignature();
+
   std::vector<std::unique_ptr<Module>> modules_;
   std::vector<FuncSignature> sigs_;
+  std::vector<Index> sig_ids_;
+  std::map<std::pair<TypeVector, TypeVector>, Index> sig_ids_by_types_;
   std::vector<std::unique_ptr<Func>> funcs_;
   std::vector<Memory> memories_;
   std::vector<Table> tables_;
@@ -609,19 +1140,42 @@ class Environment {
   std::unique_ptr<OutputBuffer> istream_;
   BindingHash module_bindings_;
   BindingHash registered_module_bindings_;
+  WaitQueues wait_queues_;
+  // Serializes memory.grow on shared memories.
+  std::mutex shared_memory_grow_mutex_;
+  // Serializes compiling functions to machine code.
+  std::mutex jit_mutex_;
+  // The number of live Executors; lazy compilation needs there to be one.
+  std::atomic<int> num_executors_{0};
 };
 
+struct JitContext;
+class Profiler;
+
 class Thread {
  public:
   struct Options {
-    static const uint32_t kDefaultValueStackSize = 512 * 1024 / sizeof(Value);
+    // In slots; see ValueSlot.
+    static const uint32_t kDefaultValueStackSize =
+        512 * 1024 / sizeof(ValueSlot);
     static const uint32_t kDefaultCallStackSize = 64 * 1024;
+    static const uint32_t kDefaultJitThreshold = 10;
 
     explicit Options(uint32_t value_stack_size = kDefaultValueStackSize,
                      uint32_t call_stack_size = kDefaultCallStackSize);
 
     uint32_t value_stack_size;
     uint32_t call_stack_size;
+    // Compile a function to machine code on this call to it, and run the
+    // machine code from then on. Only functions lowered with
+    // LoweringOptions::jit are counted, and only where IsJitSupported()
+    // returns true. 0 disables the JIT.
+    uint32_t jit_threshold = 0;
+    // The fuel available to modules lowered with LoweringOptions::fuel.
+    uint64_t fuel = UINT64_MAX;
+    // Count calls, and sample the call stack, into this profiler. Profiling
+    // needs every function interpreted, so it disables the JIT.
+    Profiler* profiler = nullptr;
   };
 
   explicit Thread(Environment*, const Options& = Options());
@@ -631,33 +1185,81 @@ class Thread {
   void set_pc(IstreamOffset offset) { pc_ = offset; }
   IstreamOffset pc() const { return pc_; }
 
+  // The fuel left. Reset() doesn't refill it, so it bounds everything that
+  // runs on the Thread until it is set again.
+  void set_fuel(uint64_t fuel) { fuel_ = fuel; }
+  uint64_t fuel() const { return fuel_; }
+
   void Reset();
-  Index NumValues() const { return value_stack_top_; }
-  Result Push(Value) WABT_WARN_UNUSED;
-  Value Pop();
-  Value ValueAt(Index at) const;
+  Index NumSlots() const { return value_stack_top_; }
+  // Push or pop a value of |type|, which takes two slots if it is a v128.
+  Result Push(Type, Value) WABT_WARN_UNUSED;
+  Value Pop(Type);
+  // Returns the value of |type| that starts at slot |at|.
+  Value ValueAt(Type, Index at) const;
 
   void Trace(Stream*);
+  // Run at most |num_instructions| instructions.
   Result Run(int num_instructions = 1);
+  // Run until the top-most function returns or traps.
+  Result RunUntilReturn();
 
   Result CallHost(HostFunc*);
 
+  // A host function's callback may return Suspended instead of its results,
+  // e.g. to wait for I/O without blocking. The Thread then stops with its
+  // stacks and pc intact and the host function's arguments popped, and stays
+  // suspended until Resume pushes the host function's results, after which
+  // running the Thread continues after the call. Reset abandons the call.
+  // Threads can't be suspended while they run machine code; see
+  // Options::jit_threshold.
+  bool is_suspended() const { return suspended_func_ != nullptr; }
+  HostFunc* suspended_func() const { return suspended_func_; }
+  // Returns Returned instead of Ok if there is nothing left to run, because
+  // the host function was tail called by the outermost function.
+  Result Resume(const TypedValues& results) WABT_WARN_UNUSED;
+
+  // The trap for the last load or store being out of bounds of |memory|. Its
+  // bounds aren't checked if |memory| has guard pages, so this is also how a
+  // fault in them is reported.
+  Result MemoryAccessOutOfBounds(const Memory* memory) const;
+
  private:
+  friend class JitCompiler;
+
+  // Machine code calls into the Thread at most this deep, to bound the native
+  // stack it uses; deeper calls are interpreted.
+  static const uint32_t kMaxJitDepth = 1000;
+
   const uint8_t* GetIstream() const { return env_->istream_->data.data(); }
 
+  // Like RunUntilReturn, but samples the call stack into |profiler_| every
+  // sample interval.
+  Result RunProfiled();
+
   Memory* ReadMemory(const uint8_t** pc);
   template <typename MemType>
   Result GetAccessAddress(const uint8_t** pc, void** out_address);
   template <typename MemType>
-  Result GetAtomicAccessAddress(const uint8_t** pc, void** out_address);
+  Result GetAccessAddress(const uint8_t** pc,
+                          uint32_t base,
+                          void** out_address);
+  template <typename MemType>
+  Result GetAtomicAccessAddress(const uint8_t** pc,
+                                void** out_address,
+                                Memory** out_memory = nullptr);
 
   Table* ReadTable(const uint8_t** pc);
 
   DataSegment* ReadDataSegment(const uint8_t** pc);
   ElemSegment* ReadElemSegment(const uint8_t** pc);
 
-  Value& Top();
-  Value& Pick(Index depth);
+  ValueSlot& Top();
+  ValueSlot& Pick(Index depth);
+  // Returns the v128 whose high slot is at |depth|, as for Pick.
+  v128 PickV128(Index depth) const;
+  Result PushSlot(ValueSlot) WABT_WARN_UNUSED;
+  ValueSlot PopSlot();
 
   // Push/Pop values with conversions, e.g. Push<float> will convert to the
   // ValueTypeRep (uint32_t) and push that. Similarly, Pop<float> will pop the
@@ -680,6 +1282,15 @@ class Thread {
   Result PushCall(const uint8_t* pc) WABT_WARN_UNUSED;
   IstreamOffset PopCall();
 
+  Result PushHostResults(const FuncSignature*,
+                         const TypedValues& results) WABT_WARN_UNUSED;
+  Result Suspend(HostFunc*) WABT_WARN_UNUSED;
+
+  // Reads the operands of call_indirect or return_call_indirect, and returns
+  // the function that the index at the top of the value stack selects.
+  Result GetIndirectCallee(const uint8_t** pc,
+                           Func** out_func) WABT_WARN_UNUSED;
+
   template <typename R, typename T> using UnopFunc      = R(T);
   template <typename R, typename T> using UnopTrapFunc  = Result(T, R*);
   template <typename R, typename T> using BinopFunc     = R(T, T);
@@ -698,7 +1309,33 @@ class Thread {
                    const uint8_t** pc) WABT_WARN_UNUSED;
   template <typename MemType, typename ResultType = MemType>
   Result AtomicRmwCmpxchg(const uint8_t** pc) WABT_WARN_UNUSED;
-
+  template <typename T>
+  Result AtomicWait(const uint8_t** pc) WABT_WARN_UNUSED;
+  Result AtomicNotify(const uint8_t** pc) WABT_WARN_UNUSED;
+
+  // Lowers a lazily compiled function. This may reallocate the istream.
+  Result CompileFunction(Index func_index) WABT_WARN_UNUSED;
+
+  // Counts a call to |func|, compiling it once it is hot, and returns true if
+  // the call should run its machine code.
+  bool ShouldRunJitCode(DefinedFunc* func);
+  // Runs the whole function, with its arguments at the top of the value stack.
+  Result RunJitCode(DefinedFunc*) WABT_WARN_UNUSED;
+  // Interprets from |offset| until the function there returns.
+  Result RunNested(IstreamOffset offset) WABT_WARN_UNUSED;
+  Result CallFromJit(Func*) WABT_WARN_UNUSED;
+  // |operands| is the offset of the call_indirect's operands.
+  Result CallIndirectFromJit(IstreamOffset operands) WABT_WARN_UNUSED;
+  static uint32_t FinishJitCall(JitContext*, Result);
+
+  // Called by machine code, with the top of the value stack in the context.
+  // Each returns a ResultType.
+  static uint32_t JitStep(JitContext*, IstreamOffset offset);
+  static uint32_t JitCall(JitContext*, Index func_index);
+  static uint32_t JitCallIndirect(JitContext*, IstreamOffset operands);
+
+  // Returns the old page count, or -1 if the memory can't grow.
+  uint32_t GrowMemory(Memory*, uint32_t grow_pages);
   Result MemoryInit(const uint8_t** pc) WABT_WARN_UNUSED;
   Result DataDrop(const uint8_t** pc) WABT_WARN_UNUSED;
   Result MemoryCopy(const uint8_t** pc) WABT_WARN_UNUSED;
@@ -710,6 +1347,8 @@ class Thread {
   Result ElemDrop(const uint8_t** pc) WABT_WARN_UNUSED;
   Result TableCopy(const uint8_t** pc) WABT_WARN_UNUSED;
   Result RefFunc(const uint8_t** pc) WABT_WARN_UNUSED;
+  // Charges the cost per unit of |opcode| for |count| bytes or elements.
+  Result ConsumeFuelPerUnit(Opcode, uint32_t count) WABT_WARN_UNUSED;
 
   template <typename R, typename T = R>
   Result Unop(UnopFunc<R, T> func) WABT_WARN_UNUSED;
@@ -731,11 +1370,32 @@ class Thread {
   Result SimdRelBinop(BinopFunc<R, P> func) WABT_WARN_UNUSED;
 
   Environment* env_ = nullptr;
-  std::vector<Value> value_stack_;
+  std::vector<ValueSlot> value_stack_;
   std::vector<IstreamOffset> call_stack_;
   uint32_t value_stack_top_ = 0;
   uint32_t call_stack_top_ = 0;
+  // Returning from the function at this depth of the call stack stops the
+  // interpreter. This is only nonzero while machine code calls back into it.
+  uint32_t call_stack_base_ = 0;
   IstreamOffset pc_ = 0;
+  uint32_t jit_threshold_ = 0;
+  uint32_t jit_depth_ = 0;
+  uint64_t fuel_ = UINT64_MAX;
+  Profiler* profiler_ = nullptr;
+  HostFunc* suspended_func_ = nullptr;
+  // Whether Resume returns from the current function, because the host
+  // function was called by return_call_indirect.
+  bool resume_returns_ = false;
+  // Set by Resume, so that the profiler doesn't count the resumed function as
+  // another call.
+  bool resumed_ = false;
+  // The number of instructions that the last call to Run ran,
+  // unless it trapped.
+  int num_instructions_run_ = 0;
+  // The address and size of the last load or store; see
+  // MemoryAccessOutOfBounds.
+  uint64_t access_addr_ = 0;
+  size_t access_size_ = 0;
 };
 
 struct ExecResult {
@@ -749,11 +1409,22 @@ struct ExecResult {
   TypedValues values;
 };
 
+// A function and its signature, resolved once by Executor::GetCallHandle so
+// that Executor::Call doesn't look them up on every call. The signature is
+// kept by index, since adding signatures to the Environment may move them.
+struct CallHandle {
+  bool is_valid() const { return func != nullptr; }
+
+  Func* func = nullptr;
+  Index sig_index = kInvalidIndex;
+};
+
 class Executor {
  public:
   explicit Executor(Environment*,
                     Stream* trace_stream = nullptr,
                     const Thread::Options& options = Thread::Options());
+  ~Executor();
 
   ExecResult RunFunction(Index func_index, const TypedValues& args);
   ExecResult Initialize(DefinedModule* module);
@@ -762,16 +1433,48 @@ class Executor {
                              string_view name,
                              const TypedValues& args);
 
+  CallHandle GetFuncCallHandle(Index func_index);
+  CallHandle GetCallHandle(const Export*);
+  // Returns UnknownExport or ExportKindMismatch if |name| isn't a function
+  // export of |module|.
+  Result GetCallHandle(Module* module, string_view name, CallHandle* out);
+
+  // Calls the function with |num_args| arguments, and stores its results in
+  // |results|, which has room for |num_results|. The counts must match the
+  // function's signature, but unlike RunFunction the types of the arguments
+  // aren't checked, since Values don't have one. Nothing is allocated, so
+  // this is the cheapest way to call a function many times.
+  Result Call(const CallHandle&,
+              const Value* args,
+              Index num_args,
+              Value* results,
+              Index num_results);
+
+  // Continues the function that a host function suspended, with the host
+  // function's |results|. Returns the function's results, or Suspended again.
+  // See Thread::Resume.
+  ExecResult Resume(const TypedValues& results);
+
+  Thread* thread() { return &thread_; }
+
  private:
+  Result RunFunc(Func*);
   ExecResult RunStartFunction(DefinedModule* module);
   Result InitializeSegments(DefinedModule* module);
   Result RunDefinedFunction(IstreamOffset function_offset);
+  // Runs the thread from its pc until the outermost function returns.
+  Result RunThread();
+  Result RunThreadUnguarded();
   Result PushArgs(const FuncSignature*, const TypedValues& args);
   void CopyResults(const FuncSignature*, TypedValues* out_results);
 
   Environment* env_ = nullptr;
   Stream* trace_stream_ = nullptr;
   Thread thread_;
+  // The outermost function of the last run, which Resume continues.
+  Func* func_ = nullptr;
+
+  WABT_DISALLOW_COPY_AND_ASSIGN(Executor);
 };
 
 bool IsCanonicalNan(uint32_t f32_bits);
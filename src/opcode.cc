@@ -323,6 +323,16 @@ bool Opcode::IsEnabled(const Features& features) const {
     case Opcode::InterpCallHost:
     case Opcode::InterpData:
     case Opcode::InterpDropKeep:
+    case Opcode::InterpRegBinop:
+    case Opcode::InterpRegBinopSet:
+    case Opcode::InterpI32AddLocals:
+    case Opcode::InterpI32AddConst:
+    case Opcode::InterpI32LoadLocal:
+    case Opcode::InterpI32CompareBrUnless:
+    case Opcode::InterpCompile:
+    case Opcode::InterpFuncEntry:
+    case Opcode::InterpConsumeFuel:
+    case Opcode::InterpSelectV128:
       return false;
 
     default:
@@ -4,6 +4,17 @@ const char SECTION_NAME(includes)[] =
 "#include <string.h>\n"
 ;
 
+const char SECTION_NAME(memory_size)[] =
+"#define MEMORY_SIZE(mem) ((mem)->size)\n"
+"#define MEMORY_PAGES(mem) ((mem)->pages)\n"
+;
+
+const char SECTION_NAME(atomic_memory_size)[] =
+"/* Another thread may grow a shared memory while this one reads its size. */\n"
+"#define MEMORY_SIZE(mem) __atomic_load_n(&(mem)->size, __ATOMIC_ACQUIRE)\n"
+"#define MEMORY_PAGES(mem) __atomic_load_n(&(mem)->pages, __ATOMIC_ACQUIRE)\n"
+;
+
 const char SECTION_NAME(declarations)[] =
 "#define UNLIKELY(x) __builtin_expect(!!(x), 0)\n"
 "#define LIKELY(x) __builtin_expect(!!(x), 1)\n"
@@ -16,16 +27,29 @@ const char SECTION_NAME(declarations)[] =
 "\n"
 "#define FUNC_EPILOGUE --wasm_rt_call_stack_depth\n"
 "\n"
+"#define CONSUME_FUEL(cost)                                    \\\n"
+"  do {                                                        \\\n"
+"    if (UNLIKELY(wasm_rt_fuel < (cost))) TRAP(OUT_OF_FUEL);   \\\n"
+"    wasm_rt_fuel -= (cost);                                   \\\n"
+"  } while (0)\n"
+"\n"
 "#define UNREACHABLE TRAP(UNREACHABLE)\n"
 "\n"
-"#define CALL_INDIRECT(table, t, ft, x, ...)          \\\n"
-"  (LIKELY((x) < table.size && table.data[x].func &&  \\\n"
-"          table.data[x].func_type == func_types[ft]) \\\n"
-"       ? ((t)table.data[x].func)(__VA_ARGS__)        \\\n"
-"       : TRAP(CALL_INDIRECT))\n"
+"/* The check is a separate expression, rather than one arm of a conditional,\n"
+" * so that the call may return a struct. */\n"
+"#define CALL_INDIRECT(table, t, ft, x, ...)              \\\n"
+"  ((LIKELY((x) < table.size && table.data[x].func &&     \\\n"
+"           table.data[x].func_type == func_types[ft])    \\\n"
+"        ? (void)0                                        \\\n"
+"        : (void)TRAP(CALL_INDIRECT)),                    \\\n"
+"   ((t)table.data[x].func)(__VA_ARGS__))\n"
 "\n"
+"#if WASM_RT_MEMCHECK_SIGNAL_HANDLER\n"
+"#define MEMCHECK(mem, a, t)\n"
+"#else\n"
 "#define MEMCHECK(mem, a, t)  \\\n"
-"  if (UNLIKELY((a) + sizeof(t) > mem->size)) TRAP(OOB)\n"
+"  if (UNLIKELY((a) + sizeof(t) > MEMORY_SIZE(mem))) TRAP(OOB)\n"
+"#endif\n"
 "\n"
 "#define DEFINE_LOAD(name, t1, t2, t3)              \\\n"
 "  static inline t3 name(wasm_rt_memory_t* mem, u64 addr) {   \\\n"
@@ -149,3 +173,546 @@ const char SECTION_NAME(declarations)[] =
 "DEFINE_REINTERPRET(i64_reinterpret_f64, f64, u64)\n"
 "\n"
 ;
+
+const char SECTION_NAME(simd_declarations)[] =
+"\n"
+"typedef s8 s8x16 __attribute__((vector_size(16)));\n"
+"typedef u8 u8x16 __attribute__((vector_size(16)));\n"
+"typedef s16 s16x8 __attribute__((vector_size(16)));\n"
+"typedef u16 u16x8 __attribute__((vector_size(16)));\n"
+"typedef s32 s32x4 __attribute__((vector_size(16)));\n"
+"typedef u32 u32x4 __attribute__((vector_size(16)));\n"
+"typedef s64 s64x2 __attribute__((vector_size(16)));\n"
+"typedef u64 u64x2 __attribute__((vector_size(16)));\n"
+"typedef f32 f32x4 __attribute__((vector_size(16)));\n"
+"typedef f64 f64x2 __attribute__((vector_size(16)));\n"
+"\n"
+"#define DEFINE_SPLAT(name, t, vt, n) \\\n"
+"  static inline v128 name(t x) {     \\\n"
+"    vt result = {0};                 \\\n"
+"    for (int i = 0; i < n; ++i)      \\\n"
+"      result[i] = x;                 \\\n"
+"    return (v128)result;             \\\n"
+"  }\n"
+"\n"
+"DEFINE_SPLAT(i8x16_splat, u32, u8x16, 16)\n"
+"DEFINE_SPLAT(i16x8_splat, u32, u16x8, 8)\n"
+"DEFINE_SPLAT(i32x4_splat, u32, u32x4, 4)\n"
+"DEFINE_SPLAT(i64x2_splat, u64, u64x2, 2)\n"
+"DEFINE_SPLAT(f32x4_splat, f32, f32x4, 4)\n"
+"DEFINE_SPLAT(f64x2_splat, f64, f64x2, 2)\n"
+"\n"
+"DEFINE_LOAD(v128_load, v128, v128, v128);\n"
+"DEFINE_STORE(v128_store, v128, v128);\n"
+"\n"
+"#define DEFINE_LOAD_SPLAT(name, t, splat)                    \\\n"
+"  static inline v128 name(wasm_rt_memory_t* mem, u64 addr) { \\\n"
+"    MEMCHECK(mem, addr, t);                                  \\\n"
+"    t value;                                                 \\\n"
+"    memcpy(&value, &mem->data[addr], sizeof(t));             \\\n"
+"    return splat(value);                                     \\\n"
+"  }\n"
+"\n"
+"DEFINE_LOAD_SPLAT(v8x16_load_splat, u8, i8x16_splat)\n"
+"DEFINE_LOAD_SPLAT(v16x8_load_splat, u16, i16x8_splat)\n"
+"DEFINE_LOAD_SPLAT(v32x4_load_splat, u32, i32x4_splat)\n"
+"DEFINE_LOAD_SPLAT(v64x2_load_splat, u64, i64x2_splat)\n"
+"\n"
+"#define DEFINE_LOAD_EXTEND(name, t, vt, n)                   \\\n"
+"  static inline v128 name(wasm_rt_memory_t* mem, u64 addr) { \\\n"
+"    MEMCHECK(mem, addr, u64);                                \\\n"
+"    t lanes[n];                                              \\\n"
+"    memcpy(lanes, &mem->data[addr], sizeof(lanes));          \\\n"
+"    vt result;                                               \\\n"
+"    for (int i = 0; i < n; ++i)                              \\\n"
+"      result[i] = lanes[i];                                  \\\n"
+"    return (v128)result;                                     \\\n"
+"  }\n"
+"\n"
+"DEFINE_LOAD_EXTEND(i16x8_load8x8_s, s8, s16x8, 8)\n"
+"DEFINE_LOAD_EXTEND(i16x8_load8x8_u, u8, u16x8, 8)\n"
+"DEFINE_LOAD_EXTEND(i32x4_load16x4_s, s16, s32x4, 4)\n"
+"DEFINE_LOAD_EXTEND(i32x4_load16x4_u, u16, u32x4, 4)\n"
+"DEFINE_LOAD_EXTEND(i64x2_load32x2_s, s32, s64x2, 2)\n"
+"DEFINE_LOAD_EXTEND(i64x2_load32x2_u, u32, u64x2, 2)\n"
+"\n"
+"#define DEFINE_EXTRACT_LANE(name, t, vt) \\\n"
+"  static inline t name(v128 v, int lane) { return ((vt)v)[lane]; }\n"
+"\n"
+"#define DEFINE_REPLACE_LANE(name, t, vt)             \\\n"
+"  static inline v128 name(v128 v, t x, int lane) {  \\\n"
+"    vt result = (vt)v;                              \\\n"
+"    result[lane] = x;                               \\\n"
+"    return (v128)result;                            \\\n"
+"  }\n"
+"\n"
+"DEFINE_EXTRACT_LANE(i8x16_extract_lane_s, u32, s8x16)\n"
+"DEFINE_EXTRACT_LANE(i8x16_extract_lane_u, u32, u8x16)\n"
+"DEFINE_EXTRACT_LANE(i16x8_extract_lane_s, u32, s16x8)\n"
+"DEFINE_EXTRACT_LANE(i16x8_extract_lane_u, u32, u16x8)\n"
+"DEFINE_EXTRACT_LANE(i32x4_extract_lane, u32, u32x4)\n"
+"DEFINE_EXTRACT_LANE(i64x2_extract_lane, u64, u64x2)\n"
+"DEFINE_EXTRACT_LANE(f32x4_extract_lane, f32, f32x4)\n"
+"DEFINE_EXTRACT_LANE(f64x2_extract_lane, f64, f64x2)\n"
+"DEFINE_REPLACE_LANE(i8x16_replace_lane, u32, u8x16)\n"
+"DEFINE_REPLACE_LANE(i16x8_replace_lane, u32, u16x8)\n"
+"DEFINE_REPLACE_LANE(i32x4_replace_lane, u32, u32x4)\n"
+"DEFINE_REPLACE_LANE(i64x2_replace_lane, u64, u64x2)\n"
+"DEFINE_REPLACE_LANE(f32x4_replace_lane, f32, f32x4)\n"
+"DEFINE_REPLACE_LANE(f64x2_replace_lane, f64, f64x2)\n"
+"\n"
+"/* Lane indexes are immediates, so the shuffle can be a single instruction. */\n"
+"#if defined(__clang__)\n"
+"#define v8x16_shuffle(a, b, ...) \\\n"
+"  ((v128)__builtin_shufflevector((u8x16)(a), (u8x16)(b), __VA_ARGS__))\n"
+"#else\n"
+"#define v8x16_shuffle(a, b, ...) \\\n"
+"  ((v128)__builtin_shuffle((u8x16)(a), (u8x16)(b), (u8x16){__VA_ARGS__}))\n"
+"#endif\n"
+"\n"
+"static inline v128 v8x16_swizzle(v128 a, v128 b) {\n"
+"  u8x16 va = (u8x16)a, vb = (u8x16)b, result;\n"
+"  for (int i = 0; i < 16; ++i)\n"
+"    result[i] = vb[i] < 16 ? va[vb[i]] : 0;\n"
+"  return (v128)result;\n"
+"}\n"
+"\n"
+"#define DEFINE_UNOP(name, vt, op) \\\n"
+"  static inline v128 name(v128 a) { return (v128)(op(vt)a); }\n"
+"\n"
+"#define DEFINE_BINOP(name, vt, op) \\\n"
+"  static inline v128 name(v128 a, v128 b) { return (v128)((vt)a op(vt)b); }\n"
+"\n"
+"/* Comparisons give each lane all ones or all zeros, as in wasm. */\n"
+"#define DEFINE_CMP DEFINE_BINOP\n"
+"\n"
+"DEFINE_CMP(i8x16_eq, u8x16, ==)\n"
+"DEFINE_CMP(i8x16_ne, u8x16, !=)\n"
+"DEFINE_CMP(i8x16_lt_s, s8x16, <)\n"
+"DEFINE_CMP(i8x16_lt_u, u8x16, <)\n"
+"DEFINE_CMP(i8x16_gt_s, s8x16, >)\n"
+"DEFINE_CMP(i8x16_gt_u, u8x16, >)\n"
+"DEFINE_CMP(i8x16_le_s, s8x16, <=)\n"
+"DEFINE_CMP(i8x16_le_u, u8x16, <=)\n"
+"DEFINE_CMP(i8x16_ge_s, s8x16, >=)\n"
+"DEFINE_CMP(i8x16_ge_u, u8x16, >=)\n"
+"DEFINE_CMP(i16x8_eq, u16x8, ==)\n"
+"DEFINE_CMP(i16x8_ne, u16x8, !=)\n"
+"DEFINE_CMP(i16x8_lt_s, s16x8, <)\n"
+"DEFINE_CMP(i16x8_lt_u, u16x8, <)\n"
+"DEFINE_CMP(i16x8_gt_s, s16x8, >)\n"
+"DEFINE_CMP(i16x8_gt_u, u16x8, >)\n"
+"DEFINE_CMP(i16x8_le_s, s16x8, <=)\n"
+"DEFINE_CMP(i16x8_le_u, u16x8, <=)\n"
+"DEFINE_CMP(i16x8_ge_s, s16x8, >=)\n"
+"DEFINE_CMP(i16x8_ge_u, u16x8, >=)\n"
+"DEFINE_CMP(i32x4_eq, u32x4, ==)\n"
+"DEFINE_CMP(i32x4_ne, u32x4, !=)\n"
+"DEFINE_CMP(i32x4_lt_s, s32x4, <)\n"
+"DEFINE_CMP(i32x4_lt_u, u32x4, <)\n"
+"DEFINE_CMP(i32x4_gt_s, s32x4, >)\n"
+"DEFINE_CMP(i32x4_gt_u, u32x4, >)\n"
+"DEFINE_CMP(i32x4_le_s, s32x4, <=)\n"
+"DEFINE_CMP(i32x4_le_u, u32x4, <=)\n"
+"DEFINE_CMP(i32x4_ge_s, s32x4, >=)\n"
+"DEFINE_CMP(i32x4_ge_u, u32x4, >=)\n"
+"DEFINE_CMP(f32x4_eq, f32x4, ==)\n"
+"DEFINE_CMP(f32x4_ne, f32x4, !=)\n"
+"DEFINE_CMP(f32x4_lt, f32x4, <)\n"
+"DEFINE_CMP(f32x4_gt, f32x4, >)\n"
+"DEFINE_CMP(f32x4_le, f32x4, <=)\n"
+"DEFINE_CMP(f32x4_ge, f32x4, >=)\n"
+"DEFINE_CMP(f64x2_eq, f64x2, ==)\n"
+"DEFINE_CMP(f64x2_ne, f64x2, !=)\n"
+"DEFINE_CMP(f64x2_lt, f64x2, <)\n"
+"DEFINE_CMP(f64x2_gt, f64x2, >)\n"
+"DEFINE_CMP(f64x2_le, f64x2, <=)\n"
+"DEFINE_CMP(f64x2_ge, f64x2, >=)\n"
+"\n"
+"DEFINE_UNOP(v128_not, v128, ~)\n"
+"DEFINE_BINOP(v128_and, v128, &)\n"
+"DEFINE_BINOP(v128_or, v128, |)\n"
+"DEFINE_BINOP(v128_xor, v128, ^)\n"
+"\n"
+"static inline v128 v128_andnot(v128 a, v128 b) {\n"
+"  return a & ~b;\n"
+"}\n"
+"\n"
+"static inline v128 v128_bitselect(v128 a, v128 b, v128 mask) {\n"
+"  return (a & mask) | (b & ~mask);\n"
+"}\n"
+"\n"
+"/* Integer arithmetic is done on unsigned lanes, so that it wraps. */\n"
+"DEFINE_UNOP(i8x16_neg, u8x16, -)\n"
+"DEFINE_BINOP(i8x16_add, u8x16, +)\n"
+"DEFINE_BINOP(i8x16_sub, u8x16, -)\n"
+"DEFINE_UNOP(i16x8_neg, u16x8, -)\n"
+"DEFINE_BINOP(i16x8_add, u16x8, +)\n"
+"DEFINE_BINOP(i16x8_sub, u16x8, -)\n"
+"DEFINE_BINOP(i16x8_mul, u16x8, *)\n"
+"DEFINE_UNOP(i32x4_neg, u32x4, -)\n"
+"DEFINE_BINOP(i32x4_add, u32x4, +)\n"
+"DEFINE_BINOP(i32x4_sub, u32x4, -)\n"
+"DEFINE_BINOP(i32x4_mul, u32x4, *)\n"
+"DEFINE_UNOP(i64x2_neg, u64x2, -)\n"
+"DEFINE_BINOP(i64x2_add, u64x2, +)\n"
+"DEFINE_BINOP(i64x2_sub, u64x2, -)\n"
+"DEFINE_BINOP(i64x2_mul, u64x2, *)\n"
+"\n"
+"#define DEFINE_SHIFT(name, vt, op, mask)       \\\n"
+"  static inline v128 name(v128 a, u32 count) { \\\n"
+"    return (v128)((vt)a op(int)(count & mask)); \\\n"
+"  }\n"
+"\n"
+"DEFINE_SHIFT(i8x16_shl, u8x16, <<, 7)\n"
+"DEFINE_SHIFT(i8x16_shr_s, s8x16, >>, 7)\n"
+"DEFINE_SHIFT(i8x16_shr_u, u8x16, >>, 7)\n"
+"DEFINE_SHIFT(i16x8_shl, u16x8, <<, 15)\n"
+"DEFINE_SHIFT(i16x8_shr_s, s16x8, >>, 15)\n"
+"DEFINE_SHIFT(i16x8_shr_u, u16x8, >>, 15)\n"
+"DEFINE_SHIFT(i32x4_shl, u32x4, <<, 31)\n"
+"DEFINE_SHIFT(i32x4_shr_s, s32x4, >>, 31)\n"
+"DEFINE_SHIFT(i32x4_shr_u, u32x4, >>, 31)\n"
+"DEFINE_SHIFT(i64x2_shl, u64x2, <<, 63)\n"
+"DEFINE_SHIFT(i64x2_shr_s, s64x2, >>, 63)\n"
+"DEFINE_SHIFT(i64x2_shr_u, u64x2, >>, 63)\n"
+"\n"
+"#define DEFINE_MINMAX(name, vt, op)                       \\\n"
+"  static inline v128 name(v128 a, v128 b) {               \\\n"
+"    return v128_bitselect(a, b, (v128)((vt)a op(vt)b)); \\\n"
+"  }\n"
+"\n"
+"DEFINE_MINMAX(i8x16_min_s, s8x16, <)\n"
+"DEFINE_MINMAX(i8x16_min_u, u8x16, <)\n"
+"DEFINE_MINMAX(i8x16_max_s, s8x16, >)\n"
+"DEFINE_MINMAX(i8x16_max_u, u8x16, >)\n"
+"DEFINE_MINMAX(i16x8_min_s, s16x8, <)\n"
+"DEFINE_MINMAX(i16x8_min_u, u16x8, <)\n"
+"DEFINE_MINMAX(i16x8_max_s, s16x8, >)\n"
+"DEFINE_MINMAX(i16x8_max_u, u16x8, >)\n"
+"DEFINE_MINMAX(i32x4_min_s, s32x4, <)\n"
+"DEFINE_MINMAX(i32x4_min_u, u32x4, <)\n"
+"DEFINE_MINMAX(i32x4_max_s, s32x4, >)\n"
+"DEFINE_MINMAX(i32x4_max_u, u32x4, >)\n"
+"\n"
+"#define SATURATE(x, min, max) ((x) < (min) ? (min) : (x) > (max) ? (max) : (x))\n"
+"\n"
+"#define DEFINE_SAT_BINOP(name, vt, n, op, min, max) \\\n"
+"  static inline v128 name(v128 a, v128 b) {         \\\n"
+"    vt va = (vt)a, vb = (vt)b, result;              \\\n"
+"    for (int i = 0; i < n; ++i) {                   \\\n"
+"      s32 x = (s32)va[i] op(s32) vb[i];             \\\n"
+"      result[i] = SATURATE(x, min, max);            \\\n"
+"    }                                               \\\n"
+"    return (v128)result;                            \\\n"
+"  }\n"
+"\n"
+"DEFINE_SAT_BINOP(i8x16_add_saturate_s, s8x16, 16, +, INT8_MIN, INT8_MAX)\n"
+"DEFINE_SAT_BINOP(i8x16_add_saturate_u, u8x16, 16, +, 0, UINT8_MAX)\n"
+"DEFINE_SAT_BINOP(i8x16_sub_saturate_s, s8x16, 16, -, INT8_MIN, INT8_MAX)\n"
+"DEFINE_SAT_BINOP(i8x16_sub_saturate_u, u8x16, 16, -, 0, UINT8_MAX)\n"
+"DEFINE_SAT_BINOP(i16x8_add_saturate_s, s16x8, 8, +, INT16_MIN, INT16_MAX)\n"
+"DEFINE_SAT_BINOP(i16x8_add_saturate_u, u16x8, 8, +, 0, UINT16_MAX)\n"
+"DEFINE_SAT_BINOP(i16x8_sub_saturate_s, s16x8, 8, -, INT16_MIN, INT16_MAX)\n"
+"DEFINE_SAT_BINOP(i16x8_sub_saturate_u, u16x8, 8, -, 0, UINT16_MAX)\n"
+"\n"
+"#define DEFINE_AVGR(name, vt, n)                \\\n"
+"  static inline v128 name(v128 a, v128 b) {     \\\n"
+"    vt va = (vt)a, vb = (vt)b, result;          \\\n"
+"    for (int i = 0; i < n; ++i)                 \\\n"
+"      result[i] = ((u32)va[i] + vb[i] + 1) >> 1; \\\n"
+"    return (v128)result;                        \\\n"
+"  }\n"
+"\n"
+"DEFINE_AVGR(i8x16_avgr_u, u8x16, 16)\n"
+"DEFINE_AVGR(i16x8_avgr_u, u16x8, 8)\n"
+"\n"
+"static inline u32 v128_any_true(v128 a) {\n"
+"  u64x2 v = (u64x2)a;\n"
+"  return (v[0] | v[1]) != 0;\n"
+"}\n"
+"\n"
+"#define DEFINE_ANY_TRUE(name) \\\n"
+"  static inline u32 name(v128 a) { return v128_any_true(a); }\n"
+"\n"
+"#define DEFINE_ALL_TRUE(name, vt) \\\n"
+"  static inline u32 name(v128 a) { return !v128_any_true((v128)((vt)a == 0)); }\n"
+"\n"
+"DEFINE_ANY_TRUE(i8x16_any_true)\n"
+"DEFINE_ANY_TRUE(i16x8_any_true)\n"
+"DEFINE_ANY_TRUE(i32x4_any_true)\n"
+"DEFINE_ALL_TRUE(i8x16_all_true, u8x16)\n"
+"DEFINE_ALL_TRUE(i16x8_all_true, u16x8)\n"
+"DEFINE_ALL_TRUE(i32x4_all_true, u32x4)\n"
+"\n"
+"/* Float abs and neg only change the sign bit, as in wasm. */\n"
+"static inline v128 f32x4_abs(v128 a) {\n"
+"  return (v128)((u32x4)a & 0x7fffffffu);\n"
+"}\n"
+"\n"
+"static inline v128 f32x4_neg(v128 a) {\n"
+"  return (v128)((u32x4)a ^ 0x80000000u);\n"
+"}\n"
+"\n"
+"static inline v128 f64x2_abs(v128 a) {\n"
+"  return (v128)((u64x2)a & 0x7fffffffffffffffull);\n"
+"}\n"
+"\n"
+"static inline v128 f64x2_neg(v128 a) {\n"
+"  return (v128)((u64x2)a ^ 0x8000000000000000ull);\n"
+"}\n"
+"\n"
+"DEFINE_BINOP(f32x4_add, f32x4, +)\n"
+"DEFINE_BINOP(f32x4_sub, f32x4, -)\n"
+"DEFINE_BINOP(f32x4_mul, f32x4, *)\n"
+"DEFINE_BINOP(f32x4_div, f32x4, /)\n"
+"DEFINE_BINOP(f64x2_add, f64x2, +)\n"
+"DEFINE_BINOP(f64x2_sub, f64x2, -)\n"
+"DEFINE_BINOP(f64x2_mul, f64x2, *)\n"
+"DEFINE_BINOP(f64x2_div, f64x2, /)\n"
+"\n"
+"#define DEFINE_LANEWISE_UNOP(name, vt, n, op) \\\n"
+"  static inline v128 name(v128 a) {           \\\n"
+"    vt va = (vt)a, result;                    \\\n"
+"    for (int i = 0; i < n; ++i)               \\\n"
+"      result[i] = op(va[i]);                  \\\n"
+"    return (v128)result;                      \\\n"
+"  }\n"
+"\n"
+"#define DEFINE_LANEWISE_BINOP(name, vt, n, op) \\\n"
+"  static inline v128 name(v128 a, v128 b) {    \\\n"
+"    vt va = (vt)a, vb = (vt)b, result;         \\\n"
+"    for (int i = 0; i < n; ++i)                \\\n"
+"      result[i] = op(va[i], vb[i]);            \\\n"
+"    return (v128)result;                       \\\n"
+"  }\n"
+"\n"
+"DEFINE_LANEWISE_UNOP(f32x4_sqrt, f32x4, 4, sqrtf)\n"
+"DEFINE_LANEWISE_UNOP(f64x2_sqrt, f64x2, 2, sqrt)\n"
+"DEFINE_LANEWISE_BINOP(f32x4_min, f32x4, 4, FMIN)\n"
+"DEFINE_LANEWISE_BINOP(f32x4_max, f32x4, 4, FMAX)\n"
+"DEFINE_LANEWISE_BINOP(f64x2_min, f64x2, 2, FMIN)\n"
+"DEFINE_LANEWISE_BINOP(f64x2_max, f64x2, 2, FMAX)\n"
+"\n"
+"#define TRUNC_SAT_S_F32(x)                               \\\n"
+"   ((x) != (x) ? 0                                       \\\n"
+"  : (x) < -2147483648.f ? INT32_MIN                      \\\n"
+"  : (x) >= 2147483648.f ? INT32_MAX : (s32)(x))\n"
+"#define TRUNC_SAT_U_F32(x) \\\n"
+"  ((x) != (x) || (x) <= -1.f ? 0 : (x) >= 4294967296.f ? UINT32_MAX : (u32)(x))\n"
+"\n"
+"static inline v128 i32x4_trunc_sat_f32x4_s(v128 a) {\n"
+"  f32x4 va = (f32x4)a;\n"
+"  s32x4 result;\n"
+"  for (int i = 0; i < 4; ++i)\n"
+"    result[i] = TRUNC_SAT_S_F32(va[i]);\n"
+"  return (v128)result;\n"
+"}\n"
+"\n"
+"static inline v128 i32x4_trunc_sat_f32x4_u(v128 a) {\n"
+"  f32x4 va = (f32x4)a;\n"
+"  u32x4 result;\n"
+"  for (int i = 0; i < 4; ++i)\n"
+"    result[i] = TRUNC_SAT_U_F32(va[i]);\n"
+"  return (v128)result;\n"
+"}\n"
+"\n"
+"static inline v128 f32x4_convert_i32x4_s(v128 a) {\n"
+"  return (v128)__builtin_convertvector((s32x4)a, f32x4);\n"
+"}\n"
+"\n"
+"static inline v128 f32x4_convert_i32x4_u(v128 a) {\n"
+"  return (v128)__builtin_convertvector((u32x4)a, f32x4);\n"
+"}\n"
+"\n"
+"#define DEFINE_NARROW(name, vt, rt, n, min, max) \\\n"
+"  static inline v128 name(v128 a, v128 b) {      \\\n"
+"    vt va = (vt)a, vb = (vt)b;                   \\\n"
+"    rt result;                                   \\\n"
+"    for (int i = 0; i < n; ++i) {                \\\n"
+"      result[i] = SATURATE(va[i], min, max);     \\\n"
+"      result[i + n] = SATURATE(vb[i], min, max); \\\n"
+"    }                                            \\\n"
+"    return (v128)result;                         \\\n"
+"  }\n"
+"\n"
+"DEFINE_NARROW(i8x16_narrow_i16x8_s, s16x8, s8x16, 8, INT8_MIN, INT8_MAX)\n"
+"DEFINE_NARROW(i8x16_narrow_i16x8_u, s16x8, u8x16, 8, 0, UINT8_MAX)\n"
+"DEFINE_NARROW(i16x8_narrow_i32x4_s, s32x4, s16x8, 4, INT16_MIN, INT16_MAX)\n"
+"DEFINE_NARROW(i16x8_narrow_i32x4_u, s32x4, u16x8, 4, 0, UINT16_MAX)\n"
+"\n"
+"#define DEFINE_WIDEN(name, vt, rt, n, first) \\\n"
+"  static inline v128 name(v128 a) {          \\\n"
+"    vt va = (vt)a;                           \\\n"
+"    rt result;                               \\\n"
+"    for (int i = 0; i < n; ++i)              \\\n"
+"      result[i] = va[i + first];             \\\n"
+"    return (v128)result;                     \\\n"
+"  }\n"
+"\n"
+"DEFINE_WIDEN(i16x8_widen_low_i8x16_s, s8x16, s16x8, 8, 0)\n"
+"DEFINE_WIDEN(i16x8_widen_high_i8x16_s, s8x16, s16x8, 8, 8)\n"
+"DEFINE_WIDEN(i16x8_widen_low_i8x16_u, u8x16, u16x8, 8, 0)\n"
+"DEFINE_WIDEN(i16x8_widen_high_i8x16_u, u8x16, u16x8, 8, 8)\n"
+"DEFINE_WIDEN(i32x4_widen_low_i16x8_s, s16x8, s32x4, 4, 0)\n"
+"DEFINE_WIDEN(i32x4_widen_high_i16x8_s, s16x8, s32x4, 4, 4)\n"
+"DEFINE_WIDEN(i32x4_widen_low_i16x8_u, u16x8, u32x4, 4, 0)\n"
+"DEFINE_WIDEN(i32x4_widen_high_i16x8_u, u16x8, u32x4, 4, 4)\n"
+;
+
+const char SECTION_NAME(atomic_declarations)[] =
+"\n"
+"#define ATOMIC_ALIGNMENT_CHECK(addr, t) \\\n"
+"  if (UNLIKELY((addr) & (sizeof(t) - 1))) TRAP(UNALIGNED)\n"
+"\n"
+"#define DEFINE_ATOMIC_LOAD(name, t1, t2)                              \\\n"
+"  static inline t2 name(wasm_rt_memory_t* mem, u64 addr) {            \\\n"
+"    MEMCHECK(mem, addr, t1);                                          \\\n"
+"    ATOMIC_ALIGNMENT_CHECK(addr, t1);                                 \\\n"
+"    return (t2)__atomic_load_n((t1*)&mem->data[addr], __ATOMIC_SEQ_CST); \\\n"
+"  }\n"
+"\n"
+"#define DEFINE_ATOMIC_STORE(name, t1, t2)                                \\\n"
+"  static inline void name(wasm_rt_memory_t* mem, u64 addr, t2 value) {  \\\n"
+"    MEMCHECK(mem, addr, t1);                                            \\\n"
+"    ATOMIC_ALIGNMENT_CHECK(addr, t1);                                   \\\n"
+"    __atomic_store_n((t1*)&mem->data[addr], (t1)value, __ATOMIC_SEQ_CST); \\\n"
+"  }\n"
+"\n"
+"DEFINE_ATOMIC_LOAD(i32_atomic_load, u32, u32);\n"
+"DEFINE_ATOMIC_LOAD(i64_atomic_load, u64, u64);\n"
+"DEFINE_ATOMIC_LOAD(i32_atomic_load8_u, u8, u32);\n"
+"DEFINE_ATOMIC_LOAD(i64_atomic_load8_u, u8, u64);\n"
+"DEFINE_ATOMIC_LOAD(i32_atomic_load16_u, u16, u32);\n"
+"DEFINE_ATOMIC_LOAD(i64_atomic_load16_u, u16, u64);\n"
+"DEFINE_ATOMIC_LOAD(i64_atomic_load32_u, u32, u64);\n"
+"DEFINE_ATOMIC_STORE(i32_atomic_store, u32, u32);\n"
+"DEFINE_ATOMIC_STORE(i64_atomic_store, u64, u64);\n"
+"DEFINE_ATOMIC_STORE(i32_atomic_store8, u8, u32);\n"
+"DEFINE_ATOMIC_STORE(i32_atomic_store16, u16, u32);\n"
+"DEFINE_ATOMIC_STORE(i64_atomic_store8, u8, u64);\n"
+"DEFINE_ATOMIC_STORE(i64_atomic_store16, u16, u64);\n"
+"DEFINE_ATOMIC_STORE(i64_atomic_store32, u32, u64);\n"
+"\n"
+"#define DEFINE_ATOMIC_RMW(name, op, t1, t2)                            \\\n"
+"  static inline t2 name(wasm_rt_memory_t* mem, u64 addr, t2 value) {  \\\n"
+"    MEMCHECK(mem, addr, t1);                                          \\\n"
+"    ATOMIC_ALIGNMENT_CHECK(addr, t1);                                 \\\n"
+"    return (t2)op((t1*)&mem->data[addr], (t1)value, __ATOMIC_SEQ_CST); \\\n"
+"  }\n"
+"\n"
+"#define DEFINE_ATOMIC_RMW_ALL(op, builtin)                              \\\n"
+"  DEFINE_ATOMIC_RMW(i32_atomic_rmw_##op, builtin, u32, u32)             \\\n"
+"  DEFINE_ATOMIC_RMW(i64_atomic_rmw_##op, builtin, u64, u64)             \\\n"
+"  DEFINE_ATOMIC_RMW(i32_atomic_rmw8_##op##_u, builtin, u8, u32)         \\\n"
+"  DEFINE_ATOMIC_RMW(i32_atomic_rmw16_##op##_u, builtin, u16, u32)       \\\n"
+"  DEFINE_ATOMIC_RMW(i64_atomic_rmw8_##op##_u, builtin, u8, u64)         \\\n"
+"  DEFINE_ATOMIC_RMW(i64_atomic_rmw16_##op##_u, builtin, u16, u64)       \\\n"
+"  DEFINE_ATOMIC_RMW(i64_atomic_rmw32_##op##_u, builtin, u32, u64)\n"
+"\n"
+"DEFINE_ATOMIC_RMW_ALL(add, __atomic_fetch_add)\n"
+"DEFINE_ATOMIC_RMW_ALL(sub, __atomic_fetch_sub)\n"
+"DEFINE_ATOMIC_RMW_ALL(and, __atomic_fetch_and)\n"
+"DEFINE_ATOMIC_RMW_ALL(or, __atomic_fetch_or)\n"
+"DEFINE_ATOMIC_RMW_ALL(xor, __atomic_fetch_xor)\n"
+"DEFINE_ATOMIC_RMW_ALL(xchg, __atomic_exchange_n)\n"
+"\n"
+"#define DEFINE_ATOMIC_CMPXCHG(name, t1, t2)                              \\\n"
+"  static inline t2 name(wasm_rt_memory_t* mem, u64 addr, t2 expected,  \\\n"
+"                        t2 replacement) {                               \\\n"
+"    MEMCHECK(mem, addr, t1);                                            \\\n"
+"    ATOMIC_ALIGNMENT_CHECK(addr, t1);                                   \\\n"
+"    t1 result = (t1)expected;                                           \\\n"
+"    __atomic_compare_exchange_n((t1*)&mem->data[addr], &result,         \\\n"
+"                                (t1)replacement, 0, __ATOMIC_SEQ_CST,   \\\n"
+"                                __ATOMIC_SEQ_CST);                      \\\n"
+"    return (t2)result;                                                  \\\n"
+"  }\n"
+"\n"
+"DEFINE_ATOMIC_CMPXCHG(i32_atomic_rmw_cmpxchg, u32, u32);\n"
+"DEFINE_ATOMIC_CMPXCHG(i64_atomic_rmw_cmpxchg, u64, u64);\n"
+"DEFINE_ATOMIC_CMPXCHG(i32_atomic_rmw8_cmpxchg_u, u8, u32);\n"
+"DEFINE_ATOMIC_CMPXCHG(i32_atomic_rmw16_cmpxchg_u, u16, u32);\n"
+"DEFINE_ATOMIC_CMPXCHG(i64_atomic_rmw8_cmpxchg_u, u8, u64);\n"
+"DEFINE_ATOMIC_CMPXCHG(i64_atomic_rmw16_cmpxchg_u, u16, u64);\n"
+"DEFINE_ATOMIC_CMPXCHG(i64_atomic_rmw32_cmpxchg_u, u32, u64);\n"
+"\n"
+"#define DEFINE_ATOMIC_WAIT(name, t, wait)                                 \\\n"
+"  static inline u32 name(wasm_rt_memory_t* mem, u64 addr, t expected,    \\\n"
+"                         u64 timeout) {                                  \\\n"
+"    MEMCHECK(mem, addr, t);                                              \\\n"
+"    ATOMIC_ALIGNMENT_CHECK(addr, t);                                     \\\n"
+"    return wait(mem, addr, expected, (s64)timeout);                      \\\n"
+"  }\n"
+"\n"
+"DEFINE_ATOMIC_WAIT(i32_atomic_wait, u32, wasm_rt_atomic_wait32)\n"
+"DEFINE_ATOMIC_WAIT(i64_atomic_wait, u64, wasm_rt_atomic_wait64)\n"
+"\n"
+"static inline u32 atomic_notify(wasm_rt_memory_t* mem, u64 addr, u32 count) {\n"
+"  MEMCHECK(mem, addr, u32);\n"
+"  ATOMIC_ALIGNMENT_CHECK(addr, u32);\n"
+"  return wasm_rt_atomic_notify(mem, addr, count);\n"
+"}\n"
+;
+
+const char SECTION_NAME(bulk_memory_declarations)[] =
+"\n"
+"#define RANGE_CHECK(start, count, size) \\\n"
+"  if (UNLIKELY((u64)(start) + (count) > (size))) TRAP(OOB)\n"
+"\n"
+"static inline void memory_fill(wasm_rt_memory_t* mem, u32 d, u32 val, u32 n) {\n"
+"  RANGE_CHECK(d, n, MEMORY_SIZE(mem));\n"
+"  memset(mem->data + d, val, n);\n"
+"}\n"
+"\n"
+"static inline void memory_copy(wasm_rt_memory_t* mem, u32 d, u32 s, u32 n) {\n"
+"  RANGE_CHECK(d, n, MEMORY_SIZE(mem));\n"
+"  RANGE_CHECK(s, n, MEMORY_SIZE(mem));\n"
+"  memmove(mem->data + d, mem->data + s, n);\n"
+"}\n"
+"\n"
+"/* The source of `memory_init` and `table_init` is null for segments that\n"
+" * aren't passive, since those are dropped when the module is instantiated. */\n"
+"static inline void memory_init(wasm_rt_memory_t* mem, const u8* src,\n"
+"                               u32 src_size, u32 d, u32 s, u32 n) {\n"
+"  RANGE_CHECK(d, n, MEMORY_SIZE(mem));\n"
+"  RANGE_CHECK(s, n, src_size);\n"
+"  if (n > 0)\n"
+"    memcpy(mem->data + d, src + s, n);\n"
+"}\n"
+"\n"
+"static inline wasm_rt_elem_t table_get(wasm_rt_table_t* table, u32 i) {\n"
+"  RANGE_CHECK(i, 1, table->size);\n"
+"  return table->data[i];\n"
+"}\n"
+"\n"
+"static inline void table_set(wasm_rt_table_t* table, u32 i,\n"
+"                             wasm_rt_elem_t value) {\n"
+"  RANGE_CHECK(i, 1, table->size);\n"
+"  table->data[i] = value;\n"
+"}\n"
+"\n"
+"static inline void table_fill(wasm_rt_table_t* table, u32 d,\n"
+"                              wasm_rt_elem_t value, u32 n) {\n"
+"  RANGE_CHECK(d, n, table->size);\n"
+"  for (u32 i = 0; i < n; ++i)\n"
+"    table->data[d + i] = value;\n"
+"}\n"
+"\n"
+"static inline void table_copy(wasm_rt_table_t* dst, wasm_rt_table_t* src,\n"
+"                              u32 d, u32 s, u32 n) {\n"
+"  RANGE_CHECK(d, n, dst->size);\n"
+"  RANGE_CHECK(s, n, src->size);\n"
+"  if (n > 0)\n"
+"    memmove(dst->data + d, src->data + s, n * sizeof(wasm_rt_elem_t));\n"
+"}\n"
+"\n"
+"static inline void table_init(wasm_rt_table_t* table,\n"
+"                              const wasm_rt_elem_t* src, u32 src_size, u32 d,\n"
+"                              u32 s, u32 n) {\n"
+"  RANGE_CHECK(d, n, table->size);\n"
+"  RANGE_CHECK(s, n, src_size);\n"
+"  if (n > 0)\n"
+"    memcpy(table->data + d, src + s, n * sizeof(wasm_rt_elem_t));\n"
+"}\n"
+;
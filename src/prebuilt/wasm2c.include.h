@@ -27,8 +27,9 @@ const char SECTION_NAME(top)[] =
 "typedef int64_t s64;\n"
 "typedef float f32;\n"
 "typedef double f64;\n"
-"\n"
-"extern void WASM_RT_ADD_PREFIX(init)(void);\n"
+"#if defined(__GNUC__) || defined(__clang__)\n"
+"typedef wasm_rt_v128_t v128;\n"
+"#endif\n"
 ;
 
 const char SECTION_NAME(bottom)[] =
@@ -20,11 +20,13 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "src/binary-reader.h"
 #include "src/cast.h"
 #include "src/interp/binary-reader-interp.h"
+#include "src/interp/interp-profiler.h"
 #include "src/interp/interp.h"
 #include "src/make-unique.h"
 
@@ -282,3 +284,979 @@ TEST_F(HostMemoryTest, Rot13) {
 
   ASSERT_EQ("Hello, WebAssembly!", string_data);
 }
+
+namespace {
+
+class SnapshotTest : public ::testing::Test {
+ protected:
+  virtual void TearDown() {
+    executor_.reset();
+    env_.reset();
+  }
+
+  Result LoadModule(interp::MemoryBackend backend,
+                    const std::vector<uint8_t>& data) {
+    env_ = MakeUnique<interp::Environment>(s_features);
+    env_->memory_backend_ = backend;
+    executor_ = MakeUnique<interp::Executor>(env_.get());
+
+    Errors errors;
+    ReadBinaryOptions options;
+    Result result = ReadBinaryInterp(env_.get(), data.data(), data.size(),
+                                     options, &errors, &module_);
+    if (Succeeded(result)) {
+      result =
+          executor_->Initialize(module_).ok() ? Result::Ok : Result::Error;
+    }
+    return result;
+  }
+
+  uint32_t Bump() {
+    interp::ExecResult exec_result =
+        executor_->RunExportByName(module_, "bump", {});
+    EXPECT_TRUE(exec_result.ok());
+    return exec_result.ok() ? exec_result.values[0].get_i32() : 0;
+  }
+
+  std::string MemoryPrefix() {
+    interp::Memory* memory = env_->GetMemory(0);
+    return std::string(memory->data.data(), 4);
+  }
+
+  void TestRestore(interp::MemoryBackend backend);
+
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+void SnapshotTest::TestRestore(interp::MemoryBackend backend) {
+  // (memory (export "mem") 1)
+  // (data (i32.const 0) "abc")
+  // (global $g (mut i32) (i32.const 10))
+  // (func $start
+  //   (global.set $g (i32.add (global.get $g) (i32.const 1)))
+  //   (i32.store8 (i32.const 3) (i32.const 100)))
+  // (func (export "bump") (result i32)
+  //   (i32.store8 (i32.const 0) (i32.const 88))
+  //   (drop (memory.grow (i32.const 1)))
+  //   (global.set $g (i32.add (global.get $g) (i32.const 1)))
+  //   (global.get $g))
+  // (start $start)
+  std::vector<uint8_t> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x02, 0x60,
+      0x00, 0x00, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x01, 0x05,
+      0x03, 0x01, 0x00, 0x01, 0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x0a, 0x0b,
+      0x07, 0x0e, 0x02, 0x03, 0x6d, 0x65, 0x6d, 0x02, 0x00, 0x04, 0x62, 0x75,
+      0x6d, 0x70, 0x00, 0x01, 0x08, 0x01, 0x00, 0x0a, 0x2c, 0x02, 0x11, 0x00,
+      0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x03, 0x41, 0xe4, 0x00,
+      0x3a, 0x00, 0x00, 0x0b, 0x18, 0x00, 0x41, 0x00, 0x41, 0xd8, 0x00, 0x3a,
+      0x00, 0x00, 0x41, 0x01, 0x40, 0x00, 0x1a, 0x23, 0x00, 0x41, 0x01, 0x6a,
+      0x24, 0x00, 0x23, 0x00, 0x0b, 0x0b, 0x09, 0x01, 0x00, 0x41, 0x00, 0x0b,
+      0x03, 0x61, 0x62, 0x63,
+  };
+
+  ASSERT_EQ(Result::Ok, LoadModule(backend, data));
+  ASSERT_EQ("abcd", MemoryPrefix());
+
+  interp::Environment::Snapshot snapshot = env_->TakeSnapshot();
+
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(12u, Bump());
+    ASSERT_EQ(13u, Bump());
+    ASSERT_EQ("Xbcd", MemoryPrefix());
+    ASSERT_EQ(3u, env_->GetMemory(0)->page_limits.initial);
+    ASSERT_EQ(3u * WABT_PAGE_SIZE, env_->GetMemory(0)->data.size());
+
+    env_->RestoreSnapshot(snapshot);
+    ASSERT_EQ("abcd", MemoryPrefix());
+    ASSERT_EQ(1u, env_->GetMemory(0)->page_limits.initial);
+    ASSERT_EQ(WABT_PAGE_SIZE, env_->GetMemory(0)->data.size());
+  }
+}
+
+}  // end of anonymous namespace
+
+TEST_F(SnapshotTest, Heap) {
+  TestRestore(interp::MemoryBackend::Heap);
+}
+
+TEST_F(SnapshotTest, GuardPages) {
+  if (interp::IsGuardPageMemorySupported()) {
+    TestRestore(interp::MemoryBackend::GuardPages);
+  }
+}
+
+namespace {
+
+class SharedMemoryTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // (memory (export "mem") 1 1 shared)
+    // (func (export "add") (param i32)
+    //   (loop $l
+    //     (drop (i32.atomic.rmw.add (i32.const 0) (i32.const 1)))
+    //     (br_if $l (local.tee 0 (i32.sub (local.get 0) (i32.const 1))))))
+    // (func (export "wait") (result i32)
+    //   (i32.atomic.wait (i32.const 4) (i32.const 0) (i64.const -1)))
+    // (func (export "notify") (result i32)
+    //   (atomic.notify (i32.const 4) (i32.const 1)))
+    std::vector<uint8_t> data = {
+        0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02,
+        0x60, 0x01, 0x7f, 0x00, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x04, 0x03,
+        0x00, 0x01, 0x01, 0x05, 0x04, 0x01, 0x03, 0x01, 0x01, 0x07, 0x1d,
+        0x04, 0x03, 0x6d, 0x65, 0x6d, 0x02, 0x00, 0x03, 0x61, 0x64, 0x64,
+        0x00, 0x00, 0x04, 0x77, 0x61, 0x69, 0x74, 0x00, 0x01, 0x06, 0x6e,
+        0x6f, 0x74, 0x69, 0x66, 0x79, 0x00, 0x02, 0x0a, 0x31, 0x03, 0x17,
+        0x00, 0x03, 0x40, 0x41, 0x00, 0x41, 0x01, 0xfe, 0x1e, 0x02, 0x00,
+        0x1a, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d, 0x00, 0x0b,
+        0x0b, 0x0c, 0x00, 0x41, 0x04, 0x41, 0x00, 0x42, 0x7f, 0xfe, 0x01,
+        0x02, 0x00, 0x0b, 0x0a, 0x00, 0x41, 0x04, 0x41, 0x01, 0xfe, 0x00,
+        0x02, 0x00, 0x0b,
+    };
+
+    Features features;
+    features.enable_threads();
+    env_ = MakeUnique<interp::Environment>(features);
+
+    Errors errors;
+    ReadBinaryOptions options;
+    options.features = features;
+    ASSERT_EQ(Result::Ok,
+              ReadBinaryInterp(env_.get(), data.data(), data.size(), options,
+                               &errors, &module_));
+  }
+
+  virtual void TearDown() { env_.reset(); }
+
+  // Each call runs on its own Executor, so it can be used from any thread.
+  interp::ExecResult Run(string_view name, const interp::TypedValues& args) {
+    interp::Executor executor(env_.get());
+    return executor.RunExportByName(module_, name, args);
+  }
+
+  std::unique_ptr<interp::Environment> env_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+}  // end of anonymous namespace
+
+TEST_F(SharedMemoryTest, AtomicRmw) {
+  const int kNumThreads = 4;
+  const uint32_t kNumAdds = 100000;
+
+  interp::TypedValues args;
+  args.emplace_back(Type::I32);
+  args.back().set_i32(kNumAdds);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&]() { EXPECT_TRUE(Run("add", args).ok()); });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  uint32_t counter;
+  memcpy(&counter, env_->GetMemory(0)->data.data(), sizeof(counter));
+  ASSERT_EQ(kNumThreads * kNumAdds, counter);
+}
+
+TEST_F(SharedMemoryTest, WaitNotify) {
+  interp::ExecResult wait_result;
+  std::thread waiter([&]() { wait_result = Run("wait", {}); });
+
+  // The waiter may not be waiting yet, so keep notifying until it is woken.
+  uint32_t woken = 0;
+  while (woken == 0) {
+    interp::ExecResult notify_result = Run("notify", {});
+    ASSERT_TRUE(notify_result.ok());
+    woken = notify_result.values[0].get_i32();
+    std::this_thread::yield();
+  }
+  waiter.join();
+
+  ASSERT_EQ(1u, woken);
+  ASSERT_TRUE(wait_result.ok());
+  ASSERT_EQ(0u, wait_result.values[0].get_i32());
+}
+
+namespace {
+
+class LazyCompileTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    env_ = MakeUnique<interp::Environment>(s_features);
+    env_->lowering_options_.lazy_compilation = true;
+    executor_ = MakeUnique<interp::Executor>(env_.get());
+  }
+
+  virtual void TearDown() {
+    executor_.reset();
+    env_.reset();
+  }
+
+  void LoadModule(const std::vector<uint8_t>& data) {
+    Errors errors;
+    ReadBinaryOptions options;
+    ASSERT_EQ(Result::Ok,
+              ReadBinaryInterp(env_.get(), data.data(), data.size(), options,
+                               &errors, &module_));
+  }
+
+  interp::DefinedFunc* GetExportedFunc(string_view name) {
+    interp::Export* export_ = module_->GetExport(name);
+    return cast<interp::DefinedFunc>(env_->GetFunc(export_->index));
+  }
+
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+}  // end of anonymous namespace
+
+TEST_F(LazyCompileTest, CompileOnFirstCall) {
+  // (func (export "f") (result i32) i32.const 42)
+  std::vector<uint8_t> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+      0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01,
+      0x01, 0x66, 0x00, 0x00, 0x0a, 0x06, 0x01, 0x04, 0x00, 0x41, 0x2a,
+      0x0b,
+  };
+  LoadModule(data);
+  interp::DefinedFunc* func = GetExportedFunc("f");
+  ASSERT_FALSE(func->is_compiled());
+
+  // Resetting to a mark from before the function was compiled throws away its
+  // lowered body, so it is compiled again by the next call.
+  interp::Environment::MarkPoint mark = env_->Mark();
+  for (int i = 0; i < 2; ++i) {
+    interp::ExecResult result = executor_->RunExportByName(module_, "f", {});
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(42u, result.values[0].get_i32());
+    ASSERT_TRUE(func->is_compiled());
+    env_->ResetToMarkPoint(mark);
+    ASSERT_FALSE(func->is_compiled());
+  }
+}
+
+TEST_F(LazyCompileTest, InvalidBody) {
+  // (func (export "f") (result i32) i64.const 0)
+  std::vector<uint8_t> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+      0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01,
+      0x01, 0x66, 0x00, 0x00, 0x0a, 0x06, 0x01, 0x04, 0x00, 0x42, 0x00,
+      0x0b,
+  };
+  LoadModule(data);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(interp::ResultType::TrapInvalidFunctionBody,
+              executor_->RunExportByName(module_, "f", {}).result.type);
+    ASSERT_FALSE(GetExportedFunc("f")->is_compiled());
+  }
+}
+
+TEST_F(LazyCompileTest, ManyExecutors) {
+  // (func (export "f") (result i32) i32.const 42)
+  std::vector<uint8_t> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+      0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01,
+      0x01, 0x66, 0x00, 0x00, 0x0a, 0x06, 0x01, 0x04, 0x00, 0x41, 0x2a,
+      0x0b,
+  };
+  LoadModule(data);
+  {
+    // Compiling would append to the istream that the other Executor reads.
+    interp::Executor other(env_.get());
+    ASSERT_EQ(interp::ResultType::TrapLazyCompileWithManyExecutors,
+              executor_->RunExportByName(module_, "f", {}).result.type);
+    ASSERT_FALSE(GetExportedFunc("f")->is_compiled());
+  }
+  interp::ExecResult result = executor_->RunExportByName(module_, "f", {});
+  ASSERT_TRUE(result.ok());
+  ASSERT_EQ(42u, result.values[0].get_i32());
+}
+
+namespace {
+
+class JitTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    env_ = MakeUnique<interp::Environment>(s_features);
+    env_->lowering_options_.jit = true;
+    interp::Thread::Options options;
+    options.jit_threshold = 2;
+    executor_ = MakeUnique<interp::Executor>(env_.get(), nullptr, options);
+  }
+
+  virtual void TearDown() {
+    executor_.reset();
+    env_.reset();
+  }
+
+  void LoadModule(const std::vector<uint8_t>& data) {
+    Errors errors;
+    ReadBinaryOptions options;
+    ASSERT_EQ(Result::Ok,
+              ReadBinaryInterp(env_.get(), data.data(), data.size(), options,
+                               &errors, &module_));
+  }
+
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+// (func (export "f") (param i32) (result i32)
+//   local.get 0 i32.const 1 i32.add)
+const std::vector<uint8_t> s_add_one_module = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+    0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05,
+    0x01, 0x01, 0x66, 0x00, 0x00, 0x0a, 0x09, 0x01, 0x07, 0x00, 0x20,
+    0x00, 0x41, 0x01, 0x6a, 0x0b,
+};
+
+}  // end of anonymous namespace
+
+TEST_F(JitTest, CompileAtThreshold) {
+  if (!interp::IsJitSupported()) {
+    return;
+  }
+
+  LoadModule(s_add_one_module);
+  interp::Export* export_ = module_->GetExport("f");
+  auto* func = cast<interp::DefinedFunc>(env_->GetFunc(export_->index));
+
+  // The first call is interpreted, the second compiles the function and runs
+  // the machine code, as do the calls after it.
+  for (uint32_t i = 0; i < 3; ++i) {
+    interp::TypedValues args;
+    args.emplace_back(Type::I32);
+    args.back().set_i32(i);
+    interp::ExecResult result = executor_->RunExportByName(module_, "f", args);
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(i + 1, result.values[0].get_i32());
+    ASSERT_EQ(i >= 1, func->jit_code != nullptr);
+  }
+}
+
+TEST_F(JitTest, ManyThreads) {
+  if (!interp::IsJitSupported()) {
+    return;
+  }
+
+  // Each thread has its own Executor; whichever call makes the function hot
+  // compiles it, and the others run the published machine code.
+  const int kNumThreads = 4;
+  const uint32_t kNumCalls = 1000;
+  LoadModule(s_add_one_module);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&]() {
+      interp::Thread::Options options;
+      options.jit_threshold = 2;
+      interp::Executor executor(env_.get(), nullptr, options);
+      for (uint32_t j = 0; j < kNumCalls; ++j) {
+        interp::TypedValues args;
+        args.emplace_back(Type::I32);
+        args.back().set_i32(j);
+        interp::ExecResult result =
+            executor.RunExportByName(module_, "f", args);
+        EXPECT_TRUE(result.ok());
+        EXPECT_EQ(j + 1, result.values[0].get_i32());
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  interp::Export* export_ = module_->GetExport("f");
+  auto* func = cast<interp::DefinedFunc>(env_->GetFunc(export_->index));
+  EXPECT_NE(nullptr, func->jit_code.load());
+}
+
+namespace {
+
+class FuelTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    features_.enable_bulk_memory();
+    env_ = MakeUnique<interp::Environment>(features_);
+    env_->lowering_options_.fuel = true;
+    executor_ = MakeUnique<interp::Executor>(env_.get());
+  }
+
+  virtual void TearDown() {
+    executor_.reset();
+    env_.reset();
+  }
+
+  void LoadModule() {
+    // (memory 1)
+    // (func (export "count") (result i32)
+    //   (local i32)
+    //   (loop $l
+    //     (local.set 0 (i32.add (local.get 0) (i32.const 1)))
+    //     (br_if $l (i32.lt_u (local.get 0) (i32.const 10))))
+    //   (local.get 0))
+    // (func (export "copy")
+    //   (memory.copy (i32.const 0) (i32.const 100) (i32.const 100)))
+    std::vector<uint8_t> data = {
+        0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x02,
+        0x60, 0x00, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x03, 0x03, 0x02, 0x00,
+        0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x10, 0x02, 0x05, 0x63,
+        0x6f, 0x75, 0x6e, 0x74, 0x00, 0x00, 0x04, 0x63, 0x6f, 0x70, 0x79,
+        0x00, 0x01, 0x0a, 0x28, 0x02, 0x17, 0x01, 0x01, 0x7f, 0x03, 0x40,
+        0x20, 0x00, 0x41, 0x01, 0x6a, 0x21, 0x00, 0x20, 0x00, 0x41, 0x0a,
+        0x49, 0x0d, 0x00, 0x0b, 0x20, 0x00, 0x0b, 0x0e, 0x00, 0x41, 0x00,
+        0x41, 0xe4, 0x00, 0x41, 0xe4, 0x00, 0xfc, 0x0a, 0x00, 0x00, 0x0b,
+    };
+    Errors errors;
+    ReadBinaryOptions options;
+    options.features = features_;
+    ASSERT_EQ(Result::Ok,
+              ReadBinaryInterp(env_.get(), data.data(), data.size(), options,
+                               &errors, &module_));
+  }
+
+  interp::ExecResult Run(string_view name, uint64_t fuel) {
+    executor_->thread()->set_fuel(fuel);
+    return executor_->RunExportByName(module_, name, {});
+  }
+
+  uint64_t fuel() { return executor_->thread()->fuel(); }
+
+  Features features_;
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+}  // end of anonymous namespace
+
+TEST_F(FuelTest, ChargePerBlock) {
+  LoadModule();
+  // The loop instruction, then 9 instructions in each of 10 iterations, then
+  // local.get and end.
+  ASSERT_TRUE(Run("count", 1000).ok());
+  ASSERT_EQ(1000u - 93, fuel());
+
+  ASSERT_EQ(interp::ResultType::TrapOutOfFuel,
+            Run("count", 50).result.type);
+}
+
+TEST_F(FuelTest, CostTable) {
+  env_->lowering_options_.fuel_costs.SetCost(Opcode::I32Add, 10);
+  LoadModule();
+  ASSERT_TRUE(Run("count", 1000).ok());
+  ASSERT_EQ(1000u - 93 - 10 * 9, fuel());
+}
+
+TEST_F(FuelTest, CostPerUnit) {
+  env_->lowering_options_.fuel_costs.SetCostPerUnit(Opcode::MemoryCopy, 2);
+  LoadModule();
+  // Three i32.consts, memory.copy and end, then 2 for each byte copied.
+  ASSERT_TRUE(Run("copy", 1000).ok());
+  ASSERT_EQ(1000u - 5 - 200, fuel());
+
+  // Running out leaves the fuel that the copy would have needed.
+  ASSERT_EQ(interp::ResultType::TrapOutOfFuel,
+            Run("copy", 100).result.type);
+  ASSERT_EQ(100u - 5, fuel());
+}
+
+namespace {
+
+class ProfilerTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    env_ = MakeUnique<interp::Environment>(Features());
+  }
+
+  virtual void TearDown() {
+    executor_.reset();
+    profiler_.reset();
+    env_.reset();
+  }
+
+  void LoadModule(uint32_t sample_interval) {
+    // (func $fib (param i32) (result i32)
+    //   (if (result i32) (i32.lt_u (local.get 0) (i32.const 2))
+    //     (then (local.get 0))
+    //     (else
+    //       (i32.add
+    //         (call $fib (i32.sub (local.get 0) (i32.const 1)))
+    //         (call $fib (i32.sub (local.get 0) (i32.const 2)))))))
+    // (func (export "main") (result i32)
+    //   (call $fib (i32.const 10)))
+    std::vector<uint8_t> data = {
+        0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02,
+        0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x03,
+        0x02, 0x00, 0x01, 0x07, 0x08, 0x01, 0x04, 0x6d, 0x61, 0x69, 0x6e,
+        0x00, 0x01, 0x0a, 0x25, 0x02, 0x1c, 0x00, 0x20, 0x00, 0x41, 0x02,
+        0x49, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b,
+        0x10, 0x00, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10, 0x00, 0x6a, 0x0b,
+        0x0b, 0x06, 0x00, 0x41, 0x0a, 0x10, 0x00, 0x0b,
+    };
+    Errors errors;
+    ASSERT_EQ(Result::Ok, ReadBinaryInterp(env_.get(), data.data(),
+                                           data.size(), ReadBinaryOptions(),
+                                           &errors, &module_));
+    profiler_ = MakeUnique<interp::Profiler>(env_.get(), sample_interval);
+    interp::Thread::Options options;
+    options.profiler = profiler_.get();
+    executor_ = MakeUnique<interp::Executor>(env_.get(), nullptr, options);
+  }
+
+  interp::ExecResult Run() {
+    return executor_->RunExportByName(module_, "main", {});
+  }
+
+  const Index kFib = 0;
+  const Index kMain = 1;
+  // fib(10) runs fib 177 times, and 2035 instructions in all.
+  const uint64_t kFibCalls = 177;
+  const uint64_t kInstructions = 2035;
+
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Profiler> profiler_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+};
+
+}  // end of anonymous namespace
+
+TEST_F(ProfilerTest, CallsAndEdges) {
+  LoadModule(1);
+  ASSERT_TRUE(Run().ok());
+  EXPECT_EQ(1u, profiler_->GetFuncProfile(kMain).calls);
+  EXPECT_EQ(kFibCalls, profiler_->GetFuncProfile(kFib).calls);
+  EXPECT_EQ(1u, profiler_->GetCallCount(kInvalidIndex, kMain));
+  EXPECT_EQ(1u, profiler_->GetCallCount(kMain, kFib));
+  EXPECT_EQ(kFibCalls - 1, profiler_->GetCallCount(kFib, kFib));
+  EXPECT_EQ(0u, profiler_->GetCallCount(kFib, kMain));
+}
+
+TEST_F(ProfilerTest, ExactInstructions) {
+  LoadModule(1);
+  ASSERT_TRUE(Run().ok());
+  auto main = profiler_->GetFuncProfile(kMain);
+  auto fib = profiler_->GetFuncProfile(kFib);
+  EXPECT_EQ(kInstructions, profiler_->total_instructions());
+  // i32.const, call and return.
+  EXPECT_EQ(3u, main.self_instructions);
+  EXPECT_EQ(kInstructions, main.total_instructions);
+  // Recursive calls are only counted once.
+  EXPECT_EQ(kInstructions - 3, fib.self_instructions);
+  EXPECT_EQ(kInstructions - 3, fib.total_instructions);
+}
+
+TEST_F(ProfilerTest, FoldedStacks) {
+  LoadModule(1);
+  ASSERT_TRUE(Run().ok());
+  MemoryStream stream;
+  profiler_->WriteFoldedStacks(&stream);
+  std::string folded(stream.output_buffer().data.begin(),
+                     stream.output_buffer().data.end());
+  // One line for each depth of recursion, outermost frame first.
+  EXPECT_EQ(0u, folded.find("main 3\n"
+                            "main;func[0] 15\n"
+                            "main;func[0];func[0] 30\n"));
+  EXPECT_EQ(11, std::count(folded.begin(), folded.end(), '\n'));
+}
+
+TEST_F(ProfilerTest, SampledInstructions) {
+  LoadModule(100);
+  ASSERT_TRUE(Run().ok());
+  ASSERT_TRUE(Run().ok());
+  // Every instruction is charged to some function, including the ones after
+  // the last full sample interval of each run.
+  auto main = profiler_->GetFuncProfile(kMain);
+  auto fib = profiler_->GetFuncProfile(kFib);
+  EXPECT_EQ(2 * kInstructions, profiler_->total_instructions());
+  EXPECT_EQ(2 * kInstructions, main.total_instructions);
+  EXPECT_EQ(2 * kInstructions, main.self_instructions + fib.self_instructions);
+  EXPECT_EQ(2 * kFibCalls, profiler_->GetFuncProfile(kFib).calls);
+}
+
+TEST(FuncSignatureTest, InternedIds) {
+  interp::Environment env{Features()};
+  TypeVector i32 = {Type::I32};
+  TypeVector f32 = {Type::F32};
+  env.EmplaceBackFuncSignature(i32, i32);
+  env.EmplaceBackFuncSignature(f32, i32);
+  env.EmplaceBackFuncSignature(i32, i32);
+  EXPECT_EQ(0u, env.GetFuncSignatureId(0));
+  EXPECT_EQ(1u, env.GetFuncSignatureId(1));
+  EXPECT_EQ(0u, env.GetFuncSignatureId(2));
+  EXPECT_TRUE(env.FuncSignaturesAreEqual(0, 2));
+  EXPECT_FALSE(env.FuncSignaturesAreEqual(0, 1));
+
+  // Signatures added after a mark get new ids once it is reset.
+  interp::Environment::MarkPoint mark = env.Mark();
+  env.EmplaceBackFuncSignature(i32, f32);
+  EXPECT_EQ(3u, env.GetFuncSignatureId(3));
+  env.ResetToMarkPoint(mark);
+  env.EmplaceBackFuncSignature(f32, f32);
+  env.EmplaceBackFuncSignature(i32, f32);
+  EXPECT_EQ(3u, env.GetFuncSignatureId(3));
+  EXPECT_EQ(4u, env.GetFuncSignatureId(4));
+  EXPECT_EQ(1u, env.GetFuncSignatureId(1));
+}
+
+namespace {
+
+int32_t TypedSub(int32_t lhs, int32_t rhs) {
+  return lhs - rhs;
+}
+
+double TypedMix(int64_t a, float b, double c) {
+  return a + b + c;
+}
+
+uint64_t TypedSeven() {
+  return 7;
+}
+
+class HostTypedTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    env_ = MakeUnique<interp::Environment>(Features());
+    interp::HostModule* host_module = env_->AppendHostModule("host");
+    host_module->AppendFuncExport("sub", TypedSub);
+    host_module->AppendFuncExport("mix", TypedMix);
+    host_module->AppendFuncExport("seven", TypedSeven);
+    host_module->AppendFuncExport(
+        "record", std::function<void(int32_t)>(
+                      [this](int32_t value) { recorded_ = value; }));
+
+    // (import "host" "sub" (func $sub (param i32 i32) (result i32)))
+    // (import "host" "mix" (func $mix (param i64 f32 f64) (result f64)))
+    // (import "host" "seven" (func $seven (result i64)))
+    // (import "host" "record" (func $record (param i32)))
+    // (func (export "sub") (result i32)
+    //   (call $sub (i32.const 10) (i32.const 3)))
+    // (func (export "mix") (result f64)
+    //   (call $mix (i64.const -2) (f32.const 0.5) (f64.const 4)))
+    // (func (export "seven") (result i64)
+    //   (i64.add (call $seven) (call $seven)))
+    // (func (export "record")
+    //   (call $record (i32.const -1)))
+    std::vector<uint8_t> data = {
+        0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x21, 0x07,
+        0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x03, 0x7e, 0x7d, 0x7c,
+        0x01, 0x7c, 0x60, 0x00, 0x01, 0x7e, 0x60, 0x01, 0x7f, 0x00, 0x60,
+        0x00, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7c, 0x60, 0x00, 0x00, 0x02,
+        0x32, 0x04, 0x04, 0x68, 0x6f, 0x73, 0x74, 0x03, 0x73, 0x75, 0x62,
+        0x00, 0x00, 0x04, 0x68, 0x6f, 0x73, 0x74, 0x03, 0x6d, 0x69, 0x78,
+        0x00, 0x01, 0x04, 0x68, 0x6f, 0x73, 0x74, 0x05, 0x73, 0x65, 0x76,
+        0x65, 0x6e, 0x00, 0x02, 0x04, 0x68, 0x6f, 0x73, 0x74, 0x06, 0x72,
+        0x65, 0x63, 0x6f, 0x72, 0x64, 0x00, 0x03, 0x03, 0x05, 0x04, 0x04,
+        0x05, 0x02, 0x06, 0x07, 0x1e, 0x04, 0x03, 0x73, 0x75, 0x62, 0x00,
+        0x04, 0x03, 0x6d, 0x69, 0x78, 0x00, 0x05, 0x05, 0x73, 0x65, 0x76,
+        0x65, 0x6e, 0x00, 0x06, 0x06, 0x72, 0x65, 0x63, 0x6f, 0x72, 0x64,
+        0x00, 0x07, 0x0a, 0x2e, 0x04, 0x08, 0x00, 0x41, 0x0a, 0x41, 0x03,
+        0x10, 0x00, 0x0b, 0x14, 0x00, 0x42, 0x7e, 0x43, 0x00, 0x00, 0x00,
+        0x3f, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x40, 0x10,
+        0x01, 0x0b, 0x07, 0x00, 0x10, 0x02, 0x10, 0x02, 0x7c, 0x0b, 0x06,
+        0x00, 0x41, 0x7f, 0x10, 0x03, 0x0b,
+    };
+    Errors errors;
+    ASSERT_EQ(Result::Ok, ReadBinaryInterp(env_.get(), data.data(),
+                                           data.size(), ReadBinaryOptions(),
+                                           &errors, &module_));
+    executor_ = MakeUnique<interp::Executor>(env_.get());
+  }
+
+  virtual void TearDown() {
+    executor_.reset();
+    env_.reset();
+  }
+
+  interp::ExecResult Run(string_view name) {
+    return executor_->RunExportByName(module_, name, {});
+  }
+
+  std::unique_ptr<interp::Environment> env_;
+  std::unique_ptr<interp::Executor> executor_;
+  interp::DefinedModule* module_ = nullptr;
+  int32_t recorded_ = 0;
+};
+
+}  // end of anonymous namespace
+
+TEST_F(HostTypedTest, Signatures) {
+  const interp::FuncSignature* sig = env_->GetFuncSignature(
+      env_->GetFunc(1)->sig_index);
+  EXPECT_EQ((TypeVector{Type::I64, Type::F32, Type::F64}), sig->param_types);
+  EXPECT_EQ(TypeVector{Type::F64}, sig->result_types);
+  sig = env_->GetFuncSignature(env_->GetFunc(3)->sig_index);
+  EXPECT_EQ(TypeVector{Type::I32}, sig->param_types);
+  EXPECT_TRUE(sig->result_types.empty());
+}
+
+TEST_F(HostTypedTest, Call) {
+  interp::ExecResult result = Run("sub");
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(7u, result.values[0].get_i32());
+
+  result = Run("mix");
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(2.5, result.values[0].get_f64());
+
+  // More results than arguments.
+  result = Run("seven");
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(14u, result.values[0].get_i64());
+
+  ASSERT_TRUE(Run("record").ok());
+  EXPECT_EQ(-1, recorded_);
+}
+
+TEST_F(HostTypedTest, CallHandle) {
+  interp::CallHandle handle;
+  ASSERT_EQ(interp::ResultType::Ok,
+            executor_->GetCallHandle(module_, "mix", &handle).type);
+  interp::Value result;
+  ASSERT_TRUE(executor_->Call(handle, nullptr, 0, &result, 1).ok());
+  EXPECT_EQ(2.5, Bitcast<double>(result.f64_bits));
+
+  // Adding signatures to the environment doesn't invalidate the handle.
+  interp::HostModule* more = env_->AppendHostModule("more");
+  for (int i = 0; i < 100; ++i) {
+    more->AppendFuncExport("seven", TypedSeven);
+  }
+  ASSERT_TRUE(executor_->Call(handle, nullptr, 0, &result, 1).ok());
+  EXPECT_EQ(2.5, Bitcast<double>(result.f64_bits));
+
+  // Host functions can be called directly too.
+  interp::Value args[2];
+  args[0].i32 = 10;
+  args[1].i32 = 3;
+  handle = executor_->GetFuncCallHandle(0);
+  ASSERT_TRUE(executor_->Call(handle, args, 2, &result, 1).ok());
+  EXPECT_EQ(7u, result.i32);
+
+  EXPECT_EQ(interp::ResultType::ArgumentTypeMismatch,
+            executor_->Call(handle, args, 1, &result, 1).type);
+  EXPECT_EQ(interp::ResultType::UnknownExport,
+            executor_->GetCallHandle(module_, "missing", &handle).type);
+}
+
+TEST(ModuleExportsTest, Lookup) {
+  interp::Environment env{Features()};
+  interp::HostModule* host_module = env.AppendHostModule("host");
+  host_module->AppendFuncExport("f", TypedSeven);
+  host_module->AppendGlobalExport("b", false, uint32_t(1));
+  host_module->AppendFuncExport("f", TypedSub);
+  EXPECT_EQ(&host_module->exports[0], host_module->GetExport("f"));
+  EXPECT_EQ(&host_module->exports[1], host_module->GetExport("b"));
+  EXPECT_EQ(nullptr, host_module->GetExport("a"));
+  EXPECT_EQ(nullptr, host_module->GetExport("g"));
+
+  // Function exports are overloaded by signature.
+  Index sub_sig_index = env.GetFunc(host_module->exports[2].index)->sig_index;
+  EXPECT_EQ(&host_module->exports[2],
+            host_module->GetFuncExport(&env, "f", sub_sig_index));
+
+  // Exports appended after a lookup are found too.
+  host_module->AppendGlobalExport("a", false, uint32_t(2));
+  EXPECT_EQ(&host_module->exports[3], host_module->GetExport("a"));
+}
+
+TEST(LinkImportsTest, ResolveAndRun) {
+  interp::Environment env{Features()};
+  interp::HostModule* host_module = env.AppendHostModule("host");
+  host_module->AppendFuncExport("seven", TypedSeven);
+  host_module->AppendGlobalExport("one", false, uint32_t(1));
+
+  std::vector<interp::Import> imports;
+  imports.emplace_back(ExternalKind::Func, "host", "seven");
+  imports.emplace_back(ExternalKind::Global, "host", "one");
+  std::vector<interp::Export*> exports;
+  Errors errors;
+  ASSERT_EQ(Result::Ok, env.LinkImports(imports, &exports, &errors));
+  ASSERT_EQ(2u, exports.size());
+  EXPECT_EQ(&host_module->exports[0], exports[0]);
+  EXPECT_EQ(&host_module->exports[1], exports[1]);
+
+  // (import "host" "seven" (func $seven (result i64)))
+  // (import "host" "one" (global $one i32))
+  // (func (export "eight") (result i64)
+  //   (i64.add (call $seven) (i64.extend_i32_u (global.get $one))))
+  std::vector<uint8_t> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+      0x60, 0x00, 0x01, 0x7e, 0x02, 0x1a, 0x02, 0x04, 0x68, 0x6f, 0x73,
+      0x74, 0x05, 0x73, 0x65, 0x76, 0x65, 0x6e, 0x00, 0x00, 0x04, 0x68,
+      0x6f, 0x73, 0x74, 0x03, 0x6f, 0x6e, 0x65, 0x03, 0x7f, 0x00, 0x03,
+      0x02, 0x01, 0x00, 0x07, 0x09, 0x01, 0x05, 0x65, 0x69, 0x67, 0x68,
+      0x74, 0x00, 0x01, 0x0a, 0x0a, 0x01, 0x08, 0x00, 0x10, 0x00, 0x23,
+      0x00, 0xad, 0x7c, 0x0b,
+  };
+  interp::DefinedModule* module = nullptr;
+  ASSERT_EQ(Result::Ok,
+            ReadBinaryInterp(&env, data.data(), data.size(),
+                             ReadBinaryOptions(), exports, &errors, &module));
+  interp::Executor executor(&env);
+  interp::ExecResult result = executor.RunExportByName(module, "eight", {});
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(8u, result.values[0].get_i64());
+}
+
+TEST(LinkImportsTest, Errors) {
+  interp::Environment env{Features()};
+  interp::HostModule* host_module = env.AppendHostModule("host");
+  host_module->AppendFuncExport("seven", TypedSeven);
+
+  std::vector<interp::Export*> exports;
+  Errors errors;
+  std::vector<interp::Import> imports;
+  imports.emplace_back(ExternalKind::Func, "other", "seven");
+  EXPECT_EQ(Result::Error, env.LinkImports(imports, &exports, &errors));
+
+  imports[0] = interp::Import(ExternalKind::Func, "host", "eight");
+  EXPECT_EQ(Result::Error, env.LinkImports(imports, &exports, &errors));
+
+  imports[0] = interp::Import(ExternalKind::Global, "host", "seven");
+  EXPECT_EQ(Result::Error, env.LinkImports(imports, &exports, &errors));
+
+  ASSERT_EQ(3u, errors.size());
+  EXPECT_EQ("unknown import module \"other\"", errors[0].message);
+  EXPECT_EQ("unknown module field \"eight\"", errors[1].message);
+  EXPECT_EQ("expected import \"host.seven\" to have kind global, not func",
+            errors[2].message);
+}
+
+namespace {
+
+class SuspendTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Features features;
+    features.enable_tail_call();
+    env_ = MakeUnique<interp::Environment>(features);
+    interp::HostModule* host_module = env_->AppendHostModule("host");
+    host_module->AppendFuncExport(
+        "read", {{Type::I32}, {Type::I32}},
+        [this](const interp::HostFunc*, const interp::FuncSignature*,
+               const interp::TypedValues& args,
+               interp::TypedValues& results) -> interp::Result {
+          reads_.push_back(args[0].get_i32());
+          return interp::ResultType::Suspended;
+        });
+  }
+
+  void LoadModule(const std::vector<uint8_t>& data) {
+    Errors errors;
+    ReadBinaryOptions options;
+    options.features.enable_tail_call();
+    ASSERT_EQ(Result::Ok,
+              ReadBinaryInterp(env_.get(), data.data(), data.size(), options,
+                               &errors, &module_));
+  }
+
+  static interp::TypedValues I32(uint32_t value) {
+    interp::TypedValues values(1, interp::TypedValue(Type::I32));
+    values[0].set_i32(value);
+    return values;
+  }
+
+  std::unique_ptr<interp::Environment> env_;
+  interp::DefinedModule* module_ = nullptr;
+  std::vector<uint32_t> reads_;
+};
+
+}  // end of anonymous namespace
+
+// (type $t (func (param i32) (result i32)))
+// (import "host" "read" (func $read (type $t)))
+// (table funcref (elem $read))
+// (func (export "sum") (param i32) (result i32)
+//   (i32.add (i32.add (i32.const 10) (call $read (local.get 0)))
+//            (call $read (i32.const 1))))
+// (func (export "tail") (param i32) (result i32)
+//   (return_call_indirect (type $t) (local.get 0) (i32.const 0)))
+static const std::vector<uint8_t> s_suspend_module = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+    0x60, 0x01, 0x7f, 0x01, 0x7f, 0x02, 0x0d, 0x01, 0x04, 0x68, 0x6f,
+    0x73, 0x74, 0x04, 0x72, 0x65, 0x61, 0x64, 0x00, 0x00, 0x03, 0x03,
+    0x02, 0x00, 0x00, 0x04, 0x05, 0x01, 0x70, 0x01, 0x01, 0x01, 0x07,
+    0x0e, 0x02, 0x03, 0x73, 0x75, 0x6d, 0x00, 0x01, 0x04, 0x74, 0x61,
+    0x69, 0x6c, 0x00, 0x02, 0x09, 0x07, 0x01, 0x00, 0x41, 0x00, 0x0b,
+    0x01, 0x00, 0x0a, 0x1a, 0x02, 0x0e, 0x00, 0x41, 0x0a, 0x20, 0x00,
+    0x10, 0x00, 0x6a, 0x41, 0x01, 0x10, 0x00, 0x6a, 0x0b, 0x09, 0x00,
+    0x20, 0x00, 0x41, 0x00, 0x13, 0x00, 0x00, 0x0b,
+};
+
+TEST_F(SuspendTest, ResumeCalls) {
+  LoadModule(s_suspend_module);
+  interp::Executor executor(env_.get());
+  interp::ExecResult result = executor.RunExportByName(module_, "sum", I32(5));
+  ASSERT_EQ(interp::ResultType::Suspended, result.result.type);
+  ASSERT_TRUE(executor.thread()->is_suspended());
+  EXPECT_EQ("read", executor.thread()->suspended_func()->field_name);
+
+  // A result of the wrong type is rejected, and the thread stays suspended.
+  interp::TypedValues wrong(1, interp::TypedValue(Type::I64));
+  EXPECT_EQ(interp::ResultType::TrapHostResultTypeMismatch,
+            executor.Resume(wrong).result.type);
+  ASSERT_TRUE(executor.thread()->is_suspended());
+
+  result = executor.Resume(I32(100));
+  ASSERT_EQ(interp::ResultType::Suspended, result.result.type);
+  result = executor.Resume(I32(7));
+  ASSERT_TRUE(result.ok());
+  EXPECT_FALSE(executor.thread()->is_suspended());
+  EXPECT_EQ(117u, result.values[0].get_i32());
+  EXPECT_EQ((std::vector<uint32_t>{5, 1}), reads_);
+}
+
+TEST_F(SuspendTest, ResumeTailCall) {
+  LoadModule(s_suspend_module);
+  interp::Executor executor(env_.get());
+  ASSERT_TRUE(executor.Initialize(module_).ok());
+  interp::ExecResult result =
+      executor.RunExportByName(module_, "tail", I32(3));
+  ASSERT_EQ(interp::ResultType::Suspended, result.result.type);
+  result = executor.Resume(I32(42));
+  ASSERT_TRUE(result.ok());
+  EXPECT_EQ(42u, result.values[0].get_i32());
+  EXPECT_EQ((std::vector<uint32_t>{3}), reads_);
+}
+
+TEST_F(SuspendTest, ManyThreads) {
+  LoadModule(s_suspend_module);
+  // One caller can keep many calls in flight, resuming them in any order.
+  std::vector<std::unique_ptr<interp::Executor>> executors;
+  for (uint32_t i = 0; i < 4; ++i) {
+    executors.emplace_back(MakeUnique<interp::Executor>(env_.get()));
+    interp::ExecResult result =
+        executors.back()->RunExportByName(module_, "sum", I32(i));
+    ASSERT_EQ(interp::ResultType::Suspended, result.result.type);
+  }
+  for (uint32_t i = 4; i > 0; --i) {
+    interp::Executor* executor = executors[i - 1].get();
+    ASSERT_EQ(interp::ResultType::Suspended,
+              executor->Resume(I32(i)).result.type);
+    interp::ExecResult result = executor->Resume(I32(0));
+    ASSERT_TRUE(result.ok());
+    EXPECT_EQ(10 + i, result.values[0].get_i32());
+  }
+}
+
+TEST_F(SuspendTest, MachineCode) {
+  if (!interp::IsJitSupported()) {
+    return;
+  }
+
+  env_->lowering_options_.jit = true;
+  LoadModule(s_suspend_module);
+  interp::Thread::Options options;
+  options.jit_threshold = 1;
+  interp::Executor executor(env_.get(), nullptr, options);
+  interp::ExecResult result = executor.RunExportByName(module_, "sum", I32(5));
+  EXPECT_EQ(interp::ResultType::TrapSuspendedInJit, result.result.type);
+  EXPECT_FALSE(executor.thread()->is_suspended());
+}
@@ -45,6 +45,7 @@ static const char* s_infile;
 static Thread::Options s_thread_options;
 static Stream* s_trace_stream;
 static Features s_features;
+static const char* s_cache_dir;
 
 static std::unique_ptr<FileStream> s_log_stream;
 static std::unique_ptr<FileStream> s_stdout_stream;
@@ -84,6 +85,10 @@ static void ParseOptions(int argc, char** argv) {
                    });
   parser.AddOption('t', "trace", "Trace execution",
                    []() { s_trace_stream = s_stdout_stream.get(); });
+  parser.AddOption('\0', "cache-dir", "DIR",
+                   "Reuse the lowered modules from a previous run, cached in "
+                   "DIR",
+                   [](const char* argument) { s_cache_dir = argument; });
 
   parser.AddArgument("filename", OptionParser::ArgumentCount::One,
                      [](const char* argument) { s_infile = argument; });
@@ -1094,8 +1099,13 @@ static wabt::Result ReadModule(string_view module_filename,
     const bool kFailOnCustomSectionError = true;
     ReadBinaryOptions options(s_features, s_log_stream.get(), kReadDebugNames,
                               kStopOnFirstError, kFailOnCustomSectionError);
-    result = ReadBinaryInterp(env, file_data.data(), file_data.size(), options,
-                              errors, out_module);
+    if (s_cache_dir) {
+      result = ReadBinaryInterpCached(env, file_data.data(), file_data.size(),
+                                      options, s_cache_dir, errors, out_module);
+    } else {
+      result = ReadBinaryInterp(env, file_data.data(), file_data.size(),
+                                options, errors, out_module);
+    }
 
     if (Succeeded(result)) {
       if (s_verbose) {
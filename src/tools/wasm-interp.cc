@@ -28,6 +28,7 @@
 #include "src/error-formatter.h"
 #include "src/feature.h"
 #include "src/interp/binary-reader-interp.h"
+#include "src/interp/interp-profiler.h"
 #include "src/interp/interp.h"
 #include "src/literal.h"
 #include "src/option-parser.h"
@@ -43,7 +44,14 @@ using namespace wabt::interp;
 static int s_verbose;
 static const char* s_infile;
 static Thread::Options s_thread_options;
+static LoweringOptions s_lowering_options;
+static const char* s_fusion_profile;
+static MemoryBackend s_memory_backend = MemoryBackend::Heap;
+static const char* s_cache_dir;
 static Stream* s_trace_stream;
+static bool s_profile;
+static const char* s_profile_folded;
+static uint32_t s_profile_interval = Profiler::kDefaultSampleInterval;
 static bool s_run_all_exports;
 static bool s_host_print;
 static bool s_dummy_import_func;
@@ -74,8 +82,26 @@ examples:
   # parse test.wasm and run all its exported functions, setting the
   # value stack size to 100 elements
   $ wasm-interp test.wasm -V 100 --run-all-exports
+
+  # run the exported functions of test.wasm, print the functions that ran
+  # the most instructions, and write a flame graph of them
+  $ wasm-interp test.wasm --run-all-exports --profile-folded=test.folded
+  $ flamegraph.pl test.folded > test.svg
+
+  # fuse the superinstructions that are common in test.wasm
+  $ wasm-opcodecnt test.wasm --sequences -o test.dist
+  $ wasm-interp test.wasm --fusion-profile=test.dist --run-all-exports
 )";
 
+static void EnableJit(uint32_t threshold) {
+  if (!IsJitSupported()) {
+    fprintf(stderr, "the JIT is not supported on this platform\n");
+    exit(1);
+  }
+  s_lowering_options.jit = true;
+  s_thread_options.jit_threshold = threshold;
+}
+
 static void ParseOptions(int argc, char** argv) {
   OptionParser parser("wasm-interp", s_description);
 
@@ -98,6 +124,95 @@ static void ParseOptions(int argc, char** argv) {
                    });
   parser.AddOption('t', "trace", "Trace execution",
                    []() { s_trace_stream = s_stdout_stream.get(); });
+  parser.AddOption("profile",
+                   "Count the calls and instructions of each function, and "
+                   "print the functions that ran the most instructions",
+                   []() { s_profile = true; });
+  parser.AddOption('\0', "profile-folded", "FILE",
+                   "Like --profile, and also write the sampled call stacks to "
+                   "FILE in the folded format of flame graph tools",
+                   [](const char* argument) {
+                     s_profile = true;
+                     s_profile_folded = argument;
+                   });
+  parser.AddOption('\0', "profile-interval", "N",
+                   "Sample the call stack every N instructions when "
+                   "profiling, instead of every 1000",
+                   [](const std::string& argument) {
+                     s_profile_interval = atoi(argument.c_str());
+                   });
+  parser.AddOption("register-lowering",
+                   "Lower local-to-local arithmetic to register-form "
+                   "instructions",
+                   []() { s_lowering_options.register_lowering = true; });
+  parser.AddOption(
+      '\0', "fuse", "NAMES",
+      "Fuse the comma-separated superinstructions in NAMES, or \"all\"",
+      [](const std::string& argument) {
+        size_t start = 0;
+        while (start <= argument.size()) {
+          size_t end = argument.find(',', start);
+          if (end == std::string::npos) {
+            end = argument.size();
+          }
+          string_view name(argument.data() + start, end - start);
+          Fusion fusion;
+          if (name == "all") {
+            for (int i = 0; i < kFusionCount; ++i) {
+              s_lowering_options.EnableFusion(static_cast<Fusion>(i));
+            }
+          } else if (ParseFusionName(name, &fusion)) {
+            s_lowering_options.EnableFusion(fusion);
+          } else {
+            fprintf(stderr, "unknown superinstruction '" PRIstringview "'\n",
+                    WABT_PRINTF_STRING_VIEW_ARG(name));
+            exit(1);
+          }
+          start = end + 1;
+        }
+      });
+  parser.AddOption('\0', "fusion-profile", "FILE",
+                   "Fuse the superinstructions that are common in FILE, the "
+                   "output of wasm-opcodecnt --sequences",
+                   [](const char* argument) { s_fusion_profile = argument; });
+  parser.AddOption("lazy-compile",
+                   "Lower each function the first time it is called, instead "
+                   "of when the module is read",
+                   []() { s_lowering_options.lazy_compilation = true; });
+  parser.AddOption("jit",
+                   "Compile hot functions to x86-64 machine code, after "
+                   "they have been called 10 times",
+                   []() { EnableJit(Thread::Options::kDefaultJitThreshold); });
+  parser.AddOption('\0', "jit-threshold", "N",
+                   "Like --jit, but compile functions once they have been "
+                   "called N times",
+                   [](const std::string& argument) {
+                     EnableJit(atoi(argument.c_str()));
+                   });
+  parser.AddOption('\0', "fuel", "N",
+                   "Give the interpreter N units of fuel, one for each "
+                   "instruction run, and trap when it runs out",
+                   [](const std::string& argument) {
+                     s_lowering_options.fuel = true;
+                     s_thread_options.fuel =
+                         strtoull(argument.c_str(), nullptr, 10);
+                   });
+  parser.AddOption("guard-pages",
+                   "Reserve the address space for linear memory up front and "
+                   "catch out-of-bounds accesses with guard pages",
+                   []() {
+                     if (!IsGuardPageMemorySupported()) {
+                       fprintf(stderr,
+                               "guard pages are not supported on this "
+                               "platform\n");
+                       exit(1);
+                     }
+                     s_memory_backend = MemoryBackend::GuardPages;
+                   });
+  parser.AddOption('\0', "cache-dir", "DIR",
+                   "Reuse the lowered module from a previous run with the "
+                   "same options, cached in DIR",
+                   [](const char* argument) { s_cache_dir = argument; });
   parser.AddOption(
       "run-all-exports",
       "Run all the exported functions, in order. Useful for testing",
@@ -134,6 +249,92 @@ static void RunAllExports(interp::Module* module,
   }
 }
 
+static bool ParseOpcodeName(string_view name, Opcode* out_opcode) {
+  for (uint32_t i = 0; i < Opcode::Invalid; ++i) {
+    Opcode opcode(static_cast<Opcode::Enum>(i));
+    if (name == opcode.GetName()) {
+      *out_opcode = opcode;
+      return true;
+    }
+  }
+  return false;
+}
+
+// A superinstruction is fused if the sequences it replaces make up at least
+// this fraction of all the opcodes in the profile.
+static const double kFusionProfileThreshold = 0.01;
+
+static wabt::Result ReadFusionProfile(const char* filename) {
+  std::vector<uint8_t> file_data;
+  CHECK_RESULT(ReadFile(filename, &file_data));
+  std::string contents(file_data.begin(), file_data.end());
+
+  const char kTotalPrefix[] = "Total opcodes: ";
+  size_t total_count = 0;
+  size_t fusion_counts[kFusionCount] = {};
+  bool in_sequences = false;
+  size_t start = 0;
+  while (start < contents.size()) {
+    size_t end = contents.find('\n', start);
+    if (end == std::string::npos) {
+      end = contents.size();
+    }
+    std::string line = contents.substr(start, end - start);
+    start = end + 1;
+
+    if (line.compare(0, sizeof(kTotalPrefix) - 1, kTotalPrefix) == 0) {
+      total_count = strtoull(line.c_str() + sizeof(kTotalPrefix) - 1,
+                             nullptr, 10);
+      continue;
+    } else if (line == "Opcode sequence counts:") {
+      in_sequences = true;
+      continue;
+    }
+
+    size_t colon = line.rfind(':');
+    if (!in_sequences || colon == std::string::npos) {
+      continue;
+    }
+
+    // Each line is "<opcode> <opcode>...: <count>".
+    std::vector<Opcode> sequence;
+    size_t name_start = 0;
+    while (name_start < colon) {
+      size_t name_end = std::min(line.find(' ', name_start), colon);
+      Opcode opcode;
+      if (!ParseOpcodeName(string_view(line.data() + name_start,
+                                       name_end - name_start),
+                           &opcode)) {
+        fprintf(stderr, "%s: unknown opcode in sequence \"%s\"\n", filename,
+                line.c_str());
+        return wabt::Result::Error;
+      }
+      sequence.push_back(opcode);
+      name_start = name_end + 1;
+    }
+
+    Fusion fusion;
+    if (GetFusionForSequence(sequence, &fusion)) {
+      fusion_counts[static_cast<int>(fusion)] +=
+          strtoull(line.c_str() + colon + 1, nullptr, 10);
+    }
+  }
+
+  if (!in_sequences || total_count == 0) {
+    fprintf(stderr,
+            "%s: no opcode sequence counts, use wasm-opcodecnt --sequences\n",
+            filename);
+    return wabt::Result::Error;
+  }
+
+  for (int i = 0; i < kFusionCount; ++i) {
+    if (fusion_counts[i] >= total_count * kFusionProfileThreshold) {
+      s_lowering_options.EnableFusion(static_cast<Fusion>(i));
+    }
+  }
+  return wabt::Result::Ok;
+}
+
 static wabt::Result ReadModule(const char* module_filename,
                                Environment* env,
                                Errors* errors,
@@ -150,8 +351,13 @@ static wabt::Result ReadModule(const char* module_filename,
     const bool kFailOnCustomSectionError = true;
     ReadBinaryOptions options(s_features, s_log_stream.get(), kReadDebugNames,
                               kStopOnFirstError, kFailOnCustomSectionError);
-    result = ReadBinaryInterp(env, file_data.data(), file_data.size(), options,
-                              errors, out_module);
+    if (s_cache_dir) {
+      result = ReadBinaryInterpCached(env, file_data.data(), file_data.size(),
+                                      options, s_cache_dir, errors, out_module);
+    } else {
+      result = ReadBinaryInterp(env, file_data.data(), file_data.size(),
+                                options, errors, out_module);
+    }
 
     if (Succeeded(result)) {
       if (s_verbose) {
@@ -173,6 +379,9 @@ static interp::Result PrintCallback(const HostFunc* func,
 }
 
 static void InitEnvironment(Environment* env) {
+  env->lowering_options_ = s_lowering_options;
+  env->memory_backend_ = s_memory_backend;
+
   if (s_host_print) {
     auto* host_module = env->AppendHostModule("host");
     host_module->on_unknown_func_export =
@@ -201,6 +410,23 @@ static void InitEnvironment(Environment* env) {
   }
 }
 
+// The number of functions, and of call edges, in the --profile report.
+static const size_t kProfileReportCount = 20;
+
+static wabt::Result WriteProfile(const Profiler& profiler) {
+  s_stdout_stream->Writef("\nprofile:\n");
+  profiler.WriteReport(s_stdout_stream.get(), kProfileReportCount);
+  if (s_profile_folded) {
+    FileStream stream(s_profile_folded);
+    if (!stream.is_open()) {
+      fprintf(stderr, "unable to open %s for writing\n", s_profile_folded);
+      return wabt::Result::Error;
+    }
+    profiler.WriteFoldedStacks(&stream);
+  }
+  return wabt::Result::Ok;
+}
+
 static wabt::Result ReadAndRunModule(const char* module_filename) {
   wabt::Result result;
   Environment env(s_features);
@@ -211,7 +437,13 @@ static wabt::Result ReadAndRunModule(const char* module_filename) {
   result = ReadModule(module_filename, &env, &errors, &module);
   FormatErrorsToFile(errors, Location::Type::Binary);
   if (Succeeded(result)) {
-    Executor executor(&env, s_trace_stream, s_thread_options);
+    std::unique_ptr<Profiler> profiler;
+    Thread::Options thread_options = s_thread_options;
+    if (s_profile) {
+      profiler.reset(new Profiler(&env, s_profile_interval));
+      thread_options.profiler = profiler.get();
+    }
+    Executor executor(&env, s_trace_stream, thread_options);
     ExecResult exec_result = executor.Initialize(module);
     if (exec_result.ok()) {
       if (s_run_all_exports) {
@@ -220,7 +452,10 @@ static wabt::Result ReadAndRunModule(const char* module_filename) {
     } else {
       WriteResult(s_stdout_stream.get(), "error initialiazing module",
                   exec_result.result);
-      return wabt::Result::Error;
+      result = wabt::Result::Error;
+    }
+    if (profiler) {
+      result |= WriteProfile(*profiler);
     }
   }
   return result;
@@ -232,6 +467,10 @@ int ProgramMain(int argc, char** argv) {
 
   ParseOptions(argc, argv);
 
+  if (s_fusion_profile && Failed(ReadFusionProfile(s_fusion_profile))) {
+    return 1;
+  }
+
   wabt::Result result = ReadAndRunModule(s_infile);
   return result != wabt::Result::Ok;
 }
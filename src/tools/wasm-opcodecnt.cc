@@ -38,6 +38,7 @@ static const char* s_infile;
 static const char* s_outfile;
 static size_t s_cutoff = 0;
 static const char* s_separator = ": ";
+static bool s_sequences;
 
 static ReadBinaryOptions s_read_binary_options;
 static std::unique_ptr<FileStream> s_log_stream;
@@ -50,6 +51,9 @@ R"(  Read a file in the wasm binary format, and count opcode usage for
 examples:
   # parse binary file test.wasm and write pcode dist file test.dist
   $ wasm-opcodecnt test.wasm -o test.dist
+
+  # also count runs of adjacent opcodes, e.g. for wasm-interp --fusion-profile
+  $ wasm-opcodecnt test.wasm --sequences -o test.dist
 )";
 
 static void ParseOptions(int argc, char** argv) {
@@ -71,6 +75,9 @@ static void ParseOptions(int argc, char** argv) {
       's', "separator", "SEPARATOR",
       "Separator text between element and count when reporting counts",
       [](const char* argument) { s_separator = argument; });
+  parser.AddOption("sequences",
+                   "Also count sequences of adjacent opcodes in a function",
+                   []() { s_sequences = true; });
   parser.AddArgument("filename", OptionParser::ArgumentCount::OneOrMore,
                      [](const char* argument) { s_infile = argument; });
   parser.Parse(argc, argv);
@@ -148,6 +155,28 @@ void WriteCountsWithImmediates(Stream& stream,
   }
 }
 
+void WriteSequenceCounts(Stream& stream, const OpcodeSequenceCounts& counts) {
+  typedef std::pair<std::vector<Opcode>, size_t> OpcodeSequenceCountPair;
+
+  std::vector<OpcodeSequenceCountPair> sorted;
+  std::copy_if(counts.begin(), counts.end(), std::back_inserter(sorted),
+               WithinCutoff<OpcodeSequenceCountPair>());
+
+  // Use a stable sort to keep the elements with the same count in sequence
+  // order (since the OpcodeSequenceCounts map is sorted).
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   SortByCountDescending<OpcodeSequenceCountPair>());
+
+  for (auto& pair : sorted) {
+    const char* prefix = "";
+    for (Opcode opcode : pair.first) {
+      stream.Writef("%s%s", prefix, opcode.GetName());
+      prefix = " ";
+    }
+    stream.Writef("%s%" PRIzd "\n", s_separator, pair.second);
+  }
+}
+
 int ProgramMain(int argc, char** argv) {
   InitStdio();
   ParseOptions(argc, argv);
@@ -164,9 +193,11 @@ int ProgramMain(int argc, char** argv) {
 
   if (Succeeded(result)) {
     OpcodeInfoCounts counts;
+    OpcodeSequenceCounts sequence_counts;
     s_read_binary_options.features = s_features;
     result = ReadBinaryOpcnt(file_data.data(), file_data.size(),
-                             s_read_binary_options, &counts);
+                             s_read_binary_options, &counts,
+                             s_sequences ? &sequence_counts : nullptr);
     if (Succeeded(result)) {
       stream.Writef("Total opcodes: %" PRIzd "\n\n", SumCounts(counts));
 
@@ -175,6 +206,11 @@ int ProgramMain(int argc, char** argv) {
 
       stream.Writef("\nOpcode counts with immediates:\n");
       WriteCountsWithImmediates(stream, counts);
+
+      if (s_sequences) {
+        stream.Writef("\nOpcode sequence counts:\n");
+        WriteSequenceCounts(stream, sequence_counts);
+      }
     }
   }
 
@@ -18,6 +18,8 @@
 #include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <vector>
 
 #include "src/apply-names.h"
 #include "src/binary-reader.h"
@@ -41,6 +43,7 @@ static std::string s_outfile;
 static Features s_features;
 static WriteCOptions s_write_c_options;
 static bool s_read_debug_names = true;
+static int s_num_outputs = 1;
 static std::unique_ptr<FileStream> s_log_stream;
 
 static const char s_description[] =
@@ -53,6 +56,10 @@ examples:
 
   # parse test.wasm, write test.c and test.h, but ignore the debug names, if any
   $ wasm2c test.wasm --no-debug-names -o test.c
+
+  # parse test.wasm, split its functions across test_0.c to test_3.c, and
+  # write test.h and test_impl.h
+  $ wasm2c test.wasm --num-outputs=4 -o test.c
 )";
 
 static void ParseOptions(int argc, char** argv) {
@@ -72,6 +79,20 @@ static void ParseOptions(int argc, char** argv) {
   s_features.AddOptions(&parser);
   parser.AddOption("no-debug-names", "Ignore debug names in the binary file",
                    []() { s_read_debug_names = false; });
+  parser.AddOption(
+      "instance-struct",
+      "Keep all module state in a caller-allocated instance struct",
+      []() { s_write_c_options.instance_struct = true; });
+  parser.AddOption("fuel",
+                   "Charge each basic block's instruction count to the "
+                   "runtime's wasm_rt_fuel, and trap when it runs out",
+                   []() { s_write_c_options.fuel = true; });
+  parser.AddOption('\0', "num-outputs", "N",
+                   "Split the functions across N source files that can be "
+                   "compiled in parallel",
+                   [](const char* argument) {
+                     s_num_outputs = atoi(argument);
+                   });
   parser.AddArgument("filename", OptionParser::ArgumentCount::One,
                      [](const char* argument) {
                        s_infile = argument;
@@ -80,15 +101,37 @@ static void ParseOptions(int argc, char** argv) {
   parser.Parse(argc, argv);
 
   // TODO(binji): currently wasm2c doesn't support any non-default feature
-  // flags.
+  // flags, other than SIMD, threads, bulk memory, reference types and
+  // multi-value.
+  Features unsupported_features = s_features;
+  unsupported_features.disable_simd();
+  unsupported_features.disable_threads();
+  unsupported_features.disable_reference_types();
+  unsupported_features.disable_bulk_memory();
+  unsupported_features.disable_multi_value();
   bool any_non_default_feature = false;
 #define WABT_FEATURE(variable, flag, default_, help) \
-  any_non_default_feature |= (s_features.variable##_enabled() != default_);
+  any_non_default_feature |=                         \
+      (unsupported_features.variable##_enabled() != default_);
 #include "src/feature.def"
 #undef WABT_FEATURE
 
   if (any_non_default_feature) {
-    fprintf(stderr, "wasm2c currently support only default feature flags.\n");
+    fprintf(stderr,
+            "wasm2c currently support only default feature flags, "
+            "--enable-simd, --enable-threads, --enable-bulk-memory, "
+            "--enable-reference-types and --enable-multi-value.\n");
+    exit(1);
+  }
+  s_write_c_options.features = s_features;
+
+  if (s_num_outputs < 1) {
+    fprintf(stderr, "--num-outputs must be at least 1.\n");
+    exit(1);
+  }
+
+  if (s_num_outputs > 1 && s_outfile.empty()) {
+    fprintf(stderr, "--num-outputs requires an output file.\n");
     exit(1);
   }
 }
@@ -136,7 +179,23 @@ int ProgramMain(int argc, char** argv) {
       }
 
       if (Succeeded(result)) {
-        if (!s_outfile.empty()) {
+        if (s_num_outputs > 1) {
+          std::string base_name = strip_extension(s_outfile).to_string();
+          std::string header_name = base_name + ".h";
+          std::string impl_header_name = base_name + "_impl.h";
+          std::vector<std::unique_ptr<FileStream>> c_streams;
+          std::vector<Stream*> c_stream_ptrs;
+          for (int i = 0; i < s_num_outputs; ++i) {
+            c_streams.emplace_back(new FileStream(
+                base_name + "_" + std::to_string(i) + ".c"));
+            c_stream_ptrs.push_back(c_streams.back().get());
+          }
+          FileStream h_stream(header_name);
+          FileStream impl_h_stream(impl_header_name);
+          result = WriteC(c_stream_ptrs, &h_stream, &impl_h_stream,
+                          header_name.c_str(), impl_header_name.c_str(),
+                          &module, s_write_c_options);
+        } else if (!s_outfile.empty()) {
           std::string header_name =
               strip_extension(s_outfile).to_string() + ".h";
           FileStream c_stream(s_outfile.c_str());
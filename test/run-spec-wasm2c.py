@@ -81,7 +81,8 @@ def F64ToC(f64_bits):
 
 
 def MangleType(t):
-    return {'i32': 'i', 'i64': 'j', 'f32': 'f', 'f64': 'd'}[t]
+    return {'i32': 'i', 'i64': 'j', 'f32': 'f', 'f64': 'd', 'v128': 'o',
+            'funcref': 'r', 'anyref': 'a', 'nullref': 'n'}[t]
 
 
 def MangleTypes(types):
@@ -108,12 +109,15 @@ def IsModuleCommand(command):
 
 class CWriter(object):
 
-    def __init__(self, spec_json, prefix, out_file, out_dir):
+    def __init__(self, spec_json, prefix, out_file, out_dir,
+                 instance_struct=False):
         self.source_filename = os.path.basename(spec_json['source_filename'])
         self.commands = spec_json['commands']
         self.out_file = out_file
         self.out_dir = out_dir
         self.prefix = prefix
+        self.instance_struct = instance_struct
+        self.instance_idx = 0
         self.module_idx = 0
         self.module_name_to_idx = {}
         self.module_prefix_map = {}
@@ -123,9 +127,18 @@ class CWriter(object):
         self._CacheModulePrefixes()
         self._WriteIncludes()
         self.out_file.write(self.prefix)
+        # With --instance-struct, the commands are run a second time on a second
+        # instance of each module, which only passes if the instances don't
+        # share any state.
+        num_instances = 1
+        if self.instance_struct:
+            self._WriteInstances()
+            num_instances = 2
         self.out_file.write("\nvoid run_spec_tests(void) {\n\n")
-        for command in self.commands:
-            self._WriteCommand(command)
+        for self.instance_idx in range(num_instances):
+            self.module_idx = 0
+            for command in self.commands:
+                self._WriteCommand(command)
         self.out_file.write("\n}\n")
 
     def GetModuleFilenames(self):
@@ -172,6 +185,25 @@ class CWriter(object):
             dummy_command = {'type': 'module', 'line': 0, 'filename': filename}
             self.commands.insert(0, dummy_command)
 
+    def _WriteInstances(self):
+        for idx in range(len(self.GetModuleFilenames())):
+            prefix = self.GetModulePrefix(idx)
+            self.out_file.write('static %sinstance_t %sinstances[2];\n' %
+                                (prefix, prefix))
+
+    def _Instance(self, idx_or_name=None):
+        return '&%sinstances[%d]' % (self.GetModulePrefix(idx_or_name),
+                                     self.instance_idx)
+
+    def _Instantiate(self):
+        if not self.instance_struct:
+            return '%sinit()' % self.GetModulePrefix()
+        return '%sinstantiate(%s)' % (self.GetModulePrefix(), self._Instance())
+
+    def _WriteInitModule(self):
+        if self.instance_struct and self.instance_idx == 0:
+            self.out_file.write('%sinit_module();\n' % self.GetModulePrefix())
+
     def _WriteFileAndLine(self, command):
         self.out_file.write('// %s:%d\n' % (self.source_filename, command['line']))
 
@@ -195,6 +227,9 @@ class CWriter(object):
             'assert_exhaustion': self._WriteAssertActionCommand,
         }
 
+        if self.instance_struct and command['type'] == 'register':
+            raise Error('--instance-struct doesn\'t support registered modules')
+
         func = command_funcs.get(command['type'])
         if func is not None:
             self._WriteFileAndLine(command)
@@ -203,11 +238,13 @@ class CWriter(object):
 
     def _WriteModuleCommand(self, command):
         self.module_idx += 1
-        self.out_file.write('%sinit();\n' % self.GetModulePrefix())
+        self._WriteInitModule()
+        self.out_file.write('%s;\n' % self._Instantiate())
 
     def _WriteAssertUninstantiableCommand(self, command):
         self.module_idx += 1
-        self.out_file.write('ASSERT_TRAP(%sinit());\n' % self.GetModulePrefix())
+        self._WriteInitModule()
+        self.out_file.write('ASSERT_TRAP(%s);\n' % self._Instantiate())
 
     def _WriteActionCommand(self, command):
         self.out_file.write('%s;\n' % self._Action(command))
@@ -237,6 +274,7 @@ class CWriter(object):
                     'f32': 'ASSERT_RETURN_F32',
                     'i64': 'ASSERT_RETURN_I64',
                     'f64': 'ASSERT_RETURN_F64',
+                    'v128': 'ASSERT_RETURN_V128',
                 }
 
                 assert_macro = assert_map[type_]
@@ -247,7 +285,26 @@ class CWriter(object):
         elif len(expected) == 0:
             self._WriteAssertActionCommand(command)
         else:
-            raise Error('Unexpected result with multiple values: %s' % expected)
+            type_map = {
+                'i32': 'u32',
+                'i64': 'u64',
+                'f32': 'f32',
+                'f64': 'f64',
+                'v128': 'v128',
+            }
+            checks = []
+            for i, const in enumerate(expected):
+                type_ = const['type']
+                if const['value'] in ('nan:canonical', 'nan:arithmetic'):
+                    raise Error('Unexpected NaN with multiple values: %s' %
+                                expected)
+                checks.append('is_equal_%s(actual.%s%d, %s)' % (
+                    type_map[type_], MangleType(type_), i,
+                    self._Constant(const)))
+            self.out_file.write(
+                'ASSERT_RETURN_MULTI(struct wasm_multi_%s, %s, %s);\n' %
+                (MangleTypes([const['type'] for const in expected]),
+                 self._Action(command), ' && '.join(checks)))
 
     def _WriteAssertActionCommand(self, command):
         assert_map = {
@@ -257,6 +314,8 @@ class CWriter(object):
         }
 
         assert_macro = assert_map[command['type']]
+        if command['type'] == 'assert_trap' and command['text'] == 'out of fuel':
+            assert_macro = 'ASSERT_OUT_OF_FUEL'
         self.out_file.write('%s(%s);\n' % (assert_macro, self._Action(command)))
 
     def _Constant(self, const):
@@ -272,6 +331,9 @@ class CWriter(object):
             return F32ToC(int(value))
         elif type_ == 'f64':
             return F64ToC(int(value))
+        elif type_ == 'v128':
+            lanes = [(int(value) >> (32 * i)) & 0xffffffff for i in range(4)]
+            return 'make_v128(%s)' % ', '.join('0x%08xu' % lane for lane in lanes)
         else:
             assert False
 
@@ -296,8 +358,16 @@ class CWriter(object):
         mangled_module_name = self.GetModulePrefix(action.get('module'))
         field = (mangled_module_name + MangleName(action['field']) +
                  MangleName(self._ActionSig(action, expected)))
+        args = [self._Constant(arg) for arg in action.get('args', [])]
+        if self.instance_struct:
+            # Exported functions, and the functions that return pointers to
+            # exported globals, take the instance as their first argument.
+            instance = self._Instance(action.get('module'))
+            args.insert(0, instance)
+            if type_ == 'get':
+                field = '%s(%s)' % (field, instance)
         if type_ == 'invoke':
-            return '%s(%s)' % (field, self._ConstantList(action.get('args', [])))
+            return '%s(%s)' % (field, ', '.join(args))
         elif type_ == 'get':
             return '*%s' % field
         else:
@@ -337,6 +407,19 @@ def main(args):
     parser.add_argument('--no-compile', help='don\'t compile the C code',
                         dest='compile', action='store_false')
     parser.set_defaults(compile=True)
+    parser.add_argument('--num-outputs', metavar='N', type=int, default=1,
+                        help='split each module across N C source files.')
+    parser.add_argument('--instance-struct',
+                        help='keep module state in instance structs, and run '
+                        'the commands on two instances of each module.',
+                        action='store_true')
+    parser.add_argument('--fuel', help='charge fuel for each basic block.',
+                        action='store_true')
+    parser.add_argument('--enable-simd', action='store_true')
+    parser.add_argument('--enable-threads', action='store_true')
+    parser.add_argument('--enable-bulk-memory', action='store_true')
+    parser.add_argument('--enable-reference-types', action='store_true')
+    parser.add_argument('--enable-multi-value', action='store_true')
     parser.add_argument('--no-run', help='don\'t run the compiled executable',
                         dest='run', action='store_false')
     parser.add_argument('-v', '--verbose', help='print more diagnotic messages.',
@@ -356,7 +439,14 @@ def main(args):
         wast2json = utils.Executable(
             find_exe.GetWast2JsonExecutable(options.bindir),
             error_cmdline=options.error_cmdline)
-        wast2json.AppendOptionalArgs({'-v': options.verbose})
+        wast2json.AppendOptionalArgs({
+            '-v': options.verbose,
+            '--enable-simd': options.enable_simd,
+            '--enable-threads': options.enable_threads,
+            '--enable-bulk-memory': options.enable_bulk_memory,
+            '--enable-reference-types': options.enable_reference_types,
+            '--enable-multi-value': options.enable_multi_value,
+        })
 
         json_file_path = utils.ChangeDir(
             utils.ChangeExt(options.file, '.json'), out_dir)
@@ -365,6 +455,15 @@ def main(args):
         wasm2c = utils.Executable(
             find_exe.GetWasm2CExecutable(options.bindir),
             error_cmdline=options.error_cmdline)
+        wasm2c.AppendOptionalArgs({
+            '--instance-struct': options.instance_struct,
+            '--fuel': options.fuel,
+            '--enable-simd': options.enable_simd,
+            '--enable-threads': options.enable_threads,
+            '--enable-bulk-memory': options.enable_bulk_memory,
+            '--enable-reference-types': options.enable_reference_types,
+            '--enable-multi-value': options.enable_multi_value,
+        })
 
         cc = utils.Executable(options.cc, *options.cflags)
 
@@ -377,7 +476,8 @@ def main(args):
                 prefix = prefix_file.read() + '\n'
 
         output = io.StringIO()
-        cwriter = CWriter(spec_json, prefix, output, out_dir)
+        cwriter = CWriter(spec_json, prefix, output, out_dir,
+                          options.instance_struct)
         cwriter.Write()
 
         main_filename = utils.ChangeExt(json_file_path, '-main.c')
@@ -393,10 +493,18 @@ def main(args):
 
         for i, wasm_filename in enumerate(cwriter.GetModuleFilenames()):
             c_filename = utils.ChangeExt(wasm_filename, '.c')
-            wasm2c.RunWithArgs(wasm_filename, '-o', c_filename, cwd=out_dir)
+            wasm2c.RunWithArgs(wasm_filename, '-o', c_filename,
+                               '--num-outputs=%d' % options.num_outputs,
+                               cwd=out_dir)
+            if options.num_outputs > 1:
+                c_filenames = [utils.ChangeExt(wasm_filename, '_%d.c' % j)
+                               for j in range(options.num_outputs)]
+            else:
+                c_filenames = [c_filename]
             if options.compile:
                 defines = '-DWASM_RT_MODULE_PREFIX=%s' % cwriter.GetModulePrefix(i)
-                o_filenames.append(Compile(cc, c_filename, out_dir, includes, defines))
+                for c_filename in c_filenames:
+                    o_filenames.append(Compile(cc, c_filename, out_dir, includes, defines))
 
         if options.compile:
             main_c = os.path.basename(main_filename)
@@ -36,7 +36,7 @@ static void error(const char* file, int line, const char* format, ...) {
     }                                                          \
   } while (0)
 
-#define ASSERT_EXHAUSTION(f)                                     \
+#define ASSERT_TRAP_CODE(f, trap, reason)                        \
   do {                                                           \
     g_tests_run++;                                               \
     wasm_rt_trap_t code = wasm_rt_impl_try();                    \
@@ -45,18 +45,22 @@ static void error(const char* file, int line, const char* format, ...) {
         (void)(f);                                               \
         error(__FILE__, __LINE__, "expected " #f " to trap.\n"); \
         break;                                                   \
-      case WASM_RT_TRAP_EXHAUSTION:                              \
+      case WASM_RT_TRAP_##trap:                                  \
         g_tests_passed++;                                        \
         break;                                                   \
       default:                                                   \
         error(__FILE__, __LINE__,                                \
               "expected " #f                                     \
-              " to trap due to exhaustion, got trap code %d.\n", \
+              " to trap due to " reason ", got trap code %d.\n", \
               code);                                             \
         break;                                                   \
     }                                                            \
   } while (0)
 
+#define ASSERT_EXHAUSTION(f) ASSERT_TRAP_CODE(f, EXHAUSTION, "exhaustion")
+#define ASSERT_OUT_OF_FUEL(f) \
+  ASSERT_TRAP_CODE(f, OUT_OF_FUEL, "running out of fuel")
+
 #define ASSERT_RETURN(f)                           \
   do {                                             \
     g_tests_run++;                                 \
@@ -110,6 +114,45 @@ static void error(const char* file, int line, const char* format, ...) {
 #define ASSERT_RETURN_F32(f, expected) ASSERT_RETURN_T(f32, ".9g", f, expected)
 #define ASSERT_RETURN_F64(f, expected) ASSERT_RETURN_T(f64, ".17g", f, expected)
 
+#if defined(__GNUC__) || defined(__clang__)
+#define ASSERT_RETURN_V128(f, expected)                                      \
+  do {                                                                       \
+    g_tests_run++;                                                           \
+    if (wasm_rt_impl_try() != 0) {                                           \
+      error(__FILE__, __LINE__, #f " trapped.\n");                           \
+    } else {                                                                 \
+      v128 actual = f;                                                       \
+      v128 expected_ = expected;                                             \
+      if (is_equal_v128(actual, expected_)) {                                \
+        g_tests_passed++;                                                    \
+      } else {                                                               \
+        error(__FILE__, __LINE__,                                            \
+              "in " #f ": expected 0x%08x %08x %08x %08x, got 0x%08x %08x " \
+              "%08x %08x.\n",                                                \
+              expected_[3], expected_[2], expected_[1], expected_[0],       \
+              actual[3], actual[2], actual[1], actual[0]);                  \
+      }                                                                      \
+    }                                                                        \
+  } while (0)
+#endif
+
+/* `check` is an expression that tests the fields of `actual`, the struct that
+ * a function with several results returns. */
+#define ASSERT_RETURN_MULTI(type, f, check)                              \
+  do {                                                                   \
+    g_tests_run++;                                                       \
+    if (wasm_rt_impl_try() != 0) {                                       \
+      error(__FILE__, __LINE__, #f " trapped.\n");                       \
+    } else {                                                             \
+      type actual = f;                                                   \
+      if (check) {                                                       \
+        g_tests_passed++;                                                \
+      } else {                                                           \
+        error(__FILE__, __LINE__, "in " #f ": unexpected results.\n");   \
+      }                                                                  \
+    }                                                                    \
+  } while (0)
+
 #define ASSERT_RETURN_CANONICAL_NAN_F32(f) \
   ASSERT_RETURN_NAN_T(f32, u32, "08x", f, canonical)
 #define ASSERT_RETURN_CANONICAL_NAN_F64(f) \
@@ -141,6 +184,17 @@ static bool is_equal_f64(f64 x, f64 y) {
   return ux == uy;
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+static bool is_equal_v128(v128 x, v128 y) {
+  return memcmp(&x, &y, sizeof(x)) == 0;
+}
+
+static v128 make_v128(u32 x0, u32 x1, u32 x2, u32 x3) {
+  v128 result = {x0, x1, x2, x3};
+  return result;
+}
+#endif
+
 static f32 make_nan_f32(u32 x) {
   x |= 0x7f800000;
   f32 res;
@@ -199,6 +253,16 @@ static void spectest_print_f64_f64(double d1, double d2) {
   printf("spectest.print_f64_f64(%g %g)\n", d1, d2);
 }
 
+/* Not part of the spectest module; these let tests of modules generated with
+ * `wasm2c --fuel` give them fuel and see how much they have used. */
+static uint64_t spectest_fuel(void) {
+  return wasm_rt_fuel;
+}
+
+static void spectest_set_fuel(uint64_t fuel) {
+  wasm_rt_fuel = fuel;
+}
+
 static wasm_rt_table_t spectest_table;
 static wasm_rt_memory_t spectest_memory;
 static uint32_t spectest_global_i32 = 666;
@@ -211,6 +275,8 @@ void (*Z_spectestZ_print_i32_f32Z_vif)(uint32_t,
 void (*Z_spectestZ_print_f64Z_vd)(double) = &spectest_print_f64;
 void (*Z_spectestZ_print_f64_f64Z_vdd)(double,
                                        double) = &spectest_print_f64_f64;
+uint64_t (*Z_spectestZ_fuelZ_jv)(void) = &spectest_fuel;
+void (*Z_spectestZ_set_fuelZ_vj)(uint64_t) = &spectest_set_fuel;
 wasm_rt_table_t* Z_spectestZ_table = &spectest_table;
 wasm_rt_memory_t* Z_spectestZ_memory = &spectest_memory;
 uint32_t* Z_spectestZ_global_i32Z_i = &spectest_global_i32;
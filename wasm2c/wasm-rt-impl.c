@@ -23,8 +23,32 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER || defined(__linux__)
+#include <pthread.h>
+#endif
+
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__)
+#include <errno.h>
+#include <time.h>
+#endif
+
 #define PAGE_SIZE 65536
 
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+/* Any u32 address plus a u32 offset is less than 8 GiB, and the access itself
+ * is at most 8 bytes wide, so one extra page covers the remainder. */
+#define MEMORY_RESERVATION_SIZE (0x200000000ull + PAGE_SIZE)
+/* Enough for the signal handler, which only calls wasm_rt_trap, or the
+ * previous handler. */
+#define SIGNAL_STACK_SIZE 65536
+#endif
+
 typedef struct FuncType {
   wasm_rt_type_t* params;
   wasm_rt_type_t* results;
@@ -32,10 +56,11 @@ typedef struct FuncType {
   uint32_t result_count;
 } FuncType;
 
-uint32_t wasm_rt_call_stack_depth;
-uint32_t g_saved_call_stack_depth;
+WASM_RT_THREAD_LOCAL uint32_t wasm_rt_call_stack_depth;
+WASM_RT_THREAD_LOCAL uint64_t wasm_rt_fuel = UINT64_MAX;
+WASM_RT_THREAD_LOCAL uint32_t g_saved_call_stack_depth;
 
-jmp_buf g_jmp_buf;
+WASM_RT_THREAD_LOCAL jmp_buf g_jmp_buf;
 FuncType* g_func_types;
 uint32_t g_func_type_count;
 
@@ -91,16 +116,201 @@ uint32_t wasm_rt_register_func_type(uint32_t param_count,
   return idx + 1;
 }
 
-void wasm_rt_allocate_memory(wasm_rt_memory_t* memory,
-                             uint32_t initial_pages,
-                             uint32_t max_pages) {
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+/* The reserved address space of each memory, so that the signal handler can
+ * tell an out-of-bounds access from any other fault. The signal handler may be
+ * reading the list on another thread, so entries are never freed; the entry of
+ * a freed memory is reused by the next one. */
+typedef struct MemoryReservation {
+  struct MemoryReservation* next;
+  uint8_t* start; /* NULL if unused. */
+} MemoryReservation;
+
+static MemoryReservation* g_memory_reservations;
+
+static pthread_once_t g_signal_handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction g_prev_sigsegv_action;
+static struct sigaction g_prev_sigbus_action;
+/* Each thread's alternate signal stack, freed when the thread exits. */
+static pthread_key_t g_signal_stack_key;
+static WASM_RT_THREAD_LOCAL bool g_signal_stack_installed;
+
+static void add_memory_reservation(uint8_t* start) {
+  MemoryReservation* reservation;
+  for (reservation = __atomic_load_n(&g_memory_reservations, __ATOMIC_ACQUIRE);
+       reservation; reservation = reservation->next) {
+    uint8_t* unused = NULL;
+    if (__atomic_compare_exchange_n(&reservation->start, &unused, start, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      return;
+    }
+  }
+  reservation = malloc(sizeof(MemoryReservation));
+  if (reservation == NULL) {
+    perror("malloc failed");
+    abort();
+  }
+  reservation->start = start;
+  reservation->next = __atomic_load_n(&g_memory_reservations, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&g_memory_reservations,
+                                      &reservation->next, reservation, false,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+static void remove_memory_reservation(uint8_t* start) {
+  MemoryReservation* reservation;
+  for (reservation = __atomic_load_n(&g_memory_reservations, __ATOMIC_ACQUIRE);
+       reservation; reservation = reservation->next) {
+    uint8_t* expected = start;
+    if (__atomic_compare_exchange_n(&reservation->start, &expected, NULL,
+                                    false, __ATOMIC_RELEASE,
+                                    __ATOMIC_RELAXED)) {
+      return;
+    }
+  }
+}
+
+static bool is_reserved_memory_address(const void* addr) {
+  const uint8_t* p = addr;
+  MemoryReservation* reservation;
+  for (reservation = __atomic_load_n(&g_memory_reservations, __ATOMIC_ACQUIRE);
+       reservation; reservation = reservation->next) {
+    uint8_t* start = __atomic_load_n(&reservation->start, __ATOMIC_ACQUIRE);
+    if (start && p >= start && p < start + MEMORY_RESERVATION_SIZE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void signal_handler(int sig, siginfo_t* si, void* context) {
+  /* Only a fault in a memory's reserved address space, while a wasm function
+   * called after wasm_rt_impl_try is running on this thread, is an
+   * out-of-bounds access. A signal sent with kill has si_code <= 0. */
+  if (si->si_code > 0 &&
+      wasm_rt_call_stack_depth > g_saved_call_stack_depth &&
+      is_reserved_memory_address(si->si_addr)) {
+    wasm_rt_trap(WASM_RT_TRAP_OOB);
+  }
+
+  /* Anything else is handled as if this handler weren't installed. */
+  const struct sigaction* prev =
+      sig == SIGSEGV ? &g_prev_sigsegv_action : &g_prev_sigbus_action;
+  if (prev->sa_flags & SA_SIGINFO) {
+    prev->sa_sigaction(sig, si, context);
+  } else if (prev->sa_handler != SIG_DFL && prev->sa_handler != SIG_IGN) {
+    prev->sa_handler(sig);
+  } else {
+    /* Returning reruns the faulting instruction, which then gets the default
+     * action. A signal that wasn't caused by a fault has to be raised again. */
+    signal(sig, SIG_DFL);
+    if (si->si_code <= 0) {
+      raise(sig);
+    }
+  }
+}
+
+static void free_signal_stack(void* stack) {
+  stack_t ss;
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_flags = SS_DISABLE;
+  sigaltstack(&ss, NULL);
+  free(stack);
+}
+
+static void install_signal_handler(void) {
+  if (pthread_key_create(&g_signal_stack_key, free_signal_stack) != 0) {
+    perror("pthread_key_create failed");
+    abort();
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  /* The handler longjmps out, so it must not leave the signal blocked. It runs
+   * on the alternate stack, in case the access faulted because the thread's
+   * stack is almost exhausted. */
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_sigaction = signal_handler;
+
+  /* Some platforms report a guard page access as SIGBUS instead. */
+  if (sigaction(SIGSEGV, &sa, &g_prev_sigsegv_action) != 0 ||
+      sigaction(SIGBUS, &sa, &g_prev_sigbus_action) != 0) {
+    perror("sigaction failed");
+    abort();
+  }
+}
+
+void wasm_rt_impl_init_signal_stack(void) {
+  if (g_signal_stack_installed) {
+    return;
+  }
+  g_signal_stack_installed = true;
+  pthread_once(&g_signal_handler_once, install_signal_handler);
+
+  /* Keep the embedder's stack, if it already installed one. */
+  stack_t ss;
+  if (sigaltstack(NULL, &ss) == 0 && !(ss.ss_flags & SS_DISABLE)) {
+    return;
+  }
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_sp = malloc(SIGNAL_STACK_SIZE);
+  ss.ss_size = SIGNAL_STACK_SIZE;
+  if (ss.ss_sp == NULL || sigaltstack(&ss, NULL) != 0) {
+    perror("sigaltstack failed");
+    abort();
+  }
+  pthread_setspecific(g_signal_stack_key, ss.ss_sp);
+}
+#endif
+
+static void allocate_memory(wasm_rt_memory_t* memory,
+                            uint32_t initial_pages,
+                            uint32_t max_pages,
+                            bool is_shared) {
   memory->pages = initial_pages;
   memory->max_pages = max_pages;
   memory->size = initial_pages * PAGE_SIZE;
-  memory->data = calloc(memory->size, 1);
+  memory->is_shared = is_shared;
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+  wasm_rt_impl_init_signal_stack();
+
+  /* Reserve the whole range up front, then make only the first `size` bytes
+   * accessible. Anything past that faults and is turned into a trap. */
+  void* addr = mmap(NULL, MEMORY_RESERVATION_SIZE, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    perror("mmap failed");
+    abort();
+  }
+  if (mprotect(addr, memory->size, PROT_READ | PROT_WRITE) != 0) {
+    perror("mprotect failed");
+    abort();
+  }
+  memory->data = addr;
+  add_memory_reservation(addr);
+#else
+  /* A shared memory can't be reallocated when it grows, so it gets all of its
+   * pages now. Most systems only commit them when they are first written. */
+  size_t size = is_shared ? (size_t)max_pages * PAGE_SIZE : memory->size;
+  memory->data = calloc(size, 1);
+#endif
 }
 
-uint32_t wasm_rt_grow_memory(wasm_rt_memory_t* memory, uint32_t delta) {
+void wasm_rt_allocate_memory(wasm_rt_memory_t* memory,
+                             uint32_t initial_pages,
+                             uint32_t max_pages) {
+  allocate_memory(memory, initial_pages, max_pages, false);
+}
+
+void wasm_rt_allocate_shared_memory(wasm_rt_memory_t* memory,
+                                    uint32_t initial_pages,
+                                    uint32_t max_pages) {
+  allocate_memory(memory, initial_pages, max_pages, true);
+}
+
+static uint32_t grow_memory(wasm_rt_memory_t* memory, uint32_t delta) {
   uint32_t old_pages = memory->pages;
   uint32_t new_pages = memory->pages + delta;
   if (new_pages == 0) {
@@ -110,17 +320,54 @@ uint32_t wasm_rt_grow_memory(wasm_rt_memory_t* memory, uint32_t delta) {
     return (uint32_t)-1;
   }
   uint32_t new_size = new_pages * PAGE_SIZE;
-  uint8_t* new_data = realloc(memory->data, new_size);
-  if (new_data == NULL) {
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+  /* The pages are already reserved, and are zero-filled on first access. */
+  if (mprotect(memory->data + old_pages * PAGE_SIZE, delta * PAGE_SIZE,
+               PROT_READ | PROT_WRITE) != 0) {
     return (uint32_t)-1;
   }
-  memory->pages = new_pages;
-  memory->size = new_size;
-  memory->data = new_data;
-  memset(memory->data + old_pages * PAGE_SIZE, 0, delta * PAGE_SIZE);
+#else
+  /* The pages of a shared memory are already allocated and zeroed. */
+  if (!memory->is_shared) {
+    uint8_t* new_data = realloc(memory->data, new_size);
+    if (new_data == NULL) {
+      return (uint32_t)-1;
+    }
+    memory->data = new_data;
+    memset(memory->data + old_pages * PAGE_SIZE, 0, delta * PAGE_SIZE);
+  }
+#endif
+  /* Other threads may be reading the size of a shared memory, and must see
+   * the new pages before they see the new size. */
+  __atomic_store_n(&memory->pages, new_pages, __ATOMIC_RELEASE);
+  __atomic_store_n(&memory->size, new_size, __ATOMIC_RELEASE);
   return old_pages;
 }
 
+/* Serializes growing shared memories, which any thread may do. */
+static bool g_shared_memory_grow_lock;
+
+uint32_t wasm_rt_grow_memory(wasm_rt_memory_t* memory, uint32_t delta) {
+  if (!memory->is_shared) {
+    return grow_memory(memory, delta);
+  }
+  while (__atomic_test_and_set(&g_shared_memory_grow_lock, __ATOMIC_ACQUIRE)) {
+  }
+  uint32_t result = grow_memory(memory, delta);
+  __atomic_clear(&g_shared_memory_grow_lock, __ATOMIC_RELEASE);
+  return result;
+}
+
+void wasm_rt_free_memory(wasm_rt_memory_t* memory) {
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+  remove_memory_reservation(memory->data);
+  munmap(memory->data, MEMORY_RESERVATION_SIZE);
+#else
+  free(memory->data);
+#endif
+  memory->data = NULL;
+}
+
 void wasm_rt_allocate_table(wasm_rt_table_t* table,
                             uint32_t elements,
                             uint32_t max_elements) {
@@ -128,3 +375,164 @@ void wasm_rt_allocate_table(wasm_rt_table_t* table,
   table->max_size = max_elements;
   table->data = calloc(table->size, sizeof(wasm_rt_elem_t));
 }
+
+uint32_t wasm_rt_grow_table(wasm_rt_table_t* table,
+                            uint32_t delta,
+                            wasm_rt_elem_t init) {
+  uint32_t old_size = table->size;
+  uint64_t new_size = (uint64_t)old_size + delta;
+  if (new_size > table->max_size) {
+    return (uint32_t)-1;
+  }
+  if (delta == 0) {
+    return old_size;
+  }
+  wasm_rt_elem_t* new_data =
+      realloc(table->data, new_size * sizeof(wasm_rt_elem_t));
+  if (new_data == NULL) {
+    return (uint32_t)-1;
+  }
+  for (uint64_t i = old_size; i < new_size; ++i) {
+    new_data[i] = init;
+  }
+  table->data = new_data;
+  table->size = new_size;
+  return old_size;
+}
+
+void wasm_rt_free_table(wasm_rt_table_t* table) {
+  free(table->data);
+  table->data = NULL;
+}
+
+#if defined(__linux__)
+/* Like interp::WaitQueues: a thread waiting on an address is added to a list
+ * under a lock, after checking the value under that same lock, and notify
+ * takes the lock to wake them, so a notify can't be missed in between. The
+ * list is in the order the threads started waiting. */
+typedef struct Waiter {
+  struct Waiter* next;
+  void* addr;
+  pthread_cond_t cond;
+  bool notified;
+} Waiter;
+
+static pthread_mutex_t g_waiters_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Waiter* g_waiters;
+
+static void remove_waiter(Waiter* waiter) {
+  Waiter** link = &g_waiters;
+  while (*link != waiter) {
+    link = &(*link)->next;
+  }
+  *link = waiter->next;
+}
+
+/* Blocks until `addr` is notified, unless it doesn't contain `expected`, which
+ * is compared as a `size`-byte value. */
+static uint32_t wait_on_address(void* addr,
+                                uint64_t expected,
+                                size_t size,
+                                int64_t timeout) {
+  pthread_mutex_lock(&g_waiters_mutex);
+  uint64_t value = size == sizeof(uint64_t)
+                       ? __atomic_load_n((uint64_t*)addr, __ATOMIC_SEQ_CST)
+                       : __atomic_load_n((uint32_t*)addr, __ATOMIC_SEQ_CST);
+  if (value != expected) {
+    pthread_mutex_unlock(&g_waiters_mutex);
+    return 1;
+  }
+
+  Waiter waiter;
+  waiter.next = NULL;
+  waiter.addr = addr;
+  waiter.notified = false;
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&waiter.cond, &attr);
+  pthread_condattr_destroy(&attr);
+  Waiter** link = &g_waiters;
+  while (*link) {
+    link = &(*link)->next;
+  }
+  *link = &waiter;
+
+  /* A timeout too large for the deadline to be represented waits forever. */
+  struct timespec deadline;
+  bool has_deadline = false;
+  if (timeout >= 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    int64_t sec = timeout / 1000000000;
+    int64_t nsec = deadline.tv_nsec + timeout % 1000000000;
+    if (sec <= INT64_MAX - 1 - deadline.tv_sec) {
+      deadline.tv_sec += sec + nsec / 1000000000;
+      deadline.tv_nsec = nsec % 1000000000;
+      has_deadline = true;
+    }
+  }
+  while (!waiter.notified) {
+    if (!has_deadline) {
+      pthread_cond_wait(&waiter.cond, &g_waiters_mutex);
+    } else if (pthread_cond_timedwait(&waiter.cond, &g_waiters_mutex,
+                                      &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  if (!waiter.notified) {
+    /* Notify removes the waiters it wakes. */
+    remove_waiter(&waiter);
+  }
+  pthread_mutex_unlock(&g_waiters_mutex);
+  pthread_cond_destroy(&waiter.cond);
+  return waiter.notified ? 0 : 2;
+}
+
+uint32_t wasm_rt_atomic_wait32(wasm_rt_memory_t* memory,
+                               uint64_t addr,
+                               uint32_t expected,
+                               int64_t timeout) {
+  if (!memory->is_shared) {
+    wasm_rt_trap(WASM_RT_TRAP_EXPECTED_SHARED);
+  }
+  return wait_on_address(&memory->data[addr], expected, sizeof(uint32_t),
+                         timeout);
+}
+
+uint32_t wasm_rt_atomic_wait64(wasm_rt_memory_t* memory,
+                               uint64_t addr,
+                               uint64_t expected,
+                               int64_t timeout) {
+  if (!memory->is_shared) {
+    wasm_rt_trap(WASM_RT_TRAP_EXPECTED_SHARED);
+  }
+  return wait_on_address(&memory->data[addr], expected, sizeof(uint64_t),
+                         timeout);
+}
+
+uint32_t wasm_rt_atomic_notify(wasm_rt_memory_t* memory,
+                               uint64_t addr,
+                               uint32_t count) {
+  /* Nothing can be waiting on a memory that isn't shared. */
+  if (!memory->is_shared) {
+    return 0;
+  }
+  void* ptr = &memory->data[addr];
+  uint32_t woken = 0;
+  pthread_mutex_lock(&g_waiters_mutex);
+  Waiter** link = &g_waiters;
+  while (*link && woken < count) {
+    Waiter* waiter = *link;
+    if (waiter->addr != ptr) {
+      link = &waiter->next;
+      continue;
+    }
+    *link = waiter->next;
+    waiter->notified = true;
+    pthread_cond_signal(&waiter->cond);
+    ++woken;
+  }
+  pthread_mutex_unlock(&g_waiters_mutex);
+  return woken;
+}
+#endif
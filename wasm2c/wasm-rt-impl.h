@@ -26,10 +26,10 @@ extern "C" {
 #endif
 
 /** A setjmp buffer used for handling traps. */
-extern jmp_buf g_jmp_buf;
+extern WASM_RT_THREAD_LOCAL jmp_buf g_jmp_buf;
 
 /** Saved call stack depth that will be restored in case a trap occurs. */
-extern uint32_t g_saved_call_stack_depth;
+extern WASM_RT_THREAD_LOCAL uint32_t g_saved_call_stack_depth;
 
 /** Convenience macro to use before calling a wasm function. On first execution
  * it will return `WASM_RT_TRAP_NONE` (i.e. 0). If the function traps, it will
@@ -46,8 +46,18 @@ extern uint32_t g_saved_call_stack_depth;
  *   my_wasm_func();
  * ```
  */
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER
+/** Installs the signal handler, if it isn't installed yet, and an alternate
+ * signal stack for this thread, if it doesn't have one yet. */
+extern void wasm_rt_impl_init_signal_stack(void);
+
+#define wasm_rt_impl_try()                                   \
+  (wasm_rt_impl_init_signal_stack(),                         \
+   g_saved_call_stack_depth = wasm_rt_call_stack_depth, setjmp(g_jmp_buf))
+#else
 #define wasm_rt_impl_try() \
   (g_saved_call_stack_depth = wasm_rt_call_stack_depth, setjmp(g_jmp_buf))
+#endif
 
 #ifdef __cplusplus
 }
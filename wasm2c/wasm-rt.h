@@ -17,6 +17,7 @@
 #ifndef WASM_RT_H_
 #define WASM_RT_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -35,16 +36,53 @@ extern "C" {
 #define WASM_RT_MAX_CALL_STACK_DEPTH 500
 #endif
 
+/** Whether linear memory bounds are checked with a signal handler instead of
+ * an explicit check on every load and store. When enabled, each memory
+ * reserves 8 GiB of address space, so any 32-bit address plus offset lands in
+ * an inaccessible page, and a SIGSEGV/SIGBUS handler converts the fault into
+ * `WASM_RT_TRAP_OOB`. This is only supported on 64-bit POSIX systems, and must
+ * be defined the same way for the runtime and the generated c files:
+ *
+ * ```
+ *   cc -c -DWASM_RT_MEMCHECK_SIGNAL_HANDLER=1 my_module.c -o my_module.o
+ * ```
+ * */
+#ifndef WASM_RT_MEMCHECK_SIGNAL_HANDLER
+#define WASM_RT_MEMCHECK_SIGNAL_HANDLER 0
+#endif
+
+#if WASM_RT_MEMCHECK_SIGNAL_HANDLER && \
+    (defined(_WIN32) || UINTPTR_MAX <= UINT32_MAX)
+#error "WASM_RT_MEMCHECK_SIGNAL_HANDLER requires a 64-bit POSIX system."
+#endif
+
+/** Storage class of the runtime's trap state (the call stack depth and the
+ * `setjmp` buffer). By default each thread has its own, so separate threads
+ * can run wasm code at the same time. Define this as empty to use plain
+ * globals instead. */
+#ifndef WASM_RT_THREAD_LOCAL
+#if defined(__cplusplus)
+#define WASM_RT_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define WASM_RT_THREAD_LOCAL __declspec(thread)
+#else
+#define WASM_RT_THREAD_LOCAL _Thread_local
+#endif
+#endif
+
 /** Reason a trap occurred. Provide this to `wasm_rt_trap`. */
 typedef enum {
   WASM_RT_TRAP_NONE,         /** No error. */
-  WASM_RT_TRAP_OOB,          /** Out-of-bounds access in linear memory. */
+  WASM_RT_TRAP_OOB,          /** Out-of-bounds access in memory or a table. */
   WASM_RT_TRAP_INT_OVERFLOW, /** Integer overflow on divide or truncation. */
   WASM_RT_TRAP_DIV_BY_ZERO,  /** Integer divide by zero. */
   WASM_RT_TRAP_INVALID_CONVERSION, /** Conversion from NaN to integer. */
   WASM_RT_TRAP_UNREACHABLE,        /** Unreachable instruction executed. */
   WASM_RT_TRAP_CALL_INDIRECT,      /** Invalid call_indirect, for any reason. */
   WASM_RT_TRAP_EXHAUSTION,         /** Call stack exhausted. */
+  WASM_RT_TRAP_OUT_OF_FUEL,        /** `wasm_rt_fuel` ran out. */
+  WASM_RT_TRAP_UNALIGNED,          /** Unaligned atomic access. */
+  WASM_RT_TRAP_EXPECTED_SHARED,    /** Atomic wait on an unshared memory. */
 } wasm_rt_trap_t;
 
 /** Value types. Used to define function signatures. */
@@ -53,20 +91,37 @@ typedef enum {
   WASM_RT_I64,
   WASM_RT_F32,
   WASM_RT_F64,
+  WASM_RT_V128,
+  WASM_RT_FUNCREF,
+  WASM_RT_ANYREF,
+  WASM_RT_NULLREF,
 } wasm_rt_type_t;
 
+/** A 128-bit SIMD value, used by modules generated with `--enable-simd`. It
+ * is a GCC/Clang vector of four 32-bit lanes, which the generated code
+ * reinterprets as vectors of other lane types to operate on. */
+#if defined(__GNUC__) || defined(__clang__)
+typedef uint32_t wasm_rt_v128_t __attribute__((vector_size(16)));
+#endif
+
 /** A function type for all `anyfunc` functions in a Table. All functions are
  * stored in this canonical form, but must be cast to their proper signature to
  * call. */
 typedef void (*wasm_rt_anyfunc_t)(void);
 
-/** A single element of a Table. */
+/** A single element of a Table. This is also the value of a `funcref`,
+ * `anyref` or `nullref`, for modules generated with
+ * `--enable-reference-types`; the null reference is all zeros. */
 typedef struct {
   /** The index as returned from `wasm_rt_register_func_type`. */
   uint32_t func_type;
   /** The function. The embedder must know the actual C signature of the
    * function and cast to it before calling. */
   wasm_rt_anyfunc_t func;
+  /** The instance that `func` belongs to, for modules generated with
+   * `--instance-struct`. It is passed as the first argument when calling
+   * `func`. NULL otherwise. */
+  void* module_instance;
 } wasm_rt_elem_t;
 
 /** A Memory object. */
@@ -78,6 +133,9 @@ typedef struct {
   uint32_t pages, max_pages;
   /** The current size of the linear memory, in bytes. */
   uint32_t size;
+  /** Whether the memory was allocated with `wasm_rt_allocate_shared_memory`,
+   * so that several threads can access it at once. */
+  bool is_shared;
 } wasm_rt_memory_t;
 
 /** A Table object. */
@@ -120,7 +178,8 @@ extern uint32_t wasm_rt_register_func_type(uint32_t params,
                                            ...);
 
 /** Initialize a Memory object with an initial page size of `initial_pages` and
- * a maximum page size of `max_pages`.
+ * a maximum page size of `max_pages`. If `WASM_RT_MEMCHECK_SIGNAL_HANDLER` is
+ * enabled, this also installs the signal handler on first use.
  *
  *  ```
  *    wasm_rt_memory_t my_memory;
@@ -131,6 +190,14 @@ extern void wasm_rt_allocate_memory(wasm_rt_memory_t*,
                                     uint32_t initial_pages,
                                     uint32_t max_pages);
 
+/** Initialize a shared Memory object, for modules generated with
+ * `--enable-threads`. Unlike other memories, its data never moves when it
+ * grows, since other threads may be accessing it, so `max_pages` are
+ * reserved up front. */
+extern void wasm_rt_allocate_shared_memory(wasm_rt_memory_t*,
+                                           uint32_t initial_pages,
+                                           uint32_t max_pages);
+
 /** Grow a Memory object by `pages`, and return the previous page count. If
  * this new page count is greater than the maximum page count, the grow fails
  * and 0xffffffffu (UINT32_MAX) is returned instead.
@@ -146,6 +213,34 @@ extern void wasm_rt_allocate_memory(wasm_rt_memory_t*,
  *  ``` */
 extern uint32_t wasm_rt_grow_memory(wasm_rt_memory_t*, uint32_t pages);
 
+/** Free the data of a Memory object that was initialized with
+ * `wasm_rt_allocate_memory` or `wasm_rt_allocate_shared_memory`. */
+extern void wasm_rt_free_memory(wasm_rt_memory_t*);
+
+/** Implement `memory.atomic.wait32` and `wait64`: block the calling thread
+ * until another thread calls `wasm_rt_atomic_notify` for `addr`, as long as
+ * the value at `addr` is `expected`. `timeout` is in nanoseconds, or negative
+ * to wait forever. Returns 0 when woken, 1 if the value was not `expected`,
+ * and 2 on timeout. Traps with `WASM_RT_TRAP_EXPECTED_SHARED` if the memory
+ * isn't shared.
+ *
+ * These are implemented with a pthread mutex and condition variables, and are
+ * only available on Linux. */
+extern uint32_t wasm_rt_atomic_wait32(wasm_rt_memory_t*,
+                                      uint64_t addr,
+                                      uint32_t expected,
+                                      int64_t timeout);
+extern uint32_t wasm_rt_atomic_wait64(wasm_rt_memory_t*,
+                                      uint64_t addr,
+                                      uint64_t expected,
+                                      int64_t timeout);
+
+/** Implement `memory.atomic.notify`: wake at most `count` of the threads that
+ * are waiting on `addr`, and return how many were woken. */
+extern uint32_t wasm_rt_atomic_notify(wasm_rt_memory_t*,
+                                      uint64_t addr,
+                                      uint32_t count);
+
 /** Initialize a Table object with an element count of `elements` and a maximum
  * page size of `max_elements`.
  *
@@ -158,8 +253,36 @@ extern void wasm_rt_allocate_table(wasm_rt_table_t*,
                                    uint32_t elements,
                                    uint32_t max_elements);
 
+/** Grow a Table object by `delta` elements, each set to `init`, and return the
+ * previous element count. If the new element count is greater than the
+ * maximum, the grow fails and 0xffffffffu (UINT32_MAX) is returned instead. */
+extern uint32_t wasm_rt_grow_table(wasm_rt_table_t*,
+                                   uint32_t delta,
+                                   wasm_rt_elem_t init);
+
+/** Free the data of a Table object that was initialized with
+ * `wasm_rt_allocate_table`. */
+extern void wasm_rt_free_table(wasm_rt_table_t*);
+
 /** Current call stack depth. */
-extern uint32_t wasm_rt_call_stack_depth;
+extern WASM_RT_THREAD_LOCAL uint32_t wasm_rt_call_stack_depth;
+
+/** Fuel left for modules generated with `wasm2c --fuel`. Each basic block
+ * subtracts the number of instructions in it when it is entered, or traps with
+ * `WASM_RT_TRAP_OUT_OF_FUEL` if there isn't enough, leaving it unchanged.
+ * Starts at UINT64_MAX; the embedder can set it before each call to bound the
+ * work the call does.
+ *
+ *  ```
+ *    wasm_rt_fuel = 1000000;
+ *    wasm_rt_trap_t code = wasm_rt_impl_try();
+ *    if (code == 0) {
+ *      my_wasm_func();
+ *    } else if (code == WASM_RT_TRAP_OUT_OF_FUEL) {
+ *      // The call ran for too long.
+ *    }
+ *  ``` */
+extern WASM_RT_THREAD_LOCAL uint64_t wasm_rt_fuel;
 
 #ifdef __cplusplus
 }